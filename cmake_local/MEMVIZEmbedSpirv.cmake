@@ -0,0 +1,39 @@
+# Script mode: turns a SPIR-V binary into a header with a constexpr u32 array.
+#
+# Usage: cmake -DINPUT=<file.spv> -DOUTPUT=<header.h> -DSYMBOL=<ARRAY_NAME> -DSOURCE=<shader name> -P MEMVIZEmbedSpirv.cmake
+
+if(NOT INPUT OR NOT OUTPUT OR NOT SYMBOL)
+    message(FATAL_ERROR "MEMVIZEmbedSpirv: INPUT, OUTPUT and SYMBOL are required.")
+endif()
+
+file(READ "${INPUT}" spirv_hex HEX)
+string(LENGTH "${spirv_hex}" spirv_hex_length)
+math(EXPR spirv_remainder "${spirv_hex_length} % 8")
+if(spirv_hex_length EQUAL 0 OR NOT spirv_remainder EQUAL 0)
+    message(FATAL_ERROR "MEMVIZEmbedSpirv: ${INPUT} is not a stream of 32 bit words.")
+endif()
+
+# SPIR-V words are little-endian in the file: bytes b0 b1 b2 b3 become 0xb3b2b1b0.
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u," spirv_words "${spirv_hex}")
+# Eight words per line. CMake regexes have no {n} repetition.
+set(spirv_word "0x[0-9a-f]+u,")
+set(spirv_line "${spirv_word}${spirv_word}${spirv_word}${spirv_word}${spirv_word}${spirv_word}${spirv_word}${spirv_word}")
+string(REGEX REPLACE "(${spirv_line})" "\\1\n    " spirv_words "${spirv_words}")
+string(REGEX REPLACE "\n    $" "" spirv_words "${spirv_words}")
+string(REGEX REPLACE ",([^\n])" ", \\1" spirv_words "${spirv_words}")
+
+file(WRITE "${OUTPUT}"
+"#pragma once
+
+// Generated from ${SOURCE} by MEMVIZEmbedSpirv.cmake. Do not edit.
+
+#include <core_types.h>
+
+namespace memviz::shaders {
+
+constexpr coretypes::u32 ${SYMBOL}[] = {
+    ${spirv_words}
+};
+
+} // namespace memviz::shaders
+")
@@ -14,10 +14,18 @@ enum struct Error {
     MEMVIZ_X11_ERROR_LIST
 #undef MEMVIZ_PLT_ERROR_ITEM
 
+#define MEMVIZ_PLT_ERROR_ITEM(name, msg) name,
+    MEMVIZ_LINUX_ERROR_LIST
+#undef MEMVIZ_PLT_ERROR_ITEM
+
 #define MEMVIZ_PLT_ERROR_ITEM(name, msg) name,
     MEMVIZ_VULKAN_ERROR_LIST
 #undef MEMVIZ_PLT_ERROR_ITEM
 
+#define MEMVIZ_PLT_ERROR_ITEM(name, msg) name,
+    MEMVIZ_SOFTWARE_RENDERER_ERROR_LIST
+#undef MEMVIZ_PLT_ERROR_ITEM
+
     SENTINEL
 };
 
@@ -37,10 +45,18 @@ constexpr inline const char* errToCStr(Error err) {
         MEMVIZ_X11_ERROR_LIST
 #undef MEMVIZ_PLT_ERROR_ITEM
 
+#define MEMVIZ_PLT_ERROR_ITEM(name, msg) case Error::name: return msg;
+        MEMVIZ_LINUX_ERROR_LIST
+#undef MEMVIZ_PLT_ERROR_ITEM
+
 #define MEMVIZ_PLT_ERROR_ITEM(name, msg) case Error::name: return msg;
         MEMVIZ_VULKAN_ERROR_LIST
 #undef MEMVIZ_PLT_ERROR_ITEM
 
+#define MEMVIZ_PLT_ERROR_ITEM(name, msg) case Error::name: return msg;
+        MEMVIZ_SOFTWARE_RENDERER_ERROR_LIST
+#undef MEMVIZ_PLT_ERROR_ITEM
+
         case Error::SENTINEL: [[fallthrough]];
         default:
             return "unknown";
@@ -7,8 +7,23 @@ namespace memviz {
     MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_X11_WINDOW, "Failed to create X11 window") \
     MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_INITIALIZE_X11_THREADS, "Failed to initialize x11 threads")
 
+#define MEMVIZ_LINUX_ERROR_LIST \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_EPOLL, "Failed to create epoll instance") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_EVENTFD, "Failed to create eventfd") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_TIMERFD, "Failed to create timerfd") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_WAIT_FOR_EVENTS, "Failed waiting for events")
+
 #define MEMVIZ_VULKAN_ERROR_LIST \
     MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_X11_KHR_XLIB_SURFACE, "Failed to create Xlib Vulkan surface") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_HEADLESS_SURFACE, "Failed to create headless Vulkan surface") \
     MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_VK_INSTANCE, "Failed to create VkInstance") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_FIND_SUITABLE_GPU, "Failed to find a suitable physical device") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_VK_DEVICE, "Failed to create VkDevice") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_VK_SWAPCHAIN, "Failed to create VkSwapchainKHR") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_VK_PIPELINE, "Failed to create Vulkan pipeline") \
+
+#define MEMVIZ_SOFTWARE_RENDERER_ERROR_LIST \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_CREATE_SOFTWARE_FRAMEBUFFER, "Failed to create software framebuffer") \
+    MEMVIZ_PLT_ERROR_ITEM(FAILED_TO_ALLOCATE_SOFTWARE_RENDERER, "Out of memory for the software renderer")
 
 } // memviz
@@ -0,0 +1,68 @@
+#pragma once
+
+// Record layout shared by libmemviz_hook.so, which writes it from inside a target process, and memviz, which reads it.
+//
+// The hook file starts with a HookFileHeader followed by HookEvents in the order their per-thread buffers were
+// flushed. Events from one thread are in order, events from different threads interleave in blocks and have to be
+// merged by their tick count.
+//
+// Events name the call stack of their call by a 32-bit id. Stacks are interned by the hook, the first event of a new
+// stack is preceded by STACK_FRAME events carrying its frames, from the same thread. Events of other threads can name
+// a stack before its frames arrive, and a dropped batch loses the frames it held, so a viewer has to tolerate ids it
+// can not resolve (yet).
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u64 HOOK_FILE_MAGIC = 0x314b4f4f485a564d; // "MVZHOOK1"
+constexpr u32 HOOK_FILE_VERSION = 2;
+
+constexpr u32 HOOK_STACK_MAX_DEPTH = 32;
+constexpr u32 HOOK_STACK_MAX_STACKS = 256 * 1024; // Ids are below this, 0 is an unknown stack.
+
+enum struct HookOp : u8 {
+    NONE,
+    MALLOC,
+    CALLOC,
+    REALLOC,        // address is the new block. A moved block also gets a FREE for the old address first.
+    FREE,
+    POSIX_MEMALIGN,
+    ALIGNED_ALLOC,  // Also memalign.
+    MMAP,
+    MUNMAP,
+    CLOCK_SYNC,     // address is a tick count and size the CLOCK_MONOTONIC nanoseconds read right after it.
+    // address is a return address, size is depth << 8 | frame index and callsite the stack id. A stack of depth frames
+    // is sent innermost (the intercepted call's return address) first.
+    STACK_FRAME,
+
+    SENTINEL
+};
+
+struct HookEvent {
+    u64 ticks;    // rdtsc on x86-64, CLOCK_MONOTONIC nanoseconds elsewhere.
+    u64 address;
+    u64 size;
+    u32 callsite; // Id of the call stack of the intercepted call, stable for the life of the process. 0 when unknown.
+    u32 tid;
+    HookOp op;
+    u8 reserved[3];
+    u32 pid;      // 0 from the hook. The viewer sets it on the events it saves, a trace can hold several processes.
+};
+static_assert(sizeof(HookEvent) == 40);
+
+struct HookFileHeader {
+    u64 magic;
+    u32 version;
+    u32 eventSize;
+    u32 pid;
+    u32 reserved;
+    // Taken back to back at startup. With the CLOCK_SYNC event written at exit they convert ticks to nanoseconds.
+    u64 startTicks;
+    u64 startNs;
+};
+static_assert(sizeof(HookFileHeader) == 40);
+
+} // namespace memviz
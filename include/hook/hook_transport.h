@@ -0,0 +1,147 @@
+#pragma once
+
+// Shared memory transport from libmemviz_hook.so to the viewer.
+//
+// memviz listens on a Unix socket (MEMVIZ_HOOK_SOCKET for the hook, --hook-socket for the viewer). For every process
+// that connects it creates a memfd holding a HookTransportHeader and HOOK_TRANSPORT_RINGS event rings, plus an eventfd,
+// and sends both over the socket. Each producer thread of the target claims a ring of its own. Threads past
+// HOOK_TRANSPORT_RINGS share rings, which is why reserving space is a CAS even though it rarely contends.
+//
+// Producers commit whole batches: reserve space, copy, then publish head once the batches reserved before theirs are
+// published. The consumer reads [tail, head) and advances tail. The eventfd is only written when the consumer armed it
+// before going to sleep, so a busy viewer costs producers no syscalls at all.
+
+#include "hook/hook_events.h"
+
+#include <atomic>
+
+#include <string.h>
+
+namespace memviz {
+
+constexpr u64 HOOK_TRANSPORT_MAGIC = 0x314e5254485a564d; // "MVZHTRN1"
+constexpr u32 HOOK_TRANSPORT_VERSION = 2;
+
+constexpr u32 HOOK_TRANSPORT_RINGS = 64;
+constexpr u32 HOOK_RING_EVENTS = 32 * 1024; // Power of two. 1.25 MiB per ring, pages are only touched when used.
+constexpr u32 HOOK_TRANSPORT_BATCH_EVENTS = 256;
+// A batch that is not full is still committed once its first event is this many ticks old.
+constexpr u64 HOOK_TRANSPORT_BATCH_MAX_TICKS = 1 << 22;
+
+// What a producer does when its ring is full. Chosen by MEMVIZ_HOOK_BACKPRESSURE=block|drop|spill in the target.
+enum struct HookBackpressure : u32 {
+    DROP,  // Count the batch as dropped. The default, the target never waits on the viewer.
+    BLOCK, // Wait for the viewer to make room. Falls back to DROP when the viewer disconnects.
+    SPILL, // Append the batch to the hook's output file (see memviz_hook.cpp) and count it as spilled.
+
+    SENTINEL
+};
+
+constexpr const char* hookBackpressureToCStr(HookBackpressure b) {
+    switch (b) {
+        case HookBackpressure::DROP:  return "drop";
+        case HookBackpressure::BLOCK: return "block";
+        case HookBackpressure::SPILL: return "spill";
+
+        case HookBackpressure::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+struct alignas(64) HookRing {
+    // Producer side. reserve runs ahead of head while batches are being copied in.
+    alignas(64) std::atomic<u64> reserve;
+    std::atomic<u64> head;
+    std::atomic<u32> owner;  // tid of the thread that claimed the ring, 0 when free.
+    std::atomic<u32> sharers; // Threads that found no free ring and write here as well.
+    std::atomic<u64> dropped;
+    std::atomic<u64> spilled;
+
+    // Consumer side, on its own cache line so polling tail never steals the producer's line.
+    alignas(64) std::atomic<u64> tail;
+
+    alignas(64) HookEvent events[HOOK_RING_EVENTS];
+};
+
+struct HookTransportHeader {
+    // Written by memviz before the memfd is sent.
+    u64 magic;
+    u32 version;
+    u32 ringCount;
+    u32 ringEvents;
+    u32 eventSize;
+
+    // Written by the hook right after it maps the memfd, before anything is committed.
+    std::atomic<u32> producerReady;
+    u32 pid;
+    HookBackpressure backpressure;
+    u32 reserved;
+    u64 startTicks;
+    u64 startNs;
+
+    // Set by the consumer before it sleeps. The first producer to commit afterwards clears it and writes the eventfd.
+    alignas(64) std::atomic<u32> consumerArmed;
+
+    HookRing rings[HOOK_TRANSPORT_RINGS];
+};
+
+constexpr addr_size HOOK_TRANSPORT_SIZE = sizeof(HookTransportHeader);
+
+static_assert(std::atomic<u64>::is_always_lock_free, "the rings are shared between processes");
+static_assert((HOOK_RING_EVENTS & (HOOK_RING_EVENTS - 1)) == 0);
+
+enum struct HookRingPush : u8 {
+    COMMITTED,
+    FULL,
+};
+
+// Producer side. Either the whole batch is committed or nothing is.
+inline HookRingPush hookRingPush(HookRing& ring, const HookEvent* events, u32 count) {
+    u64 start = ring.reserve.load(std::memory_order_relaxed);
+    do {
+        u64 tail = ring.tail.load(std::memory_order_acquire);
+        if (start + count - tail > HOOK_RING_EVENTS) return HookRingPush::FULL;
+    } while (!ring.reserve.compare_exchange_weak(start, start + count, std::memory_order_relaxed));
+
+    u32 first = u32(start & (HOOK_RING_EVENTS - 1));
+    u32 untilWrap = HOOK_RING_EVENTS - first;
+    if (count <= untilWrap) {
+        memcpy(&ring.events[first], events, count * sizeof(HookEvent));
+    }
+    else {
+        memcpy(&ring.events[first], events, untilWrap * sizeof(HookEvent));
+        memcpy(&ring.events[0], events + untilWrap, (count - untilWrap) * sizeof(HookEvent));
+    }
+
+    // Only a shared ring ever waits here, and only for a batch that is being copied right now.
+    while (ring.head.load(std::memory_order_acquire) != start) {
+#if defined(__x86_64__)
+        __builtin_ia32_pause();
+#endif
+    }
+    ring.head.store(start + count, std::memory_order_release);
+    return HookRingPush::COMMITTED;
+}
+
+// Producer side, after a commit. True when the caller has to write the eventfd.
+inline bool hookTransportShouldWake(HookTransportHeader& header) {
+    // Pairs with the fence in hookTransportArm, either the consumer sees the commit or the producer sees it armed.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header.consumerArmed.load(std::memory_order_relaxed) == 0) return false;
+    return header.consumerArmed.exchange(0, std::memory_order_relaxed) != 0;
+}
+
+// Consumer side, before sleeping. True when events were committed meanwhile and the consumer should not sleep.
+inline bool hookTransportArm(HookTransportHeader& header) {
+    header.consumerArmed.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Not header.ringCount, the producer can write the header.
+    for (u32 i = 0; i < HOOK_TRANSPORT_RINGS; i++) {
+        const HookRing& ring = header.rings[i];
+        if (ring.head.load(std::memory_order_relaxed) != ring.tail.load(std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+} // namespace memviz
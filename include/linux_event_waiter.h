@@ -0,0 +1,30 @@
+#pragma once
+
+// Shared by the Linux platform backends. Multiplexes the native connection fd, a wake-up eventfd, a deadline timerfd
+// and any fds registered by other systems behind a single epoll instance, so the main loop can sleep instead of
+// spinning on the native queue.
+
+#include <core_types.h>
+
+#include "error.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+// nativeFd is the display connection file descriptor, or -1 when there is none.
+[[nodiscard]] Error linuxEventWaiterInit(i32 nativeFd);
+void linuxEventWaiterShutdown();
+
+// Returns when nativeFd is readable, linuxEventWaiterWakeUp was called, or deadlineNs (CLOCK_MONOTONIC) passed.
+[[nodiscard]] Error linuxEventWaiterWait(u64 deadlineNs);
+void linuxEventWaiterWakeUp();
+
+// Makes linuxEventWaiterWait also return while fd is readable. The waiter never reads it, the owner has to drain it
+// every time or the wait keeps returning immediately.
+[[nodiscard]] bool linuxEventWaiterWatchFd(i32 fd);
+void linuxEventWaiterUnwatchFd(i32 fd);
+
+u64 linuxMonotonicNowNs();
+
+} // namespace memviz
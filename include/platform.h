@@ -10,6 +10,7 @@
 
 typedef struct VkInstance_T* VkInstance;
 typedef struct VkSurfaceKHR_T* VkSurfaceKHR;
+struct VkAllocationCallbacks;
 
 namespace memviz {
 
@@ -26,6 +27,57 @@ using MouseMoveCallback = void (*)(i32 x, i32 y);
 using MouseScrollCallback = void (*)(MouseScrollDirection direction, i32 x, i32 y);
 using MouseEnterOrLeaveCallback = void (*)(bool enter);
 
+enum struct PlatformEventType : u8 {
+    NONE,
+    WINDOW_CLOSE,
+    WINDOW_RESIZE,
+    WINDOW_FOCUS,
+    KEY,
+    MOUSE_CLICK,
+    MOUSE_MOVE,
+    MOUSE_SCROLL,
+    MOUSE_ENTER_OR_LEAVE,
+    SENTINEL
+};
+
+// Backend independent form of an input/window event. Native events are translated to this before they are queued,
+// which is also how synthetic events (headless runs, replays) enter the same dispatch path.
+struct PlatformEvent {
+    PlatformEventType type;
+    u32 timeMs; // Native event timestamp in milliseconds (X server time on X11). Only deltas are meaningful.
+    union {
+        struct { i32 w, h; } resize;
+        struct { bool gain; } focus;
+        struct { u32 vkcode; u32 scancode; bool isPress; KeyboardModifiers mods; } key;
+        struct { MouseButton button; bool isPress; i32 x, y; KeyboardModifiers mods; } click;
+        struct { i32 x, y; } move;
+        struct { MouseScrollDirection direction; i32 x, y; } scroll;
+        struct { bool enter; } crossing;
+    };
+};
+
+// Sees every event right before it is dispatched. Called with nullptr after the last event of a pollEvents batch.
+using EventObserverCallback = void (*)(const PlatformEvent* ev);
+
+struct PlatformEventStats {
+    u64 received;   // Events read from the native event queue or pushed with Platform::pushEvent.
+    u64 dispatched; // Events delivered to a registered callback.
+    u64 coalesced;  // Motion/resize events merged into a newer event of the same kind.
+    u64 dropped;    // Events discarded without dispatch (unhandled type or no registered callback).
+    u64 batches;    // Number of non-empty pollEvents calls.
+    u32 maxBatchSize;
+};
+
+// CPU-side image that the software renderer draws into. Pixels are 32 bit 0x00RRGGBB and rows are stride pixels apart.
+// On X11 the pixels live in a MIT-SHM segment the X server reads from directly, so presenting copies nothing.
+struct SoftwareFramebuffer {
+    u32* pixels;
+    u32 width;
+    u32 height;
+    u32 stride;
+    void* native; // Owned by the platform layer.
+};
+
 struct Platform {
     static void registerWindowCloseCallback(WindowCloseCallback cb);
     static void registerWindowResizeCallback(WindowResizeCallback cb);
@@ -38,15 +90,47 @@ struct Platform {
     static void registerMouseScrollCallback(MouseScrollCallback cb);
     static void registerMouseEnterOrLeaveCallback(MouseEnterOrLeaveCallback cb);
 
+    static void registerEventObserver(EventObserverCallback cb);
+
     [[nodiscard]] static Error init(const char* windowTitle, i32 windowWidth, i32 windowHeight);
+    // Drains everything the native queue has pending, coalesces consecutive motion and resize events and dispatches
+    // the batch to the registered callbacks. When block is true and the queue is empty, waits for at least one event.
     [[nodiscard]] static Error pollEvents(bool block = false);
+    static PlatformEventStats getEventStats();
+    // Queues a synthetic event. It is dispatched by the next pollEvents call, after the native events already queued.
+    static void pushEvent(const PlatformEvent& ev);
+
+    // Sleeps until there is a native event to poll, Platform::wakeUp is called, or the monotonic deadline (as returned
+    // by getMonotonicTimeNs) passes. A deadline of 0 means wait indefinitely.
+    [[nodiscard]] static Error waitEvents(u64 deadlineNs = 0);
+    // Thread-safe. Wakes up a waitEvents call blocked on the main thread. Intended for background ingest threads.
+    static void wakeUp();
+    // Makes waitEvents also return while the file descriptor is readable. The caller has to drain it after every
+    // wait, it is only ever polled.
+    [[nodiscard]] static bool watchFd(i32 fd);
+    static void unwatchFd(i32 fd);
+    static u64 getMonotonicTimeNs();
     static void shutdown();
 
-    bool getFrameBufferSize(u32& width, u32& height);
+    static bool getFrameBufferSize(u32& width, u32& height);
+
+    // Writes the per-user cache directory for memviz (created if missing) as a null-terminated path without a trailing
+    // separator. Returns false if there is no usable cache directory or the buffer is too small.
+    [[nodiscard]] static bool getCacheDirectory(char* out, addr_size outSize);
+
+    [[nodiscard]] static bool createSoftwareFramebuffer(u32 width, u32 height, SoftwareFramebuffer& out);
+    // Waits for a pending present of the framebuffer before releasing it.
+    static void destroySoftwareFramebuffer(SoftwareFramebuffer& fb);
+    // Queues the framebuffer to be shown in the window. The pixels must not be written again before
+    // waitSoftwareFramebuffer returned for it.
+    static void presentSoftwareFramebuffer(SoftwareFramebuffer& fb);
+    // Blocks until the last present of the framebuffer no longer reads its pixels.
+    static void waitSoftwareFramebuffer(SoftwareFramebuffer& fb);
 
     static void requiredVulkanExtsCount(i32& count);
     static void requiredVulkanExts(const char** extensions);
-    [[nodiscard]] static Error createVulkanSurface(VkInstance instance, VkSurfaceKHR& surface);
+    [[nodiscard]] static Error createVulkanSurface(VkInstance instance, const VkAllocationCallbacks* allocator,
+                                                   VkSurfaceKHR& surface);
 };
 
 } // namespace memviz
@@ -0,0 +1,22 @@
+#pragma once
+
+// IMPORTANT: Internal to the platform layer. Backends translate their native events into PlatformEvent and feed them
+//            through the shared ring declared here, so coalescing, statistics and dispatch behave the same everywhere.
+
+#include "platform.h"
+
+namespace memviz {
+
+// Pushes an event onto the per-frame ring, merging it with the previous event when both are motion or both are
+// resize events. A full ring dispatches its oldest event to make room.
+void platformEventRingPush(const PlatformEvent& ev);
+
+// Dispatches everything in the ring to the registered callbacks and closes the batch in the statistics.
+void platformEventRingFlush(u32 nativeBatchSize);
+
+bool platformEventRingEmpty();
+
+// Counts a native event that has no PlatformEvent translation.
+void platformEventDropped();
+
+} // namespace memviz
@@ -0,0 +1,61 @@
+#pragma once
+
+// Level of detail summary of the live blocks, a mipmap over the address space. Level 0 bins are 4 KiB and every level
+// has 8 times larger bins than the one below, up to one bin for the whole 48 bit address space. A bin holds the live
+// bytes overlapping it, the blocks starting in it and the bytes of every category, so it stays exact under frees.
+//
+// Only bins that hold something exist, every level is a hash table keyed by bin index. A block that would span more
+// than PYRAMID_MAX_BINS_PER_BLOCK bins of a level is kept in a short list for that level instead, large mappings do
+// not create millions of bins.
+//
+// A query samples the level whose bins best match the cell size, so its cost is bounded by the number of cells drawn
+// and not by the size of the heap. Main thread only.
+
+#include <core_types.h>
+
+#include "systems/interval_index.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 PYRAMID_BASE_SHIFT = 12;
+constexpr u32 PYRAMID_LEVEL_SHIFT = 3;
+constexpr u32 PYRAMID_LEVELS = (48 - PYRAMID_BASE_SHIFT) / PYRAMID_LEVEL_SHIFT + 1;
+constexpr u64 PYRAMID_MAX_BINS_PER_BLOCK = 4096;
+
+// Read the counters directly, everything else is private to address_pyramid.cpp.
+struct AddressPyramid {
+    void* levels;
+    u64 binCount;  // Over all levels.
+    u64 wideCount; // Blocks kept in the per level lists, over all levels.
+};
+
+struct PyramidCell {
+    u64 liveBytes;
+    u64 categoryBytes; // Bytes behind category, see addressPyramidQuery.
+    u32 blocks;        // Starting in the cell.
+    u8 category;
+};
+
+// Palette index of a block, BLOCK_CATEGORY_COUNT classes: power of two size classes from 16 bytes up, with the last
+// two for larger heap blocks and for mappings.
+u8 liveBlockCategory(const LiveBlock& block);
+
+[[nodiscard]] bool addressPyramidAdd(AddressPyramid& p, const LiveBlock& block);
+// block has to be exactly what was added.
+void addressPyramidRemove(AddressPyramid& p, const LiveBlock& block);
+// Replaces the content with the blocks of idx. Fills level 0 and sums every level into the next one, which is much
+// cheaper than adding the blocks one by one.
+[[nodiscard]] bool addressPyramidBuild(AddressPyramid& p, const IntervalIndex& idx);
+void addressPyramidClear(AddressPyramid& p);
+// Matches IntervalChangeFn, keeps p (the userData) in sync with intervalIndexApply.
+bool addressPyramidOnChange(const LiveBlock* removed, const LiveBlock* added, void* p);
+
+// Summarizes [begin, begin + cellBytes * cellCount) into out, one cell per cellBytes. Uses the coarsest level with bins
+// no larger than a cell, level 0 for cells smaller than its bins. A bin straddling cells is split between them by
+// overlap. The category of a cell is the dominant one of the bin that contributed most to it. Returns the number of
+// cells that hold anything.
+u32 addressPyramidQuery(const AddressPyramid& p, u64 begin, u64 cellBytes, PyramidCell* out, u32 cellCount);
+
+} // namespace memviz
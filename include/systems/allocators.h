@@ -0,0 +1,64 @@
+#pragma once
+
+// Allocator registry. Every id here is backed by a named memviz allocator that is registered with core in basicInit,
+// so any core container or system can be pointed at a specific allocator and its memory accounted for separately.
+//
+//  - General heaps are malloc backed and thread-safe.
+//  - The frame arena is a linear allocator for the main thread, reset at the top of every main loop iteration.
+//    Anything allocated from it is only valid until the next allocatorsBeginFrame. Free is a no-op except for the
+//    latest allocation.
+//  - Pools hand out fixed size slots from chunks that are never returned to the heap, so after warmup they do not
+//    touch the heap at all. Requests larger than the slot go to the general heap. Thread-safe.
+//
+// Every allocator counts live bytes, peak bytes and allocations. allocatorsBeginFrame also checks that iterations past
+// warmup did not make the main thread allocate from the general heaps.
+
+#include <core.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum AllocatorId : u32 {
+    DEFAULT_ALLOCATOR_ID = 0,
+    VULKAN_HOST_ALLOCATOR_ID = 1,
+    LOGGER_ALLOCATOR_ID = 2,
+    FRAME_ARENA_ALLOCATOR_ID = 3,
+    POOL_32_ALLOCATOR_ID = 4,
+    POOL_64_ALLOCATOR_ID = 5,
+    POOL_128_ALLOCATOR_ID = 6,
+    POOL_1024_ALLOCATOR_ID = 7,
+
+    ALLOCATOR_ID_SENTINEL
+};
+
+// Fits the heap view's rebuild scratch, the largest per-frame user. Pages are only touched when used.
+constexpr addr_size FRAME_ARENA_SIZE = 32 * core::CORE_MEGABYTE;
+constexpr u32 POOL_SLOTS_PER_CHUNK = 1024;
+// Iterations before allocatorsBeginFrame starts reporting heap allocations, startup and the first uploads allocate.
+constexpr u64 ALLOCATOR_WARMUP_FRAMES = 120;
+
+struct AllocatorStats {
+    u64 liveBytes;
+    u64 peakBytes;
+    u64 allocCount;
+    u64 freeCount;
+    u64 failedAllocs; // Out of memory, or an arena/pool that could not serve the request.
+};
+
+// Call before core::initProgramCtx, the logger it creates already allocates from LOGGER_ALLOCATOR_ID.
+void allocatorsRegister();
+void allocatorsShutdown();
+
+const char* allocatorName(AllocatorId id);
+AllocatorStats allocatorStats(AllocatorId id);
+void allocatorsLogStats();
+
+// Resets the frame arena and checks the previous iteration for general heap allocations made by the main thread (the
+// Vulkan driver's heap is not counted). Other threads, like the ingest and the samplers, allocate as they need and are
+// not blamed on frames. Main thread only, at the top of every main loop iteration.
+void allocatorsBeginFrame();
+// Iterations past warmup in which the main thread allocated from the general heaps.
+u64 allocatorsFramesWithHeapAllocs();
+
+} // namespace memviz
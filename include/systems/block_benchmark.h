@@ -0,0 +1,19 @@
+#pragma once
+
+// Synthetic heap for measuring the block renderer. Generates a deterministic set of allocations over two layers (a
+// small-object heap and an mmap region) and streams them to the renderer a ring's worth at a time.
+
+#include "systems/renderer/renderer.h"
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+void blockBenchmarkStart(u32 blockCount, BlockLayout layout);
+// Uploads the next chunk of blocks. Returns false once the benchmark was not started or everything is uploaded.
+bool blockBenchmarkUpdate();
+bool blockBenchmarkIsActive();
+
+} // namespace memviz
@@ -0,0 +1,74 @@
+#pragma once
+
+// Space filling curves that lay a linear range of cells out on a square grid of 2^order by 2^order cells, so nearby
+// addresses stay nearby on screen. Both directions are supported: a curve index to its cell for drawing, a cell back
+// to its index for picking.
+//
+// Every aligned run of 4^k indices covers an aligned square of 2^k by 2^k cells on both curves. An extent of the
+// curve splits into at most 6 runs per level, curveSplitExtent, and every run is drawn as one square.
+//
+// The batch kernels have a scalar, a BMI2 (pdep/pext) and an AVX2 (8 lanes) version. The widest one the CPU supports
+// is picked by curveLayoutInit, setting MEMVIZ_CURVE_SIMD to scalar, bmi2 or avx2 caps the selection. BMI2 is slow
+// on AMD before Zen 3, where pdep and pext are microcoded, AVX2 does not use them.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 CURVE_MAX_ORDER = 16;
+
+enum struct CurveKind : u8 {
+    HILBERT, // Every step moves to a neighbouring cell.
+    MORTON,  // Z-order. Cheaper, but jumps between quadrants.
+
+    SENTINEL
+};
+
+constexpr const char* curveKindToCStr(CurveKind kind) {
+    switch (kind) {
+        case CurveKind::HILBERT: return "hilbert";
+        case CurveKind::MORTON:  return "morton";
+
+        case CurveKind::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+enum struct CurveSimdLevel : u8 {
+    SCALAR,
+    BMI2,
+    AVX2,
+
+    SENTINEL
+};
+
+constexpr const char* curveSimdLevelToCStr(CurveSimdLevel level) {
+    switch (level) {
+        case CurveSimdLevel::SCALAR: return "scalar";
+        case CurveSimdLevel::BMI2:   return "bmi2";
+        case CurveSimdLevel::AVX2:   return "avx2";
+
+        case CurveSimdLevel::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+CurveSimdLevel curveLayoutInit();
+
+// Single cells, always scalar. order is at most CURVE_MAX_ORDER, coordinates and indices below 2^order and 4^order.
+u32 curveIndex(CurveKind kind, u32 order, u32 x, u32 y);
+void curvePoint(CurveKind kind, u32 order, u32 index, u32& x, u32& y);
+
+// Batches. The arrays may not overlap.
+void curveEncode(CurveKind kind, u32 order, const u32* x, const u32* y, u32* indices, u32 count);
+void curveDecode(CurveKind kind, u32 order, const u32* indices, u32* x, u32* y, u32 count);
+
+// Splits [first, first + count) into aligned runs, the start of each and the log4 of its length. The extent is clipped
+// to the 4^order cells of the grid. Returns the number of runs, which is capped at capacity.
+u32 curveSplitExtent(u32 order, u64 first, u64 count, u32* starts, u8* levels, u32 capacity);
+
+} // namespace memviz
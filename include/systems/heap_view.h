@@ -0,0 +1,73 @@
+#pragma once
+
+// Draws the live blocks of one process as squares along a space filling curve, see curve_layout.h. The visible address
+// range is cut into the 4^HEAP_VIEW_ORDER cells of the grid, a power of two bytes each, and the curve places
+// consecutive cells next to each other, so nearby memory stays nearby on screen in both directions.
+//
+// Cells of 4 KiB and up come from the address pyramid, one square per occupied cell. Smaller cells come from the block
+// index: the cell extent of every visible block is split into aligned runs, which are squares on the curve, and all run
+// starts are decoded in one batch. The squares are streamed to block layer 0 a ring's worth per frame.
+//
+// An overlay draws the page state of the cells over them on layer 1, from a page source such as pageSamplerSummarize.
+// It covers every mapped page in view, not only the heap blocks.
+
+#include <core_types.h>
+
+#include "systems/address_pyramid.h"
+#include "systems/curve_layout.h"
+#include "systems/interval_index.h"
+#include "systems/page_sampler.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 HEAP_VIEW_ORDER = 9; // 512 x 512 cells
+constexpr u32 HEAP_VIEW_MIN_CELL_SHIFT = 4; // malloc granularity
+
+enum struct HeapOverlay : u8 {
+    NONE,
+    RESIDENT, // Resident cells green, swapped ones red.
+    WRITES,   // Cells written in at least half of the remembered intervals red, the rest of the written ones yellow.
+
+    SENTINEL
+};
+
+constexpr const char* heapOverlayToCStr(HeapOverlay overlay) {
+    switch (overlay) {
+        case HeapOverlay::NONE:     return "none";
+        case HeapOverlay::RESIDENT: return "resident";
+        case HeapOverlay::WRITES:   return "writes";
+
+        case HeapOverlay::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+// Summarizes cellCount cells of cellBytes from begin, see pageSamplerSummarize.
+using HeapPageSource = u32 (*)(u64 begin, u64 cellBytes, PageCell* out, u32 cellCount);
+
+[[nodiscard]] bool heapViewStart(CurveKind kind);
+void heapViewStop();
+bool heapViewIsActive();
+
+// The blocks changed, rebuild on the next update.
+void heapViewMarkDirty();
+// The pages changed, rebuild only the overlay on the next update.
+void heapViewMarkOverlayDirty();
+// Rebuilds the squares when marked dirty, once however many marks came in, and uploads the next part of them. Squares
+// already uploaded stay up to the first one the rebuild changed. The first update with blocks fits the view to the
+// heap. Returns true while squares are waiting for upload space.
+bool heapViewUpdate(const IntervalIndex& idx, const AddressPyramid& p);
+
+// NONE or a null source hides the overlay.
+void heapViewSetOverlay(HeapOverlay overlay, HeapPageSource source);
+HeapOverlay heapViewOverlay();
+
+// Window pixel to address, for a window of width by height pixels. block is the first one in the cell under the pixel.
+bool heapViewPick(const IntervalIndex& idx, i32 x, i32 y, u32 width, u32 height, u64& address, LiveBlock& block);
+// Halves or doubles the cell size, keeping the address under the pixel in place.
+void heapViewZoom(i32 x, i32 y, u32 width, u32 height, bool zoomIn);
+
+} // namespace memviz
@@ -0,0 +1,38 @@
+#pragma once
+
+// Viewer side of the shared memory transport in hook/hook_transport.h. Listens for processes running with
+// libmemviz_hook.so and MEMVIZ_HOOK_SOCKET, hands each one its rings and drains them on the main thread. The eventfds
+// are registered with Platform::watchFd, so a waitEvents call returns as soon as a producer commits to an idle viewer.
+
+#include <core_types.h>
+
+#include "hook/hook_events.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 HOOK_INGEST_MAX_CLIENTS = 16;
+constexpr u32 HOOK_INGEST_DROP_LOGS_PER_SECOND = 1;
+
+// Events of one ring, in commit order. pid tells connected processes apart.
+using HookEventSink = void (*)(u32 pid, const HookEvent* events, u32 count);
+
+struct HookIngestStats {
+    u32 clients;    // Currently connected processes.
+    u64 accepted;   // Connections accepted since hookIngestListen.
+    u64 received;   // Events read from the rings.
+    u64 dropped;    // Events producers threw away because their ring was full, see HookBackpressure.
+    u64 spilled;    // Events producers wrote to their own output file instead.
+};
+
+[[nodiscard]] bool hookIngestListen(const char* socketPath);
+void hookIngestShutdown();
+bool hookIngestIsActive();
+
+// Main thread, after every waitEvents. Accepts new connections, drains every ring into sink, retires processes that
+// exited, and warns when producers report new drops. Returns the number of events delivered.
+u64 hookIngestUpdate(HookEventSink sink);
+HookIngestStats hookIngestStats();
+
+} // namespace memviz
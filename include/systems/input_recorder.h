@@ -0,0 +1,37 @@
+#pragma once
+
+// Records the dispatched platform event stream to a compact binary file and replays it through Platform::pushEvent,
+// so the replayed events reach the same callbacks registered on the Platform. Used for deterministic performance
+// regression runs.
+//
+// File layout:
+//   header:  "MVZI" | u16 version | u16 reserved, both little-endian
+//   records: u8 kind | varint time delta in ms | payload (varints, signed values zigzag encoded)
+// A record of kind BATCH_END marks where a pollEvents batch ended, which lets fast replays reproduce the original
+// batching exactly.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum struct InputReplaySpeed : u8 {
+    ORIGINAL,           // Events are pushed when their original time offset from the first event has passed.
+    AS_FAST_AS_POSSIBLE // One recorded batch per frame, no waiting.
+};
+
+[[nodiscard]] bool inputRecorderStart(const char* path);
+void inputRecorderStop();
+
+[[nodiscard]] bool inputReplayStart(const char* path, InputReplaySpeed speed);
+void inputReplayStop();
+bool inputReplayIsActive();
+
+// Pushes every event that is due at nowNs into the platform queue. Returns false once the recording is exhausted.
+bool inputReplayUpdate(u64 nowNs);
+
+// Monotonic time at which the next recorded event is due, suitable as a Platform::waitEvents deadline.
+u64 inputReplayNextDeadlineNs();
+
+} // namespace memviz
@@ -0,0 +1,90 @@
+#pragma once
+
+// Address ordered index of live blocks, what picking ("which block is under this pixel") and rendering ("every block
+// in [a, b)") query. A B+tree with 1 KiB nodes from POOL_1024_ALLOCATOR_ID: 25 blocks per leaf and 64 children per
+// inner node, so tens of millions of blocks are four or five levels deep and a lookup touches as many nodes. Leaves
+// are linked, a range query walks them after the first lookup.
+//
+// Blocks of one process do not overlap, a query for an address only has to look at the block starting at or right
+// before it. Keep one index per process. Not thread-safe, the main thread owns it.
+
+#include <core_types.h>
+
+#include "hook/hook_events.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+// Frees that came before their allocation, remembered so the allocation is not added when it arrives late. Power of
+// two.
+constexpr u32 INTERVAL_INDEX_UNMATCHED_FREES = 256;
+
+struct LiveBlock {
+    u64 address;
+    u64 size;
+    u64 ticks;    // Of the call that made the block.
+    u32 callsite; // Stack id, see stack_table.h.
+    u32 tid;
+    HookOp op;
+    u8 reserved[7];
+};
+
+// Read the counters directly, everything else is private to interval_index.cpp.
+struct IntervalIndex {
+    void* root;
+    u32 height;       // Inner levels above the leaves.
+    u64 count;
+    u64 liveBytes;
+    u64 leafCount;
+    u64 innerCount;
+
+    // Recent frees that found no block, one slot per address hash. A newer free overwrites whatever is in its slot,
+    // a used up one leaves address 0.
+    u64 unmatchedAddresses[INTERVAL_INDEX_UNMATCHED_FREES];
+    u64 unmatchedTicks[INTERVAL_INDEX_UNMATCHED_FREES];
+};
+
+// Return false to stop the query.
+using IntervalVisitor = bool (*)(const LiveBlock& block, void* userData);
+// One change made by intervalIndexApply. removed is null for a new block, added is null for an erased one. Return
+// false to stop applying.
+using IntervalChangeFn = bool (*)(const LiveBlock* removed, const LiveBlock* added, void* userData);
+
+enum struct IntervalInsertResult : u8 {
+    INSERTED,
+    REPLACED,
+    STALE,          // The block at the same address is newer, or a later free of it already came. Nothing changed.
+    OUT_OF_MEMORY,
+
+    SENTINEL
+};
+
+// Adds the block, or replaces the one at the same address unless that one is newer. A newer block can already be
+// there because the ingest drains rings one after the other, not in tick order. For the same reason the free of the
+// block can already have come, then nothing is added.
+[[nodiscard]] IntervalInsertResult intervalIndexInsert(IntervalIndex& idx, const LiveBlock& block,
+                                                       LiveBlock* replaced = nullptr);
+// Removes the block at address unless it was made after ticks, for the same reason. Returns false when there is none.
+// A free with no block at all is remembered for the insert of a block that arrives after its free.
+bool intervalIndexErase(IntervalIndex& idx, u64 address, u64 ticks, LiveBlock* erased = nullptr);
+// The block containing address.
+bool intervalIndexStab(const IntervalIndex& idx, u64 address, LiveBlock& out);
+// Visits the blocks overlapping [begin, end) in address order. Returns the number visited.
+u64 intervalIndexQuery(const IntervalIndex& idx, u64 begin, u64 end, IntervalVisitor visit, void* userData);
+
+// Replaces the content with blocks, which must be sorted by address without duplicates. Builds the tree bottom up
+// with leaves 7/8 full, in one pass and without any searching.
+[[nodiscard]] bool intervalIndexBulkLoad(IntervalIndex& idx, const LiveBlock* blocks, u64 count);
+void intervalIndexClear(IntervalIndex& idx);
+
+// Applies allocation events as they arrive: allocations insert, frees and unmaps erase. munmap only removes a mapping
+// it starts at, a partial unmap keeps the whole mapping. onChange sees every change, so structures derived from the
+// index can follow it. Returns false when out of memory or stopped.
+[[nodiscard]] bool intervalIndexApply(IntervalIndex& idx, const HookEvent* events, u32 count,
+                                      IntervalChangeFn onChange = nullptr, void* userData = nullptr);
+// Replaces the content with what is still live after events, which get sorted by address in place. Cheaper than
+// applying them one by one, it bulk loads the result.
+[[nodiscard]] bool intervalIndexBuild(IntervalIndex& idx, HookEvent* events, u64 count);
+
+} // namespace memviz
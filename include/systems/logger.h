@@ -5,6 +5,8 @@
 #include "core_assert_fmt.h"
 #include "core_types.h"
 
+#include <type_traits>
+
 namespace memviz {
 
 using namespace coretypes;
@@ -16,6 +18,7 @@ enum LogTag : i32 {
     USER_INPUT_TAG = 2,
     RENDERER_TAG = 3,
     RENDERER_VALIDATION_TAG = 4,
+    INGEST_TAG = 5,
 
     SENTINEL
 };
@@ -27,6 +30,7 @@ constexpr const char* logTagToCStr(LogTag t) {
         case LogTag::USER_INPUT_TAG:          return "USER_INPUT";
         case LogTag::RENDERER_TAG:            return "RENDERER";
         case LogTag::RENDERER_VALIDATION_TAG: return "RENDERER_VALIDATION";
+        case LogTag::INGEST_TAG:              return "INGEST";
 
         case LogTag::SENTINEL: [[fallthrough]];
         default:
@@ -36,6 +40,64 @@ constexpr const char* logTagToCStr(LogTag t) {
     return nullptr;
 }
 
+// ------------------------------------------ BEGIN COMPILE TIME LOG FLOOR ---------------------------------------------
+//
+// MEMVIZ_LOG_FLOOR in CMake sets the lowest level compiled in per tag (MEMVIZ_LOG_FLOOR_<TAG>, an index into
+// core::LogLevel). Calls below the floor through logTagged and the async macros are discarded at compile time,
+// arguments included. The runtime level and tag muting keep working above the floor. The tag of these macros must be a
+// constant expression.
+
+#ifndef MEMVIZ_LOG_FLOOR_ALL
+    #define MEMVIZ_LOG_FLOOR_ALL 0
+#endif
+#ifndef MEMVIZ_LOG_FLOOR_PLATFORM
+    #define MEMVIZ_LOG_FLOOR_PLATFORM MEMVIZ_LOG_FLOOR_ALL
+#endif
+#ifndef MEMVIZ_LOG_FLOOR_USER_INPUT
+    #define MEMVIZ_LOG_FLOOR_USER_INPUT MEMVIZ_LOG_FLOOR_ALL
+#endif
+#ifndef MEMVIZ_LOG_FLOOR_RENDERER
+    #define MEMVIZ_LOG_FLOOR_RENDERER MEMVIZ_LOG_FLOOR_ALL
+#endif
+#ifndef MEMVIZ_LOG_FLOOR_RENDERER_VALIDATION
+    #define MEMVIZ_LOG_FLOOR_RENDERER_VALIDATION MEMVIZ_LOG_FLOOR_ALL
+#endif
+#ifndef MEMVIZ_LOG_FLOOR_INGEST
+    #define MEMVIZ_LOG_FLOOR_INGEST MEMVIZ_LOG_FLOOR_ALL
+#endif
+
+constexpr u8 logTagFloor(i32 tag) {
+    switch (tag) {
+        case LogTag::PLATFORM_TAG:            return MEMVIZ_LOG_FLOOR_PLATFORM;
+        case LogTag::USER_INPUT_TAG:          return MEMVIZ_LOG_FLOOR_USER_INPUT;
+        case LogTag::RENDERER_TAG:            return MEMVIZ_LOG_FLOOR_RENDERER;
+        case LogTag::RENDERER_VALIDATION_TAG: return MEMVIZ_LOG_FLOOR_RENDERER_VALIDATION;
+        case LogTag::INGEST_TAG:              return MEMVIZ_LOG_FLOOR_INGEST;
+        default:                              return MEMVIZ_LOG_FLOOR_ALL;
+    }
+}
+
+constexpr bool logCompiledIn(core::LogLevel level, i32 tag) {
+    return u8(level) >= logTagFloor(tag);
+}
+
+#define MEMVIZ_LOG_LEVEL_Trace core::LogLevel::L_TRACE
+#define MEMVIZ_LOG_LEVEL_Debug core::LogLevel::L_DEBUG
+#define MEMVIZ_LOG_LEVEL_Info core::LogLevel::L_INFO
+#define MEMVIZ_LOG_LEVEL_Warn core::LogLevel::L_WARNING
+#define MEMVIZ_LOG_LEVEL_Err core::LogLevel::L_ERROR
+#define MEMVIZ_LOG_LEVEL_Fatal core::LogLevel::L_FATAL
+
+// Synchronous log with the compile time floor applied, e.g. logTagged(Debug, PLATFORM_TAG, "x={}", x).
+#define logTagged(Level, tag, fmt, ...)                                                          \
+    do {                                                                                          \
+        if constexpr (::memviz::logCompiledIn(MEMVIZ_LOG_LEVEL_##Level, i32(tag))) {              \
+            log##Level##Tagged(tag, fmt, ##__VA_ARGS__);                                          \
+        }                                                                                         \
+    } while (0)
+
+// ------------------------------------------ END COMPILE TIME LOG FLOOR -----------------------------------------------
+
 core::LoggerCreateInfo loggerSystemCreateInfo();
 
 void loggerSystemInit();
@@ -50,4 +112,141 @@ void loggerSystemSetLogLevelToFatal();
 
 void __debug__testLoggerSetup();
 
+// ------------------------------------------ BEGIN ASYNC LOGGING ------------------------------------------------------
+//
+// Deferred logging for hot paths (input events, per frame code, driver callbacks). The calling thread only copies the
+// format pointer and the arguments into its own lock-free ring. A writer thread merges the rings in call order, formats
+// the records in batches and hands them to the regular logger, so tags, muting and ANSI work the same.
+//
+// The format string must outlive the program (a literal). Supported placeholders are {}, {:f.N} and {:H}. String
+// arguments are copied, longer ones are cut to ASYNC_LOG_MAX_STRING bytes ending in "..." and counted as truncated.
+// When a ring is full the record is dropped and counted, the writer reports drops periodically.
+//
+// Any thread may log at any time. asyncLoggerStop waits for the calls already in flight before it frees the rings,
+// and every call made after it is formatted and written synchronously on the calling thread.
+
+constexpr u32 ASYNC_LOG_RING_SIZE = 64 * 1024; // per thread
+constexpr u32 ASYNC_LOG_MAX_ARGS = 8;
+constexpr u32 ASYNC_LOG_MAX_STRING = 1024;
+
+enum struct AsyncLogArgKind : u8 {
+    SIGNED,
+    UNSIGNED,
+    FLOAT,
+    BOOL,
+    STRING,
+    POINTER,
+};
+
+struct AsyncLogArg {
+    AsyncLogArgKind kind;
+    union {
+        i64 i;
+        u64 u;
+        f64 f;
+        const char* s;
+        const void* p;
+    };
+};
+
+struct AsyncLoggerStats {
+    u64 written;   // Records formatted and handed to the logger.
+    u64 dropped;   // Records lost because the caller's ring was full.
+    u64 truncated; // Records with arguments cut to fit (too many arguments or too long strings).
+    u32 threads;   // Threads that logged asynchronously so far.
+};
+
+// Started and stopped by loggerSystemInit/loggerSystemShutdown. Everything queued is written before shutdown returns.
+void asyncLoggerStart();
+void asyncLoggerStop();
+// Blocks until every record queued before the call was written.
+void asyncLoggerFlush();
+AsyncLoggerStats asyncLoggerStats();
+
+void asyncLogPush(core::LogLevel level, i32 tag, const char* fmt, const AsyncLogArg* args, u32 argCount);
+
+inline AsyncLogArg asyncLogArg(bool v)        { AsyncLogArg a; a.kind = AsyncLogArgKind::BOOL;    a.u = v;      return a; }
+inline AsyncLogArg asyncLogArg(f32 v)         { AsyncLogArg a; a.kind = AsyncLogArgKind::FLOAT;   a.f = f64(v); return a; }
+inline AsyncLogArg asyncLogArg(f64 v)         { AsyncLogArg a; a.kind = AsyncLogArgKind::FLOAT;   a.f = v;      return a; }
+inline AsyncLogArg asyncLogArg(const char* v) { AsyncLogArg a; a.kind = AsyncLogArgKind::STRING;  a.s = v;      return a; }
+inline AsyncLogArg asyncLogArg(char* v)       { AsyncLogArg a; a.kind = AsyncLogArgKind::STRING;  a.s = v;      return a; }
+inline AsyncLogArg asyncLogArg(const void* v) { AsyncLogArg a; a.kind = AsyncLogArgKind::POINTER; a.p = v;      return a; }
+
+template <typename T>
+    requires (std::is_integral_v<T> || std::is_enum_v<T>)
+inline AsyncLogArg asyncLogArg(T v) {
+    AsyncLogArg a;
+    if constexpr (std::is_enum_v<T>) {
+        using U = std::underlying_type_t<T>;
+        if constexpr (std::is_signed_v<U>) { a.kind = AsyncLogArgKind::SIGNED;   a.i = i64(U(v)); }
+        else                               { a.kind = AsyncLogArgKind::UNSIGNED; a.u = u64(U(v)); }
+    }
+    else if constexpr (std::is_signed_v<T>) { a.kind = AsyncLogArgKind::SIGNED;   a.i = i64(v); }
+    else                                    { a.kind = AsyncLogArgKind::UNSIGNED; a.u = u64(v); }
+    return a;
+}
+
+template <typename... Args>
+inline void asyncLog(core::LogLevel level, i32 tag, const char* fmt, const Args&... args) {
+    if constexpr (sizeof...(Args) == 0) {
+        asyncLogPush(level, tag, fmt, nullptr, 0);
+    }
+    else {
+        const AsyncLogArg packed[] = { asyncLogArg(args)... };
+        asyncLogPush(level, tag, fmt, packed, u32(sizeof...(Args)));
+    }
+}
+
+// Limits a call site to perSecond records per second. Calls over the limit are counted and reported with the next
+// record that gets through. Approximate when the site is hit from several threads at once.
+struct LogRateLimit {
+    u64 windowStartNs;
+    u32 count;
+    u32 suppressed;
+};
+
+// Returns whether the call may log. suppressed is set to the number of calls dropped since the last allowed one.
+bool logRateLimitAllow(LogRateLimit& limit, u32 perSecond, u32& suppressed);
+
+#define MEMVIZ_LOG_ASYNC(Level, tag, fmt, ...)                                                   \
+    do {                                                                                          \
+        if constexpr (::memviz::logCompiledIn(MEMVIZ_LOG_LEVEL_##Level, i32(tag))) {              \
+            ::memviz::asyncLog(MEMVIZ_LOG_LEVEL_##Level, i32(tag), fmt, ##__VA_ARGS__);           \
+        }                                                                                         \
+    } while (0)
+
+#define MEMVIZ_LOG_ASYNC_LIMITED(Level, perSecond, tag, fmt, ...)                                \
+    do {                                                                                          \
+        if constexpr (::memviz::logCompiledIn(MEMVIZ_LOG_LEVEL_##Level, i32(tag))) {              \
+            static ::memviz::LogRateLimit memvizRateLimit_ = {};                                  \
+            u32 memvizSuppressed_ = 0;                                                            \
+            if (::memviz::logRateLimitAllow(memvizRateLimit_, perSecond, memvizSuppressed_)) {    \
+                if (memvizSuppressed_ > 0) {                                                      \
+                    ::memviz::asyncLog(MEMVIZ_LOG_LEVEL_##Level, i32(tag),                        \
+                                       "({} similar records suppressed)", memvizSuppressed_);     \
+                }                                                                                 \
+                ::memviz::asyncLog(MEMVIZ_LOG_LEVEL_##Level, i32(tag), fmt, ##__VA_ARGS__);       \
+            }                                                                                     \
+        }                                                                                         \
+    } while (0)
+
+#define logTraceTaggedAsync(tag, fmt, ...) MEMVIZ_LOG_ASYNC(Trace, tag, fmt, ##__VA_ARGS__)
+#define logDebugTaggedAsync(tag, fmt, ...) MEMVIZ_LOG_ASYNC(Debug, tag, fmt, ##__VA_ARGS__)
+#define logInfoTaggedAsync(tag, fmt, ...) MEMVIZ_LOG_ASYNC(Info, tag, fmt, ##__VA_ARGS__)
+#define logWarnTaggedAsync(tag, fmt, ...) MEMVIZ_LOG_ASYNC(Warn, tag, fmt, ##__VA_ARGS__)
+#define logErrTaggedAsync(tag, fmt, ...) MEMVIZ_LOG_ASYNC(Err, tag, fmt, ##__VA_ARGS__)
+
+#define logTraceTaggedLimited(perSecond, tag, fmt, ...) \
+    MEMVIZ_LOG_ASYNC_LIMITED(Trace, perSecond, tag, fmt, ##__VA_ARGS__)
+#define logDebugTaggedLimited(perSecond, tag, fmt, ...) \
+    MEMVIZ_LOG_ASYNC_LIMITED(Debug, perSecond, tag, fmt, ##__VA_ARGS__)
+#define logInfoTaggedLimited(perSecond, tag, fmt, ...) \
+    MEMVIZ_LOG_ASYNC_LIMITED(Info, perSecond, tag, fmt, ##__VA_ARGS__)
+#define logWarnTaggedLimited(perSecond, tag, fmt, ...) \
+    MEMVIZ_LOG_ASYNC_LIMITED(Warn, perSecond, tag, fmt, ##__VA_ARGS__)
+#define logErrTaggedLimited(perSecond, tag, fmt, ...) \
+    MEMVIZ_LOG_ASYNC_LIMITED(Err, perSecond, tag, fmt, ##__VA_ARGS__)
+
+// ------------------------------------------ END ASYNC LOGGING --------------------------------------------------------
+
 } // memviz
@@ -0,0 +1,68 @@
+#pragma once
+
+// Page level picture of the sampled process: which pages are resident, which are swapped out and which were written
+// lately. Runs on the VMA sampler thread as its sample hook and follows the VMAs of its deltas, so the map is never
+// read twice.
+//
+// Residency comes from /proc/<pid>/pagemap, 8 bytes per page. VMAs close to each other are read together, in preads
+// of up to PAGE_SAMPLER_BATCH_PAGES entries. Writes come from the soft-dirty bit: after every scan the bits of the
+// whole process are reset through /proc/<pid>/clear_refs, the next scan sees the pages written in between. Every page
+// keeps the last PAGE_SAMPLER_HISTORY of those intervals, one bitset per interval, its write hotness is how many of
+// them it was written in.
+//
+// Only writable VMAs can get written, they are scanned at every page tick. The others are scanned when they appear or
+// change and every PAGE_SAMPLER_RESIDENCY_EVERY-th tick, so a settled process costs its writable VMAs and the ones that
+// changed. The reset is not free for the process either: every page written after it takes one write fault.
+//
+// Soft-dirty needs CONFIG_MEM_SOFT_DIRTY (x86, powerpc, s390). Without it only residency is sampled.
+
+#include <core_types.h>
+
+#include "systems/vma_sampler.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 PAGE_SAMPLER_DEFAULT_HZ = 2;
+constexpr u32 PAGE_SAMPLER_HISTORY = 8;
+constexpr u32 PAGE_SAMPLER_RESIDENCY_EVERY = 10;
+constexpr u32 PAGE_SAMPLER_BATCH_PAGES = 64 * 1024; // 512 KiB of pagemap per pread
+constexpr u64 PAGE_SAMPLER_MAX_VMA_BYTES = u64(16) << 30; // Larger VMAs are address space reservations, not tracked.
+
+// Summary of the pages overlapping a range.
+struct PageCell {
+    u32 pages;    // Tracked.
+    u32 resident;
+    u32 swapped;
+    u32 written;  // Written in at least one of the remembered intervals.
+    u32 writes;   // Intervals written in, over all pages. At most pages * PAGE_SAMPLER_HISTORY.
+};
+
+struct PageSamplerStats {
+    u32 trackedVmas;
+    u32 scannedVmas;  // In the last tick.
+    u64 trackedPages;
+    u64 residentPages;
+    u64 swappedPages;
+    u64 writtenPages; // In the last interval.
+    u64 scanNs;       // Of the last tick, clear_refs included.
+    u64 generation;   // Incremented after every tick.
+    bool softDirty;
+};
+
+// Opens the pagemap and clear_refs of pid. Call before starting the VMA sampler with pageSamplerOnSample as its hook.
+[[nodiscard]] bool pageSamplerStart(u32 pid, u32 hz);
+// After the VMA sampler stopped.
+void pageSamplerStop();
+bool pageSamplerIsActive();
+
+// The VmaSampleHook, sampler thread only.
+void pageSamplerOnSample(const VmaDelta& delta);
+
+// Any thread. Summarizes [begin + i * cellBytes, begin + (i + 1) * cellBytes) into out[i]. A page counts in the cell
+// holding its start, cells smaller than a page each get the page they are in. Returns the number of cells with pages.
+u32 pageSamplerSummarize(u64 begin, u64 cellBytes, PageCell* out, u32 cellCount);
+PageSamplerStats pageSamplerStats();
+
+} // namespace memviz
@@ -0,0 +1,57 @@
+#pragma once
+
+// Scoped zone profiler. MEMVIZ_ZONE("name") takes a begin timestamp where it is declared and, when the scope exits,
+// records the completed zone into a ring owned by the calling thread. A full ring overwrites its oldest zones, so the
+// profiler can stay on in a long running viewer and always holds the most recent ones. profilerExport writes the zones
+// in the rings as Chrome trace JSON, which chrome://tracing and Perfetto open directly.
+//
+// Built only with MEMVIZ_ENABLE_PROFILER. Without it MEMVIZ_ZONE expands to nothing and the functions below are
+// no-ops, so instrumentation can stay in hot code.
+//
+// Environment:
+//   MEMVIZ_TRACE          - path profilerShutdown writes the trace to.
+//   MEMVIZ_PROFILER_ZONES - ring size in zones per thread, rounded up to a power of two. Read by profilerInit.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 PROFILER_DEFAULT_ZONES_PER_THREAD = 1 << 19; // 12 MiB per thread
+constexpr u32 PROFILER_MAX_OPEN_ZONES = 256;                // Deeper zones are dropped.
+
+void profilerInit();
+// Writes the trace to MEMVIZ_TRACE when the variable is set.
+void profilerShutdown();
+
+// Safe while other threads keep recording, zones that are still open and zones overwritten during the export are left
+// out. Returns false when the profiler is compiled out or the file could not be written.
+[[nodiscard]] bool profilerExport(const char* path);
+
+#if defined(MEMVIZ_PROFILER) && MEMVIZ_PROFILER == 1
+
+void profilerZoneBegin(const char* name);
+void profilerZoneEnd();
+
+struct ProfilerZone {
+    explicit ProfilerZone(const char* name) { profilerZoneBegin(name); }
+    ~ProfilerZone() { profilerZoneEnd(); }
+
+    ProfilerZone(const ProfilerZone&) = delete;
+    ProfilerZone& operator=(const ProfilerZone&) = delete;
+};
+
+#define MEMVIZ_ZONE_CONCAT_IMPL(a, b) a##b
+#define MEMVIZ_ZONE_CONCAT(a, b) MEMVIZ_ZONE_CONCAT_IMPL(a, b)
+
+// The name must be a string literal, only its pointer is recorded.
+#define MEMVIZ_ZONE(name) ::memviz::ProfilerZone MEMVIZ_ZONE_CONCAT(memvizZone_, __LINE__)(name)
+
+#else
+
+#define MEMVIZ_ZONE(name)
+
+#endif
+
+} // namespace memviz
@@ -0,0 +1,75 @@
+#pragma once
+
+// Per pass frame timings of the renderer. CPU passes are measured with the monotonic clock, GPU passes come from
+// timestamp queries and arrive a few frames late. Every FRAME_TIMING_PUBLISH_INTERVAL frames min/avg/p99 over the
+// last FRAME_TIMING_WINDOW samples of each pass are logged under RENDERER_TAG. The whole run goes into a fixed size
+// log-linear histogram per pass, so memory does not grow with the run, and whole run percentiles are within ~2%.
+//
+// Environment:
+//   MEMVIZ_FRAME_TIMINGS - frameTimingShutdown writes the whole run stats there as JSON, to compare builds.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum struct FramePass : u8 {
+    CPU_WAIT,    // Waiting for the frame's resources (fence, framebuffer) to be free.
+    CPU_RECORD,  // Command buffer recording.
+    CPU_SUBMIT,
+    CPU_PRESENT,
+    CPU_BIN,     // Software renderer: sorting blocks into tiles.
+    CPU_RASTER,  // Software renderer: drawing the tiles.
+    GPU_UPLOAD,  // Instance copies from the upload ring.
+    GPU_BLOCKS,  // Block render pass.
+    GPU_FRAME,   // First to last timestamp of the frame.
+
+    SENTINEL
+};
+
+constexpr const char* framePassToCStr(FramePass p) {
+    switch (p) {
+        case FramePass::CPU_WAIT:    return "cpu_wait";
+        case FramePass::CPU_RECORD:  return "cpu_record";
+        case FramePass::CPU_SUBMIT:  return "cpu_submit";
+        case FramePass::CPU_PRESENT: return "cpu_present";
+        case FramePass::CPU_BIN:     return "cpu_bin";
+        case FramePass::CPU_RASTER:  return "cpu_raster";
+        case FramePass::GPU_UPLOAD:  return "gpu_upload";
+        case FramePass::GPU_BLOCKS:  return "gpu_blocks";
+        case FramePass::GPU_FRAME:   return "gpu_frame";
+
+        case FramePass::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+constexpr u32 FRAME_TIMING_WINDOW = 256;
+constexpr u32 FRAME_TIMING_PUBLISH_INTERVAL = 600;
+
+struct FramePassStats {
+    u64 samples;
+    u64 minNs;
+    u64 avgNs;
+    u64 p50Ns;
+    u64 p99Ns;
+    u64 maxNs;
+};
+
+void frameTimingInit();
+// Logs the whole run summary and writes the MEMVIZ_FRAME_TIMINGS dump before dropping the timings.
+void frameTimingShutdown();
+
+void frameTimingRecord(FramePass pass, u64 ns);
+// Counts the frame and publishes the rolling stats when the interval is reached.
+void frameTimingEndFrame();
+
+// Over the rolling window when rolling is true, otherwise over the whole run.
+FramePassStats frameTimingStats(FramePass pass, bool rolling);
+void frameTimingLogSummary();
+// JSON with the whole run stats of every pass that has samples, for comparing runs of different builds.
+[[nodiscard]] bool frameTimingDump(const char* path);
+
+} // namespace memviz
@@ -11,13 +11,71 @@ namespace memviz {
 
 using namespace coretypes;
 
+constexpr u32 MAX_BLOCK_LAYERS = 4;
+constexpr u32 BLOCK_CATEGORY_COUNT = 16;
+
+// One live allocation as the renderer draws it. Offsets and sizes are in granules of the layer (1 << granuleShift
+// bytes) relative to the layer base address, which keeps the instance at 12 bytes: 10M blocks are ~115 MiB.
+struct BlockInstance {
+    u32 offset;
+    u32 size;     // At least 1. Allocations larger than 4G granules are split by the caller.
+    u32 category; // Palette index, taken modulo BLOCK_CATEGORY_COUNT.
+};
+
+struct BlockLayerDesc {
+    u64 baseAddress;
+    u32 granuleShift;
+    u32 capacity; // Maximum number of instances. Changing it discards the uploaded instances.
+};
+
+// How consecutive rows of the address grid are placed. Keep in sync with shaders/blocks.vert.
+enum struct BlockLayout : u8 {
+    ROWS,  // Every row runs left to right.
+    SNAKE, // Odd rows run right to left, so consecutive addresses stay adjacent across row ends.
+    // No rows. An instance is a square on a rowCount by rowCount grid: offset is its corner cell, x in the low and y in
+    // the high 16 bits, and size its side in cells. Used by the heap view, which lays blocks out along a space filling
+    // curve. The layer base address and bytesPerRow do not apply.
+    SQUARES,
+
+    SENTINEL
+};
+
+// The visible address range is laid out as rowCount rows of bytesPerRow bytes starting at baseAddress.
+struct BlockView {
+    u64 baseAddress;
+    u64 bytesPerRow;
+    u32 rowCount;
+    BlockLayout layout;
+};
+
+enum struct BlockDrawMode : u8 {
+    RECTANGLES, // Every block in its category color, later blocks over earlier ones.
+    HEATMAP,    // Pixels colored by how many blocks cover them. Shows density where blocks are smaller than a pixel.
+
+    SENTINEL
+};
+
 struct Renderer {
     struct CrateInfo {
         const char* appName;
+        u64 hostMemoryCapBytes; // Cap on the renderer's host-side (driver) memory. 0 means unlimited.
     };
 
     static Error (*init)(CrateInfo&& info);
     static void (*shutdown)(void);
+
+    static void (*drawFrame)(void);
+    // Safe to call from the window resize callback: only records the new size, the target is rebuilt on the next frame.
+    static void (*resizeTarget)(i32 width, i32 height);
+
+    static void (*setBlockLayer)(u32 layer, const BlockLayerDesc& desc);
+    // Copies instances [first, first + count) of a layer into the renderer's upload ring. Returns how many were
+    // accepted, which is less than count when this frame's share of the ring is used up. Retry the rest next frame.
+    static u32 (*uploadBlocks)(u32 layer, u32 first, const BlockInstance* blocks, u32 count);
+    // Number of instances drawn from the layer. Instances past the last uploaded one are undefined.
+    static void (*setBlockCount)(u32 layer, u32 count);
+    static void (*setBlockView)(const BlockView& view);
+    static void (*setBlockDrawMode)(BlockDrawMode mode);
 };
 
 } // memviz
@@ -0,0 +1,55 @@
+#pragma once
+
+// Span kernels of the software renderer. Every kernel has a scalar, an SSE2 and an AVX2 version and the widest one the
+// CPU supports is picked once by softwareRasterInit. Setting MEMVIZ_RASTER_SIMD to scalar, sse2 or avx2 caps the
+// selection, which is how the kernels are compared against each other.
+
+#include <core_types.h>
+
+#include <bit>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum struct RasterSimdLevel : u8 {
+    SCALAR,
+    SSE2,
+    AVX2,
+
+    SENTINEL
+};
+
+constexpr const char* rasterSimdLevelToCStr(RasterSimdLevel level) {
+    switch (level) {
+        case RasterSimdLevel::SCALAR: return "scalar";
+        case RasterSimdLevel::SSE2:   return "sse2";
+        case RasterSimdLevel::AVX2:   return "avx2";
+
+        case RasterSimdLevel::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+RasterSimdLevel softwareRasterInit();
+
+// dst[0..count) = color
+void rasterFillSpan(u32* dst, u32 count, u32 color);
+// dst[0..count) += value, saturating at UINT16_MAX.
+void rasterAddSpan(u16* dst, u32 count, u16 value);
+// Maps heat values to colors: 0 becomes background, anything else ramp[heatToRampIndex(heat)].
+void rasterResolveHeat(u32* dst, const u16* heat, u32 count, const u32* ramp, u32 background);
+
+constexpr u32 RASTER_HEAT_RAMP_SIZE = 256;
+
+// Logarithmic, 16 steps per power of two, so both a handful and tens of thousands of overlapping blocks stay apart.
+constexpr u32 heatToRampIndex(u16 heat) { // heat > 0
+    u32 v = u32(heat);
+    u32 msb = u32(std::bit_width(v)) - 1;
+    u32 frac = msb >= 4 ? (v >> (msb - 4)) & 15 : (v << (4 - msb)) & 15;
+    u32 index = msb * 16 + frac;
+    return index < RASTER_HEAT_RAMP_SIZE ? index : RASTER_HEAT_RAMP_SIZE - 1;
+}
+
+} // namespace memviz
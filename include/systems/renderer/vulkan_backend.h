@@ -14,9 +14,12 @@
     #define WIN32_LEAN_AND_MEAN // vulkan.h might include windows.h
     #include <vulkan/vulkan.h>
 #elif defined(OS_LINUX) && OS_LINUX == 1
-    #ifdef USE_X11
+    #if defined(USE_X11)
         #define VK_USE_PLATFORM_XLIB_KHR
         #include <vulkan/vulkan.h>
+    #elif defined(USE_HEADLESS)
+        // VK_EXT_headless_surface is part of vulkan_core.h and needs no window system defines.
+        #include <vulkan/vulkan.h>
     #else
         #define VK_USE_PLATFORM_WAYLAND_KHR
         #include <vulkan/vulkan.h>
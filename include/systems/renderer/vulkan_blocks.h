@@ -0,0 +1,42 @@
+#pragma once
+
+// Instanced drawing of allocation blocks for the Vulkan backend. Every layer owns a device-local instance buffer.
+// Updates are written into a persistently mapped ring with one region per frame in flight and copied into the layer
+// buffers at the start of the frame. Each layer is then drawn with a single indirect instanced draw.
+
+#include "systems/renderer/renderer.h"
+#include "systems/renderer/vulkan_backend.h"
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+struct VulkanBlocksCreateInfo {
+    VkDevice device;
+    const VkAllocationCallbacks* allocCallbacks;
+    VkRenderPass renderPass;
+    VkPipelineCache pipelineCache;
+    u32 framesInFlight;
+};
+
+[[nodiscard]] bool vulkanBlocksInit(const VulkanBlocksCreateInfo& info);
+// The device must be idle.
+void vulkanBlocksShutdown();
+
+// Waits for the device to go idle when the layer's buffer has to be recreated.
+void vulkanBlocksSetLayer(u32 layer, const BlockLayerDesc& desc);
+void vulkanBlocksSetCount(u32 layer, u32 count);
+void vulkanBlocksSetView(const BlockView& view);
+
+// Makes the ring region of frameSlot writable again. Only call once the frame that last used the slot completed.
+void vulkanBlocksResetSlot(u32 frameSlot);
+u32 vulkanBlocksUpload(u32 frameSlot, u32 layer, u32 first, const BlockInstance* blocks, u32 count);
+
+// Outside of a render pass: copies everything uploaded into the slot's ring region into the layer buffers.
+void vulkanBlocksRecordUploads(VkCommandBuffer cmd, u32 frameSlot);
+// Inside the render pass.
+void vulkanBlocksRecordDraw(VkCommandBuffer cmd, u32 frameSlot, VkExtent2D extent);
+
+} // namespace memviz
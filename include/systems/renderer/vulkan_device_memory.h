@@ -0,0 +1,110 @@
+#pragma once
+
+// Device memory manager for the Vulkan backend. Resources never call vkAllocateMemory directly. Memory is taken from
+// large blocks per memory type instead:
+//  - long-lived allocations use a buddy allocator inside each block,
+//  - per-frame transient data is bump allocated from a linear arena with one region per frame in flight,
+//  - requests larger than a block get a dedicated VkDeviceMemory.
+// Host-visible blocks are mapped once at creation and stay mapped.
+
+#include "systems/renderer/vulkan_backend.h"
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum struct DeviceMemoryUsage : u8 {
+    LONG_LIVED,         // Never moved by defragmentation.
+    LONG_LIVED_MOVABLE, // May be returned by deviceMemoryDefragBegin. The owner recreates its resource on the move.
+    TRANSIENT,          // Valid until deviceMemoryBeginFrame is called again for the same frame slot. Never freed.
+
+    SENTINEL
+};
+
+struct DeviceAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;        // Host pointer to offset, nullptr when the memory type is not HOST_VISIBLE.
+    u32 memoryTypeIndex;
+    u32 id;              // 0 for transient allocations. Otherwise identifies the allocation in the map and in moves.
+};
+
+struct DeviceMemoryCreateInfo {
+    VkPhysicalDevice gpu;
+    VkDevice device;
+    const VkAllocationCallbacks* allocCallbacks;
+    bool memoryBudgetSupported;           // VK_EXT_memory_budget is enabled on the device.
+    VkDeviceSize blockSize;               // Rounded up to a power of two. 0 picks the default.
+    VkDeviceSize transientBytesPerFrame;  // Size of each frame's region in the transient arenas. 0 picks the default.
+    u32 framesInFlight;
+};
+
+struct DeviceMemoryMove {
+    u32 id;
+    DeviceAllocation src;
+    DeviceAllocation dst;
+};
+
+struct DeviceHeapBudget {
+    VkDeviceSize heapSize;
+    VkDeviceSize budget;      // From VK_EXT_memory_budget, otherwise an estimate of 80% of the heap.
+    VkDeviceSize usage;       // Process wide usage reported by the driver, otherwise only what this manager allocated.
+    VkDeviceSize blockBytes;  // Bytes in VkDeviceMemory objects owned by this manager.
+    VkDeviceSize usedBytes;   // Bytes handed out to resources.
+};
+
+enum struct DeviceMemoryMapEntryKind : u8 {
+    BLOCK,            // A VkDeviceMemory owned by the manager. offset is 0, size is the block size.
+    ALLOCATION,       // A long-lived allocation (buddy node or dedicated block).
+    TRANSIENT_REGION, // The used part of one frame region of a transient arena.
+
+    SENTINEL
+};
+
+struct DeviceMemoryMapEntry {
+    u32 blockIndex;
+    u32 memoryTypeIndex;
+    u64 offset;
+    u64 size;
+    u32 id;
+    DeviceMemoryMapEntryKind kind;
+};
+
+[[nodiscard]] bool deviceMemoryInit(const DeviceMemoryCreateInfo& info);
+void deviceMemoryShutdown();
+
+// Returns UINT32_MAX when no memory type in typeBits has all required flags. Among the candidates the one with the
+// most preferred flags wins.
+u32 deviceMemoryFindType(u32 typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+
+[[nodiscard]] bool deviceMemoryAlloc(const VkMemoryRequirements& reqs,
+                                     VkMemoryPropertyFlags required,
+                                     VkMemoryPropertyFlags preferred,
+                                     DeviceMemoryUsage usage,
+                                     DeviceAllocation& out);
+void deviceMemoryFree(DeviceAllocation& alloc);
+
+// Resets the transient region of frameIndex. Call after the fence of that frame slot was waited on.
+void deviceMemoryBeginFrame(u32 frameIndex);
+
+// Plans up to maxMoves moves (at most maxBytes in total) of movable allocations out of the emptiest blocks. Destination
+// memory is reserved by this call. Vulkan can not rebind the memory of a resource, so the owner creates a new resource,
+// binds it to dst, copies the old resource into it and, once the GPU finished the copies, destroys the old resource and
+// calls deviceMemoryDefragEnd with the same moves. The allocations in the moves must not be freed in between.
+u32 deviceMemoryDefragBegin(DeviceMemoryMove* outMoves, u32 maxMoves, VkDeviceSize maxBytes);
+void deviceMemoryDefragEnd(const DeviceMemoryMove* moves, u32 count);
+
+// Fills at most maxHeaps entries, indexed by memory heap. Returns the number of memory heaps.
+u32 deviceMemoryQueryBudget(DeviceHeapBudget* out, u32 maxHeaps);
+
+// Writes at most maxEntries entries and returns the total number of entries, so a first call with maxEntries = 0
+// gives the required size. Every block entry is followed by the entries inside that block.
+u32 deviceMemoryExportMap(DeviceMemoryMapEntry* out, u32 maxEntries);
+[[nodiscard]] bool deviceMemoryDumpMap(const char* path);
+
+void deviceMemoryLogStats();
+
+} // namespace memviz
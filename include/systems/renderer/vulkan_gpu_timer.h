@@ -0,0 +1,35 @@
+#pragma once
+
+// GPU side of the frame timings. Every frame slot owns a range of a timestamp query pool. Passes are bracketed with
+// timestamps while recording, and the slot's results are read back when the slot is reused, right after its fence was
+// waited on. The results are then MAX_FRAMES_IN_FLIGHT frames old but reading them never stalls.
+
+#include "systems/renderer/frame_timing.h"
+#include "systems/renderer/vulkan_backend.h"
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+struct VulkanGpuTimerCreateInfo {
+    VkPhysicalDevice gpu;
+    VkDevice device;
+    const VkAllocationCallbacks* allocCallbacks;
+    u32 queueFamily; // The queue the timed command buffers are submitted to.
+    u32 framesInFlight;
+};
+
+// Returns false when the queue does not support timestamps. All other calls are no-ops in that case.
+bool vulkanGpuTimerInit(const VulkanGpuTimerCreateInfo& info);
+// The device must be idle.
+void vulkanGpuTimerShutdown();
+
+// Call after the slot's fence was waited on, outside of a render pass and before any other timer call for the slot.
+// Publishes the slot's previous results to frame timing and resets its queries.
+void vulkanGpuTimerBeginFrame(VkCommandBuffer cmd, u32 frameSlot);
+void vulkanGpuTimerBegin(VkCommandBuffer cmd, u32 frameSlot, FramePass pass);
+void vulkanGpuTimerEnd(VkCommandBuffer cmd, u32 frameSlot, FramePass pass);
+
+} // namespace memviz
@@ -0,0 +1,41 @@
+#pragma once
+
+// VkAllocationCallbacks backed by a core allocator. Every host allocation the Vulkan loader, layers and driver make
+// through these callbacks is counted per VkSystemAllocationScope and can be capped.
+
+#include "systems/renderer/vulkan_backend.h"
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 VULKAN_ALLOCATION_SCOPE_COUNT = 5; // VK_SYSTEM_ALLOCATION_SCOPE_COMMAND .. VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE
+
+struct VulkanHostScopeStats {
+    u64 liveBytes;
+    u64 peakBytes;
+    u64 allocCount;
+    u64 freeCount;
+    u64 internalLiveBytes; // Reported through pfnInternalAllocation, not allocated by us (e.g. executable memory).
+};
+
+struct VulkanHostMemoryStats {
+    VulkanHostScopeStats scopes[VULKAN_ALLOCATION_SCOPE_COUNT];
+    u64 totalLiveBytes;
+    u64 totalPeakBytes;
+    u64 capBytes;      // 0 means unlimited.
+    u64 failedAllocs;  // Allocations refused because of the cap or because the backing allocator failed.
+};
+
+// capBytes of 0 disables the cap. Must be called before the VkInstance is created.
+void vulkanHostAllocatorInit(u32 allocatorId, u64 capBytes);
+
+// nullptr when the host allocator is not initialized, which makes Vulkan fall back to its own allocator.
+const VkAllocationCallbacks* vulkanHostAllocator();
+
+VulkanHostMemoryStats vulkanHostAllocatorStats();
+void vulkanHostAllocatorLogStats();
+
+} // namespace memviz
@@ -0,0 +1,38 @@
+#pragma once
+
+// Viewer side copy of the call stacks a hooked process interned, see hook/hook_events.h. It is built from the
+// STACK_FRAME events, which arrive one frame at a time and can trail the first events naming their stack. Ids are
+// dense, a lookup is an array index. Main thread only.
+
+#include <core_types.h>
+
+#include "hook/hook_events.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+struct StackEntry {
+    u32 offset; // Of the first frame in frames.
+    u8 depth;   // 0 for an id no frame arrived for.
+    u8 filled;  // Frames arrived so far, in order.
+    u16 reserved;
+};
+
+// Read the fields directly, the arrays are owned by the table.
+struct StackTable {
+    StackEntry* entries; // By id.
+    u32 entryCapacity;
+    u64* frames;
+    u32 frameCount;
+    u32 frameCapacity;
+    u32 count;           // Stacks with all their frames.
+};
+
+// Takes the STACK_FRAME events, the others are skipped.
+[[nodiscard]] bool stackTableApply(StackTable& t, const HookEvent* events, u64 count);
+// Frames of stack id, innermost first. 0 while the stack is unknown or some of its frames are missing.
+u32 stackTableGet(const StackTable& t, u32 id, const u64*& frames);
+void stackTableClear(StackTable& t);
+
+} // namespace memviz
@@ -0,0 +1,45 @@
+#pragma once
+
+// Wall-clock breakdown of application startup, so cold and warm starts (e.g. with and without a pipeline cache on
+// disk) can be compared. Stages may be nested or skipped, unrecorded stages are left out of the report.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+enum struct StartupStage : u8 {
+    PLATFORM_INIT,
+    RENDERER_INSTANCE,
+    RENDERER_DEVICE,
+    RENDERER_SWAPCHAIN,
+    RENDERER_PIPELINE_WARMUP,
+
+    SENTINEL
+};
+
+constexpr const char* startupStageToCStr(StartupStage s) {
+    switch (s) {
+        case StartupStage::PLATFORM_INIT:            return "platform init";
+        case StartupStage::RENDERER_INSTANCE:        return "instance creation";
+        case StartupStage::RENDERER_DEVICE:          return "device creation";
+        case StartupStage::RENDERER_SWAPCHAIN:       return "swapchain creation";
+        case StartupStage::RENDERER_PIPELINE_WARMUP: return "pipeline warmup";
+
+        case StartupStage::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+void startupTimingBegin(StartupStage stage);
+void startupTimingEnd(StartupStage stage);
+
+// Free-form detail printed next to a stage, e.g. whether the pipeline cache was warm. Must be a static string.
+void startupTimingSetNote(StartupStage stage, const char* note);
+
+// Logs every recorded stage and the time from the first begin to the call of this function.
+void startupTimingReport();
+
+} // namespace memviz
@@ -0,0 +1,74 @@
+#pragma once
+
+// Saved allocation traces. A trace is a sequence of independently decodable chunks followed by an index, so a reader
+// only maps the file and looks at the footer to open it, whatever its size, and decodes just the chunks it needs.
+//
+// File layout:
+//   header:  u64 "MVZTRACE" | u32 version | u32 reserved
+//   chunks:  TraceChunkHeader | payload
+//   index:   TraceChunkEntry[chunkCount], at an 8 byte aligned offset
+//   footer:  TraceFooter
+// Payload records: u8 op | ticks | address | varint size | callsite | tid | pid. Every field except op and size is a
+// zigzag varint delta from the previous record of the same chunk, starting from zero, so no chunk depends on another.
+// Events are kept in arrival order. Different threads and processes interleave, which the signed deltas absorb, and
+// why every chunk keeps its own tick range instead of the file being strictly sorted. Addresses and call stack ids
+// only mean something within one pid.
+//
+// A file without a valid footer (the writer did not get to stop) is still readable, its index is rebuilt by walking
+// the chunk headers. So is a file whose index does not match its chunks.
+
+#include <core_types.h>
+
+#include "hook/hook_events.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 TRACE_CHUNK_EVENTS = 64 * 1024;
+constexpr u32 TRACE_WRITER_QUEUED_CHUNKS = 8;
+constexpr u32 TRACE_DECODE_MAX_THREADS = 16;
+
+struct TraceChunkEntry {
+    u64 offset;      // Of the TraceChunkHeader from the start of the file.
+    u64 minTicks;
+    u64 maxTicks;
+    u32 eventCount;
+    u32 payloadBytes;
+};
+
+struct TraceFile {
+    const u8* data;
+    addr_size size;
+    const TraceChunkEntry* chunks;
+    u32 chunkCount;
+    u64 eventCount;
+    u64* maxTicksUpTo;  // Running maximum of maxTicks, what traceFileSeek bisects.
+    TraceChunkEntry* rebuiltChunks;
+    u32 rebuiltCapacity;
+    bool recovered;     // The footer or the index was missing or damaged and the index was rebuilt.
+};
+
+// Writer. Appending only copies events, a background thread encodes full chunks and writes them.
+[[nodiscard]] bool traceWriterStart(const char* path);
+// Main thread. Waits when TRACE_WRITER_QUEUED_CHUNKS chunks are already queued, a saved trace does not drop events.
+// The events are saved with pid, whatever their own pid field holds.
+void traceWriterAppend(u32 pid, const HookEvent* events, u32 count);
+// Writes the last partial chunk, the index and the footer.
+void traceWriterStop();
+bool traceWriterIsActive();
+
+// Reader. Maps the file read-only, nothing is decoded until asked for.
+[[nodiscard]] bool traceFileOpen(const char* path, TraceFile& out);
+void traceFileClose(TraceFile& f);
+
+// Index of the first chunk that can hold events at or after ticks, chunkCount when there is none. Later chunks may
+// still hold a few older events, from threads that committed late.
+u32 traceFileSeek(const TraceFile& f, u64 ticks);
+// out needs room for the chunk's eventCount events. Returns the number decoded, 0 for a damaged chunk.
+u32 traceFileDecodeChunk(const TraceFile& f, u32 chunk, HookEvent* out);
+// Decodes [first, first + count) on up to threadCount threads into out, one chunk after the other. Damaged chunks
+// leave their slots zeroed (HookOp::NONE). Returns the number of events decoded.
+u64 traceFileDecodeChunks(const TraceFile& f, u32 first, u32 count, HookEvent* out, u32 threadCount);
+
+} // namespace memviz
@@ -0,0 +1,35 @@
+#pragma once
+
+// Viewer side copy of the memory map of the sampled process, kept current by applying the deltas of vma_sampler.h.
+// The records are sorted by start, a lookup is a binary search. Applying a delta merges it into the records in one
+// pass, the cost follows the number of VMAs and not the size of their names. Main thread only.
+
+#include <core_types.h>
+
+#include "systems/vma_sampler.h"
+
+namespace memviz {
+
+using namespace coretypes;
+
+// Read the fields directly, the arrays are owned by the index.
+struct VmaRegions {
+    VmaRecord* records;
+    u32 count;
+    u32 capacity;
+    VmaRecord* scratch; // capacity records, the next merge target.
+    char* names;        // Terminated names, records point in with nameOffset.
+    u32 namesLength;
+    u32 namesCapacity;
+    u32 deadNameBytes;  // Of removed records, compacted away once they are half of names.
+    VmaRollup rollup;
+};
+
+[[nodiscard]] bool vmaRegionsApply(VmaRegions& r, const VmaDelta& delta);
+// The VMA containing address.
+bool vmaRegionsFind(const VmaRegions& r, u64 address, VmaRecord& out);
+// Empty for anonymous mappings.
+const char* vmaRegionName(const VmaRegions& r, const VmaRecord& record);
+void vmaRegionsClear(VmaRegions& r);
+
+} // namespace memviz
@@ -0,0 +1,120 @@
+#pragma once
+
+// Background sampler of the memory map of one process: /proc/<pid>/maps for the mappings (VMAs) and smaps_rollup for
+// the totals. Stacks, mapped files, JIT code and malloc arenas never go through the allocation hooks, this is where
+// the viewer learns about them.
+//
+// Every sample is diffed against the previous one and only the changed VMAs are handed to the main thread. The diff
+// works on the raw text: lines are matched by start address and compared byte for byte, and only lines that differ
+// are fully parsed. Both files stay open and are re-read with pread into buffers reused between samples, so a steady
+// process costs two reads, a newline scan and a compare per sample and no allocations.
+//
+// The kernel formats maps on every read, about 120ns per VMA, which is nearly all of the cost: 100k VMAs at 10 Hz keep
+// the sampler thread about 12% busy, almost all of it in the kernel. smaps_rollup walks the page tables and costs with
+// the resident size, it is read on every VMA_SAMPLER_ROLLUP_EVERY-th sample only. A sample that takes more than
+// VMA_SAMPLER_MAX_DUTY_PERCENT of the period stretches the period instead of taking over a core.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr u32 VMA_SAMPLER_DEFAULT_HZ = 10;
+constexpr u32 VMA_SAMPLER_MAX_DUTY_PERCENT = 20;
+constexpr u32 VMA_SAMPLER_ROLLUP_EVERY = 10;
+
+// VmaRecord::perms bits.
+constexpr u8 VMA_READ = 1 << 0;
+constexpr u8 VMA_WRITE = 1 << 1;
+constexpr u8 VMA_EXEC = 1 << 2;
+constexpr u8 VMA_SHARED = 1 << 3;
+
+enum struct VmaKind : u8 {
+    ANON,    // Anonymous, which includes malloc arenas and thread stacks the kernel does not know as such.
+    FILE,
+    HEAP,    // [heap], the brk area.
+    STACK,   // [stack]
+    JIT,     // Anonymous and executable.
+    SPECIAL, // [vdso], [vvar], [vsyscall] and other bracketed names.
+
+    SENTINEL
+};
+
+constexpr const char* vmaKindToCStr(VmaKind kind) {
+    switch (kind) {
+        case VmaKind::ANON:    return "anon";
+        case VmaKind::FILE:    return "file";
+        case VmaKind::HEAP:    return "heap";
+        case VmaKind::STACK:   return "stack";
+        case VmaKind::JIT:     return "jit";
+        case VmaKind::SPECIAL: return "special";
+
+        case VmaKind::SENTINEL: [[fallthrough]];
+        default:
+            return "unknown";
+    }
+}
+
+struct VmaRecord {
+    u64 start;
+    u64 end;
+    u64 offset;     // Into the mapped file.
+    u64 inode;
+    u32 dev;        // major << 20 | minor, as in dev_t.
+    u32 nameOffset; // Into the names of whoever holds the record.
+    u16 nameLength; // Path or bracketed name, empty for anonymous mappings.
+    u8 perms;       // VMA_READ | VMA_WRITE | VMA_EXEC | VMA_SHARED
+    VmaKind kind;
+};
+
+// Totals of smaps_rollup, in bytes.
+struct VmaRollup {
+    u64 rss;
+    u64 pss;
+    u64 pssAnon;
+    u64 pssFile;
+    u64 sharedClean;
+    u64 sharedDirty;
+    u64 privateClean;
+    u64 privateDirty;
+    u64 anonHugePages;
+    u64 swap;
+};
+
+// One sample compared to the previous one, both record lists sorted by start. A VMA that changed in place, it grew or
+// its permissions changed, is removed and added again. The first delta adds every VMA.
+struct VmaDelta {
+    const VmaRecord* removed;
+    u32 removedCount;
+    const VmaRecord* added;
+    u32 addedCount;
+    const char* names;  // Of both lists.
+    VmaRollup rollup;   // As of the last sample that read it.
+    u32 vmaCount;       // In the sample.
+    u64 sampleNs;       // Monotonic time the sample was taken.
+    u64 sampleCostNs;   // Reading and diffing it.
+};
+
+// Main thread. The delta is only valid during the call.
+using VmaDeltaSink = void (*)(u32 pid, const VmaDelta& delta);
+// Sampler thread, right after every sample and before the main thread sees its delta. For work that follows the map,
+// like page_sampler.h, without reading it a second time.
+using VmaSampleHook = void (*)(const VmaDelta& delta);
+
+// Starts sampling pid hz times per second on a background thread.
+[[nodiscard]] bool vmaSamplerStart(u32 pid, u32 hz, VmaSampleHook onSample = nullptr);
+void vmaSamplerStop();
+bool vmaSamplerIsActive();
+
+// Main thread. Hands a pending delta to sink. The sampler skips samples while a delta is pending, so nothing is lost
+// when the main thread is slow, the next delta covers everything since the last one. Returns false when the process
+// exited and the sampler stopped.
+bool vmaSamplerUpdate(VmaDeltaSink sink);
+
+// Parsers of the two files, exposed for the region index and for tools. Both work in place and never allocate.
+// Parses one maps line, without its newline. The name is left in line, at record.nameOffset from its start.
+bool vmaParseLine(const char* line, u32 length, VmaRecord& out);
+bool vmaParseRollup(const char* text, u32 length, VmaRollup& out);
+
+} // namespace memviz
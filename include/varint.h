@@ -0,0 +1,43 @@
+#pragma once
+
+// LEB128 style variable length integers. Small values, which is what deltas usually are, take a single byte.
+
+#include <core_types.h>
+
+namespace memviz {
+
+using namespace coretypes;
+
+constexpr addr_size VARINT_MAX_BYTES = 10; // ceil(64 / 7)
+
+constexpr inline u64 zigzagEncode(i64 v) { return (u64(v) << 1) ^ u64(v >> 63); }
+constexpr inline i64 zigzagDecode(u64 v) { return i64(v >> 1) ^ -i64(v & 1); }
+
+// Writes v to out, which must have room for VARINT_MAX_BYTES. Returns the number of bytes written.
+inline addr_size varintEncode(u64 v, u8* out) {
+    addr_size n = 0;
+    while (v >= 0x80) {
+        out[n++] = u8(v) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = u8(v);
+    return n;
+}
+
+// Reads a varint from [in, end). Returns the number of bytes consumed, or 0 if the input is truncated or malformed.
+inline addr_size varintDecode(const u8* in, const u8* end, u64& out) {
+    u64 v = 0;
+    u32 shift = 0;
+    for (addr_size n = 0; n < VARINT_MAX_BYTES && in + n < end; n++) {
+        u8 b = in[n];
+        v |= u64(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            out = v;
+            return n + 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+} // namespace memviz
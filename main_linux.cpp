@@ -1,14 +1,54 @@
 #include "basic.h"
 
 #include "platform.h"
+#include "systems/address_pyramid.h"
+#include "systems/allocators.h"
+#include "systems/block_benchmark.h"
+#include "systems/curve_layout.h"
+#include "systems/heap_view.h"
+#include "systems/hook_ingest.h"
+#include "systems/input_recorder.h"
+#include "systems/interval_index.h"
 #include "systems/logger.h"
+#include "systems/page_sampler.h"
+#include "systems/profiler.h"
 #include "systems/renderer/renderer.h"
+#include "systems/stack_table.h"
+#include "systems/startup_timing.h"
+#include "systems/trace_file.h"
+#include "systems/vma_regions.h"
+#include "systems/vma_sampler.h"
 #include <error.h>
 
+#include <cstdlib>
+#include <thread>
+
 using namespace memviz;
 
 
 bool g_appIsRunning = true;
+bool g_needsRedraw = true;
+u32 g_windowWidth = 1280;
+u32 g_windowHeight = 720;
+
+constexpr u64 FRAME_INTERVAL_NS = 16'666'667; // ~60 fps while something is changing on screen.
+constexpr u32 MOUSE_MOVE_LOGS_PER_SECOND = 30;
+constexpr u32 PROFILER_EXPORT_KEY = 0xFFC9; // XK_F12
+constexpr u32 HEAP_OVERLAY_KEY = 0xFFBF; // XK_F2
+constexpr const char* PROFILER_DEFAULT_TRACE_PATH = "memviz_trace.json";
+
+// Blocks of the process loaded from the trace or else the first one that connected, the address spaces of different
+// processes overlap.
+IntervalIndex g_liveBlocks = {};
+AddressPyramid g_livePyramid = {};
+u32 g_liveBlocksPid = 0;
+StackTable g_liveStacks = {};
+// The memory map of the same process, 0 Hz turns the sampler off.
+VmaRegions g_liveRegions = {};
+u32 g_vmaSampleHz = VMA_SAMPLER_DEFAULT_HZ;
+// Its pages, sampled on the VMA sampler thread.
+u32 g_pageSampleHz = PAGE_SAMPLER_DEFAULT_HZ;
+u64 g_pageGeneration = 0;
 
 void registerEventHandlers() {
     Platform::registerWindowCloseCallback([]() {
@@ -17,60 +57,431 @@ void registerEventHandlers() {
     });
     Platform::registerWindowResizeCallback([](i32 w, i32 h) {
         logInfoTagged(USER_INPUT_TAG, "EVENT: WINDOW_RESIZE (w={}, h={})", w, h);
-        // Renderer::resizeTarget(w, h);
+        g_needsRedraw = true;
+        g_windowWidth = w > 0 ? u32(w) : 0;
+        g_windowHeight = h > 0 ? u32(h) : 0;
+        Renderer::resizeTarget(w, h);
     });
     Platform::registerWindowFocusCallback([](bool focus) {
         if (focus) logInfoTagged(USER_INPUT_TAG, "EVENT: WINDOW_FOCUS_GAINED");
         else       logInfoTagged(USER_INPUT_TAG, "EVENT: WINDOW_FOCUS_LOST");
     });
     Platform::registerKeyCallback([](u32 vkcode, u32 scancode, bool isPress, KeyboardModifiers mods) {
-        logTraceTagged(USER_INPUT_TAG, "EVENT: KEY_{} (vkcode={}, scancode={}, mods={})",
-                       isPress ? "PRESS" : "RELEASE", vkcode, scancode, keyModifiersToCptr(mods));
+        logTraceTaggedAsync(USER_INPUT_TAG, "EVENT: KEY_{} (vkcode={}, scancode={}, mods={})",
+                            isPress ? "PRESS" : "RELEASE", vkcode, scancode, keyModifiersToCptr(mods));
+
+        if (isPress && vkcode == PROFILER_EXPORT_KEY) {
+            const char* path = std::getenv("MEMVIZ_TRACE");
+            [[maybe_unused]] bool ok = profilerExport(path ? path : PROFILER_DEFAULT_TRACE_PATH);
+        }
+        if (isPress && vkcode == HEAP_OVERLAY_KEY && heapViewIsActive()) {
+            if (!pageSamplerIsActive()) {
+                logInfoTagged(USER_INPUT_TAG, "No pages are sampled, the heap view has no overlay");
+                return;
+            }
+            u8 next = (u8(heapViewOverlay()) + 1) % u8(HeapOverlay::SENTINEL);
+            heapViewSetOverlay(HeapOverlay(next), pageSamplerSummarize);
+            g_needsRedraw = true;
+        }
     });
     Platform::registerMouseClickCallback([](MouseButton button, bool isPress, i32 x, i32 y, KeyboardModifiers mods) {
-        logTraceTagged(USER_INPUT_TAG, "EVENT: MOUSE_{} (button={}, x={}, y={}, mods={})",
-                       isPress ? "PRESS" : "RELEASE", button, x, y, keyModifiersToCptr(mods));
+        logTraceTaggedAsync(USER_INPUT_TAG, "EVENT: MOUSE_{} (button={}, x={}, y={}, mods={})",
+                            isPress ? "PRESS" : "RELEASE", button, x, y, keyModifiersToCptr(mods));
+
+        if (!isPress || button != MouseButton::LEFT) return;
+
+        // address stays 0 outside the heap view.
+        u64 address = 0;
+        LiveBlock block;
+        if (heapViewPick(g_liveBlocks, x, y, g_windowWidth, g_windowHeight, address, block)) {
+            logInfo("Picked {}: block {} of {} bytes, callsite {}, tid {}",
+                    address, block.address, block.size, block.callsite, block.tid);
+            const u64* frames = nullptr;
+            u32 depth = stackTableGet(g_liveStacks, block.callsite, frames);
+            for (u32 i = 0; i < depth; i++) logInfo("    #{} {}", i, frames[i]);
+        }
+        VmaRecord vma;
+        if (address != 0 && vmaRegionsFind(g_liveRegions, address, vma)) {
+            logInfo("Picked {}: {} mapping {}-{} {}", address, vmaKindToCStr(vma.kind), vma.start, vma.end,
+                    vmaRegionName(g_liveRegions, vma));
+        }
+        PageCell page;
+        if (address != 0 && pageSamplerSummarize(address, 1, &page, 1) > 0) {
+            logInfo("Picked {}: page {}{}, written in {} of the last {} intervals", address,
+                    page.resident ? "resident" : "not resident", page.swapped ? " (swapped)" : "", page.writes,
+                    PAGE_SAMPLER_HISTORY);
+        }
     });
     Platform::registerMouseMoveCallback([](i32 x, i32 y) {
-        // very noisy
-        logTraceTagged(USER_INPUT_TAG, "EVENT: MOUSE_MOVE (x={}, y={})", x, y);
+        // very noisy, one call per MotionNotify
+        logTraceTaggedLimited(MOUSE_MOVE_LOGS_PER_SECOND, USER_INPUT_TAG, "EVENT: MOUSE_MOVE (x={}, y={})", x, y);
     });
     Platform::registerMouseScrollCallback([](MouseScrollDirection direction, i32 x, i32 y) {
-        logTraceTagged(USER_INPUT_TAG, "EVENT: MOUSE_SCROLL (direction={}, x={}, y={})", direction, x, y);
+        logTraceTaggedAsync(USER_INPUT_TAG, "EVENT: MOUSE_SCROLL (direction={}, x={}, y={})", direction, x, y);
+
+        if (heapViewIsActive() && direction != MouseScrollDirection::NONE) {
+            heapViewZoom(x, y, g_windowWidth, g_windowHeight, direction == MouseScrollDirection::UP);
+            g_needsRedraw = true;
+        }
     });
     Platform::registerMouseEnterOrLeaveCallback([](bool enter) {
-        if (enter) logTraceTagged(USER_INPUT_TAG, "EVENT: MOUSE_ENTER");
-        else       logTraceTagged(USER_INPUT_TAG, "EVENT: MOUSE_LEAVE");
+        if (enter) logTraceTaggedAsync(USER_INPUT_TAG, "EVENT: MOUSE_ENTER");
+        else       logTraceTaggedAsync(USER_INPUT_TAG, "EVENT: MOUSE_LEAVE");
     });
 
     logInfo("Registered event handlers SUCCESSFULLY");
 }
 
-int main(int, const char**) {
+// The page sampler needs the VMA sampler, it runs as its hook.
+bool startSampling(u32 pid) {
+    if (g_vmaSampleHz == 0) return false;
+    if (g_pageSampleHz > 0 && !pageSamplerStart(pid, g_pageSampleHz)) {
+        logWarnTagged(INGEST_TAG, "Not sampling the pages of {}", pid);
+    }
+    if (!vmaSamplerStart(pid, g_vmaSampleHz, pageSamplerIsActive() ? pageSamplerOnSample : nullptr)) {
+        pageSamplerStop();
+        return false;
+    }
+    return true;
+}
+
+void onHookEvents(u32 pid, const HookEvent* events, u32 count) {
+    if (traceWriterIsActive()) traceWriterAppend(pid, events, count);
+
+    if (g_liveBlocksPid == 0) {
+        g_liveBlocksPid = pid;
+        if (g_vmaSampleHz > 0 && !vmaSamplerIsActive() && !startSampling(pid)) {
+            logWarnTagged(INGEST_TAG, "Not sampling the VMAs of {}", pid);
+        }
+    }
+    if (pid == g_liveBlocksPid && !stackTableApply(g_liveStacks, events, count)) {
+        logErrTaggedLimited(1, INGEST_TAG, "Out of memory for the call stacks");
+    }
+    if (pid == g_liveBlocksPid &&
+        !intervalIndexApply(g_liveBlocks, events, count, addressPyramidOnChange, &g_livePyramid)) {
+        logErrTaggedLimited(1, INGEST_TAG, "Out of memory for the live block index");
+    }
+    if (pid == g_liveBlocksPid) heapViewMarkDirty();
+    g_needsRedraw = true;
+}
+
+void onVmaDelta(u32, const VmaDelta& delta) {
+    if (!vmaRegionsApply(g_liveRegions, delta)) {
+        logErrTaggedLimited(1, INGEST_TAG, "Out of memory for the VMA regions");
+        return;
+    }
+    logTraceTaggedLimited(1, INGEST_TAG, "VMAs: {} (+{} -{}), rss {} pss {} in {}us", delta.vmaCount,
+                          delta.addedCount, delta.removedCount, delta.rollup.rss, delta.rollup.pss,
+                          delta.sampleCostNs / 1000);
+}
+
+// Loads the events of one process, pid 0 picks the first one in the trace. Sets g_liveBlocksPid to it.
+bool loadLiveBlocks(const TraceFile& trace, u32 pid) {
+    if (trace.eventCount == 0) return true;
+
+    auto& allocator = core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID));
+    HookEvent* events = reinterpret_cast<HookEvent*>(allocator.alloc(trace.eventCount, sizeof(HookEvent)));
+    if (!events) {
+        logErr("Out of memory for the {} events of the trace", trace.eventCount);
+        return false;
+    }
+    defer { allocator.free(events, trace.eventCount, sizeof(HookEvent)); };
+
+    // Damaged chunks leave HookOp::NONE events behind, which the build skips.
+    u32 threads = std::thread::hardware_concurrency();
+    traceFileDecodeChunks(trace, 0, trace.chunkCount, events, threads > 0 ? threads : 1);
+
+    // Address spaces and stack ids of different processes overlap, only one of them can be shown.
+    u64 kept = 0;
+    u64 skipped = 0;
+    for (u64 i = 0; i < trace.eventCount; i++) {
+        if (events[i].op == HookOp::NONE) continue;
+        if (pid == 0) pid = events[i].pid;
+        if (events[i].pid == pid) events[kept++] = events[i];
+        else                      skipped++;
+    }
+    if (kept == 0 && pid != 0) {
+        logErr("The trace holds no events of process {}", pid);
+        return false;
+    }
+    if (skipped > 0) {
+        logWarn("Showing process {} of the trace, skipped {} events of other processes (choose one with --trace-pid)",
+                pid, skipped);
+    }
+    g_liveBlocksPid = pid;
+
+    if (!stackTableApply(g_liveStacks, events, kept) ||
+        !intervalIndexBuild(g_liveBlocks, events, kept) ||
+        !addressPyramidBuild(g_livePyramid, g_liveBlocks)) {
+        logErr("Out of memory for the live blocks of the trace");
+        return false;
+    }
+    return true;
+}
+
+struct CommandLineArgs {
+    const char* recordInputPath = nullptr;
+    const char* replayInputPath = nullptr;
+    const char* hookSocketPath = nullptr;
+    const char* saveTracePath = nullptr;
+    const char* openTracePath = nullptr;
+    u32 tracePid = 0;
+    InputReplaySpeed replaySpeed = InputReplaySpeed::ORIGINAL;
+    CurveKind curve = CurveKind::HILBERT;
+    u64 vkHostMemoryCapBytes = 0;
+    u32 benchBlocks = 0;
+    u32 samplePid = 0;
+    u32 vmaSampleHz = VMA_SAMPLER_DEFAULT_HZ;
+    u32 pageSampleHz = PAGE_SAMPLER_DEFAULT_HZ;
+    bool heatmap = false;
+    bool snakeLayout = false;
+};
+
+CommandLineArgs parseCommandLine(i32 argc, const char** argv) {
+    CommandLineArgs ret;
+
+    for (i32 i = 1; i < argc; i++) {
+        auto isArg = [&](const char* name) {
+            return core::cstrLen(argv[i]) == core::cstrLen(name) &&
+                   core::memcmp(argv[i], name, core::cstrLen(name)) == 0;
+        };
+
+        if (isArg("--record-input") && i + 1 < argc) {
+            ret.recordInputPath = argv[++i];
+        }
+        else if (isArg("--replay-input") && i + 1 < argc) {
+            ret.replayInputPath = argv[++i];
+        }
+        else if (isArg("--hook-socket") && i + 1 < argc) {
+            ret.hookSocketPath = argv[++i];
+        }
+        else if (isArg("--save-trace") && i + 1 < argc) {
+            ret.saveTracePath = argv[++i];
+        }
+        else if (isArg("--open-trace") && i + 1 < argc) {
+            ret.openTracePath = argv[++i];
+        }
+        else if (isArg("--trace-pid") && i + 1 < argc) {
+            ret.tracePid = u32(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (isArg("--replay-fast")) {
+            ret.replaySpeed = InputReplaySpeed::AS_FAST_AS_POSSIBLE;
+        }
+        else if (isArg("--bench-blocks") && i + 1 < argc) {
+            ret.benchBlocks = u32(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (isArg("--sample-pid") && i + 1 < argc) {
+            ret.samplePid = u32(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (isArg("--vma-hz") && i + 1 < argc) {
+            ret.vmaSampleHz = u32(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (isArg("--page-hz") && i + 1 < argc) {
+            ret.pageSampleHz = u32(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (isArg("--heatmap")) {
+            ret.heatmap = true;
+        }
+        else if (isArg("--snake-layout")) {
+            ret.snakeLayout = true;
+        }
+        else if (isArg("--curve") && i + 1 < argc) {
+            i++;
+            ret.curve = CurveKind::SENTINEL;
+            for (u32 k = 0; k < u32(CurveKind::SENTINEL); k++) {
+                const char* name = curveKindToCStr(CurveKind(k));
+                if (core::cstrLen(argv[i]) == core::cstrLen(name) &&
+                    core::memcmp(argv[i], name, core::cstrLen(name)) == 0) {
+                    ret.curve = CurveKind(k);
+                }
+            }
+            if (ret.curve == CurveKind::SENTINEL) {
+                logWarn("Unknown curve '{}', using {}", argv[i], curveKindToCStr(CurveKind::HILBERT));
+                ret.curve = CurveKind::HILBERT;
+            }
+        }
+        else if (isArg("--vk-host-mem-cap-mb") && i + 1 < argc) {
+            ret.vkHostMemoryCapBytes = u64(std::strtoull(argv[++i], nullptr, 10)) * 1024 * 1024;
+        }
+        else {
+            logWarn("Ignoring unknown command line argument '{}'", argv[i]);
+        }
+    }
+
+    return ret;
+}
+
+int main(i32 argc, const char** argv) {
     basicInit();
     defer { basicShutdown(); };
 
+    CommandLineArgs args = parseCommandLine(argc, argv);
+
     loggerSystemSetLogLevelToTrace();
 
+    startupTimingBegin(StartupStage::PLATFORM_INIT);
     Error initErr = Platform::init("Example", 1280, 720);
     Assert(initErr == Error::OK);
+    startupTimingEnd(StartupStage::PLATFORM_INIT);
     defer { Platform::shutdown(); };
 
     Renderer::CrateInfo rinfo = {};
     rinfo.appName = "Example";
+    rinfo.hostMemoryCapBytes = args.vkHostMemoryCapBytes;
     Error renderInit = Renderer::init(std::move(rinfo));
     Assert(renderInit == Error::OK);
     defer { Renderer::shutdown(); };
 
+    if (args.heatmap) {
+        Renderer::setBlockDrawMode(BlockDrawMode::HEATMAP);
+    }
+
+    startupTimingReport();
+
     registerEventHandlers();
 
+    // A bad path on the command line is not a bug, the failing start already logged why.
+    if (args.recordInputPath && !inputRecorderStart(args.recordInputPath)) {
+        return 1;
+    }
+    defer { inputRecorderStop(); };
+
+    if (args.replayInputPath && !inputReplayStart(args.replayInputPath, args.replaySpeed)) {
+        return 1;
+    }
+    defer { inputReplayStop(); };
+
+    defer {
+        addressPyramidClear(g_livePyramid);
+        intervalIndexClear(g_liveBlocks);
+        vmaRegionsClear(g_liveRegions);
+        stackTableClear(g_liveStacks);
+    };
+
+    if (args.openTracePath) {
+        u64 startNs = Platform::getMonotonicTimeNs();
+        TraceFile trace;
+        if (!traceFileOpen(args.openTracePath, trace)) {
+            return 1;
+        }
+        defer { traceFileClose(trace); };
+        logInfo("Opened '{}' in {}us: {} events in {} chunks{}", args.openTracePath,
+                (Platform::getMonotonicTimeNs() - startNs) / 1000, trace.eventCount, trace.chunkCount,
+                trace.recovered ? " (index rebuilt)" : "");
+
+        startNs = Platform::getMonotonicTimeNs();
+        if (!loadLiveBlocks(trace, args.tracePid)) {
+            return 1;
+        }
+        logInfo("Loaded {} live blocks ({} bytes, {} summary bins, {} call stacks) in {}us", g_liveBlocks.count,
+                g_liveBlocks.liveBytes, g_livePyramid.binCount, g_liveStacks.count,
+                (Platform::getMonotonicTimeNs() - startNs) / 1000);
+    }
+
+    if (args.saveTracePath && !traceWriterStart(args.saveTracePath)) {
+        return 1;
+    }
+    // Runs after the ingest shut down, nothing appends anymore by then.
+    defer { traceWriterStop(); };
+
+    if (args.hookSocketPath && !hookIngestListen(args.hookSocketPath)) {
+        return 1;
+    }
+    defer { hookIngestShutdown(); };
+
+    // A hooked process is sampled once it connects, --sample-pid samples any process without the hook.
+    g_vmaSampleHz = args.vmaSampleHz;
+    g_pageSampleHz = args.pageSampleHz;
+    if (args.samplePid != 0 && !startSampling(args.samplePid)) {
+        // A zero rate or a process that is gone, neither is a bug.
+        logErrTagged(INGEST_TAG, "Can not sample the VMAs of {}", args.samplePid);
+        return 1;
+    }
+    // Runs after the VMA sampler stopped, its thread calls into the page sampler.
+    defer { pageSamplerStop(); };
+    defer { vmaSamplerStop(); };
+
+    // The live blocks of a trace or a hooked process, unless the benchmark owns the block layers.
+    if (args.benchBlocks == 0 && (args.openTracePath || args.hookSocketPath) && !heapViewStart(args.curve)) {
+        return 1;
+    }
+    defer { heapViewStop(); };
+
+    // A benchmark run draws as fast as the swapchain allows. Pair it with MEMVIZ_HEADLESS_FRAMES to get a fixed length.
+    u64 frameIntervalNs = FRAME_INTERVAL_NS;
+    if (args.benchBlocks > 0) {
+        blockBenchmarkStart(args.benchBlocks, args.snakeLayout ? BlockLayout::SNAKE : BlockLayout::ROWS);
+        frameIntervalNs = 0;
+    }
+
+    u64 lastFrameNs = 0;
     while (g_appIsRunning) {
+        MEMVIZ_ZONE("main loop");
+        allocatorsBeginFrame();
+
+        // Sleep until input arrives, an ingest thread calls Platform::wakeUp, or the next frame is due. Nothing to
+        // redraw means no deadline, so an idle viewer does not burn any CPU.
+        if (blockBenchmarkIsActive()) {
+            blockBenchmarkUpdate();
+            g_needsRedraw = true;
+        }
+
+        u64 deadlineNs = 0;
+        if (g_needsRedraw) {
+            deadlineNs = lastFrameNs + frameIntervalNs;
+            if (deadlineNs == 0) deadlineNs = 1; // 0 means no deadline, a pending redraw always has one
+        }
+        if (inputReplayIsActive()) {
+            u64 replayDeadlineNs = inputReplayNextDeadlineNs();
+            if (replayDeadlineNs != 0 && (deadlineNs == 0 || replayDeadlineNs < deadlineNs)) deadlineNs = replayDeadlineNs;
+        }
+        {
+            MEMVIZ_ZONE("Platform::waitEvents");
+            if (Error err = Platform::waitEvents(deadlineNs); err != Error::OK) {
+                logFatal("waitEvents failed with err={}", errToCStr(err));
+                break;
+            }
+        }
+
+        if (hookIngestIsActive()) {
+            hookIngestUpdate(onHookEvents);
+        }
+
+        // The page sampler runs on the VMA sampler's thread, it goes when the process does. A later process can then
+        // start both again.
+        if (vmaSamplerIsActive() && !vmaSamplerUpdate(onVmaDelta)) {
+            pageSamplerStop();
+        }
+
+        if (pageSamplerIsActive() && heapViewOverlay() != HeapOverlay::NONE) {
+            u64 generation = pageSamplerStats().generation;
+            if (generation != g_pageGeneration) {
+                g_pageGeneration = generation;
+                heapViewMarkOverlayDirty();
+                g_needsRedraw = true;
+            }
+        }
+
+        if (inputReplayIsActive() && !inputReplayUpdate(Platform::getMonotonicTimeNs())) {
+            // A replay run ends with the recording, so frame timings of different builds cover the same session.
+            inputReplayStop();
+            PlatformEvent closeEv = {};
+            closeEv.type = PlatformEventType::WINDOW_CLOSE;
+            Platform::pushEvent(closeEv);
+        }
+
         if (Error err = Platform::pollEvents(); err != Error::OK) {
             logFatal("pollEvents failed with err={}", errToCStr(err));
             break;
         }
 
-        // Renderer::drawFrame();
+        u64 nowNs = Platform::getMonotonicTimeNs();
+        if (g_needsRedraw && nowNs >= lastFrameNs + frameIntervalNs) {
+            bool uploadPending = heapViewUpdate(g_liveBlocks, g_livePyramid);
+            Renderer::drawFrame();
+            g_needsRedraw = uploadPending;
+            lastFrameNs = nowNs;
+        }
     }
 
     return 0;
@@ -0,0 +1,16 @@
+#version 450
+
+layout(location = 0) flat in uint inCategory;
+layout(location = 0) out vec4 outColor;
+
+// Keep in sync with BLOCK_CATEGORY_COUNT in renderer.h.
+const vec3 PALETTE[16] = vec3[](
+    vec3(0.90, 0.30, 0.25), vec3(0.25, 0.60, 0.90), vec3(0.35, 0.80, 0.40), vec3(0.95, 0.75, 0.20),
+    vec3(0.65, 0.40, 0.85), vec3(0.20, 0.80, 0.75), vec3(0.95, 0.50, 0.15), vec3(0.85, 0.35, 0.60),
+    vec3(0.55, 0.75, 0.25), vec3(0.40, 0.45, 0.95), vec3(0.80, 0.60, 0.45), vec3(0.30, 0.70, 0.55),
+    vec3(0.90, 0.85, 0.50), vec3(0.60, 0.30, 0.40), vec3(0.50, 0.55, 0.60), vec3(0.75, 0.75, 0.80)
+);
+
+void main() {
+    outColor = vec4(PALETTE[inCategory % 16u], 1.0);
+}
@@ -0,0 +1,67 @@
+#version 450
+
+// One instance per allocation block, 6 vertices per instance. The block is placed on a row-major address grid: the
+// granule offset relative to the view start picks the row and the column, the size gives the width. Blocks are clipped
+// at the end of their row.
+//
+// The squares layout has no rows: the offset is a cell of a rowCount by rowCount grid, x in the low and y in the high
+// 16 bits, and the size is the side of a square of cells. The heap view places blocks along a space filling curve.
+//
+// The layout variant is a specialization constant, so each variant is its own pipeline with the branch folded away.
+// Keep in sync with BlockLayout in renderer.h.
+layout(constant_id = 0) const uint BLOCK_LAYOUT = 0;
+const uint LAYOUT_ROWS = 0;  // Every row runs left to right.
+const uint LAYOUT_SNAKE = 1; // Odd rows run right to left, so consecutive addresses stay adjacent across row ends.
+const uint LAYOUT_SQUARES = 2; // Squares of grid cells, see above. viewStart and granulesPerRow are unused.
+
+layout(location = 0) in uvec3 inBlock; // offset, size, category
+
+layout(push_constant) uniform PushConstants {
+    uint viewStart;      // First visible granule of this layer.
+    uint granulesPerRow;
+    uint rowCount;
+    uint layer;
+    float minWidthNdc;   // Blocks narrower than a pixel are widened to stay visible.
+} pc;
+
+layout(location = 0) flat out uint outCategory;
+
+const vec2 CORNERS[6] = vec2[](
+    vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+    vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+);
+
+void main() {
+    outCategory = inBlock.z;
+    vec2 c = CORNERS[gl_VertexIndex % 6];
+
+    if (BLOCK_LAYOUT == LAYOUT_SQUARES) {
+        float cell = 2.0 / float(pc.rowCount);
+        float x0 = float(inBlock.x & 0xFFFFu) * cell - 1.0;
+        float y0 = float(inBlock.x >> 16) * cell - 1.0;
+        float side = max(float(inBlock.y) * cell, pc.minWidthNdc);
+        gl_Position = vec4(x0 + c.x * side, y0 + c.y * side, 0.0, 1.0);
+        return;
+    }
+
+    uint rel = inBlock.x - pc.viewStart; // wraps for blocks before the view
+    uint row = rel / pc.granulesPerRow;
+    if (inBlock.x < pc.viewStart || row >= pc.rowCount) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // outside the clip volume
+        return;
+    }
+
+    uint col = rel - row * pc.granulesPerRow;
+    uint width = min(inBlock.y, pc.granulesPerRow - col);
+
+    float x0 = float(col) / float(pc.granulesPerRow) * 2.0 - 1.0;
+    float w = max(float(width) / float(pc.granulesPerRow) * 2.0, pc.minWidthNdc);
+    float y0 = float(row) / float(pc.rowCount) * 2.0 - 1.0;
+    float h = 2.0 / float(pc.rowCount);
+
+    if (BLOCK_LAYOUT == LAYOUT_SNAKE && (row & 1u) == 1u) {
+        x0 = -x0 - w; // mirrored around the center
+    }
+
+    gl_Position = vec4(x0 + c.x * w, y0 + c.y * h, 0.0, 1.0);
+}
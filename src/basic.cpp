@@ -1,6 +1,8 @@
 #include "basic.h"
 
+#include "systems/allocators.h"
 #include "systems/logger.h"
+#include "systems/profiler.h"
 
 #include <iostream>
 #include <stdexcept>
@@ -14,6 +16,9 @@ core::ArrStatic<i32, 64> g_ignoredTags;
 void assertHandler(const char* failedExpr, const char* file, i32 line, const char* funcName, const char* errMsg) {
     // Using iostream here since assertions can happen inside core as well.
 
+    // Whatever was logged asynchronously before the failure is usually what explains it.
+    asyncLoggerFlush();
+
     // Get a stack trace of at max 200 stack frames, skipping the first 2. The first stack frame is this assert handler
     // frame and the second is the function itself, for which we already have information.
     constexpr u32 stackFramesToSkip = 2;
@@ -49,16 +54,21 @@ void assertHandler(const char* failedExpr, const char* file, i32 line, const cha
 } // namespace
 
 void basicInit() {
-    // TODO: Add a comprehensive way to set the default allocator and register allocators.
+    // Before anything allocates, so every allocation is accounted to a named allocator.
+    allocatorsRegister();
 
     auto loggerInfo = loggerSystemCreateInfo();
     core::initProgramCtx(assertHandler, &loggerInfo);
 
     loggerSystemInit();
+    profilerInit();
 }
 
 void basicShutdown() {
+    profilerShutdown();
+    allocatorsLogStats();
     loggerSystemShutdown();
+    allocatorsShutdown();
 }
 
 } // memviz
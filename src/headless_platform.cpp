@@ -0,0 +1,206 @@
+#include "platform.h"
+
+#include "basic.h"
+#include "error.h"
+
+#include "systems/logger.h"
+#include "systems/profiler.h"
+#include "linux_event_waiter.h"
+#include "platform_events.h"
+
+#include <stdlib.h>
+
+#if defined(MEMVIZ_USE_VULKAN)
+#include "systems/renderer/vulkan_backend.h"
+#endif
+
+// Offscreen-only platform backend. There is no window and no display connection; the framebuffer size is whatever the
+// last resize event said it is and all input comes from Platform::pushEvent. Used for benchmarks and batch rendering
+// on machines without an X server.
+//
+// Environment:
+//   MEMVIZ_HEADLESS_FRAMES - if set to N > 0, a WINDOW_CLOSE event is emitted on the N-th pollEvents call.
+
+namespace memviz {
+
+namespace {
+
+[[maybe_unused]] bool g_initialized = false; // Probably won't use this in release builds.
+
+u32 g_frameBufferWidth = 0;
+u32 g_frameBufferHeight = 0;
+
+u64 g_pollCount = 0;
+u64 g_closeAfterPolls = 0;
+
+u64 readEnvU64(const char* name) {
+    const char* v = getenv(name);
+    if (!v) return 0;
+    return u64(strtoull(v, nullptr, 10));
+}
+
+} // namespace
+
+Error Platform::init(const char* windowTitle, i32 windowWidth, i32 windowHeight) {
+    logInfoTagged(
+        LogTag::PLATFORM_TAG,
+        "Starting headless platform initialization: title='{}', width={}, height={}",
+        windowTitle, windowWidth, windowHeight
+    );
+
+    if (Error err = linuxEventWaiterInit(-1); err != Error::OK) {
+        return err;
+    }
+
+    g_closeAfterPolls = readEnvU64("MEMVIZ_HEADLESS_FRAMES");
+    g_pollCount = 0;
+    g_initialized = true;
+
+    // Emit what a window manager would send right after mapping a window, so the rest of the application goes through
+    // the same startup path it does with a real window.
+    PlatformEvent ev = {};
+    ev.type = PlatformEventType::WINDOW_RESIZE;
+    ev.timeMs = u32(linuxMonotonicNowNs() / 1'000'000);
+    ev.resize.w = windowWidth;
+    ev.resize.h = windowHeight;
+    Platform::pushEvent(ev);
+
+    ev = {};
+    ev.type = PlatformEventType::WINDOW_FOCUS;
+    ev.timeMs = u32(linuxMonotonicNowNs() / 1'000'000);
+    ev.focus.gain = true;
+    Platform::pushEvent(ev);
+
+    logInfoTagged(LogTag::PLATFORM_TAG, "Headless platform initialization completed successfully");
+
+    return Error::OK;
+}
+
+void Platform::shutdown() {
+    g_initialized = false;
+
+    PlatformEventStats stats = Platform::getEventStats();
+    logInfoTagged(
+        LogTag::PLATFORM_TAG,
+        "Event stats: received={}, dispatched={}, coalesced={}, dropped={}, batches={}, max batch={}",
+        stats.received, stats.dispatched, stats.coalesced, stats.dropped, stats.batches, stats.maxBatchSize
+    );
+
+    linuxEventWaiterShutdown();
+}
+
+Error Platform::pollEvents(bool block) {
+    Assert(g_initialized, "Platform layer not initialized");
+    MEMVIZ_ZONE("Platform::pollEvents");
+
+    g_pollCount++;
+    if (g_closeAfterPolls > 0 && g_pollCount == g_closeAfterPolls) {
+        PlatformEvent ev = {};
+        ev.type = PlatformEventType::WINDOW_CLOSE;
+        ev.timeMs = u32(linuxMonotonicNowNs() / 1'000'000);
+        Platform::pushEvent(ev);
+    }
+
+    if (block && platformEventRingEmpty()) {
+        // Only a wake-up can produce new events here.
+        if (Error err = linuxEventWaiterWait(0); err != Error::OK) {
+            return err;
+        }
+    }
+
+    platformEventRingFlush(0);
+
+    return Error::OK;
+}
+
+void Platform::pushEvent(const PlatformEvent& ev) {
+    // There is no window to ask, so the framebuffer follows the resize events.
+    if (ev.type == PlatformEventType::WINDOW_RESIZE) {
+        g_frameBufferWidth = u32(ev.resize.w);
+        g_frameBufferHeight = u32(ev.resize.h);
+    }
+
+    platformEventRingPush(ev);
+}
+
+Error Platform::waitEvents(u64 deadlineNs) {
+    Assert(g_initialized, "Platform layer not initialized");
+
+    // Runs bounded by MEMVIZ_HEADLESS_FRAMES are benchmarks, they should never sleep.
+    if (!platformEventRingEmpty() || g_closeAfterPolls > 0) {
+        return Error::OK;
+    }
+
+    return linuxEventWaiterWait(deadlineNs);
+}
+
+void Platform::wakeUp() { linuxEventWaiterWakeUp(); }
+bool Platform::watchFd(i32 fd) { return linuxEventWaiterWatchFd(fd); }
+void Platform::unwatchFd(i32 fd) { linuxEventWaiterUnwatchFd(fd); }
+u64 Platform::getMonotonicTimeNs() { return linuxMonotonicNowNs(); }
+
+void Platform::requiredVulkanExtsCount(i32& count) {
+    count = 1;
+}
+
+void Platform::requiredVulkanExts([[maybe_unused]] const char** extensions) {
+#if defined(MEMVIZ_USE_VULKAN)
+    extensions[0] = VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME;
+#endif
+}
+
+Error Platform::createVulkanSurface([[maybe_unused]] VkInstance instance,
+                                     [[maybe_unused]] const VkAllocationCallbacks* allocator,
+                                     [[maybe_unused]] VkSurfaceKHR& outSurface) {
+#if defined(MEMVIZ_USE_VULKAN)
+    Assert(g_initialized, "Platform Layer needs to be initialized");
+
+    auto createFn = reinterpret_cast<PFN_vkCreateHeadlessSurfaceEXT>(
+        vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT"));
+    if (createFn == nullptr) {
+        return Error::FAILED_TO_CREATE_HEADLESS_SURFACE;
+    }
+
+    VkHeadlessSurfaceCreateInfoEXT createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+
+    VkResult vres = createFn(instance, &createInfo, allocator, &outSurface);
+    if (vres != VK_SUCCESS) {
+        return Error::FAILED_TO_CREATE_HEADLESS_SURFACE;
+    }
+#endif
+
+    return Error::OK;
+}
+
+bool Platform::getFrameBufferSize(u32& width, u32& height) {
+    Assert(g_initialized, "Platform Layer needs to be initialized");
+
+    width = g_frameBufferWidth;
+    height = g_frameBufferHeight;
+    return true;
+}
+
+// Software framebuffers are plain memory here. Presenting shows nothing, the renderer still does all of its work.
+
+bool Platform::createSoftwareFramebuffer(u32 width, u32 height, SoftwareFramebuffer& out) {
+    out = {};
+    u32* pixels = reinterpret_cast<u32*>(malloc(addr_size(width) * addr_size(height) * sizeof(u32)));
+    if (!pixels) return false;
+
+    out.pixels = pixels;
+    out.width = width;
+    out.height = height;
+    out.stride = width;
+    return true;
+}
+
+void Platform::destroySoftwareFramebuffer(SoftwareFramebuffer& fb) {
+    free(fb.pixels);
+    fb = {};
+}
+
+void Platform::presentSoftwareFramebuffer(SoftwareFramebuffer&) {}
+void Platform::waitSoftwareFramebuffer(SoftwareFramebuffer&) {}
+
+} // namespace memviz
@@ -0,0 +1,985 @@
+// libmemviz_hook.so, the allocation interposer loaded into a target process:
+//
+//   LD_PRELOAD=/path/to/libmemviz_hook.so MEMVIZ_HOOK_OUTPUT=/tmp/service ./service
+//
+// Every intercepted call appends a HookEvent (see hook/hook_events.h) to a buffer owned by the calling thread, so the
+// fast path never takes a lock. Full buffers go to one of two places:
+//  - With MEMVIZ_HOOK_SOCKET set, the hook connects to a listening memviz and commits batches of
+//    HOOK_TRANSPORT_BATCH_EVENTS into the shared memory rings described in hook/hook_transport.h.
+//    MEMVIZ_HOOK_BACKPRESSURE picks what happens when the viewer falls behind.
+//  - Otherwise, or when connecting fails, they are appended to "<MEMVIZ_HOOK_OUTPUT>.<pid>" (default
+//    /tmp/memviz_hook.<pid>) with a single write. The spill policy writes to the same file.
+// Thread exit and process exit flush what is left.
+//
+// Rules this file has to follow, because it runs inside someone else's malloc:
+//  - Nothing here may allocate through malloc. Buffers come from raw mmap syscalls, and core is used for types only.
+//  - Thread locals are initial-exec, so touching them never calls into the dynamic loader (which would allocate).
+//  - dlsym allocates while the real functions are being resolved. Those requests, and any made while a thread is
+//    already inside the hook, are served from a static bootstrap heap or passed straight to libc unrecorded.
+//
+// Frees are recorded before the real call and allocations after it, so an address is never handed out again before
+// its free is in some buffer.
+//
+// Every event carries the id of its call stack. Stacks are captured into a fixed size array by walking frame pointers,
+// a caller built without them gets a stack of just its return address. MEMVIZ_HOOK_UNWIND=dwarf uses _Unwind_Backtrace
+// instead, which sees through such callers but costs microseconds per call, about as much as the rest of the target.
+// MEMVIZ_HOOK_UNWIND=caller keeps only the return address. The array is hashed and interned in a lock-free table, a
+// stack seen for the first time is sent as STACK_FRAME events ahead of the event that uses it.
+
+#include "hook/hook_events.h"
+#include "hook/hook_transport.h"
+
+#include <core_macros.h>
+
+#include <atomic>
+#include <new>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <unwind.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+#define HOOK_EXPORT extern "C" __attribute__((visibility("default")))
+#define HOOK_TLS thread_local __attribute__((tls_model("initial-exec")))
+// The interposed functions are built with frame pointers, their frame holds the exact return address of the call.
+#define HOOK_FRAME __builtin_frame_address(0)
+#define HOOK_CALLSITE internCallsite(HOOK_FRAME)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 HOOK_EVENTS_PER_BUFFER = 16 * 1024; // 640 KiB per thread
+constexpr addr_size BOOTSTRAP_HEAP_SIZE = 64 * 1024;
+constexpr addr_size BOOTSTRAP_HEADER_SIZE = 16; // Keeps the size of the block, realloc needs it.
+constexpr addr_size MAX_OUTPUT_PATH = 512;
+constexpr long BACKPRESSURE_BLOCK_SLEEP_NS = 50'000;
+// Twice the stacks, so probe sequences stay short. Pages of the table are only touched when used.
+constexpr u32 STACK_TABLE_SLOTS = 2 * HOOK_STACK_MAX_STACKS;
+constexpr u32 STACK_TABLE_FULL = ~u32(0); // Slot id of a stack that found no free id.
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN HOOK STATE ---------------------------------------------------------
+
+enum HookState : u32 {
+    HOOK_UNINITIALIZED,
+    HOOK_INITIALIZING,
+    HOOK_READY,
+    HOOK_SHUT_DOWN,
+};
+
+struct RealFunctions {
+    void* (*malloc)(size_t);
+    void (*free)(void*);
+    void* (*calloc)(size_t, size_t);
+    void* (*realloc)(void*, size_t);
+    int (*posixMemalign)(void**, size_t, size_t);
+    void* (*alignedAlloc)(size_t, size_t);
+    void* (*memalign)(size_t, size_t);
+    void* (*mmap)(void*, size_t, int, int, int, off_t);
+    int (*munmap)(void*, size_t);
+};
+
+enum struct UnwindMode : u32 {
+    FRAME_POINTERS, // A caller without a frame pointer ends the stack at its return address.
+    DWARF,          // Opt-in, every call pays for the unwinder.
+    CALLER,         // Only the return address of the intercepted call.
+};
+
+// Open addressing on the stack hash. A slot is claimed by a CAS on its hash, its id is published once the frames of
+// the id are written. Stacks are never removed.
+struct StackTable {
+    std::atomic<u64>* hashes; // STACK_TABLE_SLOTS, 0 is a free slot.
+    std::atomic<u32>* ids;    // STACK_TABLE_SLOTS, 0 while the claiming thread copies the frames.
+    u64* frames;              // HOOK_STACK_MAX_DEPTH per id.
+    u8* depths;               // Per id.
+    addr_size bytes;
+    std::atomic<u32> nextId;
+};
+
+struct ThreadBuffer {
+    HookEvent* events;
+    std::atomic<u32> count;   // Published with release, the exit flush reads buffers of threads that are still running.
+    std::atomic<bool> owned;  // Buffers of exited threads are handed to new threads.
+    // Held by whoever sends the events, for good once the exit flush took the buffer.
+    std::atomic<bool> flushing;
+    u32 tid;
+    HookRing* ring;           // Transport only. Claimed by this thread, or shared when every ring is taken.
+    bool ringOwned;
+    ThreadBuffer* next;       // Buffers are never unmapped, so the list only grows to the peak thread count.
+};
+
+std::atomic<u32> g_state = HOOK_UNINITIALIZED;
+RealFunctions g_real = {};
+std::atomic<ThreadBuffer*> g_buffers = nullptr;
+pthread_key_t g_threadExitKey;
+i32 g_fd = -1;
+
+HookTransportHeader* g_transport = nullptr; // nullptr when events go to the output file.
+i32 g_socketFd = -1;
+i32 g_eventFd = -1;
+std::atomic<HookBackpressure> g_backpressure = HookBackpressure::DROP;
+// File mode writes whole buffers. The transport commits small batches so the viewer sees events promptly.
+u32 g_batchEvents = HOOK_EVENTS_PER_BUFFER;
+u64 g_batchMaxTicks = ~u64(0);
+
+UnwindMode g_unwind = UnwindMode::FRAME_POINTERS;
+StackTable g_stacks = {}; // hashes is nullptr when the table could not be mapped, every stack is unknown then.
+
+alignas(16) u8 g_bootstrapHeap[BOOTSTRAP_HEAP_SIZE];
+std::atomic<addr_size> g_bootstrapUsed = 0;
+
+HOOK_TLS ThreadBuffer* t_buffer = nullptr;
+HOOK_TLS bool t_inHook = false;
+HOOK_TLS bool t_exited = false; // Past the thread exit flush, late frees from other destructors are not recorded.
+// Bounds of the thread's stack, frame pointers outside of them are not followed. 0 until the first capture.
+HOOK_TLS u64 t_stackLow = 0;
+HOOK_TLS u64 t_stackHigh = 0;
+
+// ------------------------------------------ END HOOK STATE -----------------------------------------------------------
+
+inline u64 nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return u64(ts.tv_sec) * 1'000'000'000 + u64(ts.tv_nsec);
+}
+
+inline u64 nowTicks() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+void* rawMmap(addr_size size) {
+    void* p = (void*)syscall(SYS_mmap, nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+void writeAll(const void* data, addr_size size) {
+    const u8* bytes = reinterpret_cast<const u8*>(data);
+    while (size > 0) {
+        ssize_t n = write(g_fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // Nowhere to report it from inside the target, the events are lost.
+        bytes += n;
+        size -= addr_size(n);
+    }
+}
+
+// ------------------------------------------ BEGIN BOOTSTRAP HEAP -----------------------------------------------------
+
+inline bool isBootstrap(void* p) {
+    u8* bytes = reinterpret_cast<u8*>(p);
+    return bytes >= g_bootstrapHeap && bytes < g_bootstrapHeap + BOOTSTRAP_HEAP_SIZE;
+}
+
+// Never freed. The memory is static, so it is already zeroed for calloc.
+void* bootstrapAlloc(addr_size size, addr_size alignment) {
+    if (alignment < BOOTSTRAP_HEADER_SIZE) alignment = BOOTSTRAP_HEADER_SIZE;
+
+    addr_size used = g_bootstrapUsed.load(std::memory_order_relaxed);
+    addr_size start;
+    do {
+        start = (used + BOOTSTRAP_HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+        if (start + size > BOOTSTRAP_HEAP_SIZE) return nullptr;
+    } while (!g_bootstrapUsed.compare_exchange_weak(used, start + size, std::memory_order_relaxed));
+
+    *reinterpret_cast<addr_size*>(g_bootstrapHeap + start - BOOTSTRAP_HEADER_SIZE) = size;
+    return g_bootstrapHeap + start;
+}
+
+inline addr_size bootstrapSize(void* p) {
+    return *reinterpret_cast<addr_size*>(reinterpret_cast<u8*>(p) - BOOTSTRAP_HEADER_SIZE);
+}
+
+// ------------------------------------------ END BOOTSTRAP HEAP -------------------------------------------------------
+
+// ------------------------------------------ BEGIN THREAD BUFFERS -----------------------------------------------------
+
+// ------------------------------------------ BEGIN TRANSPORT ----------------------------------------------------------
+
+void wakeConsumer() {
+    u64 one = 1;
+    [[maybe_unused]] ssize_t n = write(g_eventFd, &one, sizeof(one));
+}
+
+bool viewerDisconnected() {
+    char c;
+    return recv(g_socketFd, &c, 1, MSG_DONTWAIT | MSG_PEEK) == 0;
+}
+
+HookRing* claimRing(u32 tid, bool& owned) {
+    for (u32 i = 0; i < HOOK_TRANSPORT_RINGS; i++) {
+        u32 expected = 0;
+        if (g_transport->rings[i].owner.compare_exchange_strong(expected, tid, std::memory_order_acq_rel)) {
+            owned = true;
+            return &g_transport->rings[i];
+        }
+    }
+
+    HookRing* ring = &g_transport->rings[tid % HOOK_TRANSPORT_RINGS];
+    ring->sharers.fetch_add(1, std::memory_order_relaxed);
+    owned = false;
+    return ring;
+}
+
+void releaseRing(ThreadBuffer* b) {
+    if (!b->ring) return;
+    if (b->ringOwned) b->ring->owner.store(0, std::memory_order_release);
+    else              b->ring->sharers.fetch_sub(1, std::memory_order_relaxed);
+    b->ring = nullptr;
+}
+
+void pushToTransport(HookRing& ring, const HookEvent* events, u32 count) {
+    for (;;) {
+        if (hookRingPush(ring, events, count) == HookRingPush::COMMITTED) {
+            if (hookTransportShouldWake(*g_transport)) wakeConsumer();
+            return;
+        }
+
+        switch (g_backpressure.load(std::memory_order_relaxed)) {
+            case HookBackpressure::BLOCK: {
+                wakeConsumer();
+                if (viewerDisconnected()) {
+                    g_backpressure.store(HookBackpressure::DROP, std::memory_order_relaxed);
+                    break;
+                }
+                timespec ts = { 0, BACKPRESSURE_BLOCK_SLEEP_NS };
+                nanosleep(&ts, nullptr);
+                continue;
+            }
+            case HookBackpressure::SPILL:
+                if (g_fd >= 0) {
+                    writeAll(events, count * sizeof(HookEvent));
+                    ring.spilled.fetch_add(count, std::memory_order_relaxed);
+                    return;
+                }
+                break;
+            case HookBackpressure::DROP: [[fallthrough]];
+            case HookBackpressure::SENTINEL:
+                break;
+        }
+
+        ring.dropped.fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+}
+
+// ------------------------------------------ END TRANSPORT ------------------------------------------------------------
+
+void sendBuffer(ThreadBuffer* b) {
+    u32 count = b->count.load(std::memory_order_acquire);
+    if (count == 0) return;
+    if (g_transport) {
+        // Buffers that were never used by a thread in transport mode have no ring, the first one takes them.
+        pushToTransport(b->ring ? *b->ring : g_transport->rings[0], b->events, count);
+    }
+    else if (g_fd >= 0) {
+        writeAll(b->events, count * sizeof(HookEvent));
+    }
+}
+
+// Owner thread. Does nothing once the exit flush took the buffer.
+void flushBuffer(ThreadBuffer* b) {
+    bool expected = false;
+    if (!b->flushing.compare_exchange_strong(expected, true, std::memory_order_acquire)) return;
+
+    sendBuffer(b);
+    b->count.store(0, std::memory_order_release);
+
+    b->flushing.store(false, std::memory_order_release);
+}
+
+// Process exit, any thread. The buffer stays taken, so an owner that is still running never resets the count or sends
+// these events again, it only appends above them until the buffer is full and then drops. A buffer its owner is
+// sending right now is left to it.
+void closeBuffer(ThreadBuffer* b) {
+    bool expected = false;
+    if (!b->flushing.compare_exchange_strong(expected, true, std::memory_order_acquire)) return;
+
+    sendBuffer(b);
+}
+
+void onThreadExit(void* p) {
+    ThreadBuffer* b = reinterpret_cast<ThreadBuffer*>(p);
+    t_inHook = true;
+    flushBuffer(b);
+    releaseRing(b);
+    t_buffer = nullptr;
+    t_exited = true;
+    b->owned.store(false, std::memory_order_release);
+    t_inHook = false;
+}
+
+ThreadBuffer* registerThread() {
+    if (t_exited) return nullptr;
+
+    ThreadBuffer* b = nullptr;
+    for (ThreadBuffer* it = g_buffers.load(std::memory_order_acquire); it; it = it->next) {
+        bool expected = false;
+        if (it->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            b = it;
+            break;
+        }
+    }
+
+    if (!b) {
+        addr_size bytes = sizeof(ThreadBuffer) + HOOK_EVENTS_PER_BUFFER * sizeof(HookEvent);
+        u8* memory = reinterpret_cast<u8*>(rawMmap(bytes));
+        if (!memory) return nullptr;
+
+        b = new (memory) ThreadBuffer();
+        b->events = reinterpret_cast<HookEvent*>(memory + sizeof(ThreadBuffer));
+        b->owned.store(true, std::memory_order_relaxed);
+        b->next = g_buffers.load(std::memory_order_relaxed);
+        while (!g_buffers.compare_exchange_weak(b->next, b, std::memory_order_release)) {}
+    }
+
+    b->tid = u32(syscall(SYS_gettid));
+    if (g_transport) b->ring = claimRing(b->tid, b->ringOwned);
+    t_buffer = b;
+    // Keys below PTHREAD_KEY_2NDLEVEL_SIZE are stored inline, this does not allocate.
+    pthread_setspecific(g_threadExitKey, b);
+    return b;
+}
+
+inline void record(HookOp op, u64 address, u64 size, u32 callsite, u64 ticks) {
+    ThreadBuffer* b = t_buffer;
+    if (!b) [[unlikely]] {
+        b = registerThread();
+        if (!b) return;
+    }
+
+    u32 count = b->count.load(std::memory_order_relaxed);
+    if (count == HOOK_EVENTS_PER_BUFFER) [[unlikely]] {
+        flushBuffer(b);
+        count = b->count.load(std::memory_order_relaxed);
+        if (count == HOOK_EVENTS_PER_BUFFER) return; // The exit flush took the buffer, the event is dropped.
+    }
+
+    HookEvent& e = b->events[count];
+    e.ticks = ticks;
+    e.address = address;
+    e.size = size;
+    e.callsite = callsite;
+    e.tid = b->tid;
+    e.op = op;
+    count++;
+    b->count.store(count, std::memory_order_release);
+
+    if (count >= g_batchEvents || ticks - b->events[0].ticks > g_batchMaxTicks) [[unlikely]] {
+        flushBuffer(b);
+    }
+}
+
+// ------------------------------------------ END THREAD BUFFERS -------------------------------------------------------
+
+// ------------------------------------------ BEGIN CALL STACKS --------------------------------------------------------
+
+// pthread_getattr_np reads /proc/self/maps for the main thread, which allocates. Callers are inside the hook, so those
+// calls go straight to libc.
+void initStackBounds() {
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void* base;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &base, &size) == 0) {
+            t_stackLow = u64(base);
+            t_stackHigh = u64(base) + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (t_stackHigh == 0) t_stackHigh = 1; // Unknown, no frame pointer is followed.
+}
+
+// Follows the frame pointer chain up from frame, out[0] is already set. A caller built without frame pointers keeps
+// something else in the register, the checks end the chain on most of it, but not all: such a caller can leave a few
+// wrong frames at the end of a stack.
+u32 walkFramePointers(const u64* frame, u64* out) {
+    if (t_stackHigh == 0) [[unlikely]] initStackBounds();
+    if (u64(frame) < t_stackLow || u64(frame) >= t_stackHigh) return 1; // on a signal stack
+
+    u32 depth = 1;
+    while (depth < HOOK_STACK_MAX_DEPTH) {
+        // Callers are further up the stack, everything between this frame and the top of the stack is mapped.
+        u64 next = frame[0];
+        if (next <= u64(frame) || (next & 7) != 0 || next + 2 * sizeof(u64) > t_stackHigh) break;
+        frame = reinterpret_cast<const u64*>(next);
+        if (frame[1] == 0) break;
+        out[depth++] = frame[1];
+    }
+    return depth;
+}
+
+struct UnwindState {
+    u64* out;
+    u32 depth;
+    bool started;
+};
+
+_Unwind_Reason_Code onUnwindFrame(_Unwind_Context* context, void* arg) {
+    UnwindState& s = *reinterpret_cast<UnwindState*>(arg);
+    u64 ip = u64(_Unwind_GetIP(context));
+    // The frames of the hook come first, the stack starts after the return address of the interposed function.
+    if (!s.started) {
+        s.started = ip == s.out[0];
+        return _URC_NO_REASON;
+    }
+    if (ip == 0) return _URC_END_OF_STACK;
+    s.out[s.depth++] = ip;
+    return s.depth == HOOK_STACK_MAX_DEPTH ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+// Innermost frame first. frame is the frame address of the interposed function.
+u32 captureStack(const u64* frame, u64* out) {
+    out[0] = frame[1];
+    if (g_unwind == UnwindMode::CALLER) return 1;
+
+    // No DWARF fallback when the chain ends right away, such callers would pay it on every allocation.
+    if (g_unwind == UnwindMode::FRAME_POINTERS) return walkFramePointers(frame, out);
+
+    // Microseconds instead of nanoseconds, the unwinder looks up the unwind tables of every frame.
+    UnwindState state = { out, 1, false };
+    _Unwind_Backtrace(onUnwindFrame, &state);
+    return state.depth;
+}
+
+u64 hashStack(const u64* frames, u32 depth) {
+    u64 h = 0x9e3779b97f4a7c15ull ^ depth;
+    for (u32 i = 0; i < depth; i++) {
+        h ^= frames[i];
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    return h | 1; // 0 marks a free slot
+}
+
+bool sameStack(u32 id, const u64* frames, u32 depth) {
+    return g_stacks.depths[id] == depth &&
+           memcmp(&g_stacks.frames[addr_size(id) * HOOK_STACK_MAX_DEPTH], frames, depth * sizeof(u64)) == 0;
+}
+
+// Returns the id of the stack, 0 once the table is full. isNew is set for the thread that added it.
+u32 internStack(const u64* frames, u32 depth, bool& isNew) {
+    u64 hash = hashStack(frames, depth);
+    u32 slot = u32(hash) & (STACK_TABLE_SLOTS - 1);
+
+    for (u32 probe = 0; probe < STACK_TABLE_SLOTS; probe++, slot = (slot + 1) & (STACK_TABLE_SLOTS - 1)) {
+        u64 slotHash = g_stacks.hashes[slot].load(std::memory_order_acquire);
+        if (slotHash == 0) {
+            // A full table still answers for the stacks it has, a new one only costs a probe sequence.
+            if (g_stacks.nextId.load(std::memory_order_relaxed) >= HOOK_STACK_MAX_STACKS) return 0;
+
+            if (g_stacks.hashes[slot].compare_exchange_strong(slotHash, hash, std::memory_order_acq_rel)) {
+                u32 id = g_stacks.nextId.fetch_add(1, std::memory_order_relaxed);
+                if (id >= HOOK_STACK_MAX_STACKS) {
+                    g_stacks.ids[slot].store(STACK_TABLE_FULL, std::memory_order_release);
+                    return 0;
+                }
+                memcpy(&g_stacks.frames[addr_size(id) * HOOK_STACK_MAX_DEPTH], frames, depth * sizeof(u64));
+                g_stacks.depths[id] = u8(depth);
+                g_stacks.ids[slot].store(id, std::memory_order_release);
+                isNew = true;
+                return id;
+            }
+            // Lost the slot, slotHash now holds the winner's hash.
+        }
+        if (slotHash != hash) continue;
+
+        // The frames of a claimed slot are being copied right now, by a thread that is not waiting on anything.
+        u32 id;
+        while ((id = g_stacks.ids[slot].load(std::memory_order_acquire)) == 0) {
+#if defined(__x86_64__)
+            __builtin_ia32_pause();
+#endif
+        }
+        if (id == STACK_TABLE_FULL) continue;
+        if (sameStack(id, frames, depth)) return id;
+    }
+    return 0;
+}
+
+// Only called inside the hook. A new stack goes into the thread's buffer ahead of the event naming it.
+u32 internCallsite(void* frame) {
+    if (!g_stacks.hashes) return 0;
+
+    u64 frames[HOOK_STACK_MAX_DEPTH];
+    u32 depth = captureStack(reinterpret_cast<const u64*>(frame), frames);
+
+    bool isNew = false;
+    u32 id = internStack(frames, depth, isNew);
+    if (isNew) {
+        u64 ticks = nowTicks();
+        for (u32 i = 0; i < depth; i++) record(HookOp::STACK_FRAME, frames[i], (u64(depth) << 8) | i, id, ticks);
+    }
+    return id;
+}
+
+bool mapStackTable() {
+    addr_size hashBytes = addr_size(STACK_TABLE_SLOTS) * sizeof(u64);
+    addr_size idBytes = addr_size(STACK_TABLE_SLOTS) * sizeof(u32);
+    addr_size frameBytes = addr_size(HOOK_STACK_MAX_STACKS) * HOOK_STACK_MAX_DEPTH * sizeof(u64);
+    addr_size bytes = hashBytes + idBytes + frameBytes + HOOK_STACK_MAX_STACKS;
+
+    u8* memory = reinterpret_cast<u8*>(rawMmap(bytes));
+    if (!memory) return false;
+    g_stacks.hashes = reinterpret_cast<std::atomic<u64>*>(memory);
+    g_stacks.frames = reinterpret_cast<u64*>(memory + hashBytes);
+    g_stacks.ids = reinterpret_cast<std::atomic<u32>*>(memory + hashBytes + frameBytes);
+    g_stacks.depths = memory + hashBytes + frameBytes + idBytes;
+    g_stacks.bytes = bytes;
+    g_stacks.nextId.store(1, std::memory_order_relaxed);
+    return true;
+}
+
+// The ids of the parent's stacks were sent on its connection, the child starts over. Dropping the pages zeroes them.
+void resetStackTable() {
+    if (!g_stacks.hashes) return;
+    madvise(g_stacks.hashes, g_stacks.bytes, MADV_DONTNEED);
+    g_stacks.nextId.store(1, std::memory_order_relaxed);
+}
+
+UnwindMode unwindModeFromEnv() {
+    const char* value = getenv("MEMVIZ_HOOK_UNWIND");
+    if (value && strcmp(value, "dwarf") == 0) return UnwindMode::DWARF;
+    if (value && strcmp(value, "caller") == 0) return UnwindMode::CALLER;
+    return UnwindMode::FRAME_POINTERS;
+}
+
+// ------------------------------------------ END CALL STACKS ----------------------------------------------------------
+
+// ------------------------------------------ BEGIN INITIALIZATION -----------------------------------------------------
+
+void openOutput() {
+    char path[MAX_OUTPUT_PATH];
+    const char* prefix = getenv("MEMVIZ_HOOK_OUTPUT");
+    if (!prefix || !prefix[0]) prefix = "/tmp/memviz_hook";
+
+    // snprintf is avoided on purpose, it may allocate.
+    addr_size len = strnlen(prefix, MAX_OUTPUT_PATH - 16);
+    memcpy(path, prefix, len);
+    path[len++] = '.';
+
+    char digits[16];
+    u32 digitCount = 0;
+    u32 pid = u32(getpid());
+    do {
+        digits[digitCount++] = char('0' + pid % 10);
+        pid /= 10;
+    } while (pid > 0);
+    while (digitCount > 0) path[len++] = digits[--digitCount];
+    path[len] = '\0';
+
+    g_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (g_fd < 0) return;
+
+    HookFileHeader header = {};
+    header.magic = HOOK_FILE_MAGIC;
+    header.version = HOOK_FILE_VERSION;
+    header.eventSize = sizeof(HookEvent);
+    header.pid = u32(getpid());
+    header.startTicks = nowTicks();
+    header.startNs = nowNs();
+    writeAll(&header, sizeof(header));
+}
+
+HookBackpressure backpressureFromEnv() {
+    const char* value = getenv("MEMVIZ_HOOK_BACKPRESSURE");
+    if (value && strcmp(value, "block") == 0) return HookBackpressure::BLOCK;
+    if (value && strcmp(value, "spill") == 0) return HookBackpressure::SPILL;
+    return HookBackpressure::DROP;
+}
+
+// memviz answers a connection with the memfd holding the rings and the eventfd to wake it with.
+bool connectTransport() {
+    const char* path = getenv("MEMVIZ_HOOK_SOCKET");
+    if (!path || !path[0]) return false;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    addr_size pathLen = strnlen(path, sizeof(addr.sun_path));
+    if (pathLen == sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path, pathLen);
+
+    i32 sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return false;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(sock);
+        return false;
+    }
+
+    u32 version = 0;
+    iovec iov = { &version, sizeof(version) };
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(i32))];
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (n != sizeof(version) || version != HOOK_TRANSPORT_VERSION || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(i32))) {
+        close(sock);
+        return false;
+    }
+
+    i32 fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    void* shm = (void*)syscall(SYS_mmap, nullptr, HOOK_TRANSPORT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    HookTransportHeader* header = reinterpret_cast<HookTransportHeader*>(shm);
+    if (shm == MAP_FAILED || header->magic != HOOK_TRANSPORT_MAGIC || header->ringCount != HOOK_TRANSPORT_RINGS ||
+        header->ringEvents != HOOK_RING_EVENTS || header->eventSize != sizeof(HookEvent)) {
+        if (shm != MAP_FAILED) syscall(SYS_munmap, shm, HOOK_TRANSPORT_SIZE);
+        close(fds[1]);
+        close(sock);
+        return false;
+    }
+
+    header->pid = u32(getpid());
+    header->backpressure = g_backpressure.load(std::memory_order_relaxed);
+    header->startTicks = nowTicks();
+    header->startNs = nowNs();
+    header->producerReady.store(1, std::memory_order_release);
+
+    g_transport = header;
+    g_socketFd = sock;
+    g_eventFd = fds[1];
+    g_batchEvents = HOOK_TRANSPORT_BATCH_EVENTS;
+    g_batchMaxTicks = HOOK_TRANSPORT_BATCH_MAX_TICKS;
+    return true;
+}
+
+void disconnectTransport() {
+    if (!g_transport) return;
+    syscall(SYS_munmap, g_transport, HOOK_TRANSPORT_SIZE);
+    close(g_eventFd);
+    close(g_socketFd);
+    g_transport = nullptr;
+    g_socketFd = -1;
+    g_eventFd = -1;
+    g_batchEvents = HOOK_EVENTS_PER_BUFFER;
+    g_batchMaxTicks = ~u64(0);
+}
+
+// Picks the transport when memviz is listening, the output file otherwise. False when neither is available.
+bool openSink() {
+    g_backpressure.store(backpressureFromEnv(), std::memory_order_relaxed);
+    if (connectTransport()) {
+        if (g_backpressure.load(std::memory_order_relaxed) == HookBackpressure::SPILL) openOutput();
+        return true;
+    }
+    openOutput();
+    return g_fd >= 0;
+}
+
+// The child starts with a copy of the parent's unflushed events and of every other thread's buffer. The parent
+// writes those. The child connects on its own (or opens its own file) and only keeps its own, now empty, buffer. The
+// rings it inherited belong to the parent's connection.
+void onForkChild() {
+    for (ThreadBuffer* it = g_buffers.load(std::memory_order_relaxed); it; it = it->next) {
+        it->count.store(0, std::memory_order_relaxed);
+        it->flushing.store(false, std::memory_order_relaxed);
+        it->owned.store(it == t_buffer, std::memory_order_relaxed);
+        it->ring = nullptr;
+    }
+
+    disconnectTransport();
+    resetStackTable();
+    if (g_fd >= 0) {
+        close(g_fd);
+        g_fd = -1;
+    }
+    if (!openSink()) {
+        g_state.store(HOOK_SHUT_DOWN, std::memory_order_release);
+        return;
+    }
+
+    if (t_buffer) {
+        t_buffer->tid = u32(syscall(SYS_gettid));
+        if (g_transport) t_buffer->ring = claimRing(t_buffer->tid, t_buffer->ringOwned);
+    }
+}
+
+template <typename T>
+void resolve(T& fn, const char* name) {
+    fn = reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+}
+
+bool initialize() {
+    u32 expected = HOOK_UNINITIALIZED;
+    if (!g_state.compare_exchange_strong(expected, HOOK_INITIALIZING, std::memory_order_acq_rel)) {
+        // Another thread is resolving, wait for it. Its own nested calls never get here, t_inHook is set for them.
+        while (expected == HOOK_INITIALIZING) {
+            sched_yield();
+            expected = g_state.load(std::memory_order_acquire);
+        }
+        return expected == HOOK_READY;
+    }
+
+    t_inHook = true;
+
+    resolve(g_real.malloc, "malloc");
+    resolve(g_real.free, "free");
+    resolve(g_real.calloc, "calloc");
+    resolve(g_real.realloc, "realloc");
+    resolve(g_real.posixMemalign, "posix_memalign");
+    resolve(g_real.alignedAlloc, "aligned_alloc");
+    resolve(g_real.memalign, "memalign");
+    resolve(g_real.mmap, "mmap");
+    resolve(g_real.munmap, "munmap");
+
+    bool ok = g_real.malloc && g_real.free && g_real.calloc && g_real.realloc && g_real.posixMemalign &&
+              g_real.alignedAlloc && g_real.memalign && g_real.mmap && g_real.munmap;
+    if (ok) {
+        ok = pthread_key_create(&g_threadExitKey, onThreadExit) == 0;
+    }
+    if (ok) {
+        ok = openSink();
+    }
+    if (ok) {
+        // Without the table events still flow, with unknown stacks.
+        g_unwind = unwindModeFromEnv();
+        mapStackTable();
+    }
+    if (ok) {
+        pthread_atfork(nullptr, nullptr, onForkChild);
+    }
+
+    t_inHook = false;
+
+    // Without the real functions or anywhere to send events the hook stays a passthrough.
+    g_state.store(ok ? HOOK_READY : HOOK_SHUT_DOWN, std::memory_order_release);
+    return ok;
+}
+
+__attribute__((constructor)) void hookConstructor() {
+    if (g_state.load(std::memory_order_acquire) == HOOK_UNINITIALIZED) initialize();
+}
+
+__attribute__((destructor)) void hookDestructor() {
+    if (g_state.exchange(HOOK_SHUT_DOWN, std::memory_order_acq_rel) != HOOK_READY) return;
+
+    t_inHook = true;
+
+    // Threads that are still running lose the events they record from here on.
+    for (ThreadBuffer* it = g_buffers.load(std::memory_order_acquire); it; it = it->next) {
+        closeBuffer(it);
+    }
+
+    HookEvent sync = {};
+    sync.ticks = nowTicks();
+    sync.address = sync.ticks;
+    sync.size = nowNs();
+    sync.tid = u32(syscall(SYS_gettid));
+    sync.op = HookOp::CLOCK_SYNC;
+    if (g_transport) {
+        pushToTransport(t_buffer && t_buffer->ring ? *t_buffer->ring : g_transport->rings[0], &sync, 1);
+        // The viewer drains what is left once it sees the socket close, this only makes it look sooner.
+        wakeConsumer();
+    }
+    else if (g_fd >= 0) {
+        writeAll(&sync, sizeof(sync));
+    }
+}
+
+// ------------------------------------------ END INITIALIZATION -------------------------------------------------------
+
+// False when the call should go straight to libc: a nested call from the hook itself, initialization still in
+// progress on this thread, or a process that is shutting down.
+inline bool beginRecord() {
+    if (t_inHook) return false;
+    u32 state = g_state.load(std::memory_order_acquire);
+    if (state != HOOK_READY) [[unlikely]] {
+        if (state != HOOK_UNINITIALIZED || !initialize()) return false;
+    }
+    t_inHook = true;
+    return true;
+}
+
+inline void endRecord() {
+    t_inHook = false;
+}
+
+// frame is the one of the interposed function.
+void* allocAligned(void* (*realFn)(size_t, size_t), HookOp op, size_t alignment, size_t size, void* frame) {
+    if (!beginRecord()) {
+        if (!realFn) return bootstrapAlloc(size, alignment);
+        return realFn(alignment, size);
+    }
+
+    void* p = realFn(alignment, size);
+    if (p) record(op, u64(p), size, internCallsite(frame), nowTicks());
+    endRecord();
+    return p;
+}
+
+void* mmapImpl(void* addr, size_t length, int prot, int flags, int fd, off_t offset, void* frame) {
+    if (!beginRecord()) {
+        if (!g_real.mmap) return (void*)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+        return g_real.mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    void* p = g_real.mmap(addr, length, prot, flags, fd, offset);
+    if (p != MAP_FAILED) record(HookOp::MMAP, u64(p), length, internCallsite(frame), nowTicks());
+    endRecord();
+    return p;
+}
+
+} // namespace
+
+} // namespace memviz
+
+using namespace memviz;
+
+// ------------------------------------------ BEGIN INTERPOSED FUNCTIONS -----------------------------------------------
+
+HOOK_EXPORT void* malloc(size_t size) noexcept {
+    if (!beginRecord()) {
+        if (!g_real.malloc) return bootstrapAlloc(size, BOOTSTRAP_HEADER_SIZE);
+        return g_real.malloc(size);
+    }
+
+    void* p = g_real.malloc(size);
+    if (p) record(HookOp::MALLOC, u64(p), size, HOOK_CALLSITE, nowTicks());
+    endRecord();
+    return p;
+}
+
+HOOK_EXPORT void free(void* p) noexcept {
+    if (!p || isBootstrap(p)) return;
+
+    if (!beginRecord()) {
+        if (g_real.free) g_real.free(p);
+        return;
+    }
+
+    record(HookOp::FREE, u64(p), 0, HOOK_CALLSITE, nowTicks());
+    g_real.free(p);
+    endRecord();
+}
+
+HOOK_EXPORT void* calloc(size_t count, size_t size) noexcept {
+    if (!beginRecord()) {
+        if (!g_real.calloc) {
+            size_t bytes;
+            if (__builtin_mul_overflow(count, size, &bytes)) return nullptr;
+            return bootstrapAlloc(bytes, BOOTSTRAP_HEADER_SIZE);
+        }
+        return g_real.calloc(count, size);
+    }
+
+    void* p = g_real.calloc(count, size);
+    if (p) record(HookOp::CALLOC, u64(p), u64(count) * u64(size), HOOK_CALLSITE, nowTicks());
+    endRecord();
+    return p;
+}
+
+HOOK_EXPORT void* realloc(void* p, size_t size) noexcept {
+    if (p && isBootstrap(p)) {
+        // Moves the block out of the bootstrap heap, through malloc so the new block is recorded.
+        void* moved = malloc(size);
+        if (moved) {
+            addr_size oldSize = bootstrapSize(p);
+            memcpy(moved, p, oldSize < size ? oldSize : size);
+        }
+        return moved;
+    }
+
+    if (!beginRecord()) {
+        if (!g_real.realloc) return p ? nullptr : bootstrapAlloc(size, BOOTSTRAP_HEADER_SIZE);
+        return g_real.realloc(p, size);
+    }
+
+    u32 callsite = HOOK_CALLSITE;
+    u64 before = nowTicks();
+    void* result = g_real.realloc(p, size);
+    if (result) {
+        if (p && result != p) record(HookOp::FREE, u64(p), 0, callsite, before);
+        record(HookOp::REALLOC, u64(result), size, callsite, nowTicks());
+    }
+    else if (p && size == 0) {
+        // glibc frees the block for a zero size.
+        record(HookOp::FREE, u64(p), 0, callsite, before);
+    }
+    endRecord();
+    return result;
+}
+
+HOOK_EXPORT int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    if (!beginRecord()) {
+        if (!g_real.posixMemalign) {
+            *out = bootstrapAlloc(size, alignment);
+            return *out ? 0 : ENOMEM;
+        }
+        return g_real.posixMemalign(out, alignment, size);
+    }
+
+    int ret = g_real.posixMemalign(out, alignment, size);
+    if (ret == 0) record(HookOp::POSIX_MEMALIGN, u64(*out), size, HOOK_CALLSITE, nowTicks());
+    endRecord();
+    return ret;
+}
+
+HOOK_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return allocAligned(g_real.alignedAlloc, HookOp::ALIGNED_ALLOC, alignment, size, HOOK_FRAME);
+}
+
+HOOK_EXPORT void* memalign(size_t alignment, size_t size) noexcept {
+    return allocAligned(g_real.memalign, HookOp::ALIGNED_ALLOC, alignment, size, HOOK_FRAME);
+}
+
+HOOK_EXPORT void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept {
+    return mmapImpl(addr, length, prot, flags, fd, offset, HOOK_FRAME);
+}
+
+HOOK_EXPORT void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off64_t offset) noexcept {
+    return mmapImpl(addr, length, prot, flags, fd, off_t(offset), HOOK_FRAME);
+}
+
+HOOK_EXPORT int munmap(void* addr, size_t length) noexcept {
+    if (!beginRecord()) {
+        if (!g_real.munmap) return int(syscall(SYS_munmap, addr, length));
+        return g_real.munmap(addr, length);
+    }
+
+    record(HookOp::MUNMAP, u64(addr), length, HOOK_CALLSITE, nowTicks());
+    int ret = g_real.munmap(addr, length);
+    endRecord();
+    return ret;
+}
+
+// ------------------------------------------ END INTERPOSED FUNCTIONS -------------------------------------------------
+
+PRAGMA_WARNING_POP
@@ -0,0 +1,154 @@
+#include "linux_event_waiter.h"
+
+#include "systems/logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace memviz {
+
+namespace {
+
+constexpr u64 NS_PER_SEC = 1'000'000'000;
+
+// Stored in epoll_event::data.u32 to tell the sources apart.
+enum WaitSource : u32 {
+    WAIT_SOURCE_NATIVE = 0,
+    WAIT_SOURCE_WAKEUP = 1,
+    WAIT_SOURCE_TIMER = 2,
+    WAIT_SOURCE_WATCHED = 3,
+};
+
+i32 g_epollFd = -1;
+i32 g_wakeFd = -1;
+i32 g_timerFd = -1;
+u64 g_armedDeadlineNs = 0;
+
+bool addToEpoll(i32 fd, WaitSource source) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = source;
+    return epoll_ctl(g_epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void armTimer(u64 deadlineNs) {
+    if (deadlineNs == g_armedDeadlineNs) return;
+
+    // A zero it_value disarms the timer.
+    itimerspec spec = {};
+    spec.it_value.tv_sec = time_t(deadlineNs / NS_PER_SEC);
+    spec.it_value.tv_nsec = long(deadlineNs % NS_PER_SEC);
+    timerfd_settime(g_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    g_armedDeadlineNs = deadlineNs;
+}
+
+void drainFd(i32 fd) {
+    // Both eventfd and timerfd hand out a single u64 counter per read.
+    u64 counter;
+    [[maybe_unused]] ssize_t n = read(fd, &counter, sizeof(counter));
+}
+
+} // namespace
+
+Error linuxEventWaiterInit(i32 nativeFd) {
+    g_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epollFd < 0) {
+        return Error::FAILED_TO_CREATE_EPOLL;
+    }
+
+    // Every failure below closes what was created so far, the caller does not shut down a waiter that failed init.
+    g_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wakeFd < 0 || !addToEpoll(g_wakeFd, WAIT_SOURCE_WAKEUP)) {
+        linuxEventWaiterShutdown();
+        return Error::FAILED_TO_CREATE_EVENTFD;
+    }
+
+    g_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (g_timerFd < 0 || !addToEpoll(g_timerFd, WAIT_SOURCE_TIMER)) {
+        linuxEventWaiterShutdown();
+        return Error::FAILED_TO_CREATE_TIMERFD;
+    }
+
+    if (nativeFd >= 0 && !addToEpoll(nativeFd, WAIT_SOURCE_NATIVE)) {
+        linuxEventWaiterShutdown();
+        return Error::FAILED_TO_CREATE_EPOLL;
+    }
+
+    g_armedDeadlineNs = 0;
+    return Error::OK;
+}
+
+void linuxEventWaiterShutdown() {
+    if (g_timerFd >= 0) { close(g_timerFd); g_timerFd = -1; }
+    if (g_wakeFd >= 0)  { close(g_wakeFd); g_wakeFd = -1; }
+    if (g_epollFd >= 0) { close(g_epollFd); g_epollFd = -1; }
+}
+
+Error linuxEventWaiterWait(u64 deadlineNs) {
+    if (deadlineNs != 0 && deadlineNs <= linuxMonotonicNowNs()) {
+        return Error::OK;
+    }
+
+    armTimer(deadlineNs);
+
+    constexpr i32 MAX_EVENTS = 8;
+    epoll_event events[MAX_EVENTS];
+    i32 n;
+    do {
+        n = epoll_wait(g_epollFd, events, MAX_EVENTS, -1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        logErrTagged(PLATFORM_TAG, "epoll_wait failed: {}", strerror(errno));
+        return Error::FAILED_TO_WAIT_FOR_EVENTS;
+    }
+
+    for (i32 i = 0; i < n; i++) {
+        switch (events[i].data.u32) {
+            case WAIT_SOURCE_WAKEUP:
+                drainFd(g_wakeFd);
+                break;
+            case WAIT_SOURCE_TIMER:
+                drainFd(g_timerFd);
+                g_armedDeadlineNs = 0; // expired timers stay disarmed
+                break;
+            case WAIT_SOURCE_WATCHED:
+                // Drained by whoever registered it.
+                break;
+            case WAIT_SOURCE_NATIVE: [[fallthrough]];
+            default:
+                // The native queue is drained by the backend's pollEvents.
+                break;
+        }
+    }
+
+    return Error::OK;
+}
+
+void linuxEventWaiterWakeUp() {
+    // Safe from any thread. The counter saturates long before overflow matters, every wake-up drains it.
+    u64 one = 1;
+    [[maybe_unused]] ssize_t n = write(g_wakeFd, &one, sizeof(one));
+}
+
+bool linuxEventWaiterWatchFd(i32 fd) {
+    return addToEpoll(fd, WAIT_SOURCE_WATCHED);
+}
+
+void linuxEventWaiterUnwatchFd(i32 fd) {
+    epoll_ctl(g_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+u64 linuxMonotonicNowNs() {
+    // Must be CLOCK_MONOTONIC to match the timerfd clock.
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return u64(ts.tv_sec) * NS_PER_SEC + u64(ts.tv_nsec);
+}
+
+} // namespace memviz
@@ -0,0 +1,69 @@
+#include "platform.h"
+
+#include "basic.h"
+#include "systems/logger.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace memviz {
+
+namespace {
+
+bool appendPath(char* out, addr_size outSize, addr_size& len, const char* part) {
+    addr_size partLen = core::cstrLen(part);
+    if (len + partLen + 1 > outSize) return false;
+    core::memcopy(out + len, part, partLen);
+    len += partLen;
+    out[len] = '\0';
+    return true;
+}
+
+bool makeDirectory(const char* path) {
+    if (mkdir(path, 0700) == 0) return true;
+    struct stat st;
+    return errno == EEXIST && stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// mkdir -p: $XDG_CACHE_HOME or ~/.cache need not exist yet on a fresh account. Parents are cut at every '/' in place.
+bool ensureDirectories(char* path) {
+    for (char* it = path + 1; *it; it++) {
+        if (*it != '/') continue;
+        *it = '\0';
+        if (!makeDirectory(path)) {
+            logErrTagged(PLATFORM_TAG, "Failed to create the cache directory {}: {}", path, strerror(errno));
+            *it = '/';
+            return false;
+        }
+        *it = '/';
+    }
+    if (!makeDirectory(path)) {
+        logErrTagged(PLATFORM_TAG, "Failed to create the cache directory {}: {}", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool Platform::getCacheDirectory(char* out, addr_size outSize) {
+    // XDG Base Directory spec: $XDG_CACHE_HOME, falling back to $HOME/.cache. Relative values must be ignored.
+    addr_size len = 0;
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0] == '/') {
+        if (!appendPath(out, outSize, len, xdg)) return false;
+    }
+    else {
+        const char* home = getenv("HOME");
+        if (!home || home[0] != '/') return false;
+        if (!appendPath(out, outSize, len, home)) return false;
+        if (!appendPath(out, outSize, len, "/.cache")) return false;
+    }
+
+    if (!appendPath(out, outSize, len, "/memviz")) return false;
+    return ensureDirectories(out);
+}
+
+} // namespace memviz
@@ -0,0 +1,183 @@
+#include "platform_events.h"
+
+#include "systems/logger.h"
+
+namespace memviz {
+
+namespace {
+
+WindowCloseCallback windowCloseCallback = nullptr;
+WindowResizeCallback windowResizeCallback = nullptr;
+WindowFocusCallback windowFocusCallback = nullptr;
+
+KeyCallback keyCallback = nullptr;
+
+MouseClickCallback mouseClickCallback = nullptr;
+MouseMoveCallback mouseMoveCallback = nullptr;
+MouseScrollCallback mouseScrollCallback = nullptr;
+MouseEnterOrLeaveCallback mouseEnterOrLeaveCallback = nullptr;
+
+EventObserverCallback eventObserverCallback = nullptr;
+
+// Fixed-capacity ring that holds one frame worth of events. When it fills up the oldest event is dispatched to make
+// room, so nothing is lost, but a single pollEvents call never needs more memory than this.
+constexpr addr_size EVENT_RING_CAP = 256;
+
+struct EventRing {
+    PlatformEvent events[EVENT_RING_CAP];
+    addr_size head;
+    addr_size count;
+};
+
+EventRing g_eventRing = {};
+PlatformEventStats g_eventStats = {};
+
+// Returns true if the event reached a registered callback.
+bool dispatchEvent(const PlatformEvent& ev) {
+    switch (ev.type) {
+        case PlatformEventType::WINDOW_CLOSE:
+            if (windowCloseCallback) {
+                windowCloseCallback();
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::WINDOW_RESIZE:
+            if (windowResizeCallback) {
+                windowResizeCallback(ev.resize.w, ev.resize.h);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::WINDOW_FOCUS:
+            if (windowFocusCallback) {
+                windowFocusCallback(ev.focus.gain);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::KEY:
+            if (keyCallback) {
+                keyCallback(ev.key.vkcode, ev.key.scancode, ev.key.isPress, ev.key.mods);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::MOUSE_CLICK:
+            if (mouseClickCallback) {
+                mouseClickCallback(ev.click.button, ev.click.isPress, ev.click.x, ev.click.y, ev.click.mods);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::MOUSE_MOVE:
+            if (mouseMoveCallback) {
+                mouseMoveCallback(ev.move.x, ev.move.y);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::MOUSE_SCROLL:
+            if (mouseScrollCallback) {
+                mouseScrollCallback(ev.scroll.direction, ev.scroll.x, ev.scroll.y);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::MOUSE_ENTER_OR_LEAVE:
+            if (mouseEnterOrLeaveCallback) {
+                mouseEnterOrLeaveCallback(ev.crossing.enter);
+                return true;
+            }
+            return false;
+
+        case PlatformEventType::NONE: [[fallthrough]];
+        case PlatformEventType::SENTINEL: [[fallthrough]];
+        default:
+            return false;
+    }
+}
+
+inline void dispatchRingHead() {
+    PlatformEvent& ev = g_eventRing.events[g_eventRing.head];
+    g_eventRing.head = (g_eventRing.head + 1) % EVENT_RING_CAP;
+    g_eventRing.count--;
+
+    if (eventObserverCallback) eventObserverCallback(&ev);
+
+    if (dispatchEvent(ev)) g_eventStats.dispatched++;
+    else                   g_eventStats.dropped++;
+}
+
+inline bool isCoalescable(PlatformEventType type) {
+    return type == PlatformEventType::MOUSE_MOVE || type == PlatformEventType::WINDOW_RESIZE;
+}
+
+} // namespace
+
+void platformEventRingPush(const PlatformEvent& ev) {
+    g_eventStats.received++;
+
+    // Merge with the previous event when both are of the same coalescable kind. Only the newest pointer position and
+    // the newest window size matter for a frame, the intermediate ones are stale by the time they are dispatched.
+    if (g_eventRing.count > 0 && isCoalescable(ev.type)) {
+        addr_size lastIdx = (g_eventRing.head + g_eventRing.count - 1) % EVENT_RING_CAP;
+        PlatformEvent& last = g_eventRing.events[lastIdx];
+        if (last.type == ev.type) {
+            last = ev;
+            g_eventStats.coalesced++;
+            return;
+        }
+    }
+
+    if (g_eventRing.count == EVENT_RING_CAP) {
+        dispatchRingHead();
+    }
+
+    addr_size tailIdx = (g_eventRing.head + g_eventRing.count) % EVENT_RING_CAP;
+    g_eventRing.events[tailIdx] = ev;
+    g_eventRing.count++;
+}
+
+void platformEventRingFlush(u32 nativeBatchSize) {
+    if (g_eventRing.count == 0 && nativeBatchSize == 0) {
+        return;
+    }
+
+    while (g_eventRing.count > 0) {
+        dispatchRingHead();
+    }
+
+    if (eventObserverCallback) eventObserverCallback(nullptr);
+
+    g_eventStats.batches++;
+    if (nativeBatchSize > g_eventStats.maxBatchSize) g_eventStats.maxBatchSize = nativeBatchSize;
+}
+
+bool platformEventRingEmpty() {
+    return g_eventRing.count == 0;
+}
+
+void platformEventDropped() {
+    g_eventStats.received++;
+    g_eventStats.dropped++;
+}
+
+PlatformEventStats Platform::getEventStats() {
+    return g_eventStats;
+}
+
+void Platform::registerWindowCloseCallback(WindowCloseCallback cb) { windowCloseCallback = cb; }
+void Platform::registerWindowResizeCallback(WindowResizeCallback cb) { windowResizeCallback = cb; }
+void Platform::registerWindowFocusCallback(WindowFocusCallback cb) { windowFocusCallback = cb; }
+
+void Platform::registerKeyCallback(KeyCallback cb) { keyCallback = cb; }
+
+void Platform::registerMouseClickCallback(MouseClickCallback cb) { mouseClickCallback = cb; }
+void Platform::registerMouseMoveCallback(MouseMoveCallback cb) { mouseMoveCallback = cb; }
+void Platform::registerMouseScrollCallback(MouseScrollCallback cb) { mouseScrollCallback = cb; }
+void Platform::registerMouseEnterOrLeaveCallback(MouseEnterOrLeaveCallback cb) { mouseEnterOrLeaveCallback = cb; }
+
+void Platform::registerEventObserver(EventObserverCallback cb) { eventObserverCallback = cb; }
+
+} // namespace memviz
@@ -0,0 +1,440 @@
+#include "systems/address_pyramid.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/profiler.h"
+#include "systems/renderer/renderer.h"
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u64 EMPTY_KEY = ~u64(0); // Bin indices never get this large.
+constexpr u64 NO_SLOT = ~u64(0);
+constexpr u64 BIN_TABLE_MIN_CAPACITY = 64;
+constexpr u32 WIDE_MIN_CAPACITY = 16;
+constexpr u64 FIBONACCI_HASH = 0x9E3779B97F4A7C15;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+struct Bin {
+    u64 liveBytes;
+    u64 blocks;
+    u64 categoryBytes[BLOCK_CATEGORY_COUNT];
+};
+
+// Open addressing with linear probing. Deleting shifts the rest of the cluster back instead of leaving tombstones, so
+// churn does not slow probing down over time. Keys are apart from the bins, a probe reads 8 of them per cache line.
+struct BinTable {
+    u64* keys;
+    Bin* bins;
+    u64 capacity; // Power of two, 0 before the first insert.
+    u64 count;
+    u32 hashShift;
+};
+
+struct WideBlock {
+    u64 address;
+    u64 size;
+    u8 category;
+};
+
+struct Level {
+    BinTable table;
+    WideBlock* wide;
+    u32 wideCount;
+    u32 wideCapacity;
+};
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+u32 levelShift(u32 level) {
+    return PYRAMID_BASE_SHIFT + level * PYRAMID_LEVEL_SHIFT;
+}
+
+Level* levelsOf(const AddressPyramid& p) {
+    return reinterpret_cast<Level*>(p.levels);
+}
+
+// ------------------------------------------ BEGIN BIN TABLE ----------------------------------------------------------
+
+u64 homeSlot(const BinTable& t, u64 key) {
+    return (key * FIBONACCI_HASH) >> t.hashShift;
+}
+
+u64 findBin(const BinTable& t, u64 key) {
+    if (t.count == 0) return NO_SLOT;
+    u64 mask = t.capacity - 1;
+    for (u64 i = homeSlot(t, key);; i = (i + 1) & mask) {
+        if (t.keys[i] == key) return i;
+        if (t.keys[i] == EMPTY_KEY) return NO_SLOT;
+    }
+}
+
+bool growTable(BinTable& t) {
+    u64 capacity = t.capacity > 0 ? t.capacity * 2 : BIN_TABLE_MIN_CAPACITY;
+    u64* keys = metaAlloc<u64>(capacity);
+    Bin* bins = metaAlloc<Bin>(capacity);
+    if (!keys || !bins) {
+        metaFree(keys, capacity);
+        metaFree(bins, capacity);
+        return false;
+    }
+    for (u64 i = 0; i < capacity; i++) keys[i] = EMPTY_KEY;
+
+    BinTable grown = {};
+    grown.keys = keys;
+    grown.bins = bins;
+    grown.capacity = capacity;
+    grown.count = t.count;
+    grown.hashShift = u32(64 - __builtin_ctzll(capacity));
+    for (u64 i = 0; i < t.capacity; i++) {
+        if (t.keys[i] == EMPTY_KEY) continue;
+        u64 j = homeSlot(grown, t.keys[i]);
+        while (keys[j] != EMPTY_KEY) j = (j + 1) & (capacity - 1);
+        keys[j] = t.keys[i];
+        bins[j] = t.bins[i];
+    }
+
+    metaFree(t.keys, t.capacity);
+    metaFree(t.bins, t.capacity);
+    t = grown;
+    return true;
+}
+
+// Slot of key, a zeroed bin when it was missing. NO_SLOT when out of memory.
+u64 findOrInsertBin(BinTable& t, u64 key) {
+    if ((t.count + 1) * 10 > t.capacity * 7 && !growTable(t)) return NO_SLOT;
+
+    u64 mask = t.capacity - 1;
+    u64 i = homeSlot(t, key);
+    for (; t.keys[i] != EMPTY_KEY; i = (i + 1) & mask) {
+        if (t.keys[i] == key) return i;
+    }
+    t.keys[i] = key;
+    t.bins[i] = {};
+    t.count++;
+    return i;
+}
+
+void removeBin(BinTable& t, u64 slot) {
+    u64 mask = t.capacity - 1;
+    u64 hole = slot;
+    for (u64 i = (slot + 1) & mask; t.keys[i] != EMPTY_KEY; i = (i + 1) & mask) {
+        // An entry may fill the hole when the hole lies between its home slot and where it is now.
+        u64 home = homeSlot(t, t.keys[i]);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t.keys[hole] = t.keys[i];
+            t.bins[hole] = t.bins[i];
+            hole = i;
+        }
+    }
+    t.keys[hole] = EMPTY_KEY;
+    t.count--;
+}
+
+void freeTable(BinTable& t) {
+    metaFree(t.keys, t.capacity);
+    metaFree(t.bins, t.capacity);
+    t = {};
+}
+
+// ------------------------------------------ END BIN TABLE ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN LEVELS -------------------------------------------------------------
+
+bool addWide(Level& lvl, u64 address, u64 size, u8 category) {
+    if (lvl.wideCount == lvl.wideCapacity) {
+        u32 capacity = lvl.wideCapacity > 0 ? lvl.wideCapacity * 2 : WIDE_MIN_CAPACITY;
+        WideBlock* grown = metaAlloc<WideBlock>(capacity);
+        if (!grown) return false;
+        if (lvl.wideCount > 0) core::memcopy(grown, lvl.wide, lvl.wideCount * sizeof(WideBlock));
+        metaFree(lvl.wide, lvl.wideCapacity);
+        lvl.wide = grown;
+        lvl.wideCapacity = capacity;
+    }
+    lvl.wide[lvl.wideCount++] = { address, size, category };
+    return true;
+}
+
+void removeWide(Level& lvl, u64 address, u64 size) {
+    for (u32 i = 0; i < lvl.wideCount; i++) {
+        if (lvl.wide[i].address == address && lvl.wide[i].size == size) {
+            lvl.wide[i] = lvl.wide[--lvl.wideCount];
+            return;
+        }
+    }
+}
+
+// Adds or takes away the block's share of bins [first, last] of a level.
+bool updateBins(Level& lvl, u32 shift, u64 first, u64 last, u64 address, u64 size, u8 category, bool add) {
+    u64 end = address + size;
+    u64 blockStart = address >> shift;
+    for (u64 b = first; b <= last; b++) {
+        u64 lo = b << shift;
+        u64 hi = lo + (u64(1) << shift);
+        u64 overlap = (end < hi ? end : hi) - (address > lo ? address : lo);
+
+        if (add) {
+            u64 slot = findOrInsertBin(lvl.table, b);
+            if (slot == NO_SLOT) {
+                if (b > first) updateBins(lvl, shift, first, b - 1, address, size, category, false);
+                return false;
+            }
+            Bin& bin = lvl.table.bins[slot];
+            bin.liveBytes += overlap;
+            bin.categoryBytes[category] += overlap;
+            if (b == blockStart) bin.blocks++;
+        }
+        else {
+            u64 slot = findBin(lvl.table, b);
+            if (slot == NO_SLOT) continue;
+            Bin& bin = lvl.table.bins[slot];
+            bin.liveBytes -= overlap;
+            bin.categoryBytes[category] -= overlap;
+            if (b == blockStart) bin.blocks--;
+            if (bin.liveBytes == 0 && bin.blocks == 0) removeBin(lvl.table, slot);
+        }
+    }
+    return true;
+}
+
+bool updateLevel(AddressPyramid& p, u32 level, u64 address, u64 size, u8 category, bool add) {
+    Level& lvl = levelsOf(p)[level];
+    u32 shift = levelShift(level);
+    u64 first = address >> shift;
+    u64 last = size > 0 ? (address + size - 1) >> shift : first;
+
+    if (last - first >= PYRAMID_MAX_BINS_PER_BLOCK) {
+        if (add) {
+            if (!addWide(lvl, address, size, category)) return false;
+            p.wideCount++;
+        }
+        else {
+            removeWide(lvl, address, size);
+            p.wideCount--;
+        }
+        return true;
+    }
+
+    u64 before = lvl.table.count;
+    bool ok = updateBins(lvl, shift, first, last, address, size, category, add);
+    p.binCount = p.binCount + lvl.table.count - before;
+    return ok;
+}
+
+bool ensureLevels(AddressPyramid& p) {
+    if (p.levels) return true;
+    Level* levels = metaAlloc<Level>(PYRAMID_LEVELS);
+    if (!levels) return false;
+    core::memset(levels, 0, PYRAMID_LEVELS * sizeof(Level));
+    p.levels = levels;
+    return true;
+}
+
+u8 dominantCategory(const Bin& bin) {
+    u8 best = 0;
+    for (u32 c = 1; c < BLOCK_CATEGORY_COUNT; c++) {
+        if (bin.categoryBytes[c] > bin.categoryBytes[best]) best = u8(c);
+    }
+    return best;
+}
+
+// ------------------------------------------ END LEVELS ---------------------------------------------------------------
+
+// ------------------------------------------ BEGIN QUERY --------------------------------------------------------------
+
+struct QueryTarget {
+    PyramidCell* cells;
+    u32 cellCount;
+    u64 begin;
+    u64 end;
+    u64 cellBytes;
+};
+
+u64 share(u64 bytes, u64 overlap, u64 extent) {
+    if (overlap == extent) return bytes;
+    if (bytes == extent) return overlap;
+    return u64(f64(bytes) * f64(overlap) / f64(extent));
+}
+
+// Splits what [lo, hi) holds between the cells it overlaps, in proportion to the overlap. Blocks go to the first one.
+void spread(const QueryTarget& q, u64 lo, u64 hi, u64 bytes, u64 categoryBytes, u8 category, u64 blocks) {
+    u64 clippedLo = lo > q.begin ? lo : q.begin;
+    u64 clippedHi = hi < q.end ? hi : q.end;
+    if (clippedLo >= clippedHi) return;
+
+    u64 first = (clippedLo - q.begin) / q.cellBytes;
+    u64 last = (clippedHi - 1 - q.begin) / q.cellBytes;
+    for (u64 c = first; c <= last; c++) {
+        u64 cellLo = q.begin + c * q.cellBytes;
+        u64 cellHi = cellLo + q.cellBytes;
+        u64 overlap = (clippedHi < cellHi ? clippedHi : cellHi) - (clippedLo > cellLo ? clippedLo : cellLo);
+
+        PyramidCell& cell = q.cells[c];
+        cell.liveBytes += share(bytes, overlap, hi - lo);
+        if (c == first) cell.blocks += u32(blocks);
+        u64 contributed = share(categoryBytes, overlap, hi - lo);
+        if (contributed > cell.categoryBytes) {
+            cell.categoryBytes = contributed;
+            cell.category = category;
+        }
+    }
+}
+
+// ------------------------------------------ END QUERY ----------------------------------------------------------------
+
+} // namespace
+
+u8 liveBlockCategory(const LiveBlock& block) {
+    if (block.op == HookOp::MMAP) return u8(BLOCK_CATEGORY_COUNT - 1);
+    u8 c = 0;
+    for (u64 limit = 16; limit < block.size && c < BLOCK_CATEGORY_COUNT - 2; limit <<= 1) c++;
+    return c;
+}
+
+bool addressPyramidAdd(AddressPyramid& p, const LiveBlock& block) {
+    if (!ensureLevels(p)) return false;
+
+    u8 category = liveBlockCategory(block);
+    for (u32 level = 0; level < PYRAMID_LEVELS; level++) {
+        if (!updateLevel(p, level, block.address, block.size, category, true)) {
+            for (u32 i = 0; i < level; i++) updateLevel(p, i, block.address, block.size, category, false);
+            return false;
+        }
+    }
+    return true;
+}
+
+void addressPyramidRemove(AddressPyramid& p, const LiveBlock& block) {
+    if (!p.levels) return;
+
+    u8 category = liveBlockCategory(block);
+    for (u32 level = 0; level < PYRAMID_LEVELS; level++) {
+        updateLevel(p, level, block.address, block.size, category, false);
+    }
+}
+
+bool addressPyramidBuild(AddressPyramid& p, const IntervalIndex& idx) {
+    MEMVIZ_ZONE("addressPyramidBuild");
+
+    addressPyramidClear(p);
+    if (!ensureLevels(p)) return false;
+
+    bool ok = true;
+    void* ctx[2] = { &p, &ok };
+    intervalIndexQuery(idx, 0, ~u64(0), [](const LiveBlock& block, void* userData) {
+        void** ctx = reinterpret_cast<void**>(userData);
+        AddressPyramid& p = *reinterpret_cast<AddressPyramid*>(ctx[0]);
+        bool& ok = *reinterpret_cast<bool*>(ctx[1]);
+        ok = updateLevel(p, 0, block.address, block.size, liveBlockCategory(block), true);
+        return ok;
+    }, ctx);
+
+    // Bins of a level partition the bins of the next one, so sums carry over. Blocks too wide for a level have no bins
+    // there and are added to the next level directly.
+    Level* levels = levelsOf(p);
+    for (u32 level = 0; ok && level + 1 < PYRAMID_LEVELS; level++) {
+        const Level& from = levels[level];
+        Level& to = levels[level + 1];
+
+        u64 before = to.table.count;
+        for (u64 i = 0; ok && i < from.table.capacity; i++) {
+            if (from.table.keys[i] == EMPTY_KEY) continue;
+            u64 slot = findOrInsertBin(to.table, from.table.keys[i] >> PYRAMID_LEVEL_SHIFT);
+            if (slot == NO_SLOT) {
+                ok = false;
+                break;
+            }
+            const Bin& child = from.table.bins[i];
+            Bin& parent = to.table.bins[slot];
+            parent.liveBytes += child.liveBytes;
+            parent.blocks += child.blocks;
+            for (u32 c = 0; c < BLOCK_CATEGORY_COUNT; c++) parent.categoryBytes[c] += child.categoryBytes[c];
+        }
+        p.binCount += to.table.count - before;
+
+        for (u32 i = 0; ok && i < from.wideCount; i++) {
+            ok = updateLevel(p, level + 1, from.wide[i].address, from.wide[i].size, from.wide[i].category, true);
+        }
+    }
+
+    if (!ok) {
+        logErr("Out of memory building the address pyramid");
+        addressPyramidClear(p);
+    }
+    return ok;
+}
+
+void addressPyramidClear(AddressPyramid& p) {
+    Level* levels = levelsOf(p);
+    if (levels) {
+        for (u32 i = 0; i < PYRAMID_LEVELS; i++) {
+            freeTable(levels[i].table);
+            metaFree(levels[i].wide, levels[i].wideCapacity);
+        }
+        metaFree(levels, PYRAMID_LEVELS);
+    }
+    p = {};
+}
+
+bool addressPyramidOnChange(const LiveBlock* removed, const LiveBlock* added, void* p) {
+    AddressPyramid& pyramid = *reinterpret_cast<AddressPyramid*>(p);
+    if (removed) addressPyramidRemove(pyramid, *removed);
+    return !added || addressPyramidAdd(pyramid, *added);
+}
+
+u32 addressPyramidQuery(const AddressPyramid& p, u64 begin, u64 cellBytes, PyramidCell* out, u32 cellCount) {
+    MEMVIZ_ZONE("addressPyramidQuery");
+
+    if (cellCount == 0 || cellBytes == 0) return 0;
+    core::memset(out, 0, cellCount * sizeof(PyramidCell));
+    if (!p.levels) return 0;
+
+    u32 level = 0;
+    while (level + 1 < PYRAMID_LEVELS && (u64(1) << levelShift(level + 1)) <= cellBytes) level++;
+    u32 shift = levelShift(level);
+
+    QueryTarget q;
+    q.cells = out;
+    q.cellCount = cellCount;
+    q.begin = begin;
+    q.cellBytes = cellBytes;
+    q.end = cellBytes > (~u64(0) - begin) / cellCount ? ~u64(0) : begin + cellBytes * cellCount;
+
+    // Bins are no larger than a cell, up to 8 probes per cell. Only cells larger than the top level bins take more.
+    const Level& lvl = levelsOf(p)[level];
+    if (lvl.table.count > 0) {
+        u64 lastBin = (q.end - 1) >> shift;
+        for (u64 b = begin >> shift; b <= lastBin; b++) {
+            u64 slot = findBin(lvl.table, b);
+            if (slot == NO_SLOT) continue;
+            const Bin& bin = lvl.table.bins[slot];
+            u8 category = dominantCategory(bin);
+            u64 lo = b << shift;
+            spread(q, lo, lo + (u64(1) << shift), bin.liveBytes, bin.categoryBytes[category], category, bin.blocks);
+        }
+    }
+    for (u32 i = 0; i < lvl.wideCount; i++) {
+        const WideBlock& w = lvl.wide[i];
+        spread(q, w.address, w.address + w.size, w.size, w.size, w.category, w.address >= begin ? 1 : 0);
+    }
+
+    u32 filled = 0;
+    for (u32 i = 0; i < cellCount; i++) {
+        if (out[i].liveBytes > 0 || out[i].blocks > 0) filled++;
+    }
+    return filled;
+}
+
+} // namespace memviz
@@ -0,0 +1,342 @@
+#include "systems/allocators.h"
+
+#include "basic.h"
+#include "systems/logger.h"
+
+#include <atomic>
+
+#include <stdlib.h>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr addr_size ARENA_ALIGNMENT = 16;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN ALLOCATOR TYPES ----------------------------------------------------
+
+// General heap allocations of the calling thread, from the heaps that count for the frame check.
+thread_local u64 t_checkedHeapAllocs = 0;
+
+struct AtomicAllocatorStats {
+    std::atomic<u64> liveBytes;
+    std::atomic<u64> peakBytes;
+    std::atomic<u64> allocCount;
+    std::atomic<u64> freeCount;
+    std::atomic<u64> failedAllocs;
+
+    void onAlloc(u64 bytes) {
+        u64 live = liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        u64 peak = peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void onFree(u64 bytes) {
+        liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        freeCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    AllocatorStats load() const {
+        AllocatorStats ret;
+        ret.liveBytes = liveBytes.load(std::memory_order_relaxed);
+        ret.peakBytes = peakBytes.load(std::memory_order_relaxed);
+        ret.allocCount = allocCount.load(std::memory_order_relaxed);
+        ret.freeCount = freeCount.load(std::memory_order_relaxed);
+        ret.failedAllocs = failedAllocs.load(std::memory_order_relaxed);
+        return ret;
+    }
+};
+
+// malloc with statistics. Core passes the size back on free, so no header is needed.
+struct TrackedHeap {
+    AtomicAllocatorStats stats;
+    bool countsForFrameCheck;
+
+    void* alloc(addr_size count, addr_size size) noexcept {
+        void* p = malloc(count * size);
+        if (!p) {
+            stats.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        stats.onAlloc(count * size);
+        if (countsForFrameCheck) t_checkedHeapAllocs++;
+        return p;
+    }
+
+    void* zeroAlloc(addr_size count, addr_size size) noexcept {
+        void* p = calloc(count, size);
+        if (!p) {
+            stats.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        stats.onAlloc(count * size);
+        if (countsForFrameCheck) t_checkedHeapAllocs++;
+        return p;
+    }
+
+    void free(void* ptr, addr_size count, addr_size size) noexcept {
+        if (!ptr) return;
+        stats.onFree(count * size);
+        ::free(ptr);
+    }
+
+    void clear() noexcept {}
+    addr_size totalMemoryAllocated() noexcept { return addr_size(stats.peakBytes.load(std::memory_order_relaxed)); }
+    addr_size inUseMemory() noexcept { return addr_size(stats.liveBytes.load(std::memory_order_relaxed)); }
+};
+
+// Main thread only.
+struct FrameArena {
+    u8* data;
+    addr_size capacity;
+    addr_size offset;
+    addr_size lastOffset; // Start of the latest allocation, which free can roll back.
+    AtomicAllocatorStats stats;
+
+    void* alloc(addr_size count, addr_size size) noexcept {
+        addr_size bytes = count * size;
+        addr_size start = (offset + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+        if (!data || start + bytes > capacity) {
+            stats.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        lastOffset = start;
+        offset = start + bytes;
+        stats.onAlloc(bytes);
+        return data + start;
+    }
+
+    void* zeroAlloc(addr_size count, addr_size size) noexcept {
+        void* p = alloc(count, size);
+        if (p) core::memset(p, 0, count * size);
+        return p;
+    }
+
+    void free(void* ptr, addr_size count, addr_size size) noexcept {
+        if (!ptr) return;
+        stats.onFree(count * size);
+        if (reinterpret_cast<u8*>(ptr) == data + lastOffset && lastOffset + count * size == offset) {
+            offset = lastOffset;
+        }
+    }
+
+    void clear() noexcept {
+        offset = 0;
+        lastOffset = 0;
+        stats.liveBytes.store(0, std::memory_order_relaxed);
+    }
+
+    addr_size totalMemoryAllocated() noexcept { return capacity; }
+    addr_size inUseMemory() noexcept { return offset; }
+};
+
+// Fixed size slots. Free slots form an intrusive list, chunks come from the default heap and are kept until shutdown.
+struct Pool {
+    struct FreeSlot { FreeSlot* next; };
+    struct Chunk { Chunk* next; };
+
+    addr_size slotSize;
+    FreeSlot* freeList;
+    Chunk* chunks;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    AtomicAllocatorStats stats;
+
+    void acquire() { while (lock.test_and_set(std::memory_order_acquire)) {} }
+    void release() { lock.clear(std::memory_order_release); }
+
+    bool grow() {
+        // The chunk header takes the first slot, so every slot keeps the heap's alignment.
+        auto& heap = core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID));
+        u8* raw = reinterpret_cast<u8*>(heap.alloc(addr_size(POOL_SLOTS_PER_CHUNK) + 1, slotSize));
+        if (!raw) return false;
+
+        Chunk* c = reinterpret_cast<Chunk*>(raw);
+        c->next = chunks;
+        chunks = c;
+        for (u32 i = POOL_SLOTS_PER_CHUNK; i > 0; i--) {
+            FreeSlot* s = reinterpret_cast<FreeSlot*>(raw + addr_size(i) * slotSize);
+            s->next = freeList;
+            freeList = s;
+        }
+        return true;
+    }
+
+    void* alloc(addr_size count, addr_size size) noexcept {
+        addr_size bytes = count * size;
+        if (bytes > slotSize) {
+            return core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, size);
+        }
+
+        acquire();
+        if (!freeList && !grow()) {
+            release();
+            stats.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        FreeSlot* s = freeList;
+        freeList = s->next;
+        release();
+
+        stats.onAlloc(slotSize);
+        return s;
+    }
+
+    void* zeroAlloc(addr_size count, addr_size size) noexcept {
+        void* p = alloc(count, size);
+        if (p) core::memset(p, 0, count * size);
+        return p;
+    }
+
+    void free(void* ptr, addr_size count, addr_size size) noexcept {
+        if (!ptr) return;
+        if (count * size > slotSize) {
+            core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(ptr, count, size);
+            return;
+        }
+
+        stats.onFree(slotSize);
+        FreeSlot* s = reinterpret_cast<FreeSlot*>(ptr);
+        acquire();
+        s->next = freeList;
+        freeList = s;
+        release();
+    }
+
+    void clear() noexcept {}
+    addr_size totalMemoryAllocated() noexcept { return addr_size(stats.peakBytes.load(std::memory_order_relaxed)); }
+    addr_size inUseMemory() noexcept { return addr_size(stats.liveBytes.load(std::memory_order_relaxed)); }
+
+    void destroy() {
+        auto& heap = core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID));
+        while (chunks) {
+            Chunk* next = chunks->next;
+            heap.free(chunks, addr_size(POOL_SLOTS_PER_CHUNK) + 1, slotSize);
+            chunks = next;
+        }
+        freeList = nullptr;
+    }
+};
+
+// ------------------------------------------ END ALLOCATOR TYPES ------------------------------------------------------
+
+// ------------------------------------------ BEGIN REGISTRY STATE -----------------------------------------------------
+
+TrackedHeap g_defaultHeap;
+// Separate instance so the Vulkan driver's host memory can be swapped for a different backing allocator without
+// affecting the rest of the program.
+TrackedHeap g_vulkanHostBackingHeap;
+TrackedHeap g_loggerHeap;
+FrameArena g_frameArena;
+Pool g_pool32;
+Pool g_pool64;
+Pool g_pool128;
+Pool g_pool1024;
+
+struct RegistryEntry {
+    const char* name;
+    AtomicAllocatorStats* stats;
+};
+
+RegistryEntry g_registry[ALLOCATOR_ID_SENTINEL] = {};
+
+// Main thread.
+u64 g_frames = 0;
+u64 g_lastHeapAllocs = 0;
+u64 g_framesWithHeapAllocs = 0;
+
+// ------------------------------------------ END REGISTRY STATE -------------------------------------------------------
+
+template <typename TAllocator>
+void registerNamed(TAllocator& allocator, AllocatorId id, const char* name) {
+    core::registerAllocator(core::createAllocatorCtx(&allocator), id);
+    g_registry[id] = { name, &allocator.stats };
+}
+
+} // namespace
+
+void allocatorsRegister() {
+    // Heap allocations of these fail the steady state check, the Vulkan driver allocates whenever it likes.
+    g_defaultHeap.countsForFrameCheck = true;
+    g_loggerHeap.countsForFrameCheck = true;
+
+    registerNamed(g_defaultHeap, DEFAULT_ALLOCATOR_ID, "default heap");
+    registerNamed(g_vulkanHostBackingHeap, VULKAN_HOST_ALLOCATOR_ID, "vulkan host heap");
+    registerNamed(g_loggerHeap, LOGGER_ALLOCATOR_ID, "logger heap");
+
+    g_frameArena.data = reinterpret_cast<u8*>(g_defaultHeap.alloc(FRAME_ARENA_SIZE, sizeof(u8)));
+    g_frameArena.capacity = g_frameArena.data ? FRAME_ARENA_SIZE : 0;
+    registerNamed(g_frameArena, FRAME_ARENA_ALLOCATOR_ID, "frame arena");
+
+    g_pool32.slotSize = 32;
+    g_pool64.slotSize = 64;
+    g_pool128.slotSize = 128;
+    g_pool1024.slotSize = 1024;
+    registerNamed(g_pool32, POOL_32_ALLOCATOR_ID, "pool 32");
+    registerNamed(g_pool64, POOL_64_ALLOCATOR_ID, "pool 64");
+    registerNamed(g_pool128, POOL_128_ALLOCATOR_ID, "pool 128");
+    registerNamed(g_pool1024, POOL_1024_ALLOCATOR_ID, "pool 1024");
+}
+
+void allocatorsShutdown() {
+    g_pool32.destroy();
+    g_pool64.destroy();
+    g_pool128.destroy();
+    g_pool1024.destroy();
+
+    g_defaultHeap.free(g_frameArena.data, FRAME_ARENA_SIZE, sizeof(u8));
+    g_frameArena.data = nullptr;
+    g_frameArena.capacity = 0;
+    g_frameArena.clear();
+}
+
+const char* allocatorName(AllocatorId id) {
+    return id < ALLOCATOR_ID_SENTINEL && g_registry[id].name ? g_registry[id].name : "unknown";
+}
+
+AllocatorStats allocatorStats(AllocatorId id) {
+    if (id >= ALLOCATOR_ID_SENTINEL || !g_registry[id].stats) return {};
+    return g_registry[id].stats->load();
+}
+
+void allocatorsLogStats() {
+    logInfo("Allocators:");
+    for (u32 i = 0; i < ALLOCATOR_ID_SENTINEL; i++) {
+        if (!g_registry[i].stats) continue;
+        AllocatorStats s = g_registry[i].stats->load();
+        logInfo("\t{}: live {} B, peak {} B, {} allocs, {} frees, {} failed",
+                g_registry[i].name, s.liveBytes, s.peakBytes, s.allocCount, s.freeCount, s.failedAllocs);
+    }
+    logInfo("\t{} of {} frames past warmup allocated from the heap", g_framesWithHeapAllocs,
+            g_frames > ALLOCATOR_WARMUP_FRAMES ? g_frames - ALLOCATOR_WARMUP_FRAMES : 0);
+}
+
+void allocatorsBeginFrame() {
+    g_frameArena.clear();
+
+    u64 heapAllocs = t_checkedHeapAllocs;
+    if (g_frames > ALLOCATOR_WARMUP_FRAMES && heapAllocs != g_lastHeapAllocs) {
+        g_framesWithHeapAllocs++;
+        logWarnTaggedLimited(1, ALL_TAG, "Frame {} made {} heap allocations", g_frames, heapAllocs - g_lastHeapAllocs);
+    }
+    g_lastHeapAllocs = heapAllocs;
+    g_frames++;
+}
+
+u64 allocatorsFramesWithHeapAllocs() {
+    return g_framesWithHeapAllocs;
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
@@ -0,0 +1,131 @@
+#include "systems/block_benchmark.h"
+
+#include "basic.h"
+#include "systems/profiler.h"
+#include "systems/renderer/renderer.h"
+
+namespace memviz {
+
+namespace {
+
+constexpr u32 CHUNK_BLOCKS = 64 * 1024;
+constexpr u32 GRANULE_SHIFT = 4; // malloc granularity
+constexpr u32 HEAP_LAYER = 0;
+constexpr u32 MMAP_LAYER = 1;
+constexpr u32 MMAP_EVERY_NTH = 64; // one in 64 allocations is page backed
+
+constexpr u64 BASE_ADDRESS = 0x5555'0000'0000ull;
+constexpr u32 LAYER_COUNT = 2;
+
+struct BenchLayer {
+    u32 total;
+    u32 uploaded;
+    u32 generated;
+    u32 chunkFirst; // index of g_chunks[layer][0]
+    u32 nextOffset; // granules
+};
+
+BenchLayer g_layers[LAYER_COUNT] = {};
+BlockInstance g_chunks[LAYER_COUNT][CHUNK_BLOCKS];
+u64 g_rng = 0x9E3779B97F4A7C15ull;
+bool g_active = false;
+BlockLayout g_layout = BlockLayout::ROWS;
+
+inline u64 nextRandom() {
+    // xorshift64*, deterministic so renderer changes are measured on the same data.
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Mostly small allocations with a long tail, similar to what real heaps look like.
+u32 randomSizeGranules(u32 layer) {
+    u64 r = nextRandom();
+    if (layer == MMAP_LAYER) return u32(256 + (r % 16) * 256); // 4 KiB .. 64 KiB
+    u32 shift = u32(r % 8);
+    return u32(1 + ((r >> 8) % (2u << shift)));
+}
+
+void generateChunk(u32 layer, u32 count) {
+    BenchLayer& l = g_layers[layer];
+    l.chunkFirst = l.generated;
+    l.generated += count;
+
+    for (u32 i = 0; i < count; i++) {
+        BlockInstance& b = g_chunks[layer][i];
+        u64 r = nextRandom();
+        b.offset = l.nextOffset;
+        b.size = randomSizeGranules(layer);
+        b.category = u32(r % BLOCK_CATEGORY_COUNT);
+        // Leave holes for freed blocks.
+        l.nextOffset += b.size + ((r >> 16) % 4 == 0 ? b.size : 0);
+    }
+}
+
+} // namespace
+
+void blockBenchmarkStart(u32 blockCount, BlockLayout layout) {
+    g_layout = layout;
+    g_layers[MMAP_LAYER] = {};
+    g_layers[MMAP_LAYER].total = blockCount / MMAP_EVERY_NTH;
+    g_layers[HEAP_LAYER] = {};
+    g_layers[HEAP_LAYER].total = blockCount - g_layers[MMAP_LAYER].total;
+
+    BlockLayerDesc heapDesc = {};
+    heapDesc.baseAddress = BASE_ADDRESS;
+    heapDesc.granuleShift = GRANULE_SHIFT;
+    heapDesc.capacity = g_layers[HEAP_LAYER].total;
+    Renderer::setBlockLayer(HEAP_LAYER, heapDesc);
+
+    // Drawn over the heap layer, standing in for page backed allocations inside the same range.
+    BlockLayerDesc mmapDesc = heapDesc;
+    mmapDesc.capacity = g_layers[MMAP_LAYER].total;
+    Renderer::setBlockLayer(MMAP_LAYER, mmapDesc);
+
+    g_active = true;
+    logInfo("Block benchmark: {} heap blocks, {} mmap blocks", g_layers[HEAP_LAYER].total, g_layers[MMAP_LAYER].total);
+}
+
+bool blockBenchmarkUpdate() {
+    MEMVIZ_ZONE("blockBenchmarkUpdate");
+    if (!g_active) return false;
+
+    bool pending = false;
+    for (u32 layer = 0; layer < LAYER_COUNT; layer++) {
+        BenchLayer& l = g_layers[layer];
+
+        while (l.uploaded < l.total) {
+            // A new chunk is generated only once the previous one was fully accepted by the upload ring.
+            if (l.uploaded == l.generated) {
+                u32 remaining = l.total - l.uploaded;
+                generateChunk(layer, remaining < CHUNK_BLOCKS ? remaining : CHUNK_BLOCKS);
+            }
+
+            u32 inChunk = l.generated - l.uploaded;
+            const BlockInstance* src = &g_chunks[layer][l.uploaded - l.chunkFirst];
+            u32 accepted = Renderer::uploadBlocks(layer, l.uploaded, src, inChunk);
+            l.uploaded += accepted;
+            if (accepted < inChunk) break; // this frame's share of the ring is used up
+        }
+
+        Renderer::setBlockCount(layer, l.uploaded);
+        if (l.uploaded < l.total) pending = true;
+    }
+
+    // Fit the whole heap layer on screen.
+    BlockView view = {};
+    view.baseAddress = BASE_ADDRESS;
+    view.rowCount = 720;
+    view.layout = g_layout;
+    view.bytesPerRow = (u64(g_layers[HEAP_LAYER].nextOffset) << GRANULE_SHIFT) / view.rowCount + 1;
+    Renderer::setBlockView(view);
+
+    return pending;
+}
+
+bool blockBenchmarkIsActive() {
+    return g_active;
+}
+
+} // namespace memviz
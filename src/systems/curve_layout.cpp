@@ -0,0 +1,454 @@
+#include "systems/curve_layout.h"
+
+#include "basic.h"
+
+#include "systems/logger.h"
+
+#include <bit>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define MEMVIZ_CURVE_X86 1
+    #include <immintrin.h>
+#endif
+
+namespace memviz {
+
+namespace {
+
+// The Hilbert mapping is the branch free one from "2D Hilbert curves in O(1)" (rawrunprotected.com). Every bit of the
+// coordinates is processed at once: the orientation of every level is a prefix scan over the bit planes, done in
+// log2(16) rounds of shifts and logic. There are no tables and no per level loop, so the same code runs on 8 lanes.
+// Everything works on 16 bit planes, the coordinates are moved to the top of the plane and the index back down.
+
+using EncodeFn = void (*)(u32 order, const u32* x, const u32* y, u32* indices, u32 count);
+using DecodeFn = void (*)(u32 order, const u32* indices, u32* x, u32* y, u32 count);
+
+constexpr u32 CURVE_KIND_COUNT = u32(CurveKind::SENTINEL);
+constexpr u32 PLANE_MASK = 0xFFFF;
+constexpr u32 EVEN_BITS = 0x55555555;
+
+// ------------------------------------------ BEGIN SCALAR KERNELS -----------------------------------------------------
+
+// Spreads the low 16 bits of v to the even bits.
+inline u32 spreadBits(u32 v) {
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Inverse of spreadBits, gathers the even bits of v.
+inline u32 compactBits(u32 v) {
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+// Bit i becomes the xor of bits i to 15.
+inline u32 prefixXor(u32 v) {
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v;
+}
+
+inline void hilbertRound(u32& A, u32& B, u32& C, u32& D, u32 s) {
+    u32 a = A, b = B, c = C, d = D;
+    A = (a & (a >> s)) ^ (b & (b >> s));
+    B = (a & (b >> s)) ^ (b & ((a ^ b) >> s));
+    C ^= (a & (c >> s)) ^ (b & (d >> s));
+    D ^= (b & (c >> s)) ^ ((a ^ b) & (d >> s));
+}
+
+// The two bit planes of the index of the cell (x, y), still to be interleaved: i1 holds the odd bits, i0 the even.
+inline void hilbertPlanes(u32 order, u32 x, u32 y, u32& i0, u32& i1) {
+    x <<= 16 - order;
+    y <<= 16 - order;
+
+    u32 A, B, C, D;
+    {
+        u32 a = x ^ y;
+        u32 b = PLANE_MASK ^ a;
+        u32 c = PLANE_MASK ^ (x | y);
+        u32 d = x & (y ^ PLANE_MASK);
+        A = a | (b >> 1);
+        B = (a >> 1) ^ a;
+        C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+        D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+    }
+    hilbertRound(A, B, C, D, 2);
+    hilbertRound(A, B, C, D, 4);
+    {
+        // Only C and D are needed after the last round.
+        u32 a = A, b = B, c = C, d = D;
+        C ^= (a & (c >> 8)) ^ (b & (d >> 8));
+        D ^= (b & (c >> 8)) ^ ((a ^ b) & (d >> 8));
+    }
+
+    u32 a = C ^ (C >> 1);
+    u32 b = D ^ (D >> 1);
+    i0 = x ^ y;
+    i1 = b | (PLANE_MASK ^ (i0 | a));
+}
+
+// Inverse of hilbertPlanes, i0 and i1 are the deinterleaved index moved to the top of the plane.
+inline void hilbertPoint(u32 order, u32 i0, u32 i1, u32& x, u32& y) {
+    u32 p0 = prefixXor((i0 | i1) ^ PLANE_MASK);
+    u32 p1 = prefixXor(i0 & i1);
+    u32 a = ((i0 ^ PLANE_MASK) & p1) | (i0 & p0);
+    x = (a ^ i1) >> (16 - order);
+    y = (a ^ i0 ^ i1) >> (16 - order);
+}
+
+inline u32 hilbertIndexScalar(u32 order, u32 x, u32 y) {
+    u32 i0, i1;
+    hilbertPlanes(order, x, y, i0, i1);
+    return ((spreadBits(i1) << 1) | spreadBits(i0)) >> (32 - 2 * order);
+}
+
+inline void hilbertPointScalar(u32 order, u32 index, u32& x, u32& y) {
+    index <<= 32 - 2 * order;
+    hilbertPoint(order, compactBits(index), compactBits(index >> 1), x, y);
+}
+
+void hilbertEncodeScalar(u32 order, const u32* x, const u32* y, u32* indices, u32 count) {
+    for (u32 i = 0; i < count; i++) indices[i] = hilbertIndexScalar(order, x[i], y[i]);
+}
+
+void hilbertDecodeScalar(u32 order, const u32* indices, u32* x, u32* y, u32 count) {
+    for (u32 i = 0; i < count; i++) hilbertPointScalar(order, indices[i], x[i], y[i]);
+}
+
+// Morton does not depend on the order, the index is just the interleaved coordinates.
+void mortonEncodeScalar(u32, const u32* x, const u32* y, u32* indices, u32 count) {
+    for (u32 i = 0; i < count; i++) indices[i] = spreadBits(x[i]) | (spreadBits(y[i]) << 1);
+}
+
+void mortonDecodeScalar(u32, const u32* indices, u32* x, u32* y, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        x[i] = compactBits(indices[i]);
+        y[i] = compactBits(indices[i] >> 1);
+    }
+}
+
+// ------------------------------------------ END SCALAR KERNELS -------------------------------------------------------
+
+#if defined(MEMVIZ_CURVE_X86)
+
+PRAGMA_WARNING_PUSH
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+// ------------------------------------------ BEGIN BMI2 KERNELS -------------------------------------------------------
+
+// pdep and pext replace the four shift and mask rounds of every spread and compact with one instruction each. Only
+// called after the runtime check passed.
+
+__attribute__((target("bmi2")))
+void hilbertEncodeBmi2(u32 order, const u32* x, const u32* y, u32* indices, u32 count) {
+    u32 shift = 32 - 2 * order;
+    for (u32 i = 0; i < count; i++) {
+        u32 i0, i1;
+        hilbertPlanes(order, x[i], y[i], i0, i1);
+        indices[i] = (_pdep_u32(i1, ~EVEN_BITS) | _pdep_u32(i0, EVEN_BITS)) >> shift;
+    }
+}
+
+__attribute__((target("bmi2")))
+void hilbertDecodeBmi2(u32 order, const u32* indices, u32* x, u32* y, u32 count) {
+    u32 shift = 32 - 2 * order;
+    for (u32 i = 0; i < count; i++) {
+        u32 index = indices[i] << shift;
+        hilbertPoint(order, _pext_u32(index, EVEN_BITS), _pext_u32(index, ~EVEN_BITS), x[i], y[i]);
+    }
+}
+
+__attribute__((target("bmi2")))
+void mortonEncodeBmi2(u32, const u32* x, const u32* y, u32* indices, u32 count) {
+    for (u32 i = 0; i < count; i++) indices[i] = _pdep_u32(x[i], EVEN_BITS) | _pdep_u32(y[i], ~EVEN_BITS);
+}
+
+__attribute__((target("bmi2")))
+void mortonDecodeBmi2(u32, const u32* indices, u32* x, u32* y, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        x[i] = _pext_u32(indices[i], EVEN_BITS);
+        y[i] = _pext_u32(indices[i], ~EVEN_BITS);
+    }
+}
+
+// ------------------------------------------ END BMI2 KERNELS ---------------------------------------------------------
+
+// ------------------------------------------ BEGIN AVX2 KERNELS -------------------------------------------------------
+
+// The scalar kernels 8 lanes at a time, the tails go through the scalar loops. AVX2 has no per lane pdep, the spreads
+// use the shift and mask rounds. Only called after the runtime check passed.
+
+__attribute__((target("avx2")))
+inline __m256i spreadBitsAvx2(__m256i v) {
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x00FF00FF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x33333333));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 1)), _mm256_set1_epi32(0x55555555));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline __m256i compactBitsAvx2(__m256i v) {
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0x55555555));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 1)), _mm256_set1_epi32(0x33333333));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 2)), _mm256_set1_epi32(0x0F0F0F0F));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 4)), _mm256_set1_epi32(0x00FF00FF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 8)), _mm256_set1_epi32(0x0000FFFF));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline __m256i prefixXorAvx2(__m256i v) {
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 8));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 4));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 2));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 1));
+    return v;
+}
+
+template <i32 S>
+__attribute__((target("avx2")))
+inline void hilbertRoundAvx2(__m256i& A, __m256i& B, __m256i& C, __m256i& D) {
+    __m256i a = A, b = B, c = C, d = D;
+    __m256i ab = _mm256_xor_si256(a, b);
+    __m256i cs = _mm256_srli_epi32(c, S);
+    __m256i ds = _mm256_srli_epi32(d, S);
+    A = _mm256_xor_si256(_mm256_and_si256(a, _mm256_srli_epi32(a, S)), _mm256_and_si256(b, _mm256_srli_epi32(b, S)));
+    B = _mm256_xor_si256(_mm256_and_si256(a, _mm256_srli_epi32(b, S)), _mm256_and_si256(b, _mm256_srli_epi32(ab, S)));
+    C = _mm256_xor_si256(C, _mm256_xor_si256(_mm256_and_si256(a, cs), _mm256_and_si256(b, ds)));
+    D = _mm256_xor_si256(D, _mm256_xor_si256(_mm256_and_si256(b, cs), _mm256_and_si256(ab, ds)));
+}
+
+__attribute__((target("avx2")))
+void hilbertEncodeAvx2(u32 order, const u32* xs, const u32* ys, u32* indices, u32 count) {
+    const __m256i mask = _mm256_set1_epi32(i32(PLANE_MASK));
+    const __m128i up = _mm_cvtsi32_si128(i32(16 - order));
+    const __m128i down = _mm_cvtsi32_si128(i32(32 - 2 * order));
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i*)(xs + i)), up);
+        __m256i y = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i*)(ys + i)), up);
+
+        __m256i A, B, C, D;
+        {
+            __m256i a = _mm256_xor_si256(x, y);
+            __m256i b = _mm256_xor_si256(mask, a);
+            __m256i c = _mm256_xor_si256(mask, _mm256_or_si256(x, y));
+            __m256i d = _mm256_andnot_si256(y, x); // x & (y ^ mask), x has no bits above the plane
+            A = _mm256_or_si256(a, _mm256_srli_epi32(b, 1));
+            B = _mm256_xor_si256(_mm256_srli_epi32(a, 1), a);
+            C = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi32(c, 1),
+                                                  _mm256_and_si256(b, _mm256_srli_epi32(d, 1))), c);
+            D = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, _mm256_srli_epi32(c, 1)),
+                                                  _mm256_srli_epi32(d, 1)), d);
+        }
+        hilbertRoundAvx2<2>(A, B, C, D);
+        hilbertRoundAvx2<4>(A, B, C, D);
+        {
+            __m256i a = A, b = B, c = C, d = D;
+            __m256i cs = _mm256_srli_epi32(c, 8);
+            __m256i ds = _mm256_srli_epi32(d, 8);
+            C = _mm256_xor_si256(C, _mm256_xor_si256(_mm256_and_si256(a, cs), _mm256_and_si256(b, ds)));
+            D = _mm256_xor_si256(D, _mm256_xor_si256(_mm256_and_si256(b, cs),
+                                                     _mm256_and_si256(_mm256_xor_si256(a, b), ds)));
+        }
+
+        __m256i a = _mm256_xor_si256(C, _mm256_srli_epi32(C, 1));
+        __m256i b = _mm256_xor_si256(D, _mm256_srli_epi32(D, 1));
+        __m256i i0 = _mm256_xor_si256(x, y);
+        __m256i i1 = _mm256_or_si256(b, _mm256_xor_si256(mask, _mm256_or_si256(i0, a)));
+        __m256i index = _mm256_or_si256(_mm256_slli_epi32(spreadBitsAvx2(i1), 1), spreadBitsAvx2(i0));
+        _mm256_storeu_si256((__m256i*)(indices + i), _mm256_srl_epi32(index, down));
+    }
+    hilbertEncodeScalar(order, xs + i, ys + i, indices + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void hilbertDecodeAvx2(u32 order, const u32* indices, u32* xs, u32* ys, u32 count) {
+    const __m256i mask = _mm256_set1_epi32(i32(PLANE_MASK));
+    const __m128i up = _mm_cvtsi32_si128(i32(32 - 2 * order));
+    const __m128i down = _mm_cvtsi32_si128(i32(16 - order));
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i*)(indices + i)), up);
+        __m256i i0 = compactBitsAvx2(index);
+        __m256i i1 = compactBitsAvx2(_mm256_srli_epi32(index, 1));
+
+        __m256i p0 = prefixXorAvx2(_mm256_xor_si256(_mm256_or_si256(i0, i1), mask));
+        __m256i p1 = prefixXorAvx2(_mm256_and_si256(i0, i1));
+        __m256i a = _mm256_or_si256(_mm256_and_si256(_mm256_xor_si256(i0, mask), p1), _mm256_and_si256(i0, p0));
+        __m256i x = _mm256_xor_si256(a, i1);
+        __m256i y = _mm256_xor_si256(x, i0);
+        _mm256_storeu_si256((__m256i*)(xs + i), _mm256_srl_epi32(x, down));
+        _mm256_storeu_si256((__m256i*)(ys + i), _mm256_srl_epi32(y, down));
+    }
+    hilbertDecodeScalar(order, indices + i, xs + i, ys + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void mortonEncodeAvx2(u32 order, const u32* xs, const u32* ys, u32* indices, u32 count) {
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = spreadBitsAvx2(_mm256_loadu_si256((const __m256i*)(xs + i)));
+        __m256i y = spreadBitsAvx2(_mm256_loadu_si256((const __m256i*)(ys + i)));
+        _mm256_storeu_si256((__m256i*)(indices + i), _mm256_or_si256(x, _mm256_slli_epi32(y, 1)));
+    }
+    mortonEncodeScalar(order, xs + i, ys + i, indices + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void mortonDecodeAvx2(u32 order, const u32* indices, u32* xs, u32* ys, u32 count) {
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(indices + i));
+        _mm256_storeu_si256((__m256i*)(xs + i), compactBitsAvx2(index));
+        _mm256_storeu_si256((__m256i*)(ys + i), compactBitsAvx2(_mm256_srli_epi32(index, 1)));
+    }
+    mortonDecodeScalar(order, indices + i, xs + i, ys + i, count - i);
+}
+
+// ------------------------------------------ END AVX2 KERNELS ---------------------------------------------------------
+
+PRAGMA_WARNING_POP
+
+#endif // MEMVIZ_CURVE_X86
+
+EncodeFn g_encode[CURVE_KIND_COUNT] = { hilbertEncodeScalar, mortonEncodeScalar };
+DecodeFn g_decode[CURVE_KIND_COUNT] = { hilbertDecodeScalar, mortonDecodeScalar };
+
+bool simdLevelSupported(CurveSimdLevel level) {
+#if defined(MEMVIZ_CURVE_X86)
+    __builtin_cpu_init();
+    switch (level) {
+        case CurveSimdLevel::SCALAR: return true;
+        case CurveSimdLevel::BMI2:   return __builtin_cpu_supports("bmi2");
+        case CurveSimdLevel::AVX2:   return __builtin_cpu_supports("avx2");
+        default:                     return false;
+    }
+#else
+    return level == CurveSimdLevel::SCALAR;
+#endif
+}
+
+CurveSimdLevel detectSimdLevel() {
+    if (simdLevelSupported(CurveSimdLevel::AVX2)) return CurveSimdLevel::AVX2;
+    if (simdLevelSupported(CurveSimdLevel::BMI2)) return CurveSimdLevel::BMI2;
+    return CurveSimdLevel::SCALAR;
+}
+
+CurveSimdLevel simdLevelFromEnv(CurveSimdLevel detected) {
+    const char* v = getenv("MEMVIZ_CURVE_SIMD");
+    if (!v) return detected;
+
+    for (u32 i = 0; i < u32(CurveSimdLevel::SENTINEL); i++) {
+        CurveSimdLevel level = CurveSimdLevel(i);
+        if (strcmp(v, curveSimdLevelToCStr(level)) != 0) continue;
+        if (!simdLevelSupported(level)) {
+            logWarnTagged(RENDERER_TAG, "MEMVIZ_CURVE_SIMD={} is not supported by this CPU, using {}",
+                          v, curveSimdLevelToCStr(detected));
+            return detected;
+        }
+        return level;
+    }
+
+    logWarnTagged(RENDERER_TAG, "Ignoring unknown MEMVIZ_CURVE_SIMD value '{}'", v);
+    return detected;
+}
+
+} // namespace
+
+CurveSimdLevel curveLayoutInit() {
+    CurveSimdLevel level = simdLevelFromEnv(detectSimdLevel());
+
+    switch (level) {
+#if defined(MEMVIZ_CURVE_X86)
+        case CurveSimdLevel::AVX2:
+            g_encode[u32(CurveKind::HILBERT)] = hilbertEncodeAvx2;
+            g_decode[u32(CurveKind::HILBERT)] = hilbertDecodeAvx2;
+            g_encode[u32(CurveKind::MORTON)] = mortonEncodeAvx2;
+            g_decode[u32(CurveKind::MORTON)] = mortonDecodeAvx2;
+            break;
+        case CurveSimdLevel::BMI2:
+            g_encode[u32(CurveKind::HILBERT)] = hilbertEncodeBmi2;
+            g_decode[u32(CurveKind::HILBERT)] = hilbertDecodeBmi2;
+            g_encode[u32(CurveKind::MORTON)] = mortonEncodeBmi2;
+            g_decode[u32(CurveKind::MORTON)] = mortonDecodeBmi2;
+            break;
+#endif
+        default:
+            g_encode[u32(CurveKind::HILBERT)] = hilbertEncodeScalar;
+            g_decode[u32(CurveKind::HILBERT)] = hilbertDecodeScalar;
+            g_encode[u32(CurveKind::MORTON)] = mortonEncodeScalar;
+            g_decode[u32(CurveKind::MORTON)] = mortonDecodeScalar;
+            break;
+    }
+
+    return level;
+}
+
+u32 curveIndex(CurveKind kind, u32 order, u32 x, u32 y) {
+    Assert(order > 0 && order <= CURVE_MAX_ORDER);
+    if (kind == CurveKind::MORTON) return spreadBits(x) | (spreadBits(y) << 1);
+    return hilbertIndexScalar(order, x, y);
+}
+
+void curvePoint(CurveKind kind, u32 order, u32 index, u32& x, u32& y) {
+    Assert(order > 0 && order <= CURVE_MAX_ORDER);
+    if (kind == CurveKind::MORTON) {
+        x = compactBits(index);
+        y = compactBits(index >> 1);
+        return;
+    }
+    hilbertPointScalar(order, index, x, y);
+}
+
+void curveEncode(CurveKind kind, u32 order, const u32* x, const u32* y, u32* indices, u32 count) {
+    Assert(order > 0 && order <= CURVE_MAX_ORDER);
+    Assert(u32(kind) < CURVE_KIND_COUNT);
+    g_encode[u32(kind)](order, x, y, indices, count);
+}
+
+void curveDecode(CurveKind kind, u32 order, const u32* indices, u32* x, u32* y, u32 count) {
+    Assert(order > 0 && order <= CURVE_MAX_ORDER);
+    Assert(u32(kind) < CURVE_KIND_COUNT);
+    g_decode[u32(kind)](order, indices, x, y, count);
+}
+
+u32 curveSplitExtent(u32 order, u64 first, u64 count, u32* starts, u8* levels, u32 capacity) {
+    Assert(order > 0 && order <= CURVE_MAX_ORDER);
+
+    u64 total = u64(1) << (2 * order);
+    if (first >= total || count == 0) return 0;
+    u64 end = count > total - first ? total : first + count;
+
+    // Greedy from the left: the largest aligned run that starts at p and fits. The runs grow up to the largest
+    // alignment inside the extent and shrink after it, at most 3 of every size on each side.
+    u32 n = 0;
+    u64 p = first;
+    while (p < end && n < capacity) {
+        u32 k = p == 0 ? order : u32(std::countr_zero(p)) / 2;
+        if (k > order) k = order;
+        while (p + (u64(1) << (2 * k)) > end) k--;
+        starts[n] = u32(p);
+        levels[n] = u8(k);
+        n++;
+        p += u64(1) << (2 * k);
+    }
+
+    return n;
+}
+
+} // namespace memviz
@@ -0,0 +1,408 @@
+#include "systems/heap_view.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+#include "systems/profiler.h"
+#include "systems/renderer/renderer.h"
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 HEAP_LAYER = 0;
+constexpr u32 OVERLAY_LAYER = 1;
+constexpr u32 GRID_SIDE = 1u << HEAP_VIEW_ORDER;
+constexpr u32 GRID_CELLS = GRID_SIDE * GRID_SIDE;
+// Overlapping blocks share their cells, so there are rarely more squares than cells. An extent splits into at most 6
+// runs per level, but only blocks crossing many cells do.
+constexpr u32 MAX_SQUARES = 4 * GRID_CELLS;
+constexpr u32 MAX_CELL_SHIFT = 48 - 2 * HEAP_VIEW_ORDER; // The grid covers the whole 48 bit address space.
+constexpr u64 FIT_MIN_BYTES = u64(GRID_CELLS) << HEAP_VIEW_MIN_CELL_SHIFT;
+
+// Palette indices of the overlay, see shaders/blocks.frag.
+constexpr u32 OVERLAY_RED = 0;
+constexpr u32 OVERLAY_GREEN = 2;
+constexpr u32 OVERLAY_YELLOW = 3;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+CurveKind g_kind = CurveKind::HILBERT;
+bool g_active = false;
+bool g_dirty = false;        // Heap squares, and the overlay with them.
+bool g_overlayDirty = false; // Overlay squares only.
+bool g_fitted = false;
+
+u64 g_base = 0;
+u32 g_cellShift = PYRAMID_BASE_SHIFT;
+
+// Scratch of one rebuild, from the frame arena and only set while rebuilding. MAX_SQUARES entries each except for
+// g_cells and g_pageCells.
+PyramidCell* g_cells = nullptr; // GRID_CELLS
+u32* g_starts = nullptr;
+u8* g_levels = nullptr;
+u8* g_categories = nullptr;
+u32* g_xs = nullptr;
+u32* g_ys = nullptr;
+PageCell* g_pageCells = nullptr; // GRID_CELLS, only with an overlay
+
+BlockInstance* g_squares = nullptr;
+u32 g_squareCount = 0;
+u32 g_uploaded = 0;
+u64 g_lastCell = 0; // Last cell covered by the previous block while collecting, ~0 before the first.
+
+// Overlay, allocated when it is first shown.
+HeapOverlay g_overlay = HeapOverlay::NONE;
+HeapPageSource g_pageSource = nullptr;
+BlockInstance* g_overlaySquares = nullptr; // GRID_CELLS
+u32 g_overlayCount = 0;
+u32 g_overlayUploaded = 0;
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+template <typename T>
+T* frameAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(FRAME_ARENA_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void frameFree(T*& p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(FRAME_ARENA_ALLOCATOR_ID)).free(p, count, sizeof(T));
+    p = nullptr;
+}
+
+// In reverse, so the arena gets every byte back right away.
+void freeScratch() {
+    frameFree(g_pageCells, GRID_CELLS);
+    frameFree(g_ys, MAX_SQUARES);
+    frameFree(g_xs, MAX_SQUARES);
+    frameFree(g_categories, MAX_SQUARES);
+    frameFree(g_levels, MAX_SQUARES);
+    frameFree(g_starts, MAX_SQUARES);
+    frameFree(g_cells, GRID_CELLS);
+}
+
+bool allocScratch() {
+    g_cells = frameAlloc<PyramidCell>(GRID_CELLS);
+    g_starts = frameAlloc<u32>(MAX_SQUARES);
+    g_levels = frameAlloc<u8>(MAX_SQUARES);
+    g_categories = frameAlloc<u8>(MAX_SQUARES);
+    g_xs = frameAlloc<u32>(MAX_SQUARES);
+    g_ys = frameAlloc<u32>(MAX_SQUARES);
+    if (g_overlay != HeapOverlay::NONE) g_pageCells = frameAlloc<PageCell>(GRID_CELLS);
+    if (!g_cells || !g_starts || !g_levels || !g_categories || !g_xs || !g_ys ||
+        (g_overlay != HeapOverlay::NONE && !g_pageCells)) {
+        freeScratch();
+        return false;
+    }
+    return true;
+}
+
+// A rebuild keeps the uploaded squares up to the first one that changed, blocks coming and going far into the view do
+// not restart an upload that is still streaming.
+inline bool sameSquare(const BlockInstance& a, const BlockInstance& b) {
+    return a.offset == b.offset && a.size == b.size && a.category == b.category;
+}
+
+u64 viewEnd() {
+    return g_base + (u64(GRID_CELLS) << g_cellShift);
+}
+
+bool firstBlock(const LiveBlock& block, void* userData) {
+    *reinterpret_cast<LiveBlock*>(userData) = block;
+    return false;
+}
+
+// The view starts at the first block and spans twice the live bytes, rounded up to a whole cell size. Mappings far
+// above the heap are reached by zooming out.
+void fitView(const IntervalIndex& idx) {
+    LiveBlock first = {};
+    intervalIndexQuery(idx, 0, ~u64(0), firstBlock, &first);
+
+    u64 span = idx.liveBytes * 2 > FIT_MIN_BYTES ? idx.liveBytes * 2 : FIT_MIN_BYTES;
+    u32 shift = HEAP_VIEW_MIN_CELL_SHIFT;
+    while (shift < MAX_CELL_SHIFT && (u64(GRID_CELLS) << shift) < span) shift++;
+
+    g_cellShift = shift;
+    g_base = first.address & ~((u64(1) << shift) - 1);
+    g_fitted = true;
+    logInfoTagged(RENDERER_TAG, "Heap view: {} curve from {} with {} byte cells",
+                  curveKindToCStr(g_kind), g_base, u64(1) << g_cellShift);
+}
+
+bool collectBlock(const LiveBlock& block, void*) {
+    u64 end = viewEnd();
+    u64 begin = block.address > g_base ? block.address : g_base;
+    u64 last = block.address + block.size < end ? block.address + block.size : end;
+    if (last <= begin) return true;
+
+    u64 firstCell = (begin - g_base) >> g_cellShift;
+    u64 lastCell = (last - 1 - g_base) >> g_cellShift;
+    // Blocks come in address order, a cell the previous block already covers keeps that block's square.
+    if (g_squareCount > 0 && firstCell <= g_lastCell) firstCell = g_lastCell + 1;
+    if (firstCell > lastCell) return true;
+    g_lastCell = lastCell;
+
+    u32 n = curveSplitExtent(HEAP_VIEW_ORDER, firstCell, lastCell - firstCell + 1,
+                             g_starts + g_squareCount, g_levels + g_squareCount, MAX_SQUARES - g_squareCount);
+    u8 category = liveBlockCategory(block);
+    for (u32 i = 0; i < n; i++) g_categories[g_squareCount + i] = category;
+    g_squareCount += n;
+
+    if (g_squareCount == MAX_SQUARES) {
+        logWarnTaggedLimited(1, RENDERER_TAG, "Heap view: more than {} squares, the rest is not drawn", MAX_SQUARES);
+        return false;
+    }
+    return true;
+}
+
+void collectCells(const AddressPyramid& p) {
+    addressPyramidQuery(p, g_base, u64(1) << g_cellShift, g_cells, GRID_CELLS);
+    for (u32 i = 0; i < GRID_CELLS; i++) {
+        if (g_cells[i].liveBytes == 0) continue;
+        g_starts[g_squareCount] = i;
+        g_levels[g_squareCount] = 0;
+        g_categories[g_squareCount] = g_cells[i].category;
+        g_squareCount++;
+    }
+}
+
+void rebuild(const IntervalIndex& idx, const AddressPyramid& p) {
+    MEMVIZ_ZONE("heapView rebuild");
+
+    g_squareCount = 0;
+    g_lastCell = ~u64(0);
+
+    if (g_cellShift >= PYRAMID_BASE_SHIFT) collectCells(p);
+    else intervalIndexQuery(idx, g_base, viewEnd(), collectBlock, nullptr);
+
+    // Every run starts at a multiple of its length, so its square is the cell of the start with the low bits cleared.
+    curveDecode(g_kind, HEAP_VIEW_ORDER, g_starts, g_xs, g_ys, g_squareCount);
+    u32 kept = g_uploaded;
+    for (u32 i = 0; i < g_squareCount; i++) {
+        u32 side = 1u << g_levels[i];
+        BlockInstance s;
+        s.offset = (g_xs[i] & ~(side - 1)) | ((g_ys[i] & ~(side - 1)) << 16);
+        s.size = side;
+        s.category = g_categories[i];
+        if (i < kept && !sameSquare(g_squares[i], s)) kept = i;
+        g_squares[i] = s;
+    }
+    g_uploaded = kept < g_squareCount ? kept : g_squareCount;
+}
+
+// One square per cell with pages in the overlay's state, the cells go through the curve like the heap's do.
+void rebuildOverlay() {
+    MEMVIZ_ZONE("heapView rebuildOverlay");
+
+    g_overlayCount = 0;
+    if (g_overlay == HeapOverlay::NONE || !g_pageSource || !g_pageCells ||
+        g_pageSource(g_base, u64(1) << g_cellShift, g_pageCells, GRID_CELLS) == 0) {
+        g_overlayUploaded = 0;
+        return;
+    }
+
+    for (u32 i = 0; i < GRID_CELLS; i++) {
+        const PageCell& c = g_pageCells[i];
+        if (c.pages == 0) continue;
+
+        u32 category;
+        if (g_overlay == HeapOverlay::RESIDENT) {
+            if (c.swapped > 0) category = OVERLAY_RED;
+            else if (c.resident > 0) category = OVERLAY_GREEN;
+            else continue;
+        }
+        else {
+            if (c.written == 0) continue;
+            // Hot when the average written page was written in half of the intervals.
+            category = c.writes * 2 >= c.written * PAGE_SAMPLER_HISTORY ? OVERLAY_RED : OVERLAY_YELLOW;
+        }
+        g_starts[g_overlayCount] = i;
+        g_categories[g_overlayCount] = u8(category);
+        g_overlayCount++;
+    }
+
+    curveDecode(g_kind, HEAP_VIEW_ORDER, g_starts, g_xs, g_ys, g_overlayCount);
+    u32 kept = g_overlayUploaded;
+    for (u32 i = 0; i < g_overlayCount; i++) {
+        BlockInstance s;
+        s.offset = g_xs[i] | (g_ys[i] << 16);
+        s.size = 1;
+        s.category = g_categories[i];
+        if (i < kept && !sameSquare(g_overlaySquares[i], s)) kept = i;
+        g_overlaySquares[i] = s;
+    }
+    g_overlayUploaded = kept < g_overlayCount ? kept : g_overlayCount;
+}
+
+u32 uploadSquares(u32 layer, const BlockInstance* squares, u32 count, u32 uploaded) {
+    while (uploaded < count) {
+        u32 accepted = Renderer::uploadBlocks(layer, uploaded, squares + uploaded, count - uploaded);
+        uploaded += accepted;
+        if (accepted == 0) break; // this frame's share of the ring is used up
+    }
+    Renderer::setBlockCount(layer, uploaded);
+    return uploaded;
+}
+
+bool pixelToCell(i32 x, i32 y, u32 width, u32 height, u32& cx, u32& cy) {
+    if (x < 0 || y < 0 || width == 0 || height == 0 || u32(x) >= width || u32(y) >= height) return false;
+    cx = u32(u64(x) * GRID_SIDE / width);
+    cy = u32(u64(y) * GRID_SIDE / height);
+    return true;
+}
+
+} // namespace
+
+bool heapViewStart(CurveKind kind) {
+    g_squares = metaAlloc<BlockInstance>(MAX_SQUARES);
+    if (!g_squares) {
+        logErrTagged(RENDERER_TAG, "Out of memory for the heap view");
+        heapViewStop();
+        return false;
+    }
+
+    CurveSimdLevel simd = curveLayoutInit();
+    logInfoTagged(RENDERER_TAG, "Heap view: {} curve, {} kernels", curveKindToCStr(kind), curveSimdLevelToCStr(simd));
+
+    BlockLayerDesc desc = {};
+    desc.capacity = MAX_SQUARES;
+    Renderer::setBlockLayer(HEAP_LAYER, desc);
+
+    BlockView view = {};
+    view.bytesPerRow = 1;
+    view.rowCount = GRID_SIDE;
+    view.layout = BlockLayout::SQUARES;
+    Renderer::setBlockView(view);
+
+    g_kind = kind;
+    g_active = true;
+    g_dirty = true;
+    g_fitted = false;
+    return true;
+}
+
+void heapViewStop() {
+    metaFree(g_squares, MAX_SQUARES);
+    metaFree(g_overlaySquares, GRID_CELLS);
+    g_squares = nullptr;
+    g_overlaySquares = nullptr;
+    g_squareCount = 0;
+    g_uploaded = 0;
+    g_overlay = HeapOverlay::NONE;
+    g_overlayCount = 0;
+    g_overlayUploaded = 0;
+    g_dirty = false;
+    g_overlayDirty = false;
+    g_active = false;
+}
+
+bool heapViewIsActive() {
+    return g_active;
+}
+
+void heapViewMarkDirty() {
+    g_dirty = true;
+}
+
+void heapViewMarkOverlayDirty() {
+    g_overlayDirty = true;
+}
+
+bool heapViewUpdate(const IntervalIndex& idx, const AddressPyramid& p) {
+    MEMVIZ_ZONE("heapViewUpdate");
+    if (!g_active) return false;
+
+    // However many marks came in since the last update, they cost one rebuild.
+    bool dirty = g_dirty || g_overlayDirty;
+    if (dirty && allocScratch()) {
+        if (g_dirty) {
+            if (!g_fitted && idx.count > 0) fitView(idx);
+            rebuild(idx, p);
+        }
+        rebuildOverlay();
+        freeScratch();
+        g_dirty = false;
+        g_overlayDirty = false;
+    }
+    else if (dirty) {
+        logErrTaggedLimited(1, RENDERER_TAG, "The frame arena can not hold the heap view rebuild");
+    }
+
+    g_uploaded = uploadSquares(HEAP_LAYER, g_squares, g_squareCount, g_uploaded);
+    // The overlay goes up once the heap is complete, it has to cover it.
+    if (g_uploaded == g_squareCount) {
+        g_overlayUploaded = uploadSquares(OVERLAY_LAYER, g_overlaySquares, g_overlayCount, g_overlayUploaded);
+    }
+
+    return g_uploaded < g_squareCount || g_overlayUploaded < g_overlayCount;
+}
+
+void heapViewSetOverlay(HeapOverlay overlay, HeapPageSource source) {
+    if (!g_active) return;
+    if (!source) overlay = HeapOverlay::NONE;
+
+    if (overlay != HeapOverlay::NONE && !g_overlaySquares) {
+        g_overlaySquares = metaAlloc<BlockInstance>(GRID_CELLS);
+        if (!g_overlaySquares) {
+            logErrTagged(RENDERER_TAG, "Out of memory for the heap view overlay");
+            overlay = HeapOverlay::NONE;
+        }
+        else {
+            BlockLayerDesc desc = {};
+            desc.capacity = GRID_CELLS;
+            Renderer::setBlockLayer(OVERLAY_LAYER, desc);
+        }
+    }
+
+    g_overlay = overlay;
+    g_pageSource = source;
+    g_overlayDirty = true;
+    logInfoTagged(RENDERER_TAG, "Heap view overlay: {}", heapOverlayToCStr(overlay));
+}
+
+HeapOverlay heapViewOverlay() {
+    return g_overlay;
+}
+
+bool heapViewPick(const IntervalIndex& idx, i32 x, i32 y, u32 width, u32 height, u64& address, LiveBlock& block) {
+    u32 cx, cy;
+    if (!g_active || !pixelToCell(x, y, width, height, cx, cy)) return false;
+
+    u64 cell = curveIndex(g_kind, HEAP_VIEW_ORDER, cx, cy);
+    address = g_base + (cell << g_cellShift);
+
+    block = {};
+    return intervalIndexQuery(idx, address, address + (u64(1) << g_cellShift), firstBlock, &block) > 0;
+}
+
+void heapViewZoom(i32 x, i32 y, u32 width, u32 height, bool zoomIn) {
+    u32 cx, cy;
+    if (!g_active || !pixelToCell(x, y, width, height, cx, cy)) return;
+
+    u32 shift = g_cellShift;
+    if (zoomIn && shift > HEAP_VIEW_MIN_CELL_SHIFT) shift--;
+    else if (!zoomIn && shift < MAX_CELL_SHIFT) shift++;
+    else return;
+
+    // The cell under the pixel keeps its place on the curve, the base moves so it holds the same address. Cell aligned
+    // bases keep pyramid queries exact.
+    u64 cell = curveIndex(g_kind, HEAP_VIEW_ORDER, cx, cy);
+    u64 address = g_base + (cell << g_cellShift);
+    u64 before = cell << shift;
+    g_base = address > before ? (address - before) & ~((u64(1) << shift) - 1) : 0;
+    g_cellShift = shift;
+    g_dirty = true;
+}
+
+} // namespace memviz
@@ -0,0 +1,297 @@
+#include "systems/hook_ingest.h"
+
+#include "basic.h"
+#include "hook/hook_transport.h"
+#include "platform.h"
+#include "systems/profiler.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace memviz {
+
+namespace {
+
+struct HookClient {
+    bool active;
+    i32 socketFd;
+    i32 eventFd;
+    HookTransportHeader* shm;
+    u32 pid;
+    // The viewer's own copy of every ring's tail. The shared one is only published for the producers, the target can
+    // write anything there.
+    u64 tails[HOOK_TRANSPORT_RINGS];
+    u64 received;
+    u64 dropped; // Last totals read from the rings, for reporting the growth.
+    u64 spilled;
+};
+
+i32 g_listenFd = -1;
+char g_socketPath[sizeof(sockaddr_un::sun_path)] = {};
+HookClient g_clients[HOOK_INGEST_MAX_CLIENTS] = {};
+HookIngestStats g_stats = {};
+
+void closeFd(i32& fd) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool sendTransport(i32 socketFd, i32 memFd, i32 eventFd) {
+    u32 version = HOOK_TRANSPORT_VERSION;
+    iovec iov = { &version, sizeof(version) };
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(i32))] = {};
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(i32));
+    i32 fds[2] = { memFd, eventFd };
+    core::memcopy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(socketFd, &msg, MSG_NOSIGNAL) == ssize_t(sizeof(version));
+}
+
+void releaseClient(HookClient& c) {
+    Platform::unwatchFd(c.eventFd);
+    Platform::unwatchFd(c.socketFd);
+    if (c.shm) munmap(c.shm, HOOK_TRANSPORT_SIZE);
+    closeFd(c.eventFd);
+    closeFd(c.socketFd);
+
+    logInfoTagged(INGEST_TAG, "Hooked process {} disconnected after {} events ({} dropped, {} spilled)",
+                  c.pid, c.received, c.dropped, c.spilled);
+
+    c = {};
+    g_stats.clients--;
+}
+
+void acceptClient(i32 socketFd) {
+    HookClient* c = nullptr;
+    for (HookClient& it : g_clients) {
+        if (!it.active) {
+            c = &it;
+            break;
+        }
+    }
+    if (!c) {
+        logWarnTagged(INGEST_TAG, "Refusing a hooked process, all {} client slots are taken", HOOK_INGEST_MAX_CLIENTS);
+        close(socketFd);
+        return;
+    }
+
+    i32 memFd = memfd_create("memviz_hook_rings", MFD_CLOEXEC);
+    if (memFd < 0) {
+        logErrTagged(INGEST_TAG, "memfd_create failed: {}", strerror(errno));
+        close(socketFd);
+        return;
+    }
+    defer { close(memFd); };
+
+    // ftruncate zero fills, every ring starts empty and unowned.
+    void* shm = MAP_FAILED;
+    if (ftruncate(memFd, off_t(HOOK_TRANSPORT_SIZE)) == 0) {
+        shm = mmap(nullptr, HOOK_TRANSPORT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    }
+    if (shm == MAP_FAILED) {
+        logErrTagged(INGEST_TAG, "Failed to map the hook rings: {}", strerror(errno));
+        close(socketFd);
+        return;
+    }
+
+    HookTransportHeader* header = reinterpret_cast<HookTransportHeader*>(shm);
+    header->magic = HOOK_TRANSPORT_MAGIC;
+    header->version = HOOK_TRANSPORT_VERSION;
+    header->ringCount = HOOK_TRANSPORT_RINGS;
+    header->ringEvents = HOOK_RING_EVENTS;
+    header->eventSize = sizeof(HookEvent);
+
+    i32 eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0 || !sendTransport(socketFd, memFd, eventFd) ||
+        !Platform::watchFd(eventFd) || !Platform::watchFd(socketFd)) {
+        logErrTagged(INGEST_TAG, "Failed to hand the rings to a hooked process: {}", strerror(errno));
+        Platform::unwatchFd(eventFd);
+        if (eventFd >= 0) close(eventFd);
+        munmap(shm, HOOK_TRANSPORT_SIZE);
+        close(socketFd);
+        return;
+    }
+
+    *c = {};
+    c->active = true;
+    c->socketFd = socketFd;
+    c->eventFd = eventFd;
+    c->shm = header;
+    g_stats.clients++;
+    g_stats.accepted++;
+}
+
+// Returns true once the process closed its end, after everything it committed has been read, or when it corrupted its
+// rings.
+bool drainClient(HookClient& c, HookEventSink sink) {
+    u64 counter;
+    [[maybe_unused]] ssize_t n = read(c.eventFd, &counter, sizeof(counter));
+
+    // Checked before draining, so nothing committed before the close can be missed.
+    char peek;
+    bool closed = recv(c.socketFd, &peek, 1, MSG_DONTWAIT | MSG_PEEK) == 0;
+
+    HookTransportHeader& shm = *c.shm;
+    if (shm.producerReady.load(std::memory_order_acquire) == 0) return closed;
+    if (c.pid == 0) {
+        c.pid = shm.pid;
+        logInfoTagged(INGEST_TAG, "Hooked process {} connected (backpressure: {})",
+                      c.pid, hookBackpressureToCStr(shm.backpressure));
+    }
+
+    u64 dropped = 0;
+    u64 spilled = 0;
+    for (u32 i = 0; i < HOOK_TRANSPORT_RINGS; i++) {
+        HookRing& ring = shm.rings[i];
+        dropped += ring.dropped.load(std::memory_order_relaxed);
+        spilled += ring.spilled.load(std::memory_order_relaxed);
+
+        u64 head = ring.head.load(std::memory_order_acquire);
+        u64 tail = c.tails[i];
+        if (head == tail) continue;
+
+        // A crashed or hostile target can write any head. Anything outside the ring would hand stale or garbage slots
+        // to the sink, or keep this loop busy for up to 2^64 events.
+        if (head < tail || head - tail > HOOK_RING_EVENTS) {
+            logErrTagged(INGEST_TAG, "Process {} corrupted ring {} (head {}, tail {}), disconnecting it",
+                         c.pid, i, head, tail);
+            return true;
+        }
+
+        c.received += head - tail;
+        while (tail != head) {
+            u32 first = u32(tail & (HOOK_RING_EVENTS - 1));
+            u64 untilWrap = HOOK_RING_EVENTS - first;
+            u32 count = u32(head - tail < untilWrap ? head - tail : untilWrap);
+            sink(c.pid, &ring.events[first], count);
+            tail += count;
+        }
+        c.tails[i] = tail;
+        ring.tail.store(tail, std::memory_order_release);
+    }
+
+    if (dropped > c.dropped || spilled > c.spilled) {
+        logWarnTaggedLimited(HOOK_INGEST_DROP_LOGS_PER_SECOND, INGEST_TAG,
+                             "Process {} could not keep up: {} events dropped, {} spilled so far",
+                             c.pid, dropped, spilled);
+        g_stats.dropped += dropped - c.dropped;
+        g_stats.spilled += spilled - c.spilled;
+        c.dropped = dropped;
+        c.spilled = spilled;
+    }
+
+    return closed;
+}
+
+} // namespace
+
+bool hookIngestListen(const char* socketPath) {
+    Assert(g_listenFd < 0, "hookIngestListen called twice");
+
+    addr_size pathLen = core::cstrLen(socketPath);
+    if (pathLen == 0 || pathLen >= sizeof(g_socketPath)) {
+        logErrTagged(INGEST_TAG, "Invalid hook socket path '{}'", socketPath);
+        return false;
+    }
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    core::memcopy(addr.sun_path, socketPath, pathLen);
+
+    // A stale socket from a viewer that crashed would make bind fail. Anything else at the path is left alone, bind
+    // then fails and says why.
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socketPath);
+
+    g_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_listenFd < 0 ||
+        bind(g_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(g_listenFd, i32(HOOK_INGEST_MAX_CLIENTS)) != 0 ||
+        !Platform::watchFd(g_listenFd)) {
+        logErrTagged(INGEST_TAG, "Failed to listen on '{}': {}", socketPath, strerror(errno));
+        closeFd(g_listenFd);
+        return false;
+    }
+
+    core::memcopy(g_socketPath, socketPath, pathLen + 1);
+    g_stats = {};
+
+    logInfoTagged(INGEST_TAG, "Waiting for hooked processes on '{}' (run them with MEMVIZ_HOOK_SOCKET={})",
+                  socketPath, socketPath);
+    return true;
+}
+
+void hookIngestShutdown() {
+    if (g_listenFd < 0) return;
+
+    for (HookClient& c : g_clients) {
+        if (c.active) releaseClient(c);
+    }
+
+    Platform::unwatchFd(g_listenFd);
+    closeFd(g_listenFd);
+    unlink(g_socketPath);
+
+    logInfoTagged(INGEST_TAG, "Hook ingest: {} processes, {} events received, {} dropped, {} spilled",
+                  g_stats.accepted, g_stats.received, g_stats.dropped, g_stats.spilled);
+}
+
+bool hookIngestIsActive() {
+    return g_listenFd >= 0;
+}
+
+u64 hookIngestUpdate(HookEventSink sink) {
+    MEMVIZ_ZONE("hookIngestUpdate");
+
+    for (;;) {
+        i32 socketFd = accept4(g_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socketFd < 0) break;
+        acceptClient(socketFd);
+    }
+
+    u64 delivered = 0;
+    bool pending = false;
+    for (HookClient& c : g_clients) {
+        if (!c.active) continue;
+
+        u64 before = c.received;
+        bool closed = drainClient(c, sink);
+        delivered += c.received - before;
+
+        if (closed) {
+            releaseClient(c);
+            continue;
+        }
+
+        // Commits that raced with arming are not signalled, the next wait has to return right away for them.
+        pending |= hookTransportArm(*c.shm);
+    }
+
+    g_stats.received += delivered;
+    if (pending) Platform::wakeUp();
+    return delivered;
+}
+
+HookIngestStats hookIngestStats() {
+    return g_stats;
+}
+
+} // namespace memviz
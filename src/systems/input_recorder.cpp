@@ -0,0 +1,386 @@
+#include "systems/input_recorder.h"
+
+#include "basic.h"
+#include "platform.h"
+#include "systems/profiler.h"
+#include "varint.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace memviz {
+
+namespace {
+
+constexpr char FILE_MAGIC[4] = { 'M', 'V', 'Z', 'I' };
+constexpr u16 FILE_VERSION = 1;
+
+// Record kinds are the PlatformEventType values, plus a marker for the end of a dispatched batch.
+constexpr u8 RECORD_BATCH_END = 0xff;
+
+constexpr u64 NS_PER_MS = 1'000'000;
+
+struct Recorder {
+    FILE* file;
+    bool hasPrevTime;
+    u32 prevTimeMs;
+    i32 prevMouseX;
+    i32 prevMouseY;
+    u64 eventCount;
+};
+
+struct Replay {
+    FILE* file;
+    InputReplaySpeed speed;
+    u64 startNs;
+    u64 elapsedMs;   // Time offset of the pending record from the first record.
+    i32 prevMouseX;
+    i32 prevMouseY;
+    bool hasPending; // The next record is decoded ahead of time so its due time is known.
+    bool pendingIsBatchEnd;
+    PlatformEvent pending;
+    u64 eventCount;
+};
+
+Recorder g_recorder = {};
+Replay g_replay = {};
+
+// ------------------------------------------ BEGIN ENCODING -----------------------------------------------------------
+
+struct RecordBuffer {
+    u8 data[64];
+    addr_size len;
+
+    void putU8(u8 v) { data[len++] = v; }
+    void putVarint(u64 v) { len += varintEncode(v, data + len); }
+    void putSigned(i64 v) { putVarint(zigzagEncode(v)); }
+};
+
+inline u8 packPressAndMods(bool isPress, KeyboardModifiers mods) {
+    return u8(isPress ? 1 : 0) | u8(u8(mods) << 1);
+}
+
+inline void unpackPressAndMods(u8 v, bool& isPress, KeyboardModifiers& mods) {
+    isPress = (v & 1) != 0;
+    mods = KeyboardModifiers(v >> 1);
+}
+
+void stopRecording() {
+    Platform::registerEventObserver(nullptr);
+    if (fclose(g_recorder.file) != 0) {
+        logErrTagged(USER_INPUT_TAG, "Failed to finish the input recording: {}", strerror(errno));
+    }
+    logInfoTagged(USER_INPUT_TAG, "Input recording finished, {} events written", g_recorder.eventCount);
+    g_recorder = {};
+}
+
+// A recording with a hole in it would replay something else, so the first failed write ends it.
+bool writeRecord(const RecordBuffer& rec) {
+    if (fwrite(rec.data, 1, rec.len, g_recorder.file) == rec.len) return true;
+    logErrTagged(USER_INPUT_TAG, "Failed to write the input recording, it stops here: {}", strerror(errno));
+    stopRecording();
+    return false;
+}
+
+void recordObserver(const PlatformEvent* ev) {
+    if (!g_recorder.file) return;
+
+    RecordBuffer rec = {};
+
+    if (ev == nullptr) {
+        rec.putU8(RECORD_BATCH_END);
+        writeRecord(rec);
+        return;
+    }
+
+    // X server time wraps around every ~49 days; unsigned subtraction keeps deltas correct across the wrap.
+    u32 deltaMs = g_recorder.hasPrevTime ? u32(ev->timeMs - g_recorder.prevTimeMs) : 0;
+    g_recorder.prevTimeMs = ev->timeMs;
+    g_recorder.hasPrevTime = true;
+
+    rec.putU8(u8(ev->type));
+    rec.putVarint(deltaMs);
+
+    switch (ev->type) {
+        case PlatformEventType::WINDOW_CLOSE:
+            break;
+        case PlatformEventType::WINDOW_RESIZE:
+            rec.putSigned(ev->resize.w);
+            rec.putSigned(ev->resize.h);
+            break;
+        case PlatformEventType::WINDOW_FOCUS:
+            rec.putU8(ev->focus.gain ? 1 : 0);
+            break;
+        case PlatformEventType::KEY:
+            rec.putVarint(ev->key.vkcode);
+            rec.putVarint(ev->key.scancode);
+            rec.putU8(packPressAndMods(ev->key.isPress, ev->key.mods));
+            break;
+        case PlatformEventType::MOUSE_CLICK:
+            rec.putU8(u8(ev->click.button));
+            rec.putU8(packPressAndMods(ev->click.isPress, ev->click.mods));
+            rec.putSigned(ev->click.x);
+            rec.putSigned(ev->click.y);
+            break;
+        case PlatformEventType::MOUSE_MOVE:
+            // Consecutive pointer positions are close to each other, deltas mostly fit in a byte.
+            rec.putSigned(i64(ev->move.x) - i64(g_recorder.prevMouseX));
+            rec.putSigned(i64(ev->move.y) - i64(g_recorder.prevMouseY));
+            g_recorder.prevMouseX = ev->move.x;
+            g_recorder.prevMouseY = ev->move.y;
+            break;
+        case PlatformEventType::MOUSE_SCROLL:
+            rec.putU8(u8(ev->scroll.direction));
+            rec.putSigned(ev->scroll.x);
+            rec.putSigned(ev->scroll.y);
+            break;
+        case PlatformEventType::MOUSE_ENTER_OR_LEAVE:
+            rec.putU8(ev->crossing.enter ? 1 : 0);
+            break;
+
+        case PlatformEventType::NONE: [[fallthrough]];
+        case PlatformEventType::SENTINEL: [[fallthrough]];
+        default:
+            return;
+    }
+
+    if (writeRecord(rec)) g_recorder.eventCount++;
+}
+
+// ------------------------------------------ END ENCODING -------------------------------------------------------------
+
+// ------------------------------------------ BEGIN DECODING -----------------------------------------------------------
+
+bool readU8(FILE* f, u8& out) {
+    i32 c = fgetc(f);
+    if (c == EOF) return false;
+    out = u8(c);
+    return true;
+}
+
+bool readVarint(FILE* f, u64& out) {
+    u8 buf[VARINT_MAX_BYTES];
+    for (addr_size i = 0; i < VARINT_MAX_BYTES; i++) {
+        if (!readU8(f, buf[i])) return false;
+        if ((buf[i] & 0x80) == 0) {
+            return varintDecode(buf, buf + i + 1, out) == i + 1;
+        }
+    }
+    return false;
+}
+
+bool readSigned(FILE* f, i32& out) {
+    u64 v;
+    if (!readVarint(f, v)) return false;
+    out = i32(zigzagDecode(v));
+    return true;
+}
+
+// Decodes the record of kind into g_replay.pending. Returns false when it is cut short or corrupt.
+bool decodeRecord(u8 kind) {
+    FILE* f = g_replay.file;
+    PlatformEvent& ev = g_replay.pending;
+    ev = {};
+
+    if (kind == RECORD_BATCH_END) {
+        g_replay.pendingIsBatchEnd = true;
+        return true;
+    }
+    g_replay.pendingIsBatchEnd = false;
+
+    u64 deltaMs;
+    if (!readVarint(f, deltaMs)) return false;
+    g_replay.elapsedMs += deltaMs;
+
+    ev.type = PlatformEventType(kind);
+    ev.timeMs = u32(g_replay.elapsedMs);
+    u8 b0 = 0, b1 = 0;
+    u64 v0 = 0, v1 = 0;
+    i32 dx = 0, dy = 0;
+
+    switch (ev.type) {
+        case PlatformEventType::WINDOW_CLOSE:
+            return true;
+        case PlatformEventType::WINDOW_RESIZE:
+            return readSigned(f, ev.resize.w) && readSigned(f, ev.resize.h);
+        case PlatformEventType::WINDOW_FOCUS:
+            if (!readU8(f, b0)) return false;
+            ev.focus.gain = b0 != 0;
+            return true;
+        case PlatformEventType::KEY:
+            if (!readVarint(f, v0) || !readVarint(f, v1) || !readU8(f, b0)) return false;
+            ev.key.vkcode = u32(v0);
+            ev.key.scancode = u32(v1);
+            unpackPressAndMods(b0, ev.key.isPress, ev.key.mods);
+            return true;
+        case PlatformEventType::MOUSE_CLICK:
+            if (!readU8(f, b0) || !readU8(f, b1)) return false;
+            ev.click.button = MouseButton(b0);
+            unpackPressAndMods(b1, ev.click.isPress, ev.click.mods);
+            return readSigned(f, ev.click.x) && readSigned(f, ev.click.y);
+        case PlatformEventType::MOUSE_MOVE:
+            if (!readSigned(f, dx) || !readSigned(f, dy)) return false;
+            g_replay.prevMouseX += dx;
+            g_replay.prevMouseY += dy;
+            ev.move.x = g_replay.prevMouseX;
+            ev.move.y = g_replay.prevMouseY;
+            return true;
+        case PlatformEventType::MOUSE_SCROLL:
+            if (!readU8(f, b0)) return false;
+            ev.scroll.direction = MouseScrollDirection(b0);
+            return readSigned(f, ev.scroll.x) && readSigned(f, ev.scroll.y);
+        case PlatformEventType::MOUSE_ENTER_OR_LEAVE:
+            if (!readU8(f, b0)) return false;
+            ev.crossing.enter = b0 != 0;
+            return true;
+
+        case PlatformEventType::NONE: [[fallthrough]];
+        case PlatformEventType::SENTINEL: [[fallthrough]];
+        default:
+            logErrTagged(USER_INPUT_TAG, "Corrupt input recording: unknown record kind {}", kind);
+            return false;
+    }
+}
+
+// Decodes the next record into g_replay.pending. Returns false at the end of the file, which is only expected between
+// records. A recording that stopped mid record, like one of a killed process, replays up to the last whole record.
+bool decodeNextRecord() {
+    FILE* f = g_replay.file;
+
+    u8 kind;
+    if (!readU8(f, kind)) {
+        if (ferror(f)) logErrTagged(USER_INPUT_TAG, "Failed to read the input recording: {}", strerror(errno));
+        return false;
+    }
+    if (decodeRecord(kind)) return true;
+
+    if (ferror(f)) {
+        logErrTagged(USER_INPUT_TAG, "Failed to read the input recording: {}", strerror(errno));
+    }
+    else if (feof(f)) {
+        logWarnTagged(USER_INPUT_TAG, "The input recording ends in a truncated record, replayed {} events",
+                      g_replay.eventCount);
+    }
+    return false;
+}
+
+void advanceReplay() {
+    g_replay.hasPending = decodeNextRecord();
+}
+
+// ------------------------------------------ END DECODING -------------------------------------------------------------
+
+} // namespace
+
+bool inputRecorderStart(const char* path) {
+    Assert(g_recorder.file == nullptr, "Input recorder already started");
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        logErrTagged(USER_INPUT_TAG, "Failed to open '{}' for input recording: {}", path, strerror(errno));
+        return false;
+    }
+
+    // Little-endian whatever the host, records are bytes and varints, so the header is all that depends on it.
+    u8 header[4] = { u8(FILE_VERSION), u8(FILE_VERSION >> 8), 0, 0 };
+    if (fwrite(FILE_MAGIC, 1, sizeof(FILE_MAGIC), f) != sizeof(FILE_MAGIC) ||
+        fwrite(header, 1, sizeof(header), f) != sizeof(header)
+    ) {
+        logErrTagged(USER_INPUT_TAG, "Failed to write the input recording header to '{}': {}", path, strerror(errno));
+        fclose(f);
+        return false;
+    }
+
+    g_recorder = {};
+    g_recorder.file = f;
+    Platform::registerEventObserver(recordObserver);
+
+    logInfoTagged(USER_INPUT_TAG, "Recording input to '{}'", path);
+    return true;
+}
+
+void inputRecorderStop() {
+    if (!g_recorder.file) return;
+    stopRecording();
+}
+
+bool inputReplayStart(const char* path, InputReplaySpeed speed) {
+    Assert(g_replay.file == nullptr, "Input replay already started");
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        logErrTagged(USER_INPUT_TAG, "Failed to open input recording '{}': {}", path, strerror(errno));
+        return false;
+    }
+
+    char magic[sizeof(FILE_MAGIC)];
+    u8 header[4];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        fread(header, 1, sizeof(header), f) != sizeof(header) ||
+        core::memcmp(magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        u16(header[0] | (header[1] << 8)) != FILE_VERSION
+    ) {
+        logErrTagged(USER_INPUT_TAG, "'{}' is not a supported input recording", path);
+        fclose(f);
+        return false;
+    }
+
+    g_replay = {};
+    g_replay.file = f;
+    g_replay.speed = speed;
+    g_replay.startNs = Platform::getMonotonicTimeNs();
+    advanceReplay();
+
+    logInfoTagged(USER_INPUT_TAG, "Replaying input from '{}' ({})", path,
+                  speed == InputReplaySpeed::ORIGINAL ? "original speed" : "as fast as possible");
+    return true;
+}
+
+void inputReplayStop() {
+    if (!g_replay.file) return;
+
+    fclose(g_replay.file);
+    logInfoTagged(USER_INPUT_TAG, "Input replay finished, {} events replayed", g_replay.eventCount);
+    g_replay = {};
+}
+
+bool inputReplayIsActive() {
+    return g_replay.file != nullptr;
+}
+
+bool inputReplayUpdate(u64 nowNs) {
+    MEMVIZ_ZONE("inputReplayUpdate");
+    if (!g_replay.file) return false;
+
+    if (g_replay.speed == InputReplaySpeed::AS_FAST_AS_POSSIBLE) {
+        // Push exactly one recorded batch, so each frame sees what the original frame saw.
+        while (g_replay.hasPending && !g_replay.pendingIsBatchEnd) {
+            Platform::pushEvent(g_replay.pending);
+            g_replay.eventCount++;
+            advanceReplay();
+        }
+        if (g_replay.hasPending) advanceReplay(); // consume the batch marker
+        return g_replay.hasPending;
+    }
+
+    while (g_replay.hasPending) {
+        if (!g_replay.pendingIsBatchEnd) {
+            u64 dueNs = g_replay.startNs + g_replay.elapsedMs * NS_PER_MS;
+            if (dueNs > nowNs) break;
+            Platform::pushEvent(g_replay.pending);
+            g_replay.eventCount++;
+        }
+        advanceReplay();
+    }
+
+    return g_replay.hasPending;
+}
+
+u64 inputReplayNextDeadlineNs() {
+    if (!g_replay.file || !g_replay.hasPending) return 0;
+    if (g_replay.speed == InputReplaySpeed::AS_FAST_AS_POSSIBLE) return g_replay.startNs; // already due
+    return g_replay.startNs + g_replay.elapsedMs * NS_PER_MS;
+}
+
+} // namespace memviz
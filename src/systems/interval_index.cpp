@@ -0,0 +1,720 @@
+#include "systems/interval_index.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/profiler.h"
+
+#include <algorithm>
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr addr_size NODE_BYTES = 1024; // Slot size of POOL_1024_ALLOCATOR_ID.
+constexpr u32 LEAF_CAP = 25;
+constexpr u32 INNER_CAP = 64;
+// Loose minimums, so allocating and freeing around a node boundary does not split and merge the same nodes over and
+// over.
+constexpr u32 LEAF_MIN = LEAF_CAP / 4;
+constexpr u32 INNER_MIN = INNER_CAP / 4;
+// Bulk loaded nodes keep some room, the first inserts after opening a snapshot should not split every leaf they hit.
+constexpr u32 LEAF_BULK_FILL = LEAF_CAP * 7 / 8;
+constexpr u32 INNER_BULK_FILL = INNER_CAP * 7 / 8;
+// Even at INNER_MIN children per node this is far more than any address space can fill.
+constexpr u32 MAX_HEIGHT = 16;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN NODES --------------------------------------------------------------
+
+// A LiveBlock without its address, the address is the key.
+struct LeafValue {
+    u64 size;
+    u64 ticks;
+    u32 callsite;
+    u32 tid;
+    HookOp op;
+    u8 reserved[7];
+};
+static_assert(sizeof(LeafValue) == 32);
+
+// Keys are apart from the values, a search reads 8 of them per cache line.
+struct Leaf {
+    u32 count;
+    u32 reserved;
+    Leaf* prev;
+    Leaf* next;
+    u64 keys[LEAF_CAP];
+    LeafValue values[LEAF_CAP];
+};
+
+// Every address under children[i] is below keys[i], every address under children[i + 1] at or above it. Erasing does
+// not update the keys, one can still name an address that is gone.
+struct Inner {
+    u32 count; // Of children, keys has one less.
+    u32 reserved;
+    u64 keys[INNER_CAP - 1];
+    void* children[INNER_CAP];
+};
+
+static_assert(sizeof(Leaf) <= NODE_BYTES);
+static_assert(sizeof(Inner) <= NODE_BYTES);
+
+struct PathStep {
+    Inner* node;
+    u32 slot; // Of the child the lookup went down to.
+};
+
+struct Path {
+    PathStep steps[MAX_HEIGHT];
+    u32 depth;
+};
+
+auto& nodeAllocator() {
+    return core::getAllocator(core::AllocatorId(POOL_1024_ALLOCATOR_ID));
+}
+
+Leaf* newLeaf(IntervalIndex& idx) {
+    Leaf* leaf = reinterpret_cast<Leaf*>(nodeAllocator().alloc(1, sizeof(Leaf)));
+    if (!leaf) return nullptr;
+    leaf->count = 0;
+    leaf->prev = nullptr;
+    leaf->next = nullptr;
+    idx.leafCount++;
+    return leaf;
+}
+
+Inner* newInner(IntervalIndex& idx) {
+    Inner* inner = reinterpret_cast<Inner*>(nodeAllocator().alloc(1, sizeof(Inner)));
+    if (!inner) return nullptr;
+    inner->count = 0;
+    idx.innerCount++;
+    return inner;
+}
+
+void freeLeaf(IntervalIndex& idx, Leaf* leaf) {
+    nodeAllocator().free(leaf, 1, sizeof(Leaf));
+    idx.leafCount--;
+}
+
+void freeInner(IntervalIndex& idx, Inner* inner) {
+    nodeAllocator().free(inner, 1, sizeof(Inner));
+    idx.innerCount--;
+}
+
+void freeSubtree(IntervalIndex& idx, void* node, u32 height) {
+    if (height == 0) {
+        freeLeaf(idx, reinterpret_cast<Leaf*>(node));
+        return;
+    }
+    Inner* inner = reinterpret_cast<Inner*>(node);
+    for (u32 i = 0; i < inner->count; i++) {
+        freeSubtree(idx, inner->children[i], height - 1);
+    }
+    freeInner(idx, inner);
+}
+
+// ------------------------------------------ END NODES ----------------------------------------------------------------
+
+// ------------------------------------------ BEGIN NODE OPERATIONS ----------------------------------------------------
+
+// First i with keys[i] > key.
+u32 upperBound(const u64* keys, u32 count, u64 key) {
+    u32 lo = 0;
+    u32 hi = count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (keys[mid] <= key) lo = mid + 1;
+        else                  hi = mid;
+    }
+    return lo;
+}
+
+// First i with keys[i] >= key.
+u32 lowerBound(const u64* keys, u32 count, u64 key) {
+    u32 lo = 0;
+    u32 hi = count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (keys[mid] < key) lo = mid + 1;
+        else                 hi = mid;
+    }
+    return lo;
+}
+
+void storeBlock(Leaf* leaf, u32 i, const LiveBlock& b) {
+    leaf->keys[i] = b.address;
+    LeafValue& v = leaf->values[i];
+    v.size = b.size;
+    v.callsite = b.callsite;
+    v.ticks = b.ticks;
+    v.tid = b.tid;
+    v.op = b.op;
+}
+
+LiveBlock loadBlock(const Leaf* leaf, u32 i) {
+    const LeafValue& v = leaf->values[i];
+    LiveBlock b = {};
+    b.address = leaf->keys[i];
+    b.size = v.size;
+    b.callsite = v.callsite;
+    b.ticks = v.ticks;
+    b.tid = v.tid;
+    b.op = v.op;
+    return b;
+}
+
+void moveEntry(Leaf* to, u32 toSlot, const Leaf* from, u32 fromSlot) {
+    to->keys[toSlot] = from->keys[fromSlot];
+    to->values[toSlot] = from->values[fromSlot];
+}
+
+void insertIntoLeaf(Leaf* leaf, u32 slot, const LiveBlock& b) {
+    for (u32 i = leaf->count; i > slot; i--) moveEntry(leaf, i, leaf, i - 1);
+    storeBlock(leaf, slot, b);
+    leaf->count++;
+}
+
+void removeFromLeaf(Leaf* leaf, u32 slot) {
+    for (u32 i = slot; i + 1 < leaf->count; i++) moveEntry(leaf, i, leaf, i + 1);
+    leaf->count--;
+}
+
+void unlinkLeaf(Leaf* leaf) {
+    if (leaf->prev) leaf->prev->next = leaf->next;
+    if (leaf->next) leaf->next->prev = leaf->prev;
+}
+
+// key goes to keys[slot] and child to children[slot + 1], right after the child at slot that split.
+void insertIntoInner(Inner* inner, u32 slot, u64 key, void* child) {
+    for (u32 i = inner->count - 1; i > slot; i--) inner->keys[i] = inner->keys[i - 1];
+    for (u32 i = inner->count; i > slot + 1; i--) inner->children[i] = inner->children[i - 1];
+    inner->keys[slot] = key;
+    inner->children[slot + 1] = child;
+    inner->count++;
+}
+
+void removeFromInner(Inner* inner, u32 keySlot, u32 childSlot) {
+    for (u32 i = keySlot; i + 2 < inner->count; i++) inner->keys[i] = inner->keys[i + 1];
+    for (u32 i = childSlot; i + 1 < inner->count; i++) inner->children[i] = inner->children[i + 1];
+    inner->count--;
+}
+
+// Like insertIntoInner for a full node, the upper half moves to right. Returns the key that separates the two.
+u64 splitInner(Inner* inner, u32 slot, u64 key, void* child, Inner* right) {
+    u64 keys[INNER_CAP];
+    void* children[INNER_CAP + 1];
+    for (u32 i = 0; i < slot; i++) keys[i] = inner->keys[i];
+    keys[slot] = key;
+    for (u32 i = slot; i < INNER_CAP - 1; i++) keys[i + 1] = inner->keys[i];
+    for (u32 i = 0; i <= slot; i++) children[i] = inner->children[i];
+    children[slot + 1] = child;
+    for (u32 i = slot + 1; i < INNER_CAP; i++) children[i + 1] = inner->children[i];
+
+    constexpr u32 LEFT_CHILDREN = (INNER_CAP + 2) / 2;
+    constexpr u32 RIGHT_CHILDREN = INNER_CAP + 1 - LEFT_CHILDREN;
+    core::memcopy(inner->keys, keys, (LEFT_CHILDREN - 1) * sizeof(u64));
+    core::memcopy(inner->children, children, LEFT_CHILDREN * sizeof(void*));
+    inner->count = LEFT_CHILDREN;
+    core::memcopy(right->keys, keys + LEFT_CHILDREN, (RIGHT_CHILDREN - 1) * sizeof(u64));
+    core::memcopy(right->children, children + LEFT_CHILDREN, RIGHT_CHILDREN * sizeof(void*));
+    right->count = RIGHT_CHILDREN;
+    return keys[LEFT_CHILDREN - 1];
+}
+
+// ------------------------------------------ END NODE OPERATIONS ------------------------------------------------------
+
+// ------------------------------------------ BEGIN TREE OPERATIONS ----------------------------------------------------
+
+Leaf* findLeaf(const IntervalIndex& idx, u64 address, Path* path) {
+    void* node = idx.root;
+    if (path) path->depth = 0;
+    for (u32 level = idx.height; level > 0; level--) {
+        Inner* inner = reinterpret_cast<Inner*>(node);
+        u32 slot = upperBound(inner->keys, inner->count - 1, address);
+        if (path) path->steps[path->depth++] = { inner, slot };
+        node = inner->children[slot];
+    }
+    return reinterpret_cast<Leaf*>(node);
+}
+
+// The last block starting at or before address.
+bool findPredecessor(const IntervalIndex& idx, u64 address, const Leaf*& leaf, u32& slot) {
+    if (!idx.root) return false;
+    leaf = findLeaf(idx, address, nullptr);
+    u32 i = upperBound(leaf->keys, leaf->count, address);
+    if (i == 0) {
+        // The key that led here belonged to a block that is gone, the predecessor is in the previous leaf.
+        leaf = leaf->prev;
+        if (!leaf) return false;
+        i = leaf->count;
+    }
+    slot = i - 1;
+    return true;
+}
+
+bool splitAndInsert(IntervalIndex& idx, const Path& path, Leaf* leaf, u32 slot, const LiveBlock& block) {
+    // Every full inner node on the way up splits too, and a new root is needed when all of them are full. Allocate
+    // everything first, running out of memory halfway through would leave a broken tree.
+    u32 innerSplits = 0;
+    while (innerSplits < path.depth && path.steps[path.depth - 1 - innerSplits].node->count == INNER_CAP) {
+        innerSplits++;
+    }
+    u32 needed = innerSplits + (innerSplits == path.depth ? 1 : 0);
+    Assert(idx.height + 1 < MAX_HEIGHT, "Interval index is too deep");
+
+    Inner* spare[MAX_HEIGHT];
+    u32 spareCount = 0;
+    Leaf* right = newLeaf(idx);
+    while (right && spareCount < needed) {
+        spare[spareCount] = newInner(idx);
+        if (!spare[spareCount]) break;
+        spareCount++;
+    }
+    if (!right || spareCount < needed) {
+        if (right) freeLeaf(idx, right);
+        for (u32 i = 0; i < spareCount; i++) freeInner(idx, spare[i]);
+        return false;
+    }
+
+    constexpr u32 LEFT_ENTRIES = (LEAF_CAP + 1) / 2;
+    for (u32 i = LEFT_ENTRIES; i < leaf->count; i++) moveEntry(right, i - LEFT_ENTRIES, leaf, i);
+    right->count = leaf->count - LEFT_ENTRIES;
+    leaf->count = LEFT_ENTRIES;
+    if (slot < LEFT_ENTRIES) insertIntoLeaf(leaf, slot, block);
+    else                     insertIntoLeaf(right, slot - LEFT_ENTRIES, block);
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) leaf->next->prev = right;
+    leaf->next = right;
+
+    u64 key = right->keys[0];
+    void* child = right;
+    u32 used = 0;
+    for (u32 d = path.depth; d > 0; d--) {
+        Inner* parent = path.steps[d - 1].node;
+        u32 parentSlot = path.steps[d - 1].slot;
+        if (parent->count < INNER_CAP) {
+            insertIntoInner(parent, parentSlot, key, child);
+            return true;
+        }
+        Inner* sibling = spare[used++];
+        key = splitInner(parent, parentSlot, key, child, sibling);
+        child = sibling;
+    }
+
+    Inner* root = spare[used++];
+    root->count = 2;
+    root->keys[0] = key;
+    root->children[0] = idx.root;
+    root->children[1] = child;
+    idx.root = root;
+    idx.height++;
+    return true;
+}
+
+// path.steps[d].node lost a child, borrow one from a neighbour or merge with it. A merge takes a child from the parent
+// in turn, so this walks up until a node has enough left.
+void rebalanceInner(IntervalIndex& idx, const Path& path, u32 d) {
+    for (;;) {
+        Inner* node = path.steps[d].node;
+        if (d == 0) {
+            if (node->count == 1) {
+                idx.root = node->children[0];
+                idx.height--;
+                freeInner(idx, node);
+            }
+            return;
+        }
+        if (node->count >= INNER_MIN) return;
+
+        Inner* parent = path.steps[d - 1].node;
+        u32 s = path.steps[d - 1].slot;
+        Inner* left = s > 0 ? reinterpret_cast<Inner*>(parent->children[s - 1]) : nullptr;
+        Inner* right = s + 1 < parent->count ? reinterpret_cast<Inner*>(parent->children[s + 1]) : nullptr;
+
+        if (left && left->count > INNER_MIN) {
+            for (u32 i = node->count; i > 0; i--) node->children[i] = node->children[i - 1];
+            for (u32 i = node->count - 1; i > 0; i--) node->keys[i] = node->keys[i - 1];
+            node->children[0] = left->children[left->count - 1];
+            node->keys[0] = parent->keys[s - 1];
+            parent->keys[s - 1] = left->keys[left->count - 2];
+            node->count++;
+            left->count--;
+            return;
+        }
+        if (right && right->count > INNER_MIN) {
+            node->keys[node->count - 1] = parent->keys[s];
+            node->children[node->count] = right->children[0];
+            node->count++;
+            parent->keys[s] = right->keys[0];
+            removeFromInner(right, 0, 0);
+            return;
+        }
+
+        if (left) {
+            left->keys[left->count - 1] = parent->keys[s - 1];
+            core::memcopy(left->keys + left->count, node->keys, (node->count - 1) * sizeof(u64));
+            core::memcopy(left->children + left->count, node->children, node->count * sizeof(void*));
+            left->count += node->count;
+            freeInner(idx, node);
+            removeFromInner(parent, s - 1, s);
+        }
+        else {
+            node->keys[node->count - 1] = parent->keys[s];
+            core::memcopy(node->keys + node->count, right->keys, (right->count - 1) * sizeof(u64));
+            core::memcopy(node->children + node->count, right->children, right->count * sizeof(void*));
+            node->count += right->count;
+            freeInner(idx, right);
+            removeFromInner(parent, s, s + 1);
+        }
+        d--;
+    }
+}
+
+void rebalanceLeaf(IntervalIndex& idx, const Path& path, Leaf* leaf) {
+    u32 d = path.depth - 1;
+    Inner* parent = path.steps[d].node;
+    u32 s = path.steps[d].slot;
+    Leaf* left = s > 0 ? reinterpret_cast<Leaf*>(parent->children[s - 1]) : nullptr;
+    Leaf* right = s + 1 < parent->count ? reinterpret_cast<Leaf*>(parent->children[s + 1]) : nullptr;
+
+    if (left && left->count > LEAF_MIN) {
+        for (u32 i = leaf->count; i > 0; i--) moveEntry(leaf, i, leaf, i - 1);
+        moveEntry(leaf, 0, left, left->count - 1);
+        leaf->count++;
+        left->count--;
+        parent->keys[s - 1] = leaf->keys[0];
+        return;
+    }
+    if (right && right->count > LEAF_MIN) {
+        moveEntry(leaf, leaf->count, right, 0);
+        leaf->count++;
+        removeFromLeaf(right, 0);
+        parent->keys[s] = right->keys[0];
+        return;
+    }
+
+    if (left) {
+        for (u32 i = 0; i < leaf->count; i++) moveEntry(left, left->count + i, leaf, i);
+        left->count += leaf->count;
+        unlinkLeaf(leaf);
+        freeLeaf(idx, leaf);
+        removeFromInner(parent, s - 1, s);
+    }
+    else {
+        for (u32 i = 0; i < right->count; i++) moveEntry(leaf, leaf->count + i, right, i);
+        leaf->count += right->count;
+        unlinkLeaf(right);
+        freeLeaf(idx, right);
+        removeFromInner(parent, s, s + 1);
+    }
+    rebalanceInner(idx, path, d);
+}
+
+bool isAllocation(HookOp op) {
+    return op == HookOp::MALLOC || op == HookOp::CALLOC || op == HookOp::REALLOC || op == HookOp::POSIX_MEMALIGN ||
+           op == HookOp::ALIGNED_ALLOC || op == HookOp::MMAP;
+}
+
+bool isRelease(HookOp op) {
+    return op == HookOp::FREE || op == HookOp::MUNMAP;
+}
+
+LiveBlock toLiveBlock(const HookEvent& e) {
+    LiveBlock b = {};
+    b.address = e.address;
+    b.size = e.size;
+    b.callsite = e.callsite;
+    b.ticks = e.ticks;
+    b.tid = e.tid;
+    b.op = e.op;
+    return b;
+}
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+// The thread that freed a block can have its ring drained before the one that made it. Remembering the free lets the
+// late allocation be dropped, instead of leaving a block that stays live forever.
+u32 unmatchedSlot(u64 address) {
+    static_assert((INTERVAL_INDEX_UNMATCHED_FREES & (INTERVAL_INDEX_UNMATCHED_FREES - 1)) == 0);
+    return u32(((address >> 4) * 0x9e3779b97f4a7c15) >> 32) & (INTERVAL_INDEX_UNMATCHED_FREES - 1);
+}
+
+void rememberUnmatchedFree(IntervalIndex& idx, u64 address, u64 ticks) {
+    u32 slot = unmatchedSlot(address);
+    idx.unmatchedAddresses[slot] = address;
+    idx.unmatchedTicks[slot] = ticks;
+}
+
+// True when a remembered free at the block's address came after it. The free is used up.
+bool takeUnmatchedFree(IntervalIndex& idx, const LiveBlock& block) {
+    u32 slot = unmatchedSlot(block.address);
+    if (idx.unmatchedAddresses[slot] != block.address || idx.unmatchedTicks[slot] < block.ticks) return false;
+    idx.unmatchedAddresses[slot] = 0;
+    return true;
+}
+
+// ------------------------------------------ END TREE OPERATIONS ------------------------------------------------------
+
+} // namespace
+
+IntervalInsertResult intervalIndexInsert(IntervalIndex& idx, const LiveBlock& block, LiveBlock* replaced) {
+    if (takeUnmatchedFree(idx, block)) return IntervalInsertResult::STALE;
+
+    if (!idx.root) {
+        Leaf* leaf = newLeaf(idx);
+        if (!leaf) return IntervalInsertResult::OUT_OF_MEMORY;
+        idx.root = leaf;
+        idx.height = 0;
+    }
+
+    Path path;
+    Leaf* leaf = findLeaf(idx, block.address, &path);
+    u32 slot = lowerBound(leaf->keys, leaf->count, block.address);
+    if (slot < leaf->count && leaf->keys[slot] == block.address) {
+        if (leaf->values[slot].ticks > block.ticks) return IntervalInsertResult::STALE;
+        if (replaced) *replaced = loadBlock(leaf, slot);
+        idx.liveBytes = idx.liveBytes - leaf->values[slot].size + block.size;
+        storeBlock(leaf, slot, block);
+        return IntervalInsertResult::REPLACED;
+    }
+
+    if (leaf->count < LEAF_CAP) {
+        insertIntoLeaf(leaf, slot, block);
+    }
+    else if (!splitAndInsert(idx, path, leaf, slot, block)) {
+        return IntervalInsertResult::OUT_OF_MEMORY;
+    }
+
+    idx.count++;
+    idx.liveBytes += block.size;
+    return IntervalInsertResult::INSERTED;
+}
+
+bool intervalIndexErase(IntervalIndex& idx, u64 address, u64 ticks, LiveBlock* erased) {
+    // free(nullptr) and failed calls name no block.
+    if (address == 0) return false;
+    if (!idx.root) {
+        rememberUnmatchedFree(idx, address, ticks);
+        return false;
+    }
+
+    Path path;
+    Leaf* leaf = findLeaf(idx, address, &path);
+    u32 slot = lowerBound(leaf->keys, leaf->count, address);
+    if (slot == leaf->count || leaf->keys[slot] != address) {
+        rememberUnmatchedFree(idx, address, ticks);
+        return false;
+    }
+    // The free of an older block at this address, whose allocation is then stale when it comes.
+    if (leaf->values[slot].ticks > ticks) return false;
+
+    if (erased) *erased = loadBlock(leaf, slot);
+    idx.count--;
+    idx.liveBytes -= leaf->values[slot].size;
+    removeFromLeaf(leaf, slot);
+
+    if (path.depth == 0) {
+        if (leaf->count == 0) {
+            freeLeaf(idx, leaf);
+            idx.root = nullptr;
+        }
+    }
+    else if (leaf->count < LEAF_MIN) {
+        rebalanceLeaf(idx, path, leaf);
+    }
+    return true;
+}
+
+bool intervalIndexStab(const IntervalIndex& idx, u64 address, LiveBlock& out) {
+    const Leaf* leaf;
+    u32 slot;
+    if (!findPredecessor(idx, address, leaf, slot)) return false;
+    if (address - leaf->keys[slot] >= leaf->values[slot].size) return false;
+    out = loadBlock(leaf, slot);
+    return true;
+}
+
+u64 intervalIndexQuery(const IntervalIndex& idx, u64 begin, u64 end, IntervalVisitor visit, void* userData) {
+    if (!idx.root || begin >= end) return 0;
+
+    const Leaf* leaf;
+    u32 slot;
+    if (findPredecessor(idx, begin, leaf, slot)) {
+        // A block starting before begin only counts when it reaches into the range.
+        if (leaf->keys[slot] < begin && begin - leaf->keys[slot] >= leaf->values[slot].size) slot++;
+    }
+    else {
+        // Everything starts after begin.
+        leaf = findLeaf(idx, begin, nullptr);
+        slot = 0;
+    }
+
+    u64 visited = 0;
+    for (; leaf; leaf = leaf->next, slot = 0) {
+        for (; slot < leaf->count; slot++) {
+            if (leaf->keys[slot] >= end) return visited;
+            visited++;
+            if (!visit(loadBlock(leaf, slot), userData)) return visited;
+        }
+    }
+    return visited;
+}
+
+bool intervalIndexBulkLoad(IntervalIndex& idx, const LiveBlock* blocks, u64 count) {
+    MEMVIZ_ZONE("intervalIndexBulkLoad");
+
+    intervalIndexClear(idx);
+    if (count == 0) return true;
+
+    u64 liveBytes = 0;
+    for (u64 i = 0; i < count; i++) {
+        if (i > 0 && blocks[i].address <= blocks[i - 1].address) {
+            logErr("Bulk load needs blocks sorted by address, block {} at {} is not", i, blocks[i].address);
+            return false;
+        }
+        liveBytes += blocks[i].size;
+    }
+
+    // The level being built, with the smallest address under each node. Every level is written over the one below.
+    const u64 leafCount = (count + LEAF_BULK_FILL - 1) / LEAF_BULK_FILL;
+    void** nodes = metaAlloc<void*>(leafCount);
+    u64* firstKeys = metaAlloc<u64>(leafCount);
+    defer {
+        metaFree(nodes, leafCount);
+        metaFree(firstKeys, leafCount);
+    };
+    if (!nodes || !firstKeys) return false;
+
+    u64 nodeCount = leafCount;
+    // Spread evenly, so the last node of a level is not left nearly empty.
+    u64 next = 0;
+    Leaf* prev = nullptr;
+    for (u64 n = 0; n < nodeCount; n++) {
+        Leaf* leaf = newLeaf(idx);
+        if (!leaf) {
+            for (u64 i = 0; i < n; i++) freeLeaf(idx, reinterpret_cast<Leaf*>(nodes[i]));
+            return false;
+        }
+        u32 take = u32(count / nodeCount + (n < count % nodeCount ? 1 : 0));
+        for (u32 i = 0; i < take; i++) storeBlock(leaf, i, blocks[next + i]);
+        leaf->count = take;
+        leaf->prev = prev;
+        if (prev) prev->next = leaf;
+        nodes[n] = leaf;
+        firstKeys[n] = blocks[next].address;
+        next += take;
+        prev = leaf;
+    }
+
+    u32 height = 0;
+    while (nodeCount > 1) {
+        u64 parentCount = (nodeCount + INNER_BULK_FILL - 1) / INNER_BULK_FILL;
+        u64 consumed = 0;
+        for (u64 n = 0; n < parentCount; n++) {
+            Inner* inner = newInner(idx);
+            if (!inner) {
+                // Parents before n are complete, the children from consumed on are not attached to any yet.
+                for (u64 i = 0; i < n; i++) freeSubtree(idx, nodes[i], height + 1);
+                for (u64 i = consumed; i < nodeCount; i++) freeSubtree(idx, nodes[i], height);
+                return false;
+            }
+            u32 take = u32(nodeCount / parentCount + (n < nodeCount % parentCount ? 1 : 0));
+            for (u32 i = 0; i < take; i++) {
+                inner->children[i] = nodes[consumed + i];
+                if (i > 0) inner->keys[i - 1] = firstKeys[consumed + i];
+            }
+            inner->count = take;
+            // n never passes consumed, nothing unread is overwritten.
+            u64 firstKey = firstKeys[consumed];
+            nodes[n] = inner;
+            firstKeys[n] = firstKey;
+            consumed += take;
+        }
+        nodeCount = parentCount;
+        height++;
+    }
+
+    idx.root = nodes[0];
+    idx.height = height;
+    idx.count = count;
+    idx.liveBytes = liveBytes;
+    return true;
+}
+
+void intervalIndexClear(IntervalIndex& idx) {
+    if (idx.root) freeSubtree(idx, idx.root, idx.height);
+    idx.root = nullptr;
+    idx.height = 0;
+    idx.count = 0;
+    idx.liveBytes = 0;
+    core::memset(idx.unmatchedAddresses, 0, sizeof(idx.unmatchedAddresses));
+}
+
+bool intervalIndexApply(IntervalIndex& idx, const HookEvent* events, u32 count,
+                        IntervalChangeFn onChange, void* userData) {
+    for (u32 i = 0; i < count; i++) {
+        const HookEvent& e = events[i];
+        LiveBlock removed;
+        if (isAllocation(e.op)) {
+            LiveBlock added = toLiveBlock(e);
+            IntervalInsertResult res = intervalIndexInsert(idx, added, &removed);
+            if (res == IntervalInsertResult::OUT_OF_MEMORY) return false;
+            if (!onChange || res == IntervalInsertResult::STALE) continue;
+            if (!onChange(res == IntervalInsertResult::REPLACED ? &removed : nullptr, &added, userData)) return false;
+        }
+        else if (isRelease(e.op)) {
+            if (intervalIndexErase(idx, e.address, e.ticks, &removed) && onChange &&
+                !onChange(&removed, nullptr, userData)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool intervalIndexBuild(IntervalIndex& idx, HookEvent* events, u64 count) {
+    MEMVIZ_ZONE("intervalIndexBuild");
+
+    u64 kept = 0;
+    for (u64 i = 0; i < count; i++) {
+        if (isAllocation(events[i].op) || isRelease(events[i].op)) events[kept++] = events[i];
+    }
+
+    // Per address, the last event in tick order decides whether a block lives there.
+    std::sort(events, events + kept, [](const HookEvent& a, const HookEvent& b) {
+        return a.address != b.address ? a.address < b.address : a.ticks < b.ticks;
+    });
+
+    u64 liveCount = 0;
+    for (u64 i = 0; i < kept; i++) {
+        bool last = i + 1 == kept || events[i + 1].address != events[i].address;
+        if (last && isAllocation(events[i].op)) liveCount++;
+    }
+
+    LiveBlock* blocks = metaAlloc<LiveBlock>(liveCount > 0 ? liveCount : 1);
+    if (!blocks) return false;
+    defer { metaFree(blocks, liveCount > 0 ? liveCount : 1); };
+
+    u64 n = 0;
+    for (u64 i = 0; i < kept; i++) {
+        bool last = i + 1 == kept || events[i + 1].address != events[i].address;
+        if (last && isAllocation(events[i].op)) blocks[n++] = toLiveBlock(events[i]);
+    }
+
+    return intervalIndexBulkLoad(idx, blocks, liveCount);
+}
+
+} // namespace memviz
@@ -1,31 +1,578 @@
 #include "basic.h"
+#include "systems/allocators.h"
 #include "systems/logger.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <stdio.h>
+#include <time.h>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
 namespace memviz {
 
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 RING_MASK = ASYNC_LOG_RING_SIZE - 1;
+static_assert((ASYNC_LOG_RING_SIZE & RING_MASK) == 0, "The ring size must be a power of two");
+
+constexpr u32 MAX_ASYNC_THREADS = 64;
+constexpr u32 RECORD_ALIGN = 8;
+// The writer is woken early once a ring is this full, otherwise it drains every WRITER_INTERVAL_MS.
+constexpr u32 WAKE_THRESHOLD = ASYNC_LOG_RING_SIZE / 2;
+constexpr u32 WRITER_INTERVAL_MS = 5;
+constexpr addr_size FORMAT_BUFFER_SIZE = ASYNC_LOG_MAX_STRING * 4;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN ASYNC LOGGER STATE -------------------------------------------------
+
+// Records are contiguous in the ring. One that does not fit before the end of the ring starts at the beginning, and
+// the skipped bytes get a padding header when there is room for one.
+struct RecordHeader {
+    u32 size; // Header and payload, multiple of RECORD_ALIGN.
+    u8 level;
+    u8 argCount;
+    bool padding;
+    i32 tag;
+    u64 seq;  // Global call order, for merging the rings.
+    const char* fmt;
+};
+
+struct StoredArg {
+    AsyncLogArgKind kind;
+    u32 len;  // String bytes, copied right after the arguments.
+    u64 value;
+};
+
+struct alignas(64) ThreadRing {
+    u8* data;
+    u32 index;
+
+    // Producer side.
+    alignas(64) std::atomic<u64> tail;
+    u64 cachedHead;
+    std::atomic<u64> dropped;
+    std::atomic<u64> truncated;
+
+    // Writer side.
+    alignas(64) std::atomic<u64> head;
+    u64 reportedDrops;
+};
+
+ThreadRing* g_rings[MAX_ASYNC_THREADS] = {};
+std::atomic<u32> g_ringCount = 0;
+std::mutex g_registerMutex;
+// Rings are freed when the writer stops. The generation tells a thread its cached ring is gone.
+std::atomic<u32> g_generation = 1;
+thread_local ThreadRing* t_ring = nullptr;
+thread_local u32 t_ringGeneration = 0;
+
+std::atomic<u64> g_seq = 0;
+std::atomic<u8> g_minLevel = u8(core::LogLevel::L_TRACE);
+std::atomic<u64> g_written = 0;
+std::atomic<u64> g_unregisteredDrops = 0; // Threads past MAX_ASYNC_THREADS.
+
+std::thread g_writer;
+std::thread::id g_writerId;
+std::atomic<bool> g_running = false;
+// Cleared first by asyncLoggerStop, which then waits for g_pushers to reach zero before it frees the rings. A push
+// counts itself in before it checks g_accepting, so no push can still be using a ring once the wait is over.
+std::atomic<bool> g_accepting = false;
+alignas(64) std::atomic<u32> g_pushers = 0;
+std::mutex g_wakeMutex;
+std::condition_variable g_wakeCv;
+std::condition_variable g_flushedCv;
+std::atomic<u64> g_flushRequested = 0;
+u64 g_flushDone = 0; // guarded by g_wakeMutex
+
+// ------------------------------------------ END ASYNC LOGGER STATE ---------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(LOGGER_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(LOGGER_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+constexpr u32 alignRecord(u32 size) {
+    return (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+ThreadRing* registerThread() {
+    std::lock_guard<std::mutex> lock(g_registerMutex);
+
+    u32 index = g_ringCount.load(std::memory_order_relaxed);
+    if (index >= MAX_ASYNC_THREADS) return nullptr;
+
+    u8* data = metaAlloc<u8>(ASYNC_LOG_RING_SIZE);
+    if (!data) return nullptr;
+
+    // Aligned new, the producer and writer fields live on separate cache lines.
+    ThreadRing* r = new ThreadRing();
+    r->data = data;
+    r->index = index;
+
+    g_rings[index] = r;
+    g_ringCount.store(index + 1, std::memory_order_release);
+
+    t_ring = r;
+    t_ringGeneration = g_generation.load(std::memory_order_relaxed);
+    return r;
+}
+
+// ------------------------------------------ BEGIN FORMATTING ---------------------------------------------------------
+
+struct FormatBuffer {
+    char* data;
+    addr_size cap;
+    addr_size len;
+
+    void append(const char* s, addr_size n) {
+        if (len + n > cap - 1) n = cap - 1 - len;
+        len += core::memcopy(data + len, s, n);
+    }
+
+    template <typename... Args>
+    void appendf(const char* f, Args... args) {
+        i32 n = snprintf(data + len, cap - len, f, args...);
+        if (n > 0) len += addr_size(n) < cap - len ? addr_size(n) : cap - len - 1;
+    }
+};
+
+void appendArg(FormatBuffer& out, const AsyncLogArg& a, const char* spec, addr_size specLen) {
+    bool hex = false;
+    i32 precision = -1;
+    for (addr_size i = 0; i < specLen; i++) {
+        if (spec[i] == 'H') hex = true;
+        if (spec[i] == 'f' && i + 1 < specLen && spec[i + 1] == '.') {
+            precision = 0;
+            for (addr_size j = i + 2; j < specLen && spec[j] >= '0' && spec[j] <= '9'; j++) {
+                precision = precision * 10 + (spec[j] - '0');
+            }
+        }
+    }
+
+    switch (a.kind) {
+        case AsyncLogArgKind::SIGNED:
+            if (hex) out.appendf("%llX", (unsigned long long)a.i);
+            else     out.appendf("%lld", (long long)a.i);
+            break;
+        case AsyncLogArgKind::UNSIGNED:
+            if (hex) out.appendf("%llX", (unsigned long long)a.u);
+            else     out.appendf("%llu", (unsigned long long)a.u);
+            break;
+        case AsyncLogArgKind::FLOAT:
+            if (precision >= 0) out.appendf("%.*f", precision, a.f);
+            else                out.appendf("%g", a.f);
+            break;
+        case AsyncLogArgKind::BOOL:
+            if (a.u) out.append("true", 4);
+            else     out.append("false", 5);
+            break;
+        case AsyncLogArgKind::STRING:
+            if (a.s) out.append(a.s, core::cstrLen(a.s));
+            else     out.append("null", 4);
+            break;
+        case AsyncLogArgKind::POINTER:
+            out.appendf("%p", a.p);
+            break;
+    }
+}
+
+// Expands {} placeholders of fmt with args. Placeholders without an argument are kept as they are.
+void formatRecord(FormatBuffer& out, const char* fmt, const AsyncLogArg* args, u32 argCount) {
+    u32 next = 0;
+    const char* p = fmt;
+    while (*p) {
+        if (*p != '{') {
+            const char* start = p;
+            while (*p && *p != '{') p++;
+            out.append(start, addr_size(p - start));
+            continue;
+        }
+
+        const char* close = p + 1;
+        while (*close && *close != '}') close++;
+        if (*close != '}' || next >= argCount) {
+            out.append(p, *close ? addr_size(close - p + 1) : addr_size(close - p));
+            p = *close ? close + 1 : close;
+            continue;
+        }
+
+        appendArg(out, args[next++], p + 1, addr_size(close - (p + 1)));
+        p = close + 1;
+    }
+    out.data[out.len] = '\0';
+}
+
+void writeLine(core::LogLevel level, i32 tag, const char* line) {
+    switch (level) {
+        case core::LogLevel::L_TRACE:   logTraceTagged(LogTag(tag), "{}", line); break;
+        case core::LogLevel::L_DEBUG:   logDebugTagged(LogTag(tag), "{}", line); break;
+        case core::LogLevel::L_INFO:    logInfoTagged(LogTag(tag), "{}", line);  break;
+        case core::LogLevel::L_WARNING: logWarnTagged(LogTag(tag), "{}", line);  break;
+        case core::LogLevel::L_ERROR:   logErrTagged(LogTag(tag), "{}", line);   break;
+        default:                        logFatalTagged(LogTag(tag), "{}", line); break;
+    }
+}
+
+// ------------------------------------------ END FORMATTING -----------------------------------------------------------
+
+// ------------------------------------------ BEGIN WRITER -------------------------------------------------------------
+
+// Skips padding and returns the next record of the ring before tail, or nullptr.
+const RecordHeader* peekRecord(ThreadRing& r, u64 tail) {
+    u64 head = r.head.load(std::memory_order_relaxed);
+    while (head < tail) {
+        u32 offset = u32(head & RING_MASK);
+        u32 contiguous = ASYNC_LOG_RING_SIZE - offset;
+        if (contiguous < sizeof(RecordHeader)) {
+            head += contiguous;
+            continue;
+        }
+
+        auto hdr = reinterpret_cast<const RecordHeader*>(r.data + offset);
+        if (hdr->padding) {
+            head += hdr->size;
+            continue;
+        }
+
+        r.head.store(head, std::memory_order_release);
+        return hdr;
+    }
+    r.head.store(head, std::memory_order_release);
+    return nullptr;
+}
+
+void writeRecord(const RecordHeader* hdr, char* buffer) {
+    auto stored = reinterpret_cast<const StoredArg*>(hdr + 1);
+    auto strings = reinterpret_cast<const char*>(stored + hdr->argCount);
+
+    AsyncLogArg args[ASYNC_LOG_MAX_ARGS];
+    for (u32 i = 0; i < hdr->argCount; i++) {
+        args[i].kind = stored[i].kind;
+        args[i].u = stored[i].value;
+        if (stored[i].kind == AsyncLogArgKind::STRING) {
+            args[i].s = strings;
+            strings += stored[i].len + 1;
+        }
+    }
+
+    FormatBuffer out = { buffer, FORMAT_BUFFER_SIZE, 0 };
+    formatRecord(out, hdr->fmt, args, hdr->argCount);
+    writeLine(core::LogLevel(hdr->level), hdr->tag, buffer);
+}
+
+// Writes everything published so far, merging the rings by call order.
+void drainRings(char* buffer) {
+    u32 ringCount = g_ringCount.load(std::memory_order_acquire);
+    u64 tails[MAX_ASYNC_THREADS];
+    for (u32 i = 0; i < ringCount; i++) {
+        tails[i] = g_rings[i]->tail.load(std::memory_order_acquire);
+    }
+
+    u64 written = 0;
+    while (true) {
+        ThreadRing* oldest = nullptr;
+        const RecordHeader* oldestHdr = nullptr;
+        for (u32 i = 0; i < ringCount; i++) {
+            const RecordHeader* hdr = peekRecord(*g_rings[i], tails[i]);
+            if (hdr && (!oldestHdr || hdr->seq < oldestHdr->seq)) {
+                oldest = g_rings[i];
+                oldestHdr = hdr;
+            }
+        }
+        if (!oldest) break;
+
+        writeRecord(oldestHdr, buffer);
+        oldest->head.store(oldest->head.load(std::memory_order_relaxed) + oldestHdr->size, std::memory_order_release);
+        written++;
+    }
+
+    g_written.fetch_add(written, std::memory_order_relaxed);
+}
+
+void reportDrops() {
+    u32 ringCount = g_ringCount.load(std::memory_order_acquire);
+    for (u32 i = 0; i < ringCount; i++) {
+        ThreadRing& r = *g_rings[i];
+        u64 dropped = r.dropped.load(std::memory_order_relaxed);
+        if (dropped != r.reportedDrops) {
+            logWarn("Async logging dropped {} records from thread {} (ring full)", dropped - r.reportedDrops, r.index);
+            r.reportedDrops = dropped;
+        }
+    }
+}
+
+void writerMain() {
+    char buffer[FORMAT_BUFFER_SIZE];
+
+    while (true) {
+        // Read before draining, so everything pushed before the stop or the flush request is written.
+        bool stopping = !g_running.load(std::memory_order_acquire);
+        u64 flushTicket = g_flushRequested.load(std::memory_order_acquire);
+
+        drainRings(buffer);
+        reportDrops();
+
+        std::unique_lock<std::mutex> lock(g_wakeMutex);
+        if (flushTicket != g_flushDone) {
+            g_flushDone = flushTicket;
+            g_flushedCv.notify_all();
+        }
+        if (stopping) break;
+
+        g_wakeCv.wait_for(lock, std::chrono::milliseconds(WRITER_INTERVAL_MS), [] {
+            return !g_running.load(std::memory_order_relaxed) ||
+                   g_flushRequested.load(std::memory_order_relaxed) != g_flushDone;
+        });
+    }
+}
+
+// ------------------------------------------ END WRITER ---------------------------------------------------------------
+
+// The async logger filters by level on the calling thread, so records that would be discarded never take ring space.
+void setLogLevel(core::LogLevel level) {
+    core::loggerSetLevel(level);
+    g_minLevel.store(u8(level), std::memory_order_relaxed);
+}
+
+} // namespace
+
 void loggerSystemInit() {
     for (i32 i = i32(LogTag::ALL_TAG) + 1; i < i32(LogTag::SENTINEL); i++) {
         auto tagsv = core::sv(logTagToCStr(LogTag(i)));
         bool ok = core::loggerSetTag(i, tagsv);
         AssertFmt(ok, "Failed to set logger tag '{}'", i);
     }
+
+    asyncLoggerStart();
 }
 
 void loggerSystemShutdown() {
+    asyncLoggerStop();
     core::loggerDestroy();
 }
 
-void loggerSystemSetLogLevelToTrace() { core::loggerSetLevel(core::LogLevel::L_TRACE); }
-void loggerSystemSetLogLevelToDebug() { core::loggerSetLevel(core::LogLevel::L_DEBUG); }
-void loggerSystemSetLogLevelToInfo() { core::loggerSetLevel(core::LogLevel::L_INFO); }
-void loggerSystemSetLogLevelToWarning() { core::loggerSetLevel(core::LogLevel::L_WARNING); }
-void loggerSystemSetLogLevelToError() { core::loggerSetLevel(core::LogLevel::L_ERROR); }
-void loggerSystemSetLogLevelToFatal() { core::loggerSetLevel(core::LogLevel::L_FATAL); }
+void loggerSystemSetLogLevelToTrace() { setLogLevel(core::LogLevel::L_TRACE); }
+void loggerSystemSetLogLevelToDebug() { setLogLevel(core::LogLevel::L_DEBUG); }
+void loggerSystemSetLogLevelToInfo() { setLogLevel(core::LogLevel::L_INFO); }
+void loggerSystemSetLogLevelToWarning() { setLogLevel(core::LogLevel::L_WARNING); }
+void loggerSystemSetLogLevelToError() { setLogLevel(core::LogLevel::L_ERROR); }
+void loggerSystemSetLogLevelToFatal() { setLogLevel(core::LogLevel::L_FATAL); }
+
+void asyncLoggerStart() {
+    if (g_running.load(std::memory_order_relaxed)) return;
+    g_running.store(true, std::memory_order_release);
+    g_writer = std::thread(writerMain);
+    g_writerId = g_writer.get_id();
+    g_accepting.store(true, std::memory_order_seq_cst);
+}
+
+void asyncLoggerStop() {
+    if (!g_running.load(std::memory_order_relaxed)) return;
+
+    // New pushes log synchronously from here on. The ones already in flight finish into their rings before the writer
+    // is told to stop, so its last drain sees them.
+    g_accepting.store(false, std::memory_order_seq_cst);
+    while (g_pushers.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+
+    {
+        std::lock_guard<std::mutex> lock(g_wakeMutex);
+        g_running.store(false, std::memory_order_release);
+    }
+    g_wakeCv.notify_one();
+    g_writer.join();
+    g_writerId = {};
+
+    AsyncLoggerStats stats = asyncLoggerStats();
+    logInfo("Async logger: {} records written, {} dropped, {} truncated, {} threads",
+            stats.written, stats.dropped, stats.truncated, stats.threads);
+
+    std::lock_guard<std::mutex> lock(g_registerMutex);
+    u32 ringCount = g_ringCount.load(std::memory_order_relaxed);
+    for (u32 i = 0; i < ringCount; i++) {
+        metaFree(g_rings[i]->data, ASYNC_LOG_RING_SIZE);
+        delete g_rings[i];
+        g_rings[i] = nullptr;
+    }
+    g_ringCount.store(0, std::memory_order_release);
+    g_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void asyncLoggerFlush() {
+    if (!g_running.load(std::memory_order_acquire)) return;
+    if (std::this_thread::get_id() == g_writerId) return; // e.g. an assert while formatting
+
+    std::unique_lock<std::mutex> lock(g_wakeMutex);
+    u64 ticket = g_flushRequested.fetch_add(1, std::memory_order_acq_rel) + 1;
+    g_wakeCv.notify_one();
+    g_flushedCv.wait(lock, [ticket] { return g_flushDone >= ticket || !g_running.load(std::memory_order_relaxed); });
+}
+
+AsyncLoggerStats asyncLoggerStats() {
+    AsyncLoggerStats ret = {};
+    std::lock_guard<std::mutex> lock(g_registerMutex);
+    u32 ringCount = g_ringCount.load(std::memory_order_acquire);
+    for (u32 i = 0; i < ringCount; i++) {
+        ret.dropped += g_rings[i]->dropped.load(std::memory_order_relaxed);
+        ret.truncated += g_rings[i]->truncated.load(std::memory_order_relaxed);
+    }
+    ret.dropped += g_unregisteredDrops.load(std::memory_order_relaxed);
+    ret.written = g_written.load(std::memory_order_relaxed);
+    ret.threads = ringCount;
+    return ret;
+}
+
+bool logRateLimitAllow(LogRateLimit& limit, u32 perSecond, u32& suppressed) {
+    constexpr u64 WINDOW_NS = 1'000'000'000;
+
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    u64 nowNs = u64(ts.tv_sec) * 1'000'000'000 + u64(ts.tv_nsec);
+
+    std::atomic_ref<u64> windowStart(limit.windowStartNs);
+    std::atomic_ref<u32> count(limit.count);
+    std::atomic_ref<u32> dropped(limit.suppressed);
+
+    u64 start = windowStart.load(std::memory_order_relaxed);
+    if (nowNs - start >= WINDOW_NS && windowStart.compare_exchange_strong(start, nowNs, std::memory_order_relaxed)) {
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    if (count.fetch_add(1, std::memory_order_relaxed) >= perSecond) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    suppressed = dropped.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+void asyncLogPush(core::LogLevel level, i32 tag, const char* fmt, const AsyncLogArg* args, u32 argCount) {
+    if (u8(level) < g_minLevel.load(std::memory_order_relaxed)) return;
+
+    g_pushers.fetch_add(1, std::memory_order_seq_cst);
+    if (!g_accepting.load(std::memory_order_seq_cst)) {
+        // Before init, after shutdown: nothing to defer to. Not counted as in flight while formatting, a thread that
+        // keeps logging must not hold up asyncLoggerStop.
+        g_pushers.fetch_sub(1, std::memory_order_release);
+        char buffer[FORMAT_BUFFER_SIZE];
+        FormatBuffer out = { buffer, FORMAT_BUFFER_SIZE, 0 };
+        formatRecord(out, fmt, args, argCount);
+        writeLine(level, tag, buffer);
+        return;
+    }
+    defer { g_pushers.fetch_sub(1, std::memory_order_release); };
+
+    ThreadRing* r = t_ring;
+    if (!r || t_ringGeneration != g_generation.load(std::memory_order_relaxed)) {
+        r = registerThread();
+        if (!r) {
+            g_unregisteredDrops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    bool truncated = false;
+    if (argCount > ASYNC_LOG_MAX_ARGS) {
+        argCount = ASYNC_LOG_MAX_ARGS;
+        truncated = true;
+    }
+
+    u32 stringLens[ASYNC_LOG_MAX_ARGS];
+    u32 size = u32(sizeof(RecordHeader)) + argCount * u32(sizeof(StoredArg));
+    for (u32 i = 0; i < argCount; i++) {
+        if (args[i].kind != AsyncLogArgKind::STRING || !args[i].s) continue;
+        addr_size len = core::cstrLen(args[i].s);
+        if (len > ASYNC_LOG_MAX_STRING) {
+            len = ASYNC_LOG_MAX_STRING;
+            truncated = true;
+        }
+        stringLens[i] = u32(len);
+        size += u32(len) + 1;
+    }
+    size = alignRecord(size);
+
+    u64 tail = r->tail.load(std::memory_order_relaxed);
+    u32 offset = u32(tail & RING_MASK);
+    u32 contiguous = ASYNC_LOG_RING_SIZE - offset;
+    u32 skip = contiguous < size ? contiguous : 0;
+
+    if (tail + skip + size - r->cachedHead > ASYNC_LOG_RING_SIZE) {
+        r->cachedHead = r->head.load(std::memory_order_acquire);
+        if (tail + skip + size - r->cachedHead > ASYNC_LOG_RING_SIZE) {
+            r->dropped.fetch_add(1, std::memory_order_relaxed);
+            g_wakeCv.notify_one();
+            return;
+        }
+    }
+
+    if (skip > 0) {
+        if (skip >= sizeof(RecordHeader)) {
+            auto pad = reinterpret_cast<RecordHeader*>(r->data + offset);
+            pad->size = skip;
+            pad->padding = true;
+        }
+        tail += skip;
+        offset = 0;
+    }
+
+    auto hdr = reinterpret_cast<RecordHeader*>(r->data + offset);
+    hdr->size = size;
+    hdr->level = u8(level);
+    hdr->argCount = u8(argCount);
+    hdr->padding = false;
+    hdr->tag = tag;
+    hdr->seq = g_seq.fetch_add(1, std::memory_order_relaxed);
+    hdr->fmt = fmt;
+
+    auto stored = reinterpret_cast<StoredArg*>(hdr + 1);
+    auto strings = reinterpret_cast<char*>(stored + argCount);
+    for (u32 i = 0; i < argCount; i++) {
+        stored[i].kind = args[i].kind;
+        stored[i].value = args[i].u;
+        stored[i].len = 0;
+        if (args[i].kind == AsyncLogArgKind::STRING) {
+            if (!args[i].s) {
+                stored[i].kind = AsyncLogArgKind::POINTER; // formats the null
+                continue;
+            }
+            stored[i].len = stringLens[i];
+            strings += core::memcopy(strings, args[i].s, stringLens[i]);
+            if (stringLens[i] == ASYNC_LOG_MAX_STRING && args[i].s[ASYNC_LOG_MAX_STRING] != '\0') {
+                core::memcopy(strings - 3, "...", 3); // visibly cut
+            }
+            *strings++ = '\0';
+        }
+    }
+    if (truncated) r->truncated.fetch_add(1, std::memory_order_relaxed);
+
+    r->tail.store(tail + size, std::memory_order_release);
+
+    if (tail + size - r->cachedHead > WAKE_THRESHOLD) {
+        r->cachedHead = r->head.load(std::memory_order_acquire);
+        if (tail + size - r->cachedHead > WAKE_THRESHOLD) g_wakeCv.notify_one();
+    }
+}
 
 core::LoggerCreateInfo loggerSystemCreateInfo() {
     core::LoggerCreateInfo ret = core::LoggerCreateInfo::createDefault();
     ret.useAnsi = true;
-    ret.allocatorId = 0;
+    ret.allocatorId = LOGGER_ALLOCATOR_ID;
     return ret;
 }
 
@@ -126,3 +673,5 @@ void __debug__testLoggerSetup() {
 }
 
 } // memviz
+
+PRAGMA_WARNING_POP
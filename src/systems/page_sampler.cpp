@@ -0,0 +1,535 @@
+#include "systems/page_sampler.h"
+
+#include "basic.h"
+#include "platform.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+#include "systems/profiler.h"
+
+#include <bit>
+#include <mutex>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u64 PM_PRESENT = u64(1) << 63;
+constexpr u64 PM_SWAPPED = u64(1) << 62;
+constexpr u64 PM_SOFT_DIRTY = u64(1) << 55;
+
+constexpr u32 TRACKS_MIN_CAPACITY = 1024;
+// VMAs at most this many pages apart are read with one pread, reading the gap is cheaper than another syscall.
+constexpr u64 COALESCE_GAP_PAGES = 64;
+constexpr u32 WARNINGS_PER_SECOND = 1;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// Bits of one VMA: resident, swapped and, for writable VMAs, PAGE_SAMPLER_HISTORY written bitsets used as a ring.
+struct PageTrack {
+    u64 firstPage;
+    u64 endPage;
+    u64* bits;
+    u32 words;
+    bool writable;
+    bool needsScan;
+};
+
+struct PageSampler {
+    u32 pid;
+    u64 periodNs;
+    u64 nextScanNs;
+    u32 tick;
+    u32 head; // History slot of the current interval.
+    u32 pageShift;
+    i32 pagemapFd;
+    i32 clearRefsFd;
+
+    // Changed only on the sampler thread, under mutex. The sampler thread reads them without it.
+    PageTrack* tracks;
+    PageTrack* scratch;
+    u32 trackCount;
+    u32 trackCapacity;
+
+    u64* entries; // PAGE_SAMPLER_BATCH_PAGES
+    u32* scanList; // trackCapacity
+    u32 scanCapacity;
+
+    // Guards the tracks, their bits and stats against pageSamplerSummarize.
+    std::mutex mutex;
+    PageSamplerStats stats;
+};
+
+PageSampler* g_pages = nullptr;
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+u32 bitsetCount(const PageTrack& t) {
+    return 2 + (t.writable ? PAGE_SAMPLER_HISTORY : 0);
+}
+
+u64* residentBits(const PageTrack& t) { return t.bits; }
+u64* swappedBits(const PageTrack& t) { return t.bits + t.words; }
+u64* historyBits(const PageTrack& t, u32 slot) { return t.bits + addr_size(2 + slot) * t.words; }
+
+void freeTrack(PageTrack& t) {
+    metaFree(t.bits, addr_size(t.words) * bitsetCount(t));
+    t.bits = nullptr;
+}
+
+bool makeTrack(const PageSampler& s, const VmaRecord& vma, PageTrack& out) {
+    if ((vma.perms & (VMA_READ | VMA_WRITE | VMA_EXEC)) == 0) return false; // guard pages and reservations
+    if (vma.end - vma.start > PAGE_SAMPLER_MAX_VMA_BYTES) return false;
+
+    out = {};
+    out.firstPage = vma.start >> s.pageShift;
+    out.endPage = vma.end >> s.pageShift;
+    out.words = u32((out.endPage - out.firstPage + 63) / 64);
+    out.writable = (vma.perms & VMA_WRITE) != 0;
+    out.needsScan = true;
+
+    addr_size count = addr_size(out.words) * bitsetCount(out);
+    out.bits = metaAlloc<u64>(count);
+    if (!out.bits) {
+        logWarnTaggedLimited(WARNINGS_PER_SECOND, INGEST_TAG, "Out of memory for the pages of {}-{}",
+                             vma.start, vma.end);
+        return false;
+    }
+    core::memset(out.bits, 0, count * sizeof(u64));
+    return true;
+}
+
+// Copies the bits of the pages both tracks cover. They start at the same page, a VMA that grew or shrank in place is
+// reported as removed and added again, and would otherwise lose its write history.
+void inheritPages(const PageTrack& from, PageTrack& to) {
+    u64 pages = (from.endPage < to.endPage ? from.endPage : to.endPage) - to.firstPage;
+    u64 whole = pages / 64;
+    u64 lastMask = (u64(1) << (pages & 63)) - 1;
+
+    auto copy = [&](const u64* src, u64* dst) {
+        core::memcopy(dst, src, addr_size(whole) * sizeof(u64));
+        if (lastMask) dst[whole] = src[whole] & lastMask;
+    };
+    copy(residentBits(from), residentBits(to));
+    copy(swappedBits(from), swappedBits(to));
+    if (from.writable && to.writable) {
+        for (u32 slot = 0; slot < PAGE_SAMPLER_HISTORY; slot++) copy(historyBits(from, slot), historyBits(to, slot));
+    }
+}
+
+bool reserveTracks(PageSampler& s, u32 needed) {
+    if (needed <= s.trackCapacity) return true;
+    u32 capacity = s.trackCapacity > 0 ? s.trackCapacity : TRACKS_MIN_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    PageTrack* tracks = metaAlloc<PageTrack>(capacity);
+    PageTrack* scratch = metaAlloc<PageTrack>(capacity);
+    u32* scanList = metaAlloc<u32>(capacity);
+    if (!tracks || !scratch || !scanList) {
+        metaFree(tracks, capacity);
+        metaFree(scratch, capacity);
+        metaFree(scanList, capacity);
+        return false;
+    }
+
+    // Allocated outside the lock, pageSamplerSummarize only waits for the copy and the swap.
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.trackCount > 0) core::memcopy(tracks, s.tracks, addr_size(s.trackCount) * sizeof(PageTrack));
+    metaFree(s.tracks, s.trackCapacity);
+    metaFree(s.scratch, s.trackCapacity);
+    metaFree(s.scanList, s.trackCapacity);
+    s.tracks = tracks;
+    s.scratch = scratch;
+    s.scanList = scanList;
+    s.trackCapacity = capacity;
+    return true;
+}
+
+// Same merge as vmaRegionsApply, removed VMAs lose their bits and added ones start empty, unless an added one starts
+// where a removed one did.
+void applyDelta(PageSampler& s, const VmaDelta& delta) {
+    if (delta.removedCount == 0 && delta.addedCount == 0) return;
+    if (!reserveTracks(s, s.trackCount + delta.addedCount)) {
+        logErrTaggedLimited(WARNINGS_PER_SECOND, INGEST_TAG, "Out of memory for the page tracks");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    u32 count = 0;
+    u32 i = 0, removed = 0, added = 0;
+    while (i < s.trackCount || added < delta.addedCount) {
+        if (i < s.trackCount) {
+            PageTrack& t = s.tracks[i];
+            u64 start = t.firstPage << s.pageShift;
+            while (removed < delta.removedCount && delta.removed[removed].start < start) removed++;
+            if (removed < delta.removedCount && delta.removed[removed].start == start) {
+                // Added VMAs before start were merged already, one at start can only be next.
+                PageTrack grown;
+                if (added < delta.addedCount && delta.added[added].start == start &&
+                    makeTrack(s, delta.added[added++], grown)) {
+                    inheritPages(t, grown);
+                    s.scratch[count++] = grown;
+                }
+                freeTrack(t);
+                removed++;
+                i++;
+                continue;
+            }
+            if (added == delta.addedCount || start <= delta.added[added].start) {
+                s.scratch[count++] = t;
+                i++;
+                continue;
+            }
+        }
+
+        PageTrack t;
+        if (makeTrack(s, delta.added[added++], t)) s.scratch[count++] = t;
+    }
+
+    PageTrack* tracks = s.tracks;
+    s.tracks = s.scratch;
+    s.scratch = tracks;
+    s.trackCount = count;
+}
+
+// Decodes the entries of pages [from, to), read starting at page base, into the track.
+void decodePages(PageSampler& s, PageTrack& t, const u64* entries, u64 base, u64 from, u64 to) {
+    u64* resident = residentBits(t);
+    u64* swapped = swappedBits(t);
+    u64* written = t.writable ? historyBits(t, s.head) : nullptr;
+
+    for (u64 page = from; page < to; page++) {
+        u64 e = entries[page - base];
+        u64 index = page - t.firstPage;
+        u64 bit = u64(1) << (index & 63);
+        u64 w = index >> 6;
+        if (e & PM_PRESENT) resident[w] |= bit;
+        if (e & PM_SWAPPED) swapped[w] |= bit;
+        // New VMAs report every page soft-dirty, pages never faulted in can not have been written.
+        if (written && (e & PM_SOFT_DIRTY) && (e & (PM_PRESENT | PM_SWAPPED))) written[w] |= bit;
+    }
+}
+
+void clearScanned(PageSampler& s, PageTrack& t) {
+    core::memset(residentBits(t), 0, addr_size(t.words) * sizeof(u64));
+    core::memset(swappedBits(t), 0, addr_size(t.words) * sizeof(u64));
+    if (t.writable) core::memset(historyBits(t, s.head), 0, addr_size(t.words) * sizeof(u64));
+}
+
+// Reads the tracks scanList[first, last) with as few preads as their layout allows. Returns false when pagemap can not
+// be read anymore.
+bool scanRun(PageSampler& s, u32 first, u32 last) {
+    u64 runFirst = s.tracks[s.scanList[first]].firstPage;
+    u64 runEnd = s.tracks[s.scanList[last - 1]].endPage;
+
+    u32 next = first; // First track of the run not completely decoded yet.
+    for (u64 page = runFirst; page < runEnd;) {
+        u64 n = runEnd - page < PAGE_SAMPLER_BATCH_PAGES ? runEnd - page : PAGE_SAMPLER_BATCH_PAGES;
+        ssize_t got = pread(s.pagemapFd, s.entries, n * sizeof(u64), off_t(page * sizeof(u64)));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return false;
+        if (got == 0) break; // past the user address space, the vsyscall page
+        u64 batchEnd = page + u64(got) / sizeof(u64);
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (u32 i = next; i < last; i++) {
+            PageTrack& t = s.tracks[s.scanList[i]];
+            if (t.firstPage >= batchEnd) break;
+            if (t.firstPage >= page) clearScanned(s, t); // first batch that reaches it
+            u64 from = t.firstPage > page ? t.firstPage : page;
+            u64 to = t.endPage < batchEnd ? t.endPage : batchEnd;
+            if (from < to) decodePages(s, t, s.entries, page, from, to);
+            if (t.endPage <= batchEnd) {
+                t.needsScan = false;
+                next = i + 1;
+            }
+        }
+        page = batchEnd;
+    }
+    return true;
+}
+
+void updateStats(PageSampler& s, u32 scanned, u64 startNs) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    PageSamplerStats& st = s.stats;
+    st.trackedVmas = s.trackCount;
+    st.scannedVmas = scanned;
+    st.trackedPages = 0;
+    st.residentPages = 0;
+    st.swappedPages = 0;
+    st.writtenPages = 0;
+    for (u32 i = 0; i < s.trackCount; i++) {
+        const PageTrack& t = s.tracks[i];
+        st.trackedPages += t.endPage - t.firstPage;
+        for (u32 w = 0; w < t.words; w++) {
+            st.residentPages += u64(std::popcount(residentBits(t)[w]));
+            st.swappedPages += u64(std::popcount(swappedBits(t)[w]));
+            if (t.writable) st.writtenPages += u64(std::popcount(historyBits(t, s.head)[w]));
+        }
+    }
+    st.scanNs = Platform::getMonotonicTimeNs() - startNs;
+    st.generation++;
+}
+
+void tick(PageSampler& s) {
+    MEMVIZ_ZONE("page sample");
+    u64 startNs = Platform::getMonotonicTimeNs();
+
+    {
+        // The slot being overwritten is the oldest interval, dropped from every writable track at once.
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.head = (s.head + 1) % PAGE_SAMPLER_HISTORY;
+    }
+
+    bool residency = s.tick % PAGE_SAMPLER_RESIDENCY_EVERY == 0;
+    u32 scanned = 0;
+    for (u32 i = 0; i < s.trackCount; i++) {
+        const PageTrack& t = s.tracks[i];
+        if (t.writable || t.needsScan || residency) s.scanList[scanned++] = i;
+    }
+
+    // Runs of tracks close enough to share their preads.
+    for (u32 first = 0; first < scanned;) {
+        u32 last = first + 1;
+        while (last < scanned) {
+            const PageTrack& prev = s.tracks[s.scanList[last - 1]];
+            const PageTrack& t = s.tracks[s.scanList[last]];
+            if (t.firstPage - prev.endPage > COALESCE_GAP_PAGES) break;
+            last++;
+        }
+        if (!scanRun(s, first, last)) {
+            logWarnTaggedLimited(WARNINGS_PER_SECOND, INGEST_TAG, "Failed to read the pagemap of {}, errno={}",
+                                 s.pid, errno);
+            break;
+        }
+        first = last;
+    }
+
+    // Starts the next interval. Clears the soft-dirty bits of every page of the process.
+    if (s.stats.softDirty && pwrite(s.clearRefsFd, "4", 1, 0) != 1) {
+        logWarnTagged(INGEST_TAG, "Failed to reset the soft-dirty bits of {}, errno={}, sampling residency only",
+                      s.pid, errno);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.stats.softDirty = false;
+    }
+
+    updateStats(s, scanned, startNs);
+    s.tick++;
+}
+
+// Without CONFIG_MEM_SOFT_DIRTY the reset succeeds and no page is ever soft-dirty. A page this process just wrote
+// tells, pages are soft-dirty from their first write until a reset.
+bool softDirtySupported(u32 pageShift) {
+    u64 pageBytes = u64(1) << pageShift;
+    void* probe = mmap(nullptr, pageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (probe == MAP_FAILED) return false;
+    defer { munmap(probe, pageBytes); };
+    *reinterpret_cast<volatile u8*>(probe) = 1;
+
+    i32 fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    defer { close(fd); };
+    u64 entry = 0;
+    off_t at = off_t((reinterpret_cast<u64>(probe) >> pageShift) * sizeof(u64));
+    return pread(fd, &entry, sizeof(entry), at) == sizeof(entry) && (entry & PM_SOFT_DIRTY) != 0;
+}
+
+void freePageSampler(PageSampler* s) {
+    for (u32 i = 0; i < s->trackCount; i++) freeTrack(s->tracks[i]);
+    metaFree(s->tracks, s->trackCapacity);
+    metaFree(s->scratch, s->trackCapacity);
+    metaFree(s->scanList, s->trackCapacity);
+    metaFree(s->entries, PAGE_SAMPLER_BATCH_PAGES);
+    if (s->pagemapFd >= 0) close(s->pagemapFd);
+    if (s->clearRefsFd >= 0) close(s->clearRefsFd);
+    delete s;
+}
+
+// Index of the first track ending after page.
+u32 firstTrackAfter(const PageSampler& s, u64 page) {
+    u32 lo = 0, hi = s.trackCount;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (s.tracks[mid].endPage <= page) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void addPage(const PageTrack& t, u64 index, PageCell& cell) {
+    u64 bit = u64(1) << (index & 63);
+    u64 w = index >> 6;
+    cell.pages++;
+    if (residentBits(t)[w] & bit) cell.resident++;
+    if (swappedBits(t)[w] & bit) cell.swapped++;
+    if (!t.writable) return;
+
+    u32 writes = 0;
+    for (u32 slot = 0; slot < PAGE_SAMPLER_HISTORY; slot++) {
+        if (historyBits(t, slot)[w] & bit) writes++;
+    }
+    if (writes > 0) cell.written++;
+    cell.writes += writes;
+}
+
+// A whole word of pages in one cell.
+void addWord(const PageTrack& t, u64 w, PageCell& cell) {
+    cell.pages += 64;
+    cell.resident += u32(std::popcount(residentBits(t)[w]));
+    cell.swapped += u32(std::popcount(swappedBits(t)[w]));
+    if (!t.writable) return;
+
+    u64 any = 0;
+    for (u32 slot = 0; slot < PAGE_SAMPLER_HISTORY; slot++) {
+        u64 bits = historyBits(t, slot)[w];
+        any |= bits;
+        cell.writes += u32(std::popcount(bits));
+    }
+    cell.written += u32(std::popcount(any));
+}
+
+} // namespace
+
+bool pageSamplerStart(u32 pid, u32 hz) {
+    Assert(!g_pages, "pageSamplerStart called twice");
+    if (hz == 0) return false;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/pagemap", pid);
+    i32 pagemapFd = open(path, O_RDONLY | O_CLOEXEC);
+    if (pagemapFd < 0) {
+        logErrTagged(INGEST_TAG, "Failed to open {}, errno={}", path, errno);
+        return false;
+    }
+
+    PageSampler* s = new PageSampler();
+    s->pid = pid;
+    s->periodNs = 1'000'000'000ull / hz;
+    s->pageShift = u32(std::countr_zero(u64(sysconf(_SC_PAGESIZE))));
+    s->pagemapFd = pagemapFd;
+    s->clearRefsFd = -1;
+    s->entries = metaAlloc<u64>(PAGE_SAMPLER_BATCH_PAGES);
+    if (!s->entries) {
+        logErrTagged(INGEST_TAG, "Out of memory for the pagemap buffer");
+        freePageSampler(s);
+        return false;
+    }
+
+    // Pages are soft-dirty from their first write on, the reset makes the first interval start now.
+    if (softDirtySupported(s->pageShift)) {
+        snprintf(path, sizeof(path), "/proc/%u/clear_refs", pid);
+        s->clearRefsFd = open(path, O_WRONLY | O_CLOEXEC);
+        s->stats.softDirty = s->clearRefsFd >= 0 && pwrite(s->clearRefsFd, "4", 1, 0) == 1;
+        if (!s->stats.softDirty) {
+            logWarnTagged(INGEST_TAG, "Can not reset the soft-dirty bits of {}, errno={}", pid, errno);
+        }
+    }
+    else {
+        logWarnTagged(INGEST_TAG, "The kernel does not track soft-dirty pages, writes are not sampled");
+    }
+
+    g_pages = s;
+    logInfoTagged(INGEST_TAG, "Sampling the pages of {} {} times per second{}", pid, hz,
+                  s->stats.softDirty ? "" : ", residency only");
+    return true;
+}
+
+void pageSamplerStop() {
+    if (!g_pages) return;
+    freePageSampler(g_pages);
+    g_pages = nullptr;
+}
+
+bool pageSamplerIsActive() {
+    return g_pages != nullptr;
+}
+
+void pageSamplerOnSample(const VmaDelta& delta) {
+    if (!g_pages) return;
+    PageSampler& s = *g_pages;
+
+    applyDelta(s, delta);
+
+    if (delta.sampleNs < s.nextScanNs) return;
+    s.nextScanNs = delta.sampleNs + s.periodNs;
+    tick(s);
+}
+
+u32 pageSamplerSummarize(u64 begin, u64 cellBytes, PageCell* out, u32 cellCount) {
+    core::memset(out, 0, addr_size(cellCount) * sizeof(PageCell));
+    if (!g_pages || cellBytes == 0 || cellCount == 0) return 0;
+    PageSampler& s = *g_pages;
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    u64 pageBytes = u64(1) << s.pageShift;
+    u64 span = cellBytes * cellCount;
+    u64 end = begin + span < begin ? ~u64(0) : begin + span;
+
+    if (cellBytes < pageBytes) {
+        // Every cell looks up its page, the cells only move forward.
+        u32 ti = firstTrackAfter(s, begin >> s.pageShift);
+        for (u32 c = 0; c < cellCount && ti < s.trackCount; c++) {
+            u64 page = (begin + c * cellBytes) >> s.pageShift;
+            while (ti < s.trackCount && s.tracks[ti].endPage <= page) ti++;
+            if (ti == s.trackCount) break;
+            const PageTrack& t = s.tracks[ti];
+            if (page >= t.firstPage) addPage(t, page - t.firstPage, out[c]);
+        }
+    }
+    else {
+        // Pages starting in [begin, end), whole words at once when they fall in one cell.
+        u64 firstPage = (begin + pageBytes - 1) >> s.pageShift;
+        u64 endPage = ((end - 1) >> s.pageShift) + 1;
+        for (u32 ti = firstTrackAfter(s, firstPage); ti < s.trackCount && s.tracks[ti].firstPage < endPage; ti++) {
+            const PageTrack& t = s.tracks[ti];
+            u64 from = t.firstPage > firstPage ? t.firstPage : firstPage;
+            u64 to = t.endPage < endPage ? t.endPage : endPage;
+
+            for (u64 page = from; page < to;) {
+                u64 index = page - t.firstPage;
+                u64 cell = ((page << s.pageShift) - begin) / cellBytes;
+                u64 lastInWord = page + (63 - (index & 63));
+                bool wholeWord = (index & 63) == 0 && lastInWord < to &&
+                                 ((lastInWord << s.pageShift) - begin) / cellBytes == cell;
+                if (wholeWord) {
+                    addWord(t, index >> 6, out[cell]);
+                    page += 64;
+                }
+                else {
+                    addPage(t, index, out[cell]);
+                    page++;
+                }
+            }
+        }
+    }
+
+    u32 occupied = 0;
+    for (u32 c = 0; c < cellCount; c++) {
+        if (out[c].pages > 0) occupied++;
+    }
+    return occupied;
+}
+
+PageSamplerStats pageSamplerStats() {
+    if (!g_pages) return {};
+    std::lock_guard<std::mutex> lock(g_pages->mutex);
+    return g_pages->stats;
+}
+
+} // namespace memviz
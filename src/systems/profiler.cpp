@@ -0,0 +1,238 @@
+#include "systems/profiler.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+
+#if defined(MEMVIZ_PROFILER) && MEMVIZ_PROFILER == 1
+
+#include <atomic>
+#include <mutex>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 MAX_PROFILED_THREADS = 64;
+constexpr u32 MIN_ZONES_PER_THREAD = 1024;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN PROFILER STATE -----------------------------------------------------
+
+struct Zone {
+    const char* name;
+    u64 beginNs;
+    u64 endNs;
+};
+
+struct OpenZone {
+    const char* name;
+    u64 beginNs;
+};
+
+struct ThreadZones {
+    Zone* zones;
+    u64 capacity;              // Power of two.
+    std::atomic<u64> count;    // Zones ever completed. Published with release, so an exporter sees complete zones.
+    std::atomic<u64> dropped;  // Zones nested deeper than PROFILER_MAX_OPEN_ZONES.
+    u32 tid;
+
+    // Only touched by the owning thread.
+    OpenZone open[PROFILER_MAX_OPEN_ZONES];
+    u32 openCount;
+    u32 droppedDepth; // Open zones that did not fit in open, their ends are dropped as well.
+};
+
+ThreadZones* g_threads[MAX_PROFILED_THREADS] = {};
+std::atomic<u32> g_threadCount = 0;
+std::mutex g_registerMutex;
+thread_local ThreadZones* t_zones = nullptr;
+u64 g_startNs = 0;
+u64 g_zonesPerThread = PROFILER_DEFAULT_ZONES_PER_THREAD; // guarded by g_registerMutex
+
+// ------------------------------------------ END PROFILER STATE -------------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+// Not slewed by NTP, so zone durations stay exact.
+inline u64 nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return u64(ts.tv_sec) * 1'000'000'000 + u64(ts.tv_nsec);
+}
+
+ThreadZones* registerThread() {
+    std::lock_guard<std::mutex> lock(g_registerMutex);
+
+    u32 index = g_threadCount.load(std::memory_order_relaxed);
+    if (index >= MAX_PROFILED_THREADS) return nullptr;
+
+    Zone* zones = metaAlloc<Zone>(g_zonesPerThread);
+    if (!zones) return nullptr;
+
+    ThreadZones* t = new ThreadZones();
+    t->zones = zones;
+    t->capacity = g_zonesPerThread;
+    t->tid = u32(syscall(SYS_gettid));
+
+    g_threads[index] = t;
+    g_threadCount.store(index + 1, std::memory_order_release);
+    t_zones = t;
+    return t;
+}
+
+} // namespace
+
+void profilerInit() {
+    g_startNs = nowNs();
+
+    // Threads that recorded before this keep the ring size they got.
+    if (const char* v = getenv("MEMVIZ_PROFILER_ZONES")) {
+        u64 zones = MIN_ZONES_PER_THREAD;
+        u64 wanted = strtoull(v, nullptr, 10);
+        while (zones < wanted && zones < (u64(1) << 40)) zones *= 2;
+
+        std::lock_guard<std::mutex> lock(g_registerMutex);
+        g_zonesPerThread = zones;
+    }
+}
+
+void profilerShutdown() {
+    if (const char* path = getenv("MEMVIZ_TRACE")) {
+        [[maybe_unused]] bool ok = profilerExport(path);
+    }
+
+    // Every recording thread is expected to be joined by now.
+    std::lock_guard<std::mutex> lock(g_registerMutex);
+    u32 threadCount = g_threadCount.load(std::memory_order_relaxed);
+    for (u32 i = 0; i < threadCount; i++) {
+        metaFree(g_threads[i]->zones, g_threads[i]->capacity);
+        delete g_threads[i];
+        g_threads[i] = nullptr;
+    }
+    g_threadCount.store(0, std::memory_order_relaxed);
+}
+
+void profilerZoneBegin(const char* name) {
+    ThreadZones* t = t_zones ? t_zones : registerThread();
+    if (!t) return;
+
+    if (t->droppedDepth > 0 || t->openCount == PROFILER_MAX_OPEN_ZONES) {
+        t->droppedDepth++;
+        t->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    t->open[t->openCount++] = { name, nowNs() };
+}
+
+void profilerZoneEnd() {
+    ThreadZones* t = t_zones;
+    if (!t) return;
+
+    if (t->droppedDepth > 0) {
+        t->droppedDepth--;
+        return;
+    }
+
+    const OpenZone& open = t->open[--t->openCount];
+    u64 count = t->count.load(std::memory_order_relaxed);
+    t->zones[count & (t->capacity - 1)] = { open.name, open.beginNs, nowNs() };
+    t->count.store(count + 1, std::memory_order_release);
+}
+
+bool profilerExport(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        logErr("Failed to open '{}' for the profiler trace", path);
+        return false;
+    }
+    defer { fclose(f); };
+
+    u32 pid = u32(getpid());
+    u64 zones = 0;
+    u64 dropped = 0;
+    u64 overwritten = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+
+    u32 threadCount = g_threadCount.load(std::memory_order_acquire);
+    for (u32 i = 0; i < threadCount; i++) {
+        const ThreadZones& t = *g_threads[i];
+        u64 count = t.count.load(std::memory_order_acquire);
+        u64 oldest = count > t.capacity ? count - t.capacity : 0;
+        dropped += t.dropped.load(std::memory_order_relaxed);
+
+        for (u64 z = oldest; z < count; z++) {
+            Zone zone = t.zones[z & (t.capacity - 1)];
+
+            // The owner keeps recording. A slot it wrapped around to while this one was read holds a newer zone, or
+            // half of one, and everything before it is gone as well.
+            u64 now = t.count.load(std::memory_order_acquire);
+            if (now > t.capacity && z < now - t.capacity) {
+                oldest = now - t.capacity;
+                if (z + 1 < oldest) z = oldest - 1;
+                continue;
+            }
+
+            u64 startNs = zone.beginNs > g_startNs ? zone.beginNs - g_startNs : 0;
+            u64 durNs = zone.endNs - zone.beginNs;
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                    first ? "" : ",", zone.name, pid, t.tid,
+                    (unsigned long long)(startNs / 1000), (unsigned long long)(startNs % 1000),
+                    (unsigned long long)(durNs / 1000), (unsigned long long)(durNs % 1000));
+            first = false;
+            zones++;
+        }
+        overwritten += oldest;
+    }
+
+    fprintf(f, "\n]}\n");
+
+    logInfo("Wrote {} profiler zones from {} threads to '{}' ({} overwritten, {} dropped)", zones, threadCount, path,
+            overwritten, dropped);
+    return true;
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
+
+#else
+
+namespace memviz {
+
+void profilerInit() {}
+void profilerShutdown() {}
+
+bool profilerExport(const char*) {
+    logWarn("The profiler is not compiled in, configure with MEMVIZ_ENABLE_PROFILER=ON");
+    return false;
+}
+
+} // namespace memviz
+
+#endif
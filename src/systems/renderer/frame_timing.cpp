@@ -0,0 +1,205 @@
+#include "systems/renderer/frame_timing.h"
+
+#include "basic.h"
+
+#include "systems/logger.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+// Whole run histogram: values below 2 * HISTOGRAM_SUB_BUCKETS ns are exact, every power of two above that is split
+// into HISTOGRAM_SUB_BUCKETS linear buckets. Percentiles report bucket midpoints, off by at most 1/64 of their value.
+constexpr u32 HISTOGRAM_SUB_BITS = 5;
+constexpr u32 HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+// Enough for any u32 value, a single pass longer than 4s is clamped, which is fine for percentiles.
+constexpr u32 HISTOGRAM_BUCKETS = (32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN FRAME TIMING STATE -------------------------------------------------
+
+struct PassTimings {
+    u64 window[FRAME_TIMING_WINDOW];
+    u32 windowCount;
+    u32 windowNext;
+
+    // Whole run. Fixed size, a viewer left running for days uses as much memory as one that ran for a second.
+    u64 buckets[HISTOGRAM_BUCKETS];
+    u64 count;
+    u64 sumNs;
+    u64 minNs;
+    u64 maxNs;
+};
+
+PassTimings g_passes[u32(FramePass::SENTINEL)] = {};
+u64 g_frames = 0;
+
+// ------------------------------------------ END FRAME TIMING STATE ---------------------------------------------------
+
+// Sorts samples in place.
+template <typename T>
+FramePassStats statsOf(T* samples, u64 count) {
+    FramePassStats ret = {};
+    if (count == 0) return ret;
+
+    std::sort(samples, samples + count);
+
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++) sum += u64(samples[i]);
+
+    ret.samples = count;
+    ret.minNs = u64(samples[0]);
+    ret.maxNs = u64(samples[count - 1]);
+    ret.avgNs = sum / count;
+    ret.p50Ns = u64(samples[(count - 1) / 2]);
+    ret.p99Ns = u64(samples[(count - 1) * 99 / 100]);
+    return ret;
+}
+
+u32 bucketOf(u32 ns) {
+    if (ns < 2 * HISTOGRAM_SUB_BUCKETS) return ns;
+    u32 shift = u32(31 - __builtin_clz(ns)) - HISTOGRAM_SUB_BITS;
+    return shift * HISTOGRAM_SUB_BUCKETS + (ns >> shift);
+}
+
+// Midpoint of the values that land in bucket.
+u64 bucketValue(u32 bucket) {
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) return bucket;
+    u32 shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    u64 low = u64(bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+    return low + (u64(1) << shift) / 2;
+}
+
+// Value of the sample at rank (0 based) in sorted order, clamped to the exact min and max.
+u64 histogramRank(const PassTimings& p, u64 rank) {
+    u64 seen = 0;
+    for (u32 i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += p.buckets[i];
+        if (seen > rank) return std::clamp(bucketValue(i), p.minNs, p.maxNs);
+    }
+    return p.maxNs;
+}
+
+void resetTimings() {
+    for (u32 i = 0; i < u32(FramePass::SENTINEL); i++) g_passes[i] = {};
+    g_frames = 0;
+}
+
+} // namespace
+
+void frameTimingInit() {
+    resetTimings();
+}
+
+void frameTimingShutdown() {
+    frameTimingLogSummary();
+    if (const char* timingsPath = getenv("MEMVIZ_FRAME_TIMINGS")) {
+        [[maybe_unused]] bool ok = frameTimingDump(timingsPath); // logs its own failure
+    }
+    resetTimings();
+}
+
+void frameTimingRecord(FramePass pass, u64 ns) {
+    PassTimings& p = g_passes[u32(pass)];
+
+    p.window[p.windowNext] = ns;
+    p.windowNext = (p.windowNext + 1) % FRAME_TIMING_WINDOW;
+    if (p.windowCount < FRAME_TIMING_WINDOW) p.windowCount++;
+
+    u64 clamped = ns < UINT32_MAX ? ns : UINT32_MAX;
+    p.buckets[bucketOf(u32(clamped))]++;
+    if (p.count == 0 || clamped < p.minNs) p.minNs = clamped;
+    if (clamped > p.maxNs) p.maxNs = clamped;
+    p.count++;
+    p.sumNs += ns;
+}
+
+void frameTimingEndFrame() {
+    g_frames++;
+    if (g_frames % FRAME_TIMING_PUBLISH_INTERVAL != 0) return;
+
+    for (u32 i = 0; i < u32(FramePass::SENTINEL); i++) {
+        FramePassStats s = frameTimingStats(FramePass(i), true);
+        if (s.samples == 0) continue;
+        logInfoTagged(RENDERER_TAG, "{}: min {:f.3}ms, avg {:f.3}ms, p99 {:f.3}ms (last {} frames)",
+                      framePassToCStr(FramePass(i)), f64(s.minNs) / 1e6, f64(s.avgNs) / 1e6, f64(s.p99Ns) / 1e6,
+                      s.samples);
+    }
+}
+
+FramePassStats frameTimingStats(FramePass pass, bool rolling) {
+    const PassTimings& p = g_passes[u32(pass)];
+
+    if (rolling) {
+        u64 samples[FRAME_TIMING_WINDOW];
+        core::memcopy(samples, p.window, p.windowCount * sizeof(u64));
+        return statsOf(samples, p.windowCount);
+    }
+
+    FramePassStats ret = {};
+    if (p.count == 0) return ret;
+    ret.samples = p.count;
+    ret.minNs = p.minNs;
+    ret.maxNs = p.maxNs;
+    ret.avgNs = p.sumNs / p.count; // not clamped
+    ret.p50Ns = histogramRank(p, (p.count - 1) / 2);
+    ret.p99Ns = histogramRank(p, (p.count - 1) * 99 / 100);
+    return ret;
+}
+
+void frameTimingLogSummary() {
+    logInfoTagged(RENDERER_TAG, "Frame timings over {} frames:", g_frames);
+    for (u32 i = 0; i < u32(FramePass::SENTINEL); i++) {
+        FramePassStats s = frameTimingStats(FramePass(i), false);
+        if (s.samples == 0) continue;
+        logInfoTagged(RENDERER_TAG, "\t{}: min {:f.3}ms, avg {:f.3}ms, p50 {:f.3}ms, p99 {:f.3}ms, max {:f.3}ms",
+                      framePassToCStr(FramePass(i)), f64(s.minNs) / 1e6, f64(s.avgNs) / 1e6, f64(s.p50Ns) / 1e6,
+                      f64(s.p99Ns) / 1e6, f64(s.maxNs) / 1e6);
+    }
+}
+
+bool frameTimingDump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        logErrTagged(RENDERER_TAG, "Failed to open '{}' for the frame timings: {}", path, strerror(errno));
+        return false;
+    }
+    defer { fclose(f); };
+
+    fprintf(f, "{\n  \"frames\": %llu,\n  \"passes\": {", (unsigned long long)g_frames);
+
+    bool first = true;
+    for (u32 i = 0; i < u32(FramePass::SENTINEL); i++) {
+        FramePassStats s = frameTimingStats(FramePass(i), false);
+        if (s.samples == 0) continue;
+        fprintf(f, "%s\n    \"%s\": { \"samples\": %llu, \"min_ns\": %llu, \"avg_ns\": %llu, \"p50_ns\": %llu, "
+                   "\"p99_ns\": %llu, \"max_ns\": %llu }",
+                first ? "" : ",", framePassToCStr(FramePass(i)), (unsigned long long)s.samples,
+                (unsigned long long)s.minNs, (unsigned long long)s.avgNs, (unsigned long long)s.p50Ns,
+                (unsigned long long)s.p99Ns, (unsigned long long)s.maxNs);
+        first = false;
+    }
+    fprintf(f, "\n  }\n}\n");
+
+    logInfoTagged(RENDERER_TAG, "Wrote frame timings to '{}'", path);
+    return true;
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
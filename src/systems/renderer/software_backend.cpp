@@ -0,0 +1,645 @@
+#include "systems/renderer/renderer.h"
+#include "systems/renderer/software_raster.h"
+
+#include "basic.h"
+#include "platform.h"
+#include "error.h"
+
+#include "systems/allocators.h"
+#include "systems/logger.h"
+#include "systems/profiler.h"
+#include "systems/renderer/frame_timing.h"
+#include "systems/startup_timing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <stdlib.h>
+
+// CPU renderer for machines without a GPU, and the reference the Vulkan backend is measured against. Blocks are placed
+// exactly like shaders/blocks.vert places them. The framebuffer is split into square tiles and a frame runs three
+// passes on a pool of worker threads:
+//  1. count: every worker takes a contiguous slice of the instances and counts how many land in each tile,
+//  2. bin: the same slices write their instance indices into per tile lists. Slices are ordered and written in order,
+//     so every list keeps the draw order (layer by layer, instance by instance),
+//  3. raster: workers take whole tiles and draw their lists. Tiles never share pixels, nothing is synchronized.
+// A tile's pixels stay in cache while all of its blocks are drawn, which is the whole point of binning first.
+//
+// Environment:
+//   MEMVIZ_RASTER_THREADS - number of threads drawing a frame, including the main thread. Defaults to all cores.
+//   MEMVIZ_RASTER_SIMD    - see software_raster.h.
+//   MEMVIZ_FRAME_TIMINGS  - path to write the frame timings of the run to at shutdown, see frame_timing.h.
+
+namespace memviz {
+
+using RendererCreateInfo = Renderer::CrateInfo;
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 TILE_SIZE = 64; // 16 KiB of pixels and 8 KiB of heat per tile, both stay in L1/L2.
+constexpr u32 MAX_WORKERS = 64;
+// One is read by the X server while the other is drawn.
+constexpr u32 FRAMEBUFFER_COUNT = 2;
+
+// Same colors as the Vulkan backend (CLEAR_COLOR in vulkan_backend.cpp, PALETTE in shaders/blocks.frag).
+constexpr u32 CLEAR_COLOR = 0x14141A;
+constexpr u32 PALETTE[BLOCK_CATEGORY_COUNT] = {
+    0xE64C40, 0x4099E6, 0x59CC66, 0xF2BF33, 0xA666D9, 0x33CCBF, 0xF28026, 0xD95999,
+    0x8CBF40, 0x6673F2, 0xCC9973, 0x4CB28C, 0xE6D980, 0x994C66, 0x808C99, 0xBFBFCC,
+};
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN RENDERER STATE -----------------------------------------------------
+
+struct BlockLayer {
+    BlockLayerDesc desc;
+    BlockInstance* blocks; // desc.capacity instances
+    u32 count;
+};
+
+// Per frame placement of a layer, what the Vulkan backend passes as push constants.
+struct FrameLayer {
+    const BlockInstance* blocks;
+    u32 first; // Index of blocks[0] across all layers of the frame.
+    u32 count;
+    u32 viewStart;
+    u32 granulesPerRow;
+};
+
+struct PixelRect {
+    u32 x0, y0, x1, y1;
+};
+
+using PassFn = void (*)(u32 worker);
+
+BlockLayer g_layers[MAX_BLOCK_LAYERS] = {};
+BlockView g_view = { 0, 1, 1, BlockLayout::ROWS };
+BlockDrawMode g_drawMode = BlockDrawMode::RECTANGLES;
+
+SoftwareFramebuffer g_framebuffers[FRAMEBUFFER_COUNT] = {};
+u64 g_frameNumber = 0;
+
+// Written by resizeTarget from the window callback, consumed at the start of the next drawFrame.
+bool g_targetDirty = false;
+u32 g_targetWidth = 0;
+u32 g_targetHeight = 0;
+
+// Tile grid of the current framebuffers.
+u32 g_width = 0;
+u32 g_height = 0;
+u32 g_tilesX = 0;
+u32 g_tilesY = 0;
+u32 g_tileCount = 0;
+
+FrameLayer g_frameLayers[MAX_BLOCK_LAYERS] = {};
+u32 g_frameLayerCount = 0;
+u32 g_frameInstanceCount = 0;
+SoftwareFramebuffer* g_frameTarget = nullptr;
+
+// g_tileCounts[worker * g_tileCount + tile]: hits of the worker's slice in the tile after the count pass, the worker's
+// write cursor into g_bins after the prefix sum.
+u32* g_tileCounts = nullptr;
+u32* g_tileOffsets = nullptr; // g_tileCount + 1 entries, the list of tile t is g_bins[g_tileOffsets[t], [t + 1]).
+u32* g_bins = nullptr;
+u32 g_binsCapacity = 0;
+std::atomic<u32> g_nextTile = 0;
+
+u16* g_heat = nullptr; // TILE_SIZE * TILE_SIZE per worker
+u32 g_heatRamp[RASTER_HEAT_RAMP_SIZE] = {};
+
+// Worker pool. Worker 0 is the thread calling drawFrame.
+std::thread g_workers[MAX_WORKERS];
+u32 g_workerCount = 1;
+std::mutex g_poolMutex;
+std::condition_variable g_poolStart;
+std::condition_variable g_poolDone;
+PassFn g_poolPass = nullptr;
+u64 g_poolGeneration = 0;
+u32 g_poolRemaining = 0;
+bool g_poolQuit = false;
+
+// ------------------------------------------ END RENDERER STATE -------------------------------------------------------
+
+// ------------------------------------------ BEGIN STATIC FUNCTIONS ---------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+void startWorkers(u32 count);
+void stopWorkers();
+void workerMain(u32 worker);
+void runPass(PassFn pass);
+
+bool recreateFramebuffers();
+void destroyFramebuffers();
+void buildHeatRamp();
+
+void prepareFrameLayers();
+bool blockRect(const FrameLayer& l, const BlockInstance& b, PixelRect& out);
+void countPass(u32 worker);
+void binPass(u32 worker);
+void rasterPass(u32 worker);
+void rasterTile(u32 worker, u32 tile);
+
+// ------------------------------------------ END STATIC FUNCTIONS -----------------------------------------------------
+
+} // namespace
+
+Error softwareInit(RendererCreateInfo&&) {
+    MEMVIZ_ZONE("Renderer::init");
+    startupTimingBegin(StartupStage::RENDERER_DEVICE);
+    frameTimingInit();
+    RasterSimdLevel simd = softwareRasterInit();
+
+    u32 workers = std::thread::hardware_concurrency();
+    if (const char* v = getenv("MEMVIZ_RASTER_THREADS")) {
+        workers = u32(strtoul(v, nullptr, 10));
+    }
+    if (workers == 0) workers = 1;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    startWorkers(workers);
+
+    g_heat = metaAlloc<u16>(addr_size(g_workerCount) * TILE_SIZE * TILE_SIZE);
+    if (!g_heat) {
+        logErrTagged(RENDERER_TAG, "Out of memory for the heat tiles of {} threads", g_workerCount);
+        stopWorkers();
+        frameTimingShutdown();
+        return Error::FAILED_TO_ALLOCATE_SOFTWARE_RENDERER;
+    }
+    buildHeatRamp();
+
+    logInfoTagged(RENDERER_TAG, "Software renderer: {} threads, {}x{} tiles, {} kernels",
+                  g_workerCount, TILE_SIZE, TILE_SIZE, rasterSimdLevelToCStr(simd));
+    startupTimingEnd(StartupStage::RENDERER_DEVICE);
+
+    startupTimingBegin(StartupStage::RENDERER_SWAPCHAIN);
+    Platform::getFrameBufferSize(g_targetWidth, g_targetHeight);
+    if (!recreateFramebuffers()) {
+        metaFree(g_heat, addr_size(g_workerCount) * TILE_SIZE * TILE_SIZE);
+        g_heat = nullptr;
+        stopWorkers();
+        frameTimingShutdown();
+        return Error::FAILED_TO_CREATE_SOFTWARE_FRAMEBUFFER;
+    }
+    startupTimingEnd(StartupStage::RENDERER_SWAPCHAIN);
+
+    return Error::OK;
+}
+
+void softwareDrawFrame() {
+    MEMVIZ_ZONE("Renderer::drawFrame");
+    if (g_targetDirty) {
+        g_targetDirty = false;
+        if (!recreateFramebuffers()) {
+            logErrTagged(RENDERER_TAG, "Failed to create {}x{} software framebuffers", g_targetWidth, g_targetHeight);
+        }
+    }
+    if (g_tileCount == 0) {
+        return; // minimized
+    }
+
+    u64 startNs = Platform::getMonotonicTimeNs();
+
+    SoftwareFramebuffer& fb = g_framebuffers[g_frameNumber % FRAMEBUFFER_COUNT];
+    Platform::waitSoftwareFramebuffer(fb);
+    g_frameTarget = &fb;
+    u64 waitEndNs = Platform::getMonotonicTimeNs();
+
+    prepareFrameLayers();
+
+    runPass(countPass);
+
+    // Exclusive prefix sum over (tile, worker), turning the counts into write cursors.
+    u32 total = 0;
+    for (u32 t = 0; t < g_tileCount; t++) {
+        g_tileOffsets[t] = total;
+        for (u32 w = 0; w < g_workerCount; w++) {
+            u32& c = g_tileCounts[w * g_tileCount + t];
+            u32 n = c;
+            c = total;
+            total += n;
+        }
+    }
+    g_tileOffsets[g_tileCount] = total;
+
+    if (total > g_binsCapacity) {
+        metaFree(g_bins, g_binsCapacity);
+        g_binsCapacity = total + total / 4;
+        g_bins = metaAlloc<u32>(g_binsCapacity);
+        if (!g_bins) g_binsCapacity = 0;
+    }
+
+    // Without room for the bins the previous contents of the framebuffer go out again, the next frame retries.
+    bool binned = total <= g_binsCapacity;
+    if (binned) runPass(binPass);
+    else logErrTaggedLimited(1, RENDERER_TAG, "Out of memory for {} tile bins, frame skipped", total);
+    u64 binEndNs = Platform::getMonotonicTimeNs();
+
+    g_nextTile.store(0, std::memory_order_relaxed);
+    if (binned) runPass(rasterPass);
+    u64 rasterEndNs = Platform::getMonotonicTimeNs();
+
+    Platform::presentSoftwareFramebuffer(fb);
+    g_frameNumber++;
+    u64 endNs = Platform::getMonotonicTimeNs();
+
+    frameTimingRecord(FramePass::CPU_WAIT, waitEndNs - startNs);
+    frameTimingRecord(FramePass::CPU_BIN, binEndNs - waitEndNs);
+    frameTimingRecord(FramePass::CPU_RASTER, rasterEndNs - binEndNs);
+    frameTimingRecord(FramePass::CPU_PRESENT, endNs - rasterEndNs);
+    frameTimingEndFrame();
+}
+
+void softwareSetBlockLayer(u32 layer, const BlockLayerDesc& desc) {
+    Assert(layer < MAX_BLOCK_LAYERS);
+    BlockLayer& l = g_layers[layer];
+
+    if (desc.capacity != l.desc.capacity) {
+        metaFree(l.blocks, l.desc.capacity);
+        l.blocks = desc.capacity > 0 ? metaAlloc<BlockInstance>(desc.capacity) : nullptr;
+        l.count = 0;
+    }
+    l.desc = desc;
+    if (desc.capacity > 0 && !l.blocks) {
+        logErrTagged(RENDERER_TAG, "Out of memory for {} blocks of layer {}", desc.capacity, layer);
+        l.desc.capacity = 0; // Uploads take nothing, the layer draws empty.
+    }
+}
+
+u32 softwareUploadBlocks(u32 layer, u32 first, const BlockInstance* blocks, u32 count) {
+    Assert(layer < MAX_BLOCK_LAYERS);
+    BlockLayer& l = g_layers[layer];
+
+    // No ring to run out of: the instances are copied where the workers read them. Frames are drawn synchronously, so
+    // nobody is reading them right now.
+    if (first >= l.desc.capacity) return 0;
+    if (count > l.desc.capacity - first) count = l.desc.capacity - first;
+    core::memcopy(l.blocks + first, blocks, addr_size(count) * sizeof(BlockInstance));
+    return count;
+}
+
+void softwareSetBlockCount(u32 layer, u32 count) {
+    Assert(layer < MAX_BLOCK_LAYERS);
+    BlockLayer& l = g_layers[layer];
+    l.count = count < l.desc.capacity ? count : l.desc.capacity;
+}
+
+void softwareSetBlockView(const BlockView& view) {
+    g_view = view;
+    if (g_view.bytesPerRow == 0) g_view.bytesPerRow = 1;
+    if (g_view.rowCount == 0) g_view.rowCount = 1;
+    if (g_view.layout >= BlockLayout::SENTINEL) g_view.layout = BlockLayout::ROWS;
+}
+
+void softwareSetBlockDrawMode(BlockDrawMode mode) {
+    g_drawMode = mode;
+}
+
+void softwareResizeTarget(i32 width, i32 height) {
+    g_targetWidth = width > 0 ? u32(width) : 0;
+    g_targetHeight = height > 0 ? u32(height) : 0;
+    g_targetDirty = true;
+}
+
+void softwareShutdown() {
+    logInfoTagged(RENDERER_TAG, "Shutting down software renderer.");
+
+    frameTimingShutdown();
+
+    stopWorkers();
+    destroyFramebuffers();
+
+    for (u32 i = 0; i < MAX_BLOCK_LAYERS; i++) {
+        metaFree(g_layers[i].blocks, g_layers[i].desc.capacity);
+        g_layers[i] = {};
+    }
+
+    metaFree(g_bins, g_binsCapacity);
+    g_bins = nullptr;
+    g_binsCapacity = 0;
+    metaFree(g_heat, addr_size(g_workerCount) * TILE_SIZE * TILE_SIZE);
+    g_heat = nullptr;
+}
+
+namespace {
+
+void startWorkers(u32 count) {
+    g_workerCount = count;
+    g_poolQuit = false;
+    for (u32 i = 1; i < count; i++) {
+        g_workers[i] = std::thread(workerMain, i);
+    }
+}
+
+void stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(g_poolMutex);
+        g_poolQuit = true;
+    }
+    g_poolStart.notify_all();
+
+    for (u32 i = 1; i < g_workerCount; i++) {
+        if (g_workers[i].joinable()) g_workers[i].join();
+    }
+}
+
+void workerMain(u32 worker) {
+    u64 seenGeneration = 0;
+    for (;;) {
+        PassFn pass = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(g_poolMutex);
+            g_poolStart.wait(lock, [&] { return g_poolQuit || g_poolGeneration != seenGeneration; });
+            if (g_poolQuit) return;
+            seenGeneration = g_poolGeneration;
+            pass = g_poolPass;
+        }
+
+        pass(worker);
+
+        std::lock_guard<std::mutex> lock(g_poolMutex);
+        if (--g_poolRemaining == 0) g_poolDone.notify_one();
+    }
+}
+
+// Runs pass on every worker and returns once all of them finished.
+void runPass(PassFn pass) {
+    if (g_workerCount > 1) {
+        {
+            std::lock_guard<std::mutex> lock(g_poolMutex);
+            g_poolPass = pass;
+            g_poolRemaining = g_workerCount - 1;
+            g_poolGeneration++;
+        }
+        g_poolStart.notify_all();
+    }
+
+    pass(0);
+
+    if (g_workerCount > 1) {
+        std::unique_lock<std::mutex> lock(g_poolMutex);
+        g_poolDone.wait(lock, [] { return g_poolRemaining == 0; });
+    }
+}
+
+bool recreateFramebuffers() {
+    destroyFramebuffers();
+
+    // Kept at 16 bits so tile coordinates and heat rows never overflow. Larger windows are drawn clipped.
+    u32 width = g_targetWidth < UINT16_MAX ? g_targetWidth : UINT16_MAX;
+    u32 height = g_targetHeight < UINT16_MAX ? g_targetHeight : UINT16_MAX;
+    if (width == 0 || height == 0) {
+        return true; // minimized, nothing to draw into
+    }
+
+    for (u32 i = 0; i < FRAMEBUFFER_COUNT; i++) {
+        if (!Platform::createSoftwareFramebuffer(width, height, g_framebuffers[i])) {
+            destroyFramebuffers();
+            return false;
+        }
+    }
+
+    g_width = width;
+    g_height = height;
+    g_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    g_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    g_tileCount = g_tilesX * g_tilesY;
+    g_tileCounts = metaAlloc<u32>(addr_size(g_workerCount) * g_tileCount);
+    g_tileOffsets = metaAlloc<u32>(addr_size(g_tileCount) + 1);
+    if (!g_tileCounts || !g_tileOffsets) {
+        logErrTagged(RENDERER_TAG, "Out of memory for the bins of {} tiles", g_tileCount);
+        destroyFramebuffers();
+        return false;
+    }
+
+    return true;
+}
+
+void destroyFramebuffers() {
+    for (u32 i = 0; i < FRAMEBUFFER_COUNT; i++) {
+        if (g_framebuffers[i].pixels) Platform::destroySoftwareFramebuffer(g_framebuffers[i]);
+    }
+
+    metaFree(g_tileCounts, addr_size(g_workerCount) * g_tileCount);
+    metaFree(g_tileOffsets, addr_size(g_tileCount) + 1);
+    g_tileCounts = nullptr;
+    g_tileOffsets = nullptr;
+    g_width = 0;
+    g_height = 0;
+    g_tilesX = 0;
+    g_tilesY = 0;
+    g_tileCount = 0;
+}
+
+// Dark blue through red and yellow to white.
+void buildHeatRamp() {
+    constexpr u32 STOPS[] = { 0x1E2A78, 0x8C2BA0, 0xE0433A, 0xF5B731, 0xFFFFFF };
+    constexpr u32 SEGMENTS = CORE_C_ARRLEN(STOPS) - 1;
+
+    for (u32 i = 0; i < RASTER_HEAT_RAMP_SIZE; i++) {
+        u32 pos = i * SEGMENTS * 256 / RASTER_HEAT_RAMP_SIZE;
+        u32 seg = pos / 256;
+        u32 t = pos % 256;
+        u32 a = STOPS[seg];
+        u32 b = STOPS[seg + 1];
+
+        u32 color = 0;
+        for (u32 shift = 0; shift <= 16; shift += 8) {
+            u32 ca = (a >> shift) & 0xFF;
+            u32 cb = (b >> shift) & 0xFF;
+            color |= ((ca * (256 - t) + cb * t) >> 8) << shift;
+        }
+        g_heatRamp[i] = color;
+    }
+}
+
+void prepareFrameLayers() {
+    g_frameLayerCount = 0;
+    g_frameInstanceCount = 0;
+
+    for (u32 layer = 0; layer < MAX_BLOCK_LAYERS; layer++) {
+        const BlockLayer& l = g_layers[layer];
+        if (l.count == 0) continue;
+
+        u64 viewStartBytes = g_view.baseAddress > l.desc.baseAddress ? g_view.baseAddress - l.desc.baseAddress : 0;
+        u64 viewStart = viewStartBytes >> l.desc.granuleShift;
+        u64 granulesPerRow = g_view.bytesPerRow >> l.desc.granuleShift;
+        if (viewStart > UINT32_MAX) continue; // the whole layer is before the view
+        if (granulesPerRow == 0) granulesPerRow = 1;
+        if (granulesPerRow > UINT32_MAX) granulesPerRow = UINT32_MAX;
+
+        FrameLayer& fl = g_frameLayers[g_frameLayerCount++];
+        fl.blocks = l.blocks;
+        fl.first = g_frameInstanceCount;
+        fl.count = l.count;
+        fl.viewStart = u32(viewStart);
+        fl.granulesPerRow = u32(granulesPerRow);
+        g_frameInstanceCount += l.count;
+    }
+}
+
+// Same placement as shaders/blocks.vert, in pixels. Blocks narrower or lower than a pixel still cover one.
+bool blockRect(const FrameLayer& l, const BlockInstance& b, PixelRect& out) {
+    if (g_view.layout == BlockLayout::SQUARES) {
+        u64 cx = b.offset & 0xFFFF, cy = b.offset >> 16;
+        if (cx >= g_view.rowCount || cy >= g_view.rowCount) return false;
+        u64 cx1 = cx + b.size < g_view.rowCount ? cx + b.size : g_view.rowCount;
+        u64 cy1 = cy + b.size < g_view.rowCount ? cy + b.size : g_view.rowCount;
+        out.x0 = u32(cx * g_width / g_view.rowCount);
+        out.x1 = u32(cx1 * g_width / g_view.rowCount);
+        out.y0 = u32(cy * g_height / g_view.rowCount);
+        out.y1 = u32(cy1 * g_height / g_view.rowCount);
+        if (out.x1 <= out.x0) out.x1 = out.x0 + 1;
+        if (out.y1 <= out.y0) out.y1 = out.y0 + 1;
+        return true;
+    }
+
+    if (b.offset < l.viewStart) return false;
+    u32 rel = b.offset - l.viewStart;
+    u32 row = rel / l.granulesPerRow;
+    if (row >= g_view.rowCount) return false;
+
+    u32 col = rel - row * l.granulesPerRow;
+    u32 width = b.size < l.granulesPerRow - col ? b.size : l.granulesPerRow - col;
+
+    out.x0 = u32(u64(col) * g_width / l.granulesPerRow);
+    out.x1 = u32((u64(col) + width) * g_width / l.granulesPerRow);
+    if (out.x1 <= out.x0) out.x1 = out.x0 + 1;
+    if (g_view.layout == BlockLayout::SNAKE && (row & 1) == 1) {
+        u32 x0 = out.x0;
+        out.x0 = out.x1 < g_width ? g_width - out.x1 : 0;
+        out.x1 = g_width - x0;
+    }
+    out.y0 = u32(u64(row) * g_height / g_view.rowCount);
+    out.y1 = u32((u64(row) + 1) * g_height / g_view.rowCount);
+    if (out.y1 <= out.y0) out.y1 = out.y0 + 1;
+    return true;
+}
+
+// Calls fn(globalIndex, tile) for every tile every instance of the worker's slice touches, in instance order.
+template <typename Fn>
+inline void forEachBinnedBlock(u32 worker, Fn&& fn) {
+    u32 begin = u32(u64(g_frameInstanceCount) * worker / g_workerCount);
+    u32 end = u32(u64(g_frameInstanceCount) * (worker + 1) / g_workerCount);
+
+    for (u32 li = 0; li < g_frameLayerCount; li++) {
+        const FrameLayer& l = g_frameLayers[li];
+        if (end <= l.first) break;
+        u32 from = begin > l.first ? begin - l.first : 0;
+        u32 to = end - l.first < l.count ? end - l.first : l.count;
+
+        for (u32 i = from; i < to; i++) {
+            PixelRect r;
+            if (!blockRect(l, l.blocks[i], r)) continue;
+
+            u32 tx0 = r.x0 / TILE_SIZE, tx1 = (r.x1 - 1) / TILE_SIZE;
+            u32 ty0 = r.y0 / TILE_SIZE, ty1 = (r.y1 - 1) / TILE_SIZE;
+            for (u32 ty = ty0; ty <= ty1; ty++) {
+                for (u32 tx = tx0; tx <= tx1; tx++) {
+                    fn(l.first + i, ty * g_tilesX + tx);
+                }
+            }
+        }
+    }
+}
+
+void countPass(u32 worker) {
+    MEMVIZ_ZONE("software countPass");
+    u32* counts = g_tileCounts + addr_size(worker) * g_tileCount;
+    for (u32 t = 0; t < g_tileCount; t++) counts[t] = 0;
+    forEachBinnedBlock(worker, [counts](u32, u32 tile) { counts[tile]++; });
+}
+
+void binPass(u32 worker) {
+    MEMVIZ_ZONE("software binPass");
+    u32* cursors = g_tileCounts + addr_size(worker) * g_tileCount;
+    forEachBinnedBlock(worker, [cursors](u32 index, u32 tile) { g_bins[cursors[tile]++] = index; });
+}
+
+void rasterPass(u32 worker) {
+    MEMVIZ_ZONE("software rasterPass");
+    for (;;) {
+        u32 tile = g_nextTile.fetch_add(1, std::memory_order_relaxed);
+        if (tile >= g_tileCount) break;
+        rasterTile(worker, tile);
+    }
+}
+
+void rasterTile(u32 worker, u32 tile) {
+    const SoftwareFramebuffer& fb = *g_frameTarget;
+
+    u32 tx0 = (tile % g_tilesX) * TILE_SIZE;
+    u32 ty0 = (tile / g_tilesX) * TILE_SIZE;
+    u32 tx1 = tx0 + TILE_SIZE < g_width ? tx0 + TILE_SIZE : g_width;
+    u32 ty1 = ty0 + TILE_SIZE < g_height ? ty0 + TILE_SIZE : g_height;
+    u32 tileWidth = tx1 - tx0;
+
+    bool heatmap = g_drawMode == BlockDrawMode::HEATMAP;
+    u16* heat = g_heat + addr_size(worker) * TILE_SIZE * TILE_SIZE;
+
+    for (u32 y = ty0; y < ty1; y++) {
+        if (heatmap) core::memset(heat + (y - ty0) * TILE_SIZE, 0, tileWidth * sizeof(u16));
+        else         rasterFillSpan(fb.pixels + addr_size(y) * fb.stride + tx0, tileWidth, CLEAR_COLOR);
+    }
+
+    // Indices in a tile list only grow, so the layer of each one is found by walking forward.
+    u32 li = 0;
+    for (u32 bi = g_tileOffsets[tile]; bi < g_tileOffsets[tile + 1]; bi++) {
+        u32 index = g_bins[bi];
+        while (index >= g_frameLayers[li].first + g_frameLayers[li].count) li++;
+        const FrameLayer& l = g_frameLayers[li];
+        const BlockInstance& b = l.blocks[index - l.first];
+
+        PixelRect r;
+        blockRect(l, b, r); // binned, so it is visible
+        u32 x0 = r.x0 > tx0 ? r.x0 : tx0;
+        u32 x1 = r.x1 < tx1 ? r.x1 : tx1;
+        u32 y0 = r.y0 > ty0 ? r.y0 : ty0;
+        u32 y1 = r.y1 < ty1 ? r.y1 : ty1;
+
+        if (heatmap) {
+            for (u32 y = y0; y < y1; y++) {
+                rasterAddSpan(heat + (y - ty0) * TILE_SIZE + (x0 - tx0), x1 - x0, 1);
+            }
+        }
+        else {
+            u32 color = PALETTE[b.category % BLOCK_CATEGORY_COUNT];
+            for (u32 y = y0; y < y1; y++) {
+                rasterFillSpan(fb.pixels + addr_size(y) * fb.stride + x0, x1 - x0, color);
+            }
+        }
+    }
+
+    if (heatmap) {
+        for (u32 y = ty0; y < ty1; y++) {
+            rasterResolveHeat(fb.pixels + addr_size(y) * fb.stride + tx0, heat + (y - ty0) * TILE_SIZE, tileWidth,
+                              g_heatRamp, CLEAR_COLOR);
+        }
+    }
+}
+
+} // namespace
+
+Error (*Renderer::init)(Renderer::CrateInfo&&) = softwareInit;
+void (*Renderer::shutdown)(void) = softwareShutdown;
+void (*Renderer::drawFrame)(void) = softwareDrawFrame;
+void (*Renderer::resizeTarget)(i32, i32) = softwareResizeTarget;
+void (*Renderer::setBlockLayer)(u32, const BlockLayerDesc&) = softwareSetBlockLayer;
+u32 (*Renderer::uploadBlocks)(u32, u32, const BlockInstance*, u32) = softwareUploadBlocks;
+void (*Renderer::setBlockCount)(u32, u32) = softwareSetBlockCount;
+void (*Renderer::setBlockView)(const BlockView&) = softwareSetBlockView;
+void (*Renderer::setBlockDrawMode)(BlockDrawMode) = softwareSetBlockDrawMode;
+
+} // namespace memviz
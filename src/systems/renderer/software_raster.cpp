@@ -0,0 +1,184 @@
+#include "systems/renderer/software_raster.h"
+
+#include "basic.h"
+
+#include "systems/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define MEMVIZ_RASTER_X86 1
+    #include <immintrin.h>
+#endif
+
+namespace memviz {
+
+namespace {
+
+using FillSpanFn = void (*)(u32* dst, u32 count, u32 color);
+using AddSpanFn = void (*)(u16* dst, u32 count, u16 value);
+
+// ------------------------------------------ BEGIN SCALAR KERNELS -----------------------------------------------------
+
+void fillSpanScalar(u32* dst, u32 count, u32 color) {
+    for (u32 i = 0; i < count; i++) dst[i] = color;
+}
+
+void addSpanScalar(u16* dst, u32 count, u16 value) {
+    for (u32 i = 0; i < count; i++) {
+        u32 sum = u32(dst[i]) + u32(value);
+        dst[i] = sum > UINT16_MAX ? u16(UINT16_MAX) : u16(sum);
+    }
+}
+
+// ------------------------------------------ END SCALAR KERNELS -------------------------------------------------------
+
+#if defined(MEMVIZ_RASTER_X86)
+
+// Spans are mostly short (a block is often a few pixels wide), so the head and tail go through the scalar loop and
+// only the middle uses full vectors. Unaligned stores are as fast as aligned ones on every CPU with AVX2.
+
+PRAGMA_WARNING_PUSH
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+// ------------------------------------------ BEGIN SSE2 KERNELS -------------------------------------------------------
+
+void fillSpanSse2(u32* dst, u32 count, u32 color) {
+    __m128i v = _mm_set1_epi32(i32(color));
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 12), v);
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+    fillSpanScalar(dst + i, count - i, color);
+}
+
+void addSpanSse2(u16* dst, u32 count, u16 value) {
+    __m128i v = _mm_set1_epi16(i16(value));
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu16(h, v));
+    }
+    addSpanScalar(dst + i, count - i, value);
+}
+
+// ------------------------------------------ END SSE2 KERNELS ---------------------------------------------------------
+
+// ------------------------------------------ BEGIN AVX2 KERNELS -------------------------------------------------------
+
+// Compiled for AVX2 regardless of the global flags, only ever called after the runtime check passed.
+
+__attribute__((target("avx2")))
+void fillSpanAvx2(u32* dst, u32 count, u32 color) {
+    __m256i v = _mm256_set1_epi32(i32(color));
+    u32 i = 0;
+    for (; i + 32 <= count; i += 32) {
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 24), v);
+    }
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+    fillSpanScalar(dst + i, count - i, color);
+}
+
+__attribute__((target("avx2")))
+void addSpanAvx2(u16* dst, u32 count, u16 value) {
+    __m256i v = _mm256_set1_epi16(i16(value));
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i h = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epu16(h, v));
+    }
+    addSpanScalar(dst + i, count - i, value);
+}
+
+// ------------------------------------------ END AVX2 KERNELS ---------------------------------------------------------
+
+PRAGMA_WARNING_POP
+
+#endif // MEMVIZ_RASTER_X86
+
+FillSpanFn g_fillSpan = fillSpanScalar;
+AddSpanFn g_addSpan = addSpanScalar;
+
+RasterSimdLevel detectSimdLevel() {
+#if defined(MEMVIZ_RASTER_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return RasterSimdLevel::AVX2;
+    return RasterSimdLevel::SSE2; // part of x86-64
+#else
+    return RasterSimdLevel::SCALAR;
+#endif
+}
+
+RasterSimdLevel simdLevelFromEnv(RasterSimdLevel detected) {
+    const char* v = getenv("MEMVIZ_RASTER_SIMD");
+    if (!v) return detected;
+
+    for (u32 i = 0; i < u32(RasterSimdLevel::SENTINEL); i++) {
+        RasterSimdLevel level = RasterSimdLevel(i);
+        if (strcmp(v, rasterSimdLevelToCStr(level)) != 0) continue;
+        if (level > detected) {
+            logWarnTagged(RENDERER_TAG, "MEMVIZ_RASTER_SIMD={} is not supported by this CPU, using {}",
+                          v, rasterSimdLevelToCStr(detected));
+            return detected;
+        }
+        return level;
+    }
+
+    logWarnTagged(RENDERER_TAG, "Ignoring unknown MEMVIZ_RASTER_SIMD value '{}'", v);
+    return detected;
+}
+
+} // namespace
+
+RasterSimdLevel softwareRasterInit() {
+    RasterSimdLevel level = simdLevelFromEnv(detectSimdLevel());
+
+    switch (level) {
+#if defined(MEMVIZ_RASTER_X86)
+        case RasterSimdLevel::AVX2:
+            g_fillSpan = fillSpanAvx2;
+            g_addSpan = addSpanAvx2;
+            break;
+        case RasterSimdLevel::SSE2:
+            g_fillSpan = fillSpanSse2;
+            g_addSpan = addSpanSse2;
+            break;
+#endif
+        default:
+            g_fillSpan = fillSpanScalar;
+            g_addSpan = addSpanScalar;
+            break;
+    }
+
+    return level;
+}
+
+void rasterFillSpan(u32* dst, u32 count, u32 color) {
+    g_fillSpan(dst, count, color);
+}
+
+void rasterAddSpan(u16* dst, u32 count, u16 value) {
+    g_addSpan(dst, count, value);
+}
+
+void rasterResolveHeat(u32* dst, const u16* heat, u32 count, const u32* ramp, u32 background) {
+    // Once per pixel per frame, against many fills per pixel. A table lookup per pixel does not vectorize without
+    // gathers, which are slower than this loop on most CPUs, so there is only the scalar version.
+    for (u32 i = 0; i < count; i++) {
+        dst[i] = heat[i] == 0 ? background : ramp[heatToRampIndex(heat[i])];
+    }
+}
+
+} // namespace memviz
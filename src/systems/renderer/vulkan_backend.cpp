@@ -5,7 +5,15 @@
 #include "platform.h"
 #include "error.h"
 
+#include "systems/allocators.h"
 #include "systems/logger.h"
+#include "systems/profiler.h"
+#include "systems/renderer/frame_timing.h"
+#include "systems/renderer/vulkan_blocks.h"
+#include "systems/renderer/vulkan_device_memory.h"
+#include "systems/renderer/vulkan_gpu_timer.h"
+#include "systems/renderer/vulkan_host_allocator.h"
+#include "systems/startup_timing.h"
 
 PRAGMA_WARNING_PUSH
 
@@ -14,6 +22,10 @@ PRAGMA_WARNING_SUPPRESS_ALL
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vk_layer.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 PRAGMA_WARNING_POP
 
 PRAGMA_WARNING_PUSH
@@ -25,12 +37,26 @@ namespace memviz {
 
 using RendererCreateInfo = Renderer::CrateInfo;
 
+constexpr addr_size TEMP_STATIC_ARR_CAP = 254;
+constexpr addr_size MAX_GPU_DEVICES = 16;
+
 template <typename T>
-using TempStaticArr = core::ArrStatic<T, 254>;
+using TempStaticArr = core::ArrStatic<T, TEMP_STATIC_ARR_CAP>;
 
-using ExtPropsList = core::ArrStatic<VkExtensionProperties, 254>;
+using ExtPropsList = core::ArrStatic<VkExtensionProperties, TEMP_STATIC_ARR_CAP>;
 using LayerPropsList = core::ArrStatic<VkLayerProperties, 254>;
 
+struct GPUDevice {
+    VkPhysicalDevice handle;
+    VkPhysicalDeviceProperties props;
+    VkPhysicalDeviceFeatures features;
+    u32 graphicsQueueFamily;
+    u32 presentQueueFamily;
+    i32 score; // Negative when the device can not be used at all.
+};
+
+using GPUDeviceList = core::ArrStatic<GPUDevice, MAX_GPU_DEVICES>;
+
 namespace {
 
 // ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
@@ -57,6 +83,27 @@ constexpr addr_size LAYERS_COUNT = CORE_C_ARRLEN(LAYERS);
 
 #endif
 
+constexpr const char* DEVICE_EXTS[] = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+#if defined(OS_MAC) && OS_MAC == 1
+    VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME,
+#endif
+};
+constexpr addr_size DEVICE_EXTS_COUNT = CORE_C_ARRLEN(DEVICE_EXTS);
+constexpr addr_size MAX_DEVICE_EXTS = DEVICE_EXTS_COUNT + 4;
+
+// Two frames let the CPU record frame N+1 while the GPU works on frame N. A third only adds latency for this workload.
+constexpr u32 MAX_FRAMES_IN_FLIGHT = 2;
+constexpr u32 MAX_SWAPCHAIN_IMAGES = 8;
+constexpr u32 MAX_RETIRED_SWAPCHAINS = 4;
+
+constexpr char PIPELINE_CACHE_MAGIC[4] = { 'M', 'V', 'P', 'C' };
+constexpr u32 PIPELINE_CACHE_FILE_VERSION = 1;
+constexpr const char* PIPELINE_CACHE_FILE_NAME = "pipeline_cache.bin";
+constexpr addr_size PIPELINE_CACHE_PATH_MAX = 1024;
+
+constexpr VkClearColorValue CLEAR_COLOR = {{ 0.08f, 0.08f, 0.10f, 1.0f }};
+
 // ------------------------------------------ END CONSTNATS ------------------------------------------------------------
 
 // ------------------------------------------ BEGIN RENDERER STATE -----------------------------------------------------
@@ -64,7 +111,86 @@ constexpr addr_size LAYERS_COUNT = CORE_C_ARRLEN(LAYERS);
 // ExtPropsList g_allSupportedInstExts;
 LayerPropsList g_allSupportedInstLayers;
 
+// Host allocations of the loader, layers and driver go through a core allocator so they can be measured and capped.
+const VkAllocationCallbacks* g_allocCallbacks = nullptr;
+
 VkInstance g_instance = VK_NULL_HANDLE;
+VkDebugUtilsMessengerEXT g_debugMessenger = VK_NULL_HANDLE;
+VkSurfaceKHR g_surface = VK_NULL_HANDLE;
+
+GPUDeviceList g_allSupportedPhysicalDevices;
+GPUDevice g_gpu = {};
+VkDevice g_device = VK_NULL_HANDLE;
+bool g_memoryBudgetEnabled = false; // VK_EXT_memory_budget
+VkQueue g_graphicsQueue = VK_NULL_HANDLE;
+VkQueue g_presentQueue = VK_NULL_HANDLE;
+
+struct Swapchain {
+    VkSwapchainKHR handle;
+    VkFormat format;
+    VkExtent2D extent;
+    u32 imageCount;
+    VkImage images[MAX_SWAPCHAIN_IMAGES];
+    VkImageView imageViews[MAX_SWAPCHAIN_IMAGES];
+    VkFramebuffer framebuffers[MAX_SWAPCHAIN_IMAGES];
+    // One per image, not per frame: the presentation engine may still wait on it after the frame fence signalled.
+    VkSemaphore renderFinished[MAX_SWAPCHAIN_IMAGES];
+};
+
+// A swapchain replaced during a resize. It is destroyed only once every frame that could have used it completed, so
+// recreation never has to wait for the device to go idle.
+struct RetiredSwapchain {
+    Swapchain swapchain;
+    u64 retiredAtFrame;
+};
+
+struct FrameData {
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmd;
+    VkSemaphore imageAvailable;
+    VkFence inFlight;
+};
+
+Swapchain g_swapchain = {};
+// Created with the first swapchain. Only compatible with that swapchain format, which is picked the same way every time.
+VkRenderPass g_renderPass = VK_NULL_HANDLE;
+VkFormat g_renderPassFormat = VK_FORMAT_UNDEFINED;
+RetiredSwapchain g_retiredSwapchains[MAX_RETIRED_SWAPCHAINS] = {};
+u32 g_retiredSwapchainCount = 0;
+
+FrameData g_frames[MAX_FRAMES_IN_FLIGHT] = {};
+u64 g_frameNumber = 0;
+// False once the current frame slot was submitted. The slot's upload ring region may only be written again after its
+// fence was waited on.
+bool g_uploadSlotReady = false;
+
+// Presented frames and the time between them, reported at shutdown.
+u64 g_frameStatsFirstNs = 0;
+u64 g_frameStatsLastNs = 0;
+u64 g_frameStatsMaxIntervalNs = 0;
+u64 g_frameStatsCount = 0;
+
+// Prefixed to the driver's cache blob on disk. The driver validates its own header too, but driver updates that keep
+// the pipelineCacheUUID have been known to crash on stale data, so the driver version and UUID are checked as well.
+struct PipelineCacheFileHeader {
+    char magic[4];
+    u32 version;
+    u32 vendorID;
+    u32 deviceID;
+    u32 driverVersion;
+    u8 driverUUID[VK_UUID_SIZE];
+    u8 pipelineCacheUUID[VK_UUID_SIZE];
+    u32 reserved; // keeps dataSize aligned without implicit padding, the header is compared with memcmp
+    u64 dataSize;
+};
+
+VkPipelineCache g_pipelineCache = VK_NULL_HANDLE;
+char g_pipelineCachePath[PIPELINE_CACHE_PATH_MAX] = {};
+
+// Written by resizeTarget from the window callback, consumed at the start of the next drawFrame.
+bool g_swapchainDirty = false;
+u32 g_targetWidth = 0;
+u32 g_targetHeight = 0;
 
 // ------------------------------------------ END RENDERER STATE -------------------------------------------------------
 
@@ -82,8 +208,27 @@ LayerPropsList* getAllSupportedInstLayers(bool invalidateCache = false);
 void            logInstLayersList(const LayerPropsList& list);
 bool            checkSupportForInstLayer(const char* name);
 
-// GPUDeviceList* getAllSupportedPhysicalDevices(VkInstance instance, bool useCache = true);
-// void           logPhysicalDevicesList(const GPUDeviceList& list);
+GPUDeviceList* getAllSupportedPhysicalDevices(VkInstance instance, bool useCache = true);
+void           logPhysicalDevicesList(const GPUDeviceList& list);
+i32            scorePhysicalDevice(const GPUDevice& gpu);
+bool           checkDeviceExtensionSupport(VkPhysicalDevice device);
+bool           checkOptionalDeviceExtension(VkPhysicalDevice device, const char* name);
+[[nodiscard]] Error pickPhysicalDevice();
+[[nodiscard]] Error createLogicalDevice();
+
+[[nodiscard]] Error createSwapchain(VkSwapchainKHR oldSwapchain);
+void                recreateSwapchain();
+void                destroySwapchain(Swapchain& swapchain);
+void                destroyRetiredSwapchains(bool force);
+void                createFrameData();
+void                destroyFrameData();
+[[nodiscard]] Error createRenderPass(VkFormat format);
+
+PipelineCacheFileHeader currentPipelineCacheHeader();
+bool                    buildPipelineCachePath();
+bool                    loadPipelineCacheBlob(void*& outData, addr_size& outSize);
+void                    createPipelineCache();
+void                    savePipelineCache();
 
 [[nodiscard]] VkDebugUtilsMessengerEXT vulkanCreateDebugMessenger(VkInstance instance);
 [[nodiscard]] VkDebugUtilsMessengerCreateInfoEXT defaultDebugMessengerInfo();
@@ -108,22 +253,295 @@ void logVulkanVersion();
 } // namesspace
 
 Error vulkanInit(RendererCreateInfo&& rendererInfo) {
+    MEMVIZ_ZONE("Renderer::init");
+    vulkanHostAllocatorInit(VULKAN_HOST_ALLOCATOR_ID, rendererInfo.hostMemoryCapBytes);
+    g_allocCallbacks = vulkanHostAllocator();
+
+    startupTimingBegin(StartupStage::RENDERER_INSTANCE);
     logVulkanVersion();
     logInstLayersList(*getAllSupportedInstLayers());
 
     createInstance(rendererInfo);
 
+#ifdef MEMVIZ_VALIDATION_LAYERS_ENABLED
+    g_debugMessenger = vulkanCreateDebugMessenger(g_instance);
+#endif
+
+    if (Error err = Platform::createVulkanSurface(g_instance, g_allocCallbacks, g_surface); err != Error::OK) {
+        return err;
+    }
+    startupTimingEnd(StartupStage::RENDERER_INSTANCE);
+
+    startupTimingBegin(StartupStage::RENDERER_DEVICE);
+    if (Error err = pickPhysicalDevice(); err != Error::OK) {
+        return err;
+    }
+
+    if (Error err = createLogicalDevice(); err != Error::OK) {
+        return err;
+    }
+
+    DeviceMemoryCreateInfo memInfo = {};
+    memInfo.gpu = g_gpu.handle;
+    memInfo.device = g_device;
+    memInfo.allocCallbacks = g_allocCallbacks;
+    memInfo.memoryBudgetSupported = g_memoryBudgetEnabled;
+    memInfo.framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    if (!deviceMemoryInit(memInfo)) {
+        return Error::FAILED_TO_CREATE_VK_DEVICE;
+    }
+
+    frameTimingInit();
+    VulkanGpuTimerCreateInfo timerInfo = {};
+    timerInfo.gpu = g_gpu.handle;
+    timerInfo.device = g_device;
+    timerInfo.allocCallbacks = g_allocCallbacks;
+    timerInfo.queueFamily = g_gpu.graphicsQueueFamily;
+    timerInfo.framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    vulkanGpuTimerInit(timerInfo); // frames are only missing the GPU timings without it
+    startupTimingEnd(StartupStage::RENDERER_DEVICE);
+
+    startupTimingBegin(StartupStage::RENDERER_SWAPCHAIN);
+    Platform::getFrameBufferSize(g_targetWidth, g_targetHeight);
+    if (Error err = createSwapchain(VK_NULL_HANDLE); err != Error::OK) {
+        return err;
+    }
+
+    createFrameData();
+    startupTimingEnd(StartupStage::RENDERER_SWAPCHAIN);
+
+    startupTimingBegin(StartupStage::RENDERER_PIPELINE_WARMUP);
+    createPipelineCache();
+
+    VulkanBlocksCreateInfo blocksInfo = {};
+    blocksInfo.device = g_device;
+    blocksInfo.allocCallbacks = g_allocCallbacks;
+    blocksInfo.renderPass = g_renderPass;
+    blocksInfo.pipelineCache = g_pipelineCache;
+    blocksInfo.framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    if (!vulkanBlocksInit(blocksInfo)) {
+        return Error::FAILED_TO_CREATE_VK_PIPELINE;
+    }
+    startupTimingEnd(StartupStage::RENDERER_PIPELINE_WARMUP);
+
     return Error::OK;
 }
 
+void vulkanDrawFrame() {
+    MEMVIZ_ZONE("Renderer::drawFrame");
+    u32 frameSlot = u32(g_frameNumber % MAX_FRAMES_IN_FLIGHT);
+    FrameData& frame = g_frames[frameSlot];
+
+    // The only wait on the CPU side: the GPU finishing the frame that used these resources MAX_FRAMES_IN_FLIGHT ago.
+    u64 waitStartNs = Platform::getMonotonicTimeNs();
+    VK_MUST(vkWaitForFences(g_device, 1, &frame.inFlight, VK_TRUE, UINT64_MAX));
+    frameTimingRecord(FramePass::CPU_WAIT, Platform::getMonotonicTimeNs() - waitStartNs);
+    if (!g_uploadSlotReady) {
+        deviceMemoryBeginFrame(frameSlot);
+        vulkanBlocksResetSlot(frameSlot);
+        g_uploadSlotReady = true;
+    }
+    destroyRetiredSwapchains(false);
+
+    if (g_swapchainDirty) {
+        recreateSwapchain();
+    }
+    if (g_swapchain.handle == VK_NULL_HANDLE) {
+        return; // minimized
+    }
+
+    u32 imageIndex = 0;
+    VkResult vres = vkAcquireNextImageKHR(g_device, g_swapchain.handle, UINT64_MAX,
+                                          frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+    if (vres == VK_ERROR_OUT_OF_DATE_KHR) {
+        g_swapchainDirty = true;
+        return;
+    }
+    PanicFmt(vres == VK_SUCCESS || vres == VK_SUBOPTIMAL_KHR, "vkAcquireNextImageKHR failed with {}", i32(vres));
+
+    // Only reset the fence once work is guaranteed to be submitted, otherwise the next wait on it deadlocks.
+    u64 recordStartNs = Platform::getMonotonicTimeNs();
+    VK_MUST(vkResetFences(g_device, 1, &frame.inFlight));
+    VK_MUST(vkResetCommandPool(g_device, frame.cmdPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_MUST(vkBeginCommandBuffer(frame.cmd, &beginInfo));
+
+    // Picks up the GPU timings of the frame that last used this slot, the fence above guarantees they are ready.
+    vulkanGpuTimerBeginFrame(frame.cmd, frameSlot);
+
+    vulkanGpuTimerBegin(frame.cmd, frameSlot, FramePass::GPU_UPLOAD);
+    vulkanBlocksRecordUploads(frame.cmd, frameSlot);
+    vulkanGpuTimerEnd(frame.cmd, frameSlot, FramePass::GPU_UPLOAD);
+
+    VkClearValue clearValue{};
+    clearValue.color = CLEAR_COLOR;
+    VkRenderPassBeginInfo passInfo{};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    passInfo.renderPass = g_renderPass;
+    passInfo.framebuffer = g_swapchain.framebuffers[imageIndex];
+    passInfo.renderArea.extent = g_swapchain.extent;
+    passInfo.clearValueCount = 1;
+    passInfo.pClearValues = &clearValue;
+    vulkanGpuTimerBegin(frame.cmd, frameSlot, FramePass::GPU_BLOCKS);
+    vkCmdBeginRenderPass(frame.cmd, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vulkanBlocksRecordDraw(frame.cmd, frameSlot, g_swapchain.extent);
+    vkCmdEndRenderPass(frame.cmd);
+    vulkanGpuTimerEnd(frame.cmd, frameSlot, FramePass::GPU_BLOCKS);
+
+    VK_MUST(vkEndCommandBuffer(frame.cmd));
+    u64 submitStartNs = Platform::getMonotonicTimeNs();
+    frameTimingRecord(FramePass::CPU_RECORD, submitStartNs - recordStartNs);
+
+    VkSemaphore renderFinished = g_swapchain.renderFinished[imageIndex];
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &frame.imageAvailable;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &renderFinished;
+    VK_MUST(vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, frame.inFlight), "Failed to submit frame");
+    g_uploadSlotReady = false;
+    u64 presentStartNs = Platform::getMonotonicTimeNs();
+    frameTimingRecord(FramePass::CPU_SUBMIT, presentStartNs - submitStartNs);
+
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderFinished;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &g_swapchain.handle;
+    presentInfo.pImageIndices = &imageIndex;
+
+    vres = vkQueuePresentKHR(g_presentQueue, &presentInfo);
+    frameTimingRecord(FramePass::CPU_PRESENT, Platform::getMonotonicTimeNs() - presentStartNs);
+    frameTimingEndFrame();
+    if (vres == VK_ERROR_OUT_OF_DATE_KHR || vres == VK_SUBOPTIMAL_KHR) {
+        g_swapchainDirty = true;
+    }
+    else {
+        PanicFmt(vres == VK_SUCCESS, "vkQueuePresentKHR failed with {}", i32(vres));
+    }
+
+    g_frameNumber++;
+
+    u64 nowNs = Platform::getMonotonicTimeNs();
+    if (g_frameStatsCount == 0) {
+        g_frameStatsFirstNs = nowNs;
+    }
+    else if (nowNs - g_frameStatsLastNs > g_frameStatsMaxIntervalNs) {
+        g_frameStatsMaxIntervalNs = nowNs - g_frameStatsLastNs;
+    }
+    g_frameStatsLastNs = nowNs;
+    g_frameStatsCount++;
+}
+
+void vulkanSetBlockLayer(u32 layer, const BlockLayerDesc& desc) {
+    vulkanBlocksSetLayer(layer, desc);
+}
+
+u32 vulkanUploadBlocks(u32 layer, u32 first, const BlockInstance* blocks, u32 count) {
+    u32 frameSlot = u32(g_frameNumber % MAX_FRAMES_IN_FLIGHT);
+    if (!g_uploadSlotReady) {
+        // Usually already signaled: uploads happen between frames and the slot was submitted MAX_FRAMES_IN_FLIGHT
+        // frames ago.
+        VK_MUST(vkWaitForFences(g_device, 1, &g_frames[frameSlot].inFlight, VK_TRUE, UINT64_MAX));
+        deviceMemoryBeginFrame(frameSlot);
+        vulkanBlocksResetSlot(frameSlot);
+        g_uploadSlotReady = true;
+    }
+    return vulkanBlocksUpload(frameSlot, layer, first, blocks, count);
+}
+
+void vulkanSetBlockCount(u32 layer, u32 count) {
+    vulkanBlocksSetCount(layer, count);
+}
+
+void vulkanSetBlockView(const BlockView& view) {
+    vulkanBlocksSetView(view);
+}
+
+void vulkanSetBlockDrawMode(BlockDrawMode mode) {
+    // Only the software renderer draws heatmaps so far.
+    if (mode != BlockDrawMode::RECTANGLES) {
+        logWarnTagged(RENDERER_TAG, "The Vulkan renderer only draws blocks as rectangles");
+    }
+}
+
+void vulkanResizeTarget(i32 width, i32 height) {
+    // Called from the window resize callback. No Vulkan work happens here, the swapchain is rebuilt lazily by the next
+    // drawFrame, so a burst of resize events costs nothing.
+    g_targetWidth = width > 0 ? u32(width) : 0;
+    g_targetHeight = height > 0 ? u32(height) : 0;
+    g_swapchainDirty = true;
+}
+
 void vulkanShutdown() {
     logInfoTagged(RENDERER_TAG, "Shutting down Vulkan renderer.");
 
+    if (g_device != VK_NULL_HANDLE) {
+        VK_MUST(vkDeviceWaitIdle(g_device));
+
+        if (g_frameStatsCount > 1) {
+            u64 avgNs = (g_frameStatsLastNs - g_frameStatsFirstNs) / (g_frameStatsCount - 1);
+            logInfoTagged(RENDERER_TAG, "Frames: {}, avg frame time: {:f.3}ms, max: {:f.3}ms",
+                          g_frameStatsCount, f64(avgNs) / 1e6, f64(g_frameStatsMaxIntervalNs) / 1e6);
+        }
+
+        frameTimingShutdown();
+        vulkanGpuTimerShutdown();
+
+        vulkanBlocksShutdown();
+
+        savePipelineCache();
+        vkDestroyPipelineCache(g_device, g_pipelineCache, g_allocCallbacks);
+        g_pipelineCache = VK_NULL_HANDLE;
+
+        destroyFrameData();
+        destroyRetiredSwapchains(true);
+        destroySwapchain(g_swapchain);
+        if (g_renderPass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(g_device, g_renderPass, g_allocCallbacks);
+            g_renderPass = VK_NULL_HANDLE;
+        }
+
+        // MEMVIZ_GPU_HEAP_MAP=<path> writes the manager's own allocation map, to be loaded back into memviz.
+        if (const char* mapPath = getenv("MEMVIZ_GPU_HEAP_MAP")) {
+            if (!deviceMemoryDumpMap(mapPath)) {
+                logWarnTagged(RENDERER_TAG, "Failed to write the device memory map to '{}'", mapPath);
+            }
+        }
+        deviceMemoryShutdown();
+
+        logInfoTagged(RENDERER_TAG, "Destroying Vulkan device");
+        vkDestroyDevice(g_device, g_allocCallbacks);
+        g_device = VK_NULL_HANDLE;
+    }
+
+    if (g_surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(g_instance, g_surface, g_allocCallbacks);
+        g_surface = VK_NULL_HANDLE;
+    }
+
+    if (g_debugMessenger != VK_NULL_HANDLE) {
+        wrap_vkDestroyDebugUtilsMessengerEXT(g_instance, g_debugMessenger, g_allocCallbacks);
+        g_debugMessenger = VK_NULL_HANDLE;
+    }
+
     if (g_instance != VK_NULL_HANDLE) {
         logInfoTagged(RENDERER_TAG, "Destroying Vulkan instance");
-        vkDestroyInstance(g_instance, nullptr);
+        vkDestroyInstance(g_instance, g_allocCallbacks);
         g_instance = VK_NULL_HANDLE;
     }
+
+    vulkanHostAllocatorLogStats();
 }
 
 namespace {
@@ -188,7 +606,7 @@ void createInstance(const RendererCreateInfo& rendererInfo) {
 #endif
 
     VK_MUST(
-        vkCreateInstance(&instanceCreateInfo, nullptr, &g_instance),
+        vkCreateInstance(&instanceCreateInfo, g_allocCallbacks, &g_instance),
         "Failed to create VkInstance"
     );
 }
@@ -228,12 +646,684 @@ bool checkSupportForInstLayer(const char* name) {
     return false;
 }
 
+GPUDeviceList* getAllSupportedPhysicalDevices(VkInstance instance, bool useCache) {
+    if (useCache && !g_allSupportedPhysicalDevices.empty()) {
+        return &g_allSupportedPhysicalDevices;
+    }
+
+    u32 deviceCount = 0;
+    VK_MUST(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr));
+
+    // Ignore anything past what the list can hold, VK_INCOMPLETE is fine in that case.
+    if (deviceCount > MAX_GPU_DEVICES) deviceCount = u32(MAX_GPU_DEVICES);
+    TempStaticArr<VkPhysicalDevice> handles (deviceCount, VK_NULL_HANDLE);
+    VkResult vres = vkEnumeratePhysicalDevices(instance, &deviceCount, handles.data());
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to enumerate physical devices");
+
+    GPUDeviceList list;
+    for (u32 i = 0; i < deviceCount; i++) {
+        GPUDevice gpu = {};
+        gpu.handle = handles[i];
+        vkGetPhysicalDeviceProperties(gpu.handle, &gpu.props);
+        vkGetPhysicalDeviceFeatures(gpu.handle, &gpu.features);
+
+        u32 familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu.handle, &familyCount, nullptr);
+        if (familyCount > TEMP_STATIC_ARR_CAP) familyCount = u32(TEMP_STATIC_ARR_CAP);
+        TempStaticArr<VkQueueFamilyProperties> families (familyCount, VkQueueFamilyProperties{});
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu.handle, &familyCount, families.data());
+
+        gpu.graphicsQueueFamily = UINT32_MAX;
+        gpu.presentQueueFamily = UINT32_MAX;
+        for (u32 fi = 0; fi < familyCount; fi++) {
+            bool graphics = (families[fi].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            VkBool32 present = VK_FALSE;
+            VK_MUST(vkGetPhysicalDeviceSurfaceSupportKHR(gpu.handle, fi, g_surface, &present));
+
+            // A single family that can do both avoids ownership transfers and concurrent sharing of swapchain images.
+            if (graphics && present) {
+                gpu.graphicsQueueFamily = fi;
+                gpu.presentQueueFamily = fi;
+                break;
+            }
+            if (graphics && gpu.graphicsQueueFamily == UINT32_MAX) gpu.graphicsQueueFamily = fi;
+            if (present && gpu.presentQueueFamily == UINT32_MAX)  gpu.presentQueueFamily = fi;
+        }
+
+        gpu.score = scorePhysicalDevice(gpu);
+        list.push(gpu);
+    }
+
+    g_allSupportedPhysicalDevices = std::move(list);
+    return &g_allSupportedPhysicalDevices;
+}
+
+void logPhysicalDevicesList(const GPUDeviceList& list) {
+    auto deviceTypeToCStr = [](VkPhysicalDeviceType t) -> const char* {
+        switch (t) {
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   return "discrete";
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    return "virtual";
+            case VK_PHYSICAL_DEVICE_TYPE_CPU:            return "cpu";
+            default:                                     return "other";
+        }
+    };
+
+    logInfoTagged(RENDERER_TAG, "Physical Devices ({})", list.len());
+    for (addr_size i = 0; i < list.len(); i++) {
+        const GPUDevice& gpu = list[i];
+        logInfoTagged(RENDERER_TAG, "\tname: {}, type: {}, api: {}.{}.{}, score: {}",
+                      gpu.props.deviceName, deviceTypeToCStr(gpu.props.deviceType),
+                      VK_API_VERSION_MAJOR(gpu.props.apiVersion), VK_API_VERSION_MINOR(gpu.props.apiVersion),
+                      VK_API_VERSION_PATCH(gpu.props.apiVersion), gpu.score);
+    }
+}
+
+i32 scorePhysicalDevice(const GPUDevice& gpu) {
+    if (gpu.graphicsQueueFamily == UINT32_MAX || gpu.presentQueueFamily == UINT32_MAX) return -1;
+    if (!checkDeviceExtensionSupport(gpu.handle)) return -1;
+
+    u32 formatCount = 0;
+    u32 presentModeCount = 0;
+    VK_MUST(vkGetPhysicalDeviceSurfaceFormatsKHR(gpu.handle, g_surface, &formatCount, nullptr));
+    VK_MUST(vkGetPhysicalDeviceSurfacePresentModesKHR(gpu.handle, g_surface, &presentModeCount, nullptr));
+    if (formatCount == 0 || presentModeCount == 0) return -1;
+
+    i32 score = 0;
+    switch (gpu.props.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   score += 10000; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 5000;  break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    score += 2000;  break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:            score += 1000;  break; // lavapipe, usable but last resort
+        default:                                     score += 500;   break;
+    }
+
+    // Larger max texture size is a decent proxy for a more capable device within the same class.
+    score += i32(gpu.props.limits.maxImageDimension2D / 1024);
+    if (gpu.graphicsQueueFamily == gpu.presentQueueFamily) score += 100;
+
+    return score;
+}
+
+bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+    u32 extCount = 0;
+    VK_MUST(vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, nullptr));
+    if (extCount > TEMP_STATIC_ARR_CAP) extCount = u32(TEMP_STATIC_ARR_CAP);
+
+    ExtPropsList exts (extCount, VkExtensionProperties{});
+    VkResult vres = vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, exts.data());
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to enumerate device extensions");
+
+    for (addr_size i = 0; i < DEVICE_EXTS_COUNT; i++) {
+        bool found = false;
+        for (u32 j = 0; j < extCount; j++) {
+            if (core::memcmp(exts[j].extensionName, DEVICE_EXTS[i], core::cstrLen(DEVICE_EXTS[i]) + 1) == 0) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) return false;
+    }
+
+    return true;
+}
+
+bool checkOptionalDeviceExtension(VkPhysicalDevice device, const char* name) {
+    u32 extCount = 0;
+    VK_MUST(vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, nullptr));
+    if (extCount > TEMP_STATIC_ARR_CAP) extCount = u32(TEMP_STATIC_ARR_CAP);
+
+    ExtPropsList exts (extCount, VkExtensionProperties{});
+    VkResult vres = vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, exts.data());
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to enumerate device extensions");
+
+    for (u32 i = 0; i < extCount; i++) {
+        if (core::memcmp(exts[i].extensionName, name, core::cstrLen(name) + 1) == 0) return true;
+    }
+    return false;
+}
+
+Error pickPhysicalDevice() {
+    const GPUDeviceList& devices = *getAllSupportedPhysicalDevices(g_instance);
+    logPhysicalDevicesList(devices);
+
+    // MEMVIZ_VK_DEVICE=<substring of the device name> forces a device, e.g. "llvmpipe" to test on the software ICD.
+    const char* forced = getenv("MEMVIZ_VK_DEVICE");
+
+    i32 bestIdx = -1;
+    for (addr_size i = 0; i < devices.len(); i++) {
+        const GPUDevice& gpu = devices[i];
+        if (gpu.score < 0) continue;
+
+        if (forced) {
+            if (strstr(gpu.props.deviceName, forced)) {
+                bestIdx = i32(i);
+                break;
+            }
+            continue;
+        }
+
+        if (bestIdx < 0 || gpu.score > devices[addr_size(bestIdx)].score) {
+            bestIdx = i32(i);
+        }
+    }
+
+    if (bestIdx < 0) {
+        logErrTagged(RENDERER_TAG, "No suitable physical device found{}{}",
+                     forced ? " matching " : "", forced ? forced : "");
+        return Error::FAILED_TO_FIND_SUITABLE_GPU;
+    }
+
+    g_gpu = devices[addr_size(bestIdx)];
+    logInfoTagged(RENDERER_TAG, "Selected physical device: {}", g_gpu.props.deviceName);
+    return Error::OK;
+}
+
+Error createLogicalDevice() {
+    f32 queuePriority = 1.0f;
+
+    VkDeviceQueueCreateInfo queueInfos[2] = {};
+    u32 queueInfoCount = 0;
+
+    queueInfos[queueInfoCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[queueInfoCount].queueFamilyIndex = g_gpu.graphicsQueueFamily;
+    queueInfos[queueInfoCount].queueCount = 1;
+    queueInfos[queueInfoCount].pQueuePriorities = &queuePriority;
+    queueInfoCount++;
+
+    if (g_gpu.presentQueueFamily != g_gpu.graphicsQueueFamily) {
+        queueInfos[queueInfoCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfos[queueInfoCount].queueFamilyIndex = g_gpu.presentQueueFamily;
+        queueInfos[queueInfoCount].queueCount = 1;
+        queueInfos[queueInfoCount].pQueuePriorities = &queuePriority;
+        queueInfoCount++;
+    }
+
+    VkPhysicalDeviceFeatures enabledFeatures{};
+
+    const char* enabledExts[MAX_DEVICE_EXTS];
+    u32 enabledExtCount = 0;
+    for (addr_size i = 0; i < DEVICE_EXTS_COUNT; i++) {
+        enabledExts[enabledExtCount++] = DEVICE_EXTS[i];
+    }
+
+    // Lets the device memory manager see the real per-heap budget, including other processes. Queried through
+    // vkGetPhysicalDeviceMemoryProperties2, so it also needs a 1.1 device.
+    g_memoryBudgetEnabled = g_gpu.props.apiVersion >= VK_API_VERSION_1_1 &&
+                            checkOptionalDeviceExtension(g_gpu.handle, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (g_memoryBudgetEnabled) {
+        enabledExts[enabledExtCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+
+    logInfoTagged(RENDERER_TAG, "Enabled device extensions:");
+    for (u32 i = 0; i < enabledExtCount; i++) {
+        logInfoTagged(RENDERER_TAG, "\t{}", enabledExts[i]);
+    }
+
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.queueCreateInfoCount = queueInfoCount;
+    deviceInfo.pQueueCreateInfos = queueInfos;
+    deviceInfo.pEnabledFeatures = &enabledFeatures;
+    deviceInfo.enabledExtensionCount = enabledExtCount;
+    deviceInfo.ppEnabledExtensionNames = enabledExts;
+
+    if (vkCreateDevice(g_gpu.handle, &deviceInfo, g_allocCallbacks, &g_device) != VK_SUCCESS) {
+        return Error::FAILED_TO_CREATE_VK_DEVICE;
+    }
+
+    vkGetDeviceQueue(g_device, g_gpu.graphicsQueueFamily, 0, &g_graphicsQueue);
+    vkGetDeviceQueue(g_device, g_gpu.presentQueueFamily, 0, &g_presentQueue);
+
+    return Error::OK;
+}
+
+Error createSwapchain(VkSwapchainKHR oldSwapchain) {
+    VkSurfaceCapabilitiesKHR caps;
+    VK_MUST(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(g_gpu.handle, g_surface, &caps));
+
+    // currentExtent is 0xFFFFFFFF when the surface size is determined by the swapchain (e.g. headless surfaces).
+    VkExtent2D extent = caps.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        auto clampU32 = [](u32 v, u32 lo, u32 hi) { return v < lo ? lo : (v > hi ? hi : v); };
+        extent.width = clampU32(g_targetWidth, caps.minImageExtent.width, caps.maxImageExtent.width);
+        extent.height = clampU32(g_targetHeight, caps.minImageExtent.height, caps.maxImageExtent.height);
+    }
+    if (extent.width == 0 || extent.height == 0) {
+        // Minimized. Try again once the window has a size.
+        g_swapchainDirty = true;
+        return Error::OK;
+    }
+
+    u32 formatCount = 0;
+    VK_MUST(vkGetPhysicalDeviceSurfaceFormatsKHR(g_gpu.handle, g_surface, &formatCount, nullptr));
+    if (formatCount > TEMP_STATIC_ARR_CAP) formatCount = u32(TEMP_STATIC_ARR_CAP);
+    TempStaticArr<VkSurfaceFormatKHR> formats (formatCount, VkSurfaceFormatKHR{});
+    VkResult vres = vkGetPhysicalDeviceSurfaceFormatsKHR(g_gpu.handle, g_surface, &formatCount, formats.data());
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to query surface formats");
+
+    VkSurfaceFormatKHR surfaceFormat = formats[0];
+    for (u32 i = 0; i < formatCount; i++) {
+        if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB &&
+            formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            surfaceFormat = formats[i];
+            break;
+        }
+    }
+
+    u32 presentModeCount = 0;
+    VK_MUST(vkGetPhysicalDeviceSurfacePresentModesKHR(g_gpu.handle, g_surface, &presentModeCount, nullptr));
+    if (presentModeCount > TEMP_STATIC_ARR_CAP) presentModeCount = u32(TEMP_STATIC_ARR_CAP);
+    TempStaticArr<VkPresentModeKHR> presentModes (presentModeCount, VK_PRESENT_MODE_FIFO_KHR);
+    vres = vkGetPhysicalDeviceSurfacePresentModesKHR(g_gpu.handle, g_surface, &presentModeCount, presentModes.data());
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to query present modes");
+
+    // MAILBOX gives the lowest latency without tearing. FIFO is the only mode guaranteed to exist.
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    for (u32 i = 0; i < presentModeCount; i++) {
+        if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+            presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            break;
+        }
+    }
+
+    u32 imageCount = caps.minImageCount + 1;
+    if (caps.maxImageCount > 0 && imageCount > caps.maxImageCount) imageCount = caps.maxImageCount;
+    if (imageCount > MAX_SWAPCHAIN_IMAGES) imageCount = MAX_SWAPCHAIN_IMAGES;
+
+    VkCompositeAlphaFlagBitsKHR compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(caps.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)) {
+        compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+    }
+
+    VkSwapchainCreateInfoKHR createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = g_surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = extent;
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    createInfo.preTransform = caps.currentTransform;
+    createInfo.compositeAlpha = compositeAlpha;
+    createInfo.presentMode = presentMode;
+    createInfo.clipped = VK_TRUE;
+    createInfo.oldSwapchain = oldSwapchain;
+
+    u32 queueFamilies[] = { g_gpu.graphicsQueueFamily, g_gpu.presentQueueFamily };
+    if (g_gpu.graphicsQueueFamily != g_gpu.presentQueueFamily) {
+        createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount = 2;
+        createInfo.pQueueFamilyIndices = queueFamilies;
+    }
+    else {
+        createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    Swapchain sc = {};
+    if (vkCreateSwapchainKHR(g_device, &createInfo, g_allocCallbacks, &sc.handle) != VK_SUCCESS) {
+        return Error::FAILED_TO_CREATE_VK_SWAPCHAIN;
+    }
+    sc.format = surfaceFormat.format;
+    sc.extent = extent;
+
+    if (g_renderPass == VK_NULL_HANDLE) {
+        if (Error err = createRenderPass(sc.format); err != Error::OK) {
+            vkDestroySwapchainKHR(g_device, sc.handle, g_allocCallbacks);
+            return err;
+        }
+    }
+    Panic(sc.format == g_renderPassFormat, "Swapchain format changed, the render pass is no longer compatible");
+
+    VK_MUST(vkGetSwapchainImagesKHR(g_device, sc.handle, &sc.imageCount, nullptr));
+    if (sc.imageCount > MAX_SWAPCHAIN_IMAGES) sc.imageCount = MAX_SWAPCHAIN_IMAGES;
+    vres = vkGetSwapchainImagesKHR(g_device, sc.handle, &sc.imageCount, sc.images);
+    Panic(vres == VK_SUCCESS || vres == VK_INCOMPLETE, "Failed to get swapchain images");
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (u32 i = 0; i < sc.imageCount; i++) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = sc.images[i];
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = sc.format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VK_MUST(vkCreateImageView(g_device, &viewInfo, g_allocCallbacks, &sc.imageViews[i]), "Failed to create image view");
+
+        VK_MUST(vkCreateSemaphore(g_device, &semaphoreInfo, g_allocCallbacks, &sc.renderFinished[i]));
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = g_renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &sc.imageViews[i];
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+        VK_MUST(vkCreateFramebuffer(g_device, &framebufferInfo, g_allocCallbacks, &sc.framebuffers[i]));
+    }
+
+    g_swapchain = sc;
+
+    logInfoTagged(RENDERER_TAG, "Created swapchain: {}x{}, images={}, present mode={}",
+                  extent.width, extent.height, sc.imageCount,
+                  presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? "mailbox" : "fifo");
+
+    return Error::OK;
+}
+
+void recreateSwapchain() {
+    g_swapchainDirty = false;
+
+    Swapchain old = g_swapchain;
+    g_swapchain = {};
+
+    if (old.handle != VK_NULL_HANDLE) {
+        if (g_retiredSwapchainCount == MAX_RETIRED_SWAPCHAINS) {
+            // Resizing faster than frames complete. Fall back to waiting, this is the only path that stalls.
+            VkFence fences[MAX_FRAMES_IN_FLIGHT];
+            for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) fences[i] = g_frames[i].inFlight;
+            VK_MUST(vkWaitForFences(g_device, MAX_FRAMES_IN_FLIGHT, fences, VK_TRUE, UINT64_MAX));
+            destroyRetiredSwapchains(true);
+        }
+        g_retiredSwapchains[g_retiredSwapchainCount++] = { old, g_frameNumber };
+    }
+
+    if (Error err = createSwapchain(old.handle); err != Error::OK) {
+        logErrTagged(RENDERER_TAG, "Failed to recreate swapchain: {}", errToCStr(err));
+        g_swapchainDirty = true;
+    }
+}
+
+void destroySwapchain(Swapchain& sc) {
+    for (u32 i = 0; i < sc.imageCount; i++) {
+        vkDestroyFramebuffer(g_device, sc.framebuffers[i], g_allocCallbacks);
+        vkDestroyImageView(g_device, sc.imageViews[i], g_allocCallbacks);
+        vkDestroySemaphore(g_device, sc.renderFinished[i], g_allocCallbacks);
+    }
+    if (sc.handle != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(g_device, sc.handle, g_allocCallbacks);
+    }
+    sc = {};
+}
+
+void destroyRetiredSwapchains(bool force) {
+    // Fences signal in submission order, so once the frame MAX_FRAMES_IN_FLIGHT after the retirement has been waited
+    // on, nothing in flight can reference the old swapchain anymore.
+    u32 i = 0;
+    while (i < g_retiredSwapchainCount) {
+        RetiredSwapchain& r = g_retiredSwapchains[i];
+        if (force || g_frameNumber >= r.retiredAtFrame + MAX_FRAMES_IN_FLIGHT) {
+            destroySwapchain(r.swapchain);
+            g_retiredSwapchains[i] = g_retiredSwapchains[--g_retiredSwapchainCount];
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+void createFrameData() {
+    for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        FrameData& frame = g_frames[i];
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = g_gpu.graphicsQueueFamily;
+        VK_MUST(vkCreateCommandPool(g_device, &poolInfo, g_allocCallbacks, &frame.cmdPool));
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.cmdPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VK_MUST(vkAllocateCommandBuffers(g_device, &allocInfo, &frame.cmd));
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VK_MUST(vkCreateSemaphore(g_device, &semaphoreInfo, g_allocCallbacks, &frame.imageAvailable));
+
+        // Created signaled so the very first wait in drawFrame does not block.
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        VK_MUST(vkCreateFence(g_device, &fenceInfo, g_allocCallbacks, &frame.inFlight));
+    }
+}
+
+void destroyFrameData() {
+    for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        FrameData& frame = g_frames[i];
+        vkDestroyFence(g_device, frame.inFlight, g_allocCallbacks);
+        vkDestroySemaphore(g_device, frame.imageAvailable, g_allocCallbacks);
+        vkDestroyCommandPool(g_device, frame.cmdPool, g_allocCallbacks); // frees the command buffer too
+        frame = {};
+    }
+}
+
+Error createRenderPass(VkFormat format) {
+    VkAttachmentDescription color{};
+    color.format = format;
+    color.samples = VK_SAMPLE_COUNT_1_BIT;
+    color.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    color.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    color.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    color.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentReference colorRef{};
+    colorRef.attachment = 0;
+    colorRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorRef;
+
+    // The layout transition has to wait for the image to be acquired. The acquire semaphore is waited on at the color
+    // output stage, so chain the external dependency to the same stage.
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &color;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+
+    if (vkCreateRenderPass(g_device, &renderPassInfo, g_allocCallbacks, &g_renderPass) != VK_SUCCESS) {
+        return Error::FAILED_TO_CREATE_VK_SWAPCHAIN;
+    }
+    g_renderPassFormat = format;
+    return Error::OK;
+}
+
+PipelineCacheFileHeader currentPipelineCacheHeader() {
+    PipelineCacheFileHeader h = {};
+    core::memcopy(h.magic, PIPELINE_CACHE_MAGIC, sizeof(h.magic));
+    h.version = PIPELINE_CACHE_FILE_VERSION;
+    h.vendorID = g_gpu.props.vendorID;
+    h.deviceID = g_gpu.props.deviceID;
+    h.driverVersion = g_gpu.props.driverVersion;
+    core::memcopy(h.pipelineCacheUUID, g_gpu.props.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // VkPhysicalDeviceIDProperties is core in 1.1. Older devices keep an all-zero driver UUID.
+    if (g_gpu.props.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceIDProperties idProps{};
+        idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2{};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props2.pNext = &idProps;
+        vkGetPhysicalDeviceProperties2(g_gpu.handle, &props2);
+        core::memcopy(h.driverUUID, idProps.driverUUID, VK_UUID_SIZE);
+    }
+
+    return h;
+}
+
+bool buildPipelineCachePath() {
+    addr_size len = 0;
+    if (!Platform::getCacheDirectory(g_pipelineCachePath, PIPELINE_CACHE_PATH_MAX)) {
+        // No XDG cache dir (e.g. HOME unset on a build box), keep it next to the build assets.
+        len = core::cstrLen(MEMVIZ_ASSETS);
+        if (len + 1 >= PIPELINE_CACHE_PATH_MAX) return false;
+        core::memcopy(g_pipelineCachePath, MEMVIZ_ASSETS, len);
+        g_pipelineCachePath[len] = '\0';
+    }
+
+    len = core::cstrLen(g_pipelineCachePath);
+    addr_size nameLen = core::cstrLen(PIPELINE_CACHE_FILE_NAME);
+    if (len + 1 + nameLen + 1 >= PIPELINE_CACHE_PATH_MAX) return false;
+    g_pipelineCachePath[len++] = '/';
+    core::memcopy(g_pipelineCachePath + len, PIPELINE_CACHE_FILE_NAME, nameLen);
+    g_pipelineCachePath[len + nameLen] = '\0';
+    return true;
+}
+
+bool loadPipelineCacheBlob(void*& outData, addr_size& outSize) {
+    outData = nullptr;
+    outSize = 0;
+
+    FILE* f = fopen(g_pipelineCachePath, "rb");
+    if (!f) return false;
+    defer { fclose(f); };
+
+    PipelineCacheFileHeader fileHeader;
+    if (fread(&fileHeader, sizeof(fileHeader), 1, f) != 1) {
+        logWarnTagged(RENDERER_TAG, "Pipeline cache '{}' is truncated, ignoring it", g_pipelineCachePath);
+        return false;
+    }
+
+    PipelineCacheFileHeader expected = currentPipelineCacheHeader();
+    expected.dataSize = fileHeader.dataSize;
+    if (core::memcmp(&fileHeader, &expected, sizeof(expected)) != 0) {
+        logInfoTagged(RENDERER_TAG, "Pipeline cache '{}' was written by another device or driver, ignoring it",
+                      g_pipelineCachePath);
+        return false;
+    }
+
+    // The driver's own header: u32 headerSize, u32 headerVersion, u32 vendorID, u32 deviceID, u8 uuid[VK_UUID_SIZE].
+    constexpr addr_size VK_CACHE_HEADER_SIZE = 16 + VK_UUID_SIZE;
+    if (fileHeader.dataSize < VK_CACHE_HEADER_SIZE) return false;
+
+    void* data = malloc(fileHeader.dataSize);
+    if (!data) return false;
+    if (fread(data, 1, fileHeader.dataSize, f) != fileHeader.dataSize) {
+        logWarnTagged(RENDERER_TAG, "Pipeline cache '{}' is truncated, ignoring it", g_pipelineCachePath);
+        free(data);
+        return false;
+    }
+
+    const u32* vkHeader = reinterpret_cast<const u32*>(data);
+    bool valid = vkHeader[0] >= VK_CACHE_HEADER_SIZE &&
+                 vkHeader[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                 vkHeader[2] == g_gpu.props.vendorID &&
+                 vkHeader[3] == g_gpu.props.deviceID &&
+                 core::memcmp(vkHeader + 4, g_gpu.props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if (!valid) {
+        logWarnTagged(RENDERER_TAG, "Pipeline cache '{}' has an invalid driver header, ignoring it",
+                      g_pipelineCachePath);
+        free(data);
+        return false;
+    }
+
+    outData = data;
+    outSize = fileHeader.dataSize;
+    return true;
+}
+
+void createPipelineCache() {
+    void* initialData = nullptr;
+    addr_size initialSize = 0;
+
+    if (buildPipelineCachePath()) {
+        loadPipelineCacheBlob(initialData, initialSize);
+    }
+    else {
+        logWarnTagged(RENDERER_TAG, "No usable pipeline cache path, pipelines will be compiled from scratch");
+        g_pipelineCachePath[0] = '\0';
+    }
+    defer { free(initialData); };
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = initialSize;
+    cacheInfo.pInitialData = initialData;
+
+    VkResult vres = vkCreatePipelineCache(g_device, &cacheInfo, g_allocCallbacks, &g_pipelineCache);
+    if (vres != VK_SUCCESS && initialData) {
+        // Some drivers reject data they do not like instead of ignoring it. Start empty rather than fail.
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        initialSize = 0;
+        vres = vkCreatePipelineCache(g_device, &cacheInfo, g_allocCallbacks, &g_pipelineCache);
+    }
+    VK_MUST(vres, "Failed to create pipeline cache");
+
+    startupTimingSetNote(StartupStage::RENDERER_PIPELINE_WARMUP, initialSize > 0 ? "(warm cache)" : "(cold cache)");
+    logInfoTagged(RENDERER_TAG, "Pipeline cache: {} bytes loaded from '{}'", initialSize, g_pipelineCachePath);
+}
+
+void savePipelineCache() {
+    if (g_pipelineCache == VK_NULL_HANDLE || g_pipelineCachePath[0] == '\0') return;
+
+    addr_size dataSize = 0;
+    if (vkGetPipelineCacheData(g_device, g_pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) return;
+
+    void* data = malloc(dataSize);
+    if (!data) return;
+    defer { free(data); };
+    if (vkGetPipelineCacheData(g_device, g_pipelineCache, &dataSize, data) != VK_SUCCESS) return;
+
+    PipelineCacheFileHeader header = currentPipelineCacheHeader();
+    header.dataSize = dataSize;
+
+    // Write next to the destination and rename over it. rename is atomic within a filesystem, so a crash mid-write
+    // leaves either the old cache or the new one, never a torn file.
+    char tmpPath[PIPELINE_CACHE_PATH_MAX + 4];
+    addr_size len = core::cstrLen(g_pipelineCachePath);
+    core::memcopy(tmpPath, g_pipelineCachePath, len);
+    core::memcopy(tmpPath + len, ".tmp", 5);
+
+    FILE* f = fopen(tmpPath, "wb");
+    if (!f) {
+        logWarnTagged(RENDERER_TAG, "Failed to open '{}' for writing the pipeline cache", tmpPath);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(data, 1, dataSize, f) == dataSize;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmpPath, g_pipelineCachePath) != 0) {
+        logWarnTagged(RENDERER_TAG, "Failed to write pipeline cache '{}'", g_pipelineCachePath);
+        remove(tmpPath);
+        return;
+    }
+
+    logInfoTagged(RENDERER_TAG, "Pipeline cache: {} bytes saved to '{}'", dataSize, g_pipelineCachePath);
+}
+
 [[nodiscard]] VkDebugUtilsMessengerEXT vulkanCreateDebugMessenger(VkInstance instance) {
     VkDebugUtilsMessengerCreateInfoEXT debugMessengerCreateInfo = defaultDebugMessengerInfo();
     VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
     VkResult vres = wrap_vkCreateDebugUtilsMessengerEXT(instance,
                                                         &debugMessengerCreateInfo,
-                                                        nullptr,
+                                                        g_allocCallbacks,
                                                         &debugMessenger);
     VK_MUST(vres, "Failed to Create Vulkan Debug Messenger");
     return debugMessenger;
@@ -259,6 +1349,7 @@ bool checkSupportForInstLayer(const char* name) {
         [[maybe_unused]] void* pUserData
     ) -> VkBool32 {
         static constexpr addr_size DEBUG_MESSAGE_BUFFER_SIZE = 1024;
+        static constexpr u32 VALIDATION_LOGS_PER_SECOND = 20;
         char buffer[DEBUG_MESSAGE_BUFFER_SIZE];
         char* ptr = buffer;
 
@@ -279,18 +1370,20 @@ bool checkSupportForInstLayer(const char* name) {
         // Null-terminate the buffer
         *ptr = '\0';
 
-        // Log the message with the appropriate logger
+        // Log the message with the appropriate logger. Deferred, the callback runs inside the driver on the
+        // render thread. The buffer is copied into the record. Validation tends to repeat the same message every
+        // frame, so each severity is rate limited.
         if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-            logErrTagged(RENDERER_VALIDATION_TAG, buffer);
+            logErrTaggedLimited(VALIDATION_LOGS_PER_SECOND, RENDERER_VALIDATION_TAG, "{}", buffer);
         }
         else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-            logWarnTagged(RENDERER_VALIDATION_TAG, buffer);
+            logWarnTaggedLimited(VALIDATION_LOGS_PER_SECOND, RENDERER_VALIDATION_TAG, "{}", buffer);
         }
         else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
-            logInfoTagged(RENDERER_VALIDATION_TAG, buffer);
+            logInfoTaggedLimited(VALIDATION_LOGS_PER_SECOND, RENDERER_VALIDATION_TAG, "{}", buffer);
         }
         else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT) {
-            logDebugTagged(RENDERER_VALIDATION_TAG, buffer);
+            logDebugTaggedLimited(VALIDATION_LOGS_PER_SECOND, RENDERER_VALIDATION_TAG, "{}", buffer);
         }
 
         return VK_FALSE;
@@ -364,6 +1457,13 @@ void getVulkanVersion(char out[VERSION_BUFFER_SIZE]) {
 
 Error (*Renderer::init)(Renderer::CrateInfo&&) = vulkanInit;
 void (*Renderer::shutdown)(void) = vulkanShutdown;
+void (*Renderer::drawFrame)(void) = vulkanDrawFrame;
+void (*Renderer::resizeTarget)(i32, i32) = vulkanResizeTarget;
+void (*Renderer::setBlockLayer)(u32, const BlockLayerDesc&) = vulkanSetBlockLayer;
+u32 (*Renderer::uploadBlocks)(u32, u32, const BlockInstance*, u32) = vulkanUploadBlocks;
+void (*Renderer::setBlockCount)(u32, u32) = vulkanSetBlockCount;
+void (*Renderer::setBlockView)(const BlockView&) = vulkanSetBlockView;
+void (*Renderer::setBlockDrawMode)(BlockDrawMode) = vulkanSetBlockDrawMode;
 
 } // memviz
 
@@ -0,0 +1,504 @@
+#include "systems/renderer/vulkan_blocks.h"
+
+#include "basic.h"
+#include "systems/logger.h"
+#include "systems/renderer/vulkan_device_memory.h"
+
+// Generated at build time from shaders/, see memviz_shaders in CMakeLists.txt.
+#include "shaders/blocks_frag_spv.h"
+#include "shaders/blocks_vert_spv.h"
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 MAX_FRAME_SLOTS = 4;
+// Per frame share of the upload ring. At 12 bytes per instance that is ~1.4M instances per frame, so a full 10M block
+// snapshot streams in within a handful of frames without stalling any of them.
+constexpr VkDeviceSize RING_BYTES_PER_FRAME = VkDeviceSize(16) * 1024 * 1024;
+constexpr u32 MAX_PENDING_COPIES = 256;
+constexpr u32 VERTICES_PER_BLOCK = 6;
+
+constexpr u32 BLOCK_LAYOUT_COUNT = u32(BlockLayout::SENTINEL);
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN BLOCKS STATE -------------------------------------------------------
+
+// Must match the push constant block in shaders/blocks.vert.
+struct BlockPushConstants {
+    u32 viewStart;
+    u32 granulesPerRow;
+    u32 rowCount;
+    u32 layer;
+    f32 minWidthNdc;
+};
+
+struct BlockLayer {
+    BlockLayerDesc desc;
+    VkBuffer buffer;
+    DeviceAllocation memory;
+    u32 count;
+};
+
+struct PendingCopy {
+    u32 layer;
+    VkBufferCopy region;
+};
+
+struct FrameSlot {
+    VkDeviceSize cursor;
+    PendingCopy copies[MAX_PENDING_COPIES];
+    u32 copyCount;
+};
+
+VkDevice g_device = VK_NULL_HANDLE;
+const VkAllocationCallbacks* g_allocCallbacks = nullptr;
+u32 g_framesInFlight = 0;
+
+VkPipelineLayout g_pipelineLayout = VK_NULL_HANDLE;
+// One pipeline per BlockLayout, specialized from the same shaders.
+VkPipeline g_pipelines[BLOCK_LAYOUT_COUNT] = {};
+
+VkBuffer g_ringBuffer = VK_NULL_HANDLE;
+DeviceAllocation g_ringMemory = {};
+VkBuffer g_indirectBuffer = VK_NULL_HANDLE;
+DeviceAllocation g_indirectMemory = {};
+
+BlockLayer g_layers[MAX_BLOCK_LAYERS] = {};
+FrameSlot g_slots[MAX_FRAME_SLOTS] = {};
+BlockView g_view = {};
+
+bool g_initialized = false;
+
+// ------------------------------------------ END BLOCKS STATE ---------------------------------------------------------
+
+bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                  VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                  VkBuffer& outBuffer, DeviceAllocation& outMemory) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(g_device, &bufferInfo, g_allocCallbacks, &outBuffer) != VK_SUCCESS) {
+        logErrTagged(RENDERER_TAG, "Failed to create a buffer of {}KiB", size / 1024);
+        return false;
+    }
+
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(g_device, outBuffer, &reqs);
+    if (!deviceMemoryAlloc(reqs, required, preferred, DeviceMemoryUsage::LONG_LIVED, outMemory)) {
+        vkDestroyBuffer(g_device, outBuffer, g_allocCallbacks);
+        outBuffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VK_MUST(vkBindBufferMemory(g_device, outBuffer, outMemory.memory, outMemory.offset));
+    return true;
+}
+
+void destroyBuffer(VkBuffer& buffer, DeviceAllocation& memory) {
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(g_device, buffer, g_allocCallbacks);
+        buffer = VK_NULL_HANDLE;
+    }
+    if (memory.memory != VK_NULL_HANDLE) {
+        deviceMemoryFree(memory);
+    }
+}
+
+VkShaderModule createShaderModule(const u32* code, addr_size size) {
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = size;
+    moduleInfo.pCode = code;
+
+    VkShaderModule module = VK_NULL_HANDLE;
+    VK_MUST(vkCreateShaderModule(g_device, &moduleInfo, g_allocCallbacks, &module));
+    return module;
+}
+
+bool createPipeline(VkRenderPass renderPass, VkPipelineCache pipelineCache) {
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(BlockPushConstants);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    VK_MUST(vkCreatePipelineLayout(g_device, &layoutInfo, g_allocCallbacks, &g_pipelineLayout));
+
+    VkShaderModule vert = createShaderModule(shaders::BLOCKS_VERT_SPV, sizeof(shaders::BLOCKS_VERT_SPV));
+    VkShaderModule frag = createShaderModule(shaders::BLOCKS_FRAG_SPV, sizeof(shaders::BLOCKS_FRAG_SPV));
+    defer {
+        vkDestroyShaderModule(g_device, vert, g_allocCallbacks);
+        vkDestroyShaderModule(g_device, frag, g_allocCallbacks);
+    };
+
+    VkPipelineShaderStageCreateInfo stages[2] = {};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vert;
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = frag;
+    stages[1].pName = "main";
+
+    // The instance is the only vertex input. Corners come from gl_VertexIndex.
+    VkVertexInputBindingDescription binding{};
+    binding.binding = 0;
+    binding.stride = sizeof(BlockInstance);
+    binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    VkVertexInputAttributeDescription attribute{};
+    attribute.location = 0;
+    attribute.binding = 0;
+    attribute.format = VK_FORMAT_R32G32B32_UINT;
+    attribute.offset = 0;
+
+    VkPipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInput.vertexBindingDescriptionCount = 1;
+    vertexInput.pVertexBindingDescriptions = &binding;
+    vertexInput.vertexAttributeDescriptionCount = 1;
+    vertexInput.pVertexAttributeDescriptions = &attribute;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo raster{};
+    raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    raster.polygonMode = VK_POLYGON_MODE_FILL;
+    raster.cullMode = VK_CULL_MODE_NONE;
+    raster.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    raster.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisample{};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                     VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo blend{};
+    blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blendAttachment;
+
+    // Viewport and scissor are dynamic so a resize never rebuilds the pipeline.
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = u32(CORE_C_ARRLEN(dynamicStates));
+    dynamicState.pDynamicStates = dynamicStates;
+
+    // BLOCK_LAYOUT (constant_id 0 in blocks.vert) is the only difference between the variants.
+    VkSpecializationMapEntry layoutEntry{};
+    layoutEntry.constantID = 0;
+    layoutEntry.offset = 0;
+    layoutEntry.size = sizeof(u32);
+
+    u32 layoutValues[BLOCK_LAYOUT_COUNT];
+    VkSpecializationInfo specInfos[BLOCK_LAYOUT_COUNT] = {};
+    VkPipelineShaderStageCreateInfo variantStages[BLOCK_LAYOUT_COUNT][2] = {};
+    VkGraphicsPipelineCreateInfo pipelineInfos[BLOCK_LAYOUT_COUNT] = {};
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &raster;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pColorBlendState = &blend;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = g_pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+
+    for (u32 i = 0; i < BLOCK_LAYOUT_COUNT; i++) {
+        layoutValues[i] = i;
+        specInfos[i].mapEntryCount = 1;
+        specInfos[i].pMapEntries = &layoutEntry;
+        specInfos[i].dataSize = sizeof(u32);
+        specInfos[i].pData = &layoutValues[i];
+
+        variantStages[i][0] = stages[0];
+        variantStages[i][0].pSpecializationInfo = &specInfos[i];
+        variantStages[i][1] = stages[1];
+
+        pipelineInfos[i] = pipelineInfo;
+        pipelineInfos[i].pStages = variantStages[i];
+    }
+
+    VK_MUST(vkCreateGraphicsPipelines(g_device, pipelineCache, BLOCK_LAYOUT_COUNT, pipelineInfos, g_allocCallbacks,
+                                      g_pipelines),
+            "Failed to create the blocks pipelines");
+    return true;
+}
+
+inline VkDeviceSize ringSlotStart(u32 frameSlot) {
+    return RING_BYTES_PER_FRAME * frameSlot;
+}
+
+inline VkDeviceSize indirectSlotOffset(u32 frameSlot, u32 layer) {
+    return VkDeviceSize(frameSlot * MAX_BLOCK_LAYERS + layer) * sizeof(VkDrawIndirectCommand);
+}
+
+} // namespace
+
+bool vulkanBlocksInit(const VulkanBlocksCreateInfo& info) {
+    Assert(!g_initialized, "Blocks renderer initialized twice");
+    Assert(info.framesInFlight > 0 && info.framesInFlight <= MAX_FRAME_SLOTS);
+
+    g_device = info.device;
+    g_allocCallbacks = info.allocCallbacks;
+    g_framesInFlight = info.framesInFlight;
+
+    if (!createPipeline(info.renderPass, info.pipelineCache)) {
+        return false;
+    }
+
+    // Both are written by the CPU every frame. Coherent memory saves explicit flushes of the mapped ranges.
+    constexpr VkMemoryPropertyFlags HOST_WRITE = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!createBuffer(RING_BYTES_PER_FRAME * g_framesInFlight, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                      HOST_WRITE, 0, g_ringBuffer, g_ringMemory)) {
+        return false;
+    }
+    if (!createBuffer(VkDeviceSize(g_framesInFlight) * MAX_BLOCK_LAYERS * sizeof(VkDrawIndirectCommand),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, HOST_WRITE, 0, g_indirectBuffer, g_indirectMemory)) {
+        return false;
+    }
+
+    g_view.baseAddress = 0;
+    g_view.bytesPerRow = 1;
+    g_view.rowCount = 1;
+    g_view.layout = BlockLayout::ROWS;
+
+    g_initialized = true;
+    return true;
+}
+
+void vulkanBlocksShutdown() {
+    if (g_device == VK_NULL_HANDLE) return;
+
+    for (u32 i = 0; i < MAX_BLOCK_LAYERS; i++) {
+        destroyBuffer(g_layers[i].buffer, g_layers[i].memory);
+        g_layers[i] = {};
+    }
+    destroyBuffer(g_indirectBuffer, g_indirectMemory);
+    destroyBuffer(g_ringBuffer, g_ringMemory);
+
+    for (u32 i = 0; i < BLOCK_LAYOUT_COUNT; i++) {
+        if (g_pipelines[i] != VK_NULL_HANDLE) {
+            vkDestroyPipeline(g_device, g_pipelines[i], g_allocCallbacks);
+            g_pipelines[i] = VK_NULL_HANDLE;
+        }
+    }
+    if (g_pipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(g_device, g_pipelineLayout, g_allocCallbacks);
+        g_pipelineLayout = VK_NULL_HANDLE;
+    }
+
+    g_device = VK_NULL_HANDLE;
+    g_initialized = false;
+}
+
+void vulkanBlocksSetLayer(u32 layer, const BlockLayerDesc& desc) {
+    Assert(g_initialized);
+    Assert(layer < MAX_BLOCK_LAYERS, "Block layer out of range");
+    BlockLayer& l = g_layers[layer];
+
+    if (desc.capacity != l.desc.capacity) {
+        // Earlier frames may still read the old buffer. Capacity changes are rare, so waiting is simpler than
+        // retiring the buffer.
+        VK_MUST(vkDeviceWaitIdle(g_device));
+        destroyBuffer(l.buffer, l.memory);
+        l.count = 0;
+
+        for (u32 s = 0; s < g_framesInFlight; s++) {
+            FrameSlot& slot = g_slots[s];
+            u32 kept = 0;
+            for (u32 i = 0; i < slot.copyCount; i++) {
+                if (slot.copies[i].layer != layer) slot.copies[kept++] = slot.copies[i];
+            }
+            slot.copyCount = kept;
+        }
+
+        if (desc.capacity > 0) {
+            VkDeviceSize size = VkDeviceSize(desc.capacity) * sizeof(BlockInstance);
+            bool ok = createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                   0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, l.buffer, l.memory);
+            if (!ok) {
+                logErrTagged(RENDERER_TAG, "Failed to allocate block layer {} with capacity {}", layer, desc.capacity);
+                l.desc = {};
+                return;
+            }
+        }
+    }
+
+    l.desc = desc;
+}
+
+void vulkanBlocksSetCount(u32 layer, u32 count) {
+    Assert(layer < MAX_BLOCK_LAYERS, "Block layer out of range");
+    BlockLayer& l = g_layers[layer];
+    l.count = count < l.desc.capacity ? count : l.desc.capacity;
+}
+
+void vulkanBlocksSetView(const BlockView& view) {
+    g_view = view;
+    if (g_view.bytesPerRow == 0) g_view.bytesPerRow = 1;
+    if (g_view.rowCount == 0) g_view.rowCount = 1;
+    if (g_view.layout >= BlockLayout::SENTINEL) g_view.layout = BlockLayout::ROWS;
+}
+
+void vulkanBlocksResetSlot(u32 frameSlot) {
+    Assert(frameSlot < g_framesInFlight);
+    g_slots[frameSlot].cursor = 0;
+    g_slots[frameSlot].copyCount = 0;
+}
+
+u32 vulkanBlocksUpload(u32 frameSlot, u32 layer, u32 first, const BlockInstance* blocks, u32 count) {
+    Assert(g_initialized);
+    Assert(layer < MAX_BLOCK_LAYERS, "Block layer out of range");
+    Assert(frameSlot < g_framesInFlight);
+
+    BlockLayer& l = g_layers[layer];
+    if (l.buffer == VK_NULL_HANDLE || first >= l.desc.capacity) return 0;
+    if (count > l.desc.capacity - first) count = l.desc.capacity - first;
+
+    FrameSlot& slot = g_slots[frameSlot];
+    VkDeviceSize available = (RING_BYTES_PER_FRAME - slot.cursor) / sizeof(BlockInstance);
+    if (u64(count) > available) count = u32(available);
+    if (count == 0) return 0;
+
+    VkDeviceSize srcOffset = ringSlotStart(frameSlot) + slot.cursor;
+    VkDeviceSize dstOffset = VkDeviceSize(first) * sizeof(BlockInstance);
+    VkDeviceSize size = VkDeviceSize(count) * sizeof(BlockInstance);
+
+    // Consecutive uploads to the same layer usually continue where the previous one ended, so they share a region.
+    PendingCopy* last = slot.copyCount > 0 ? &slot.copies[slot.copyCount - 1] : nullptr;
+    if (last && last->layer == layer &&
+        last->region.srcOffset + last->region.size == srcOffset &&
+        last->region.dstOffset + last->region.size == dstOffset) {
+        last->region.size += size;
+    }
+    else {
+        if (slot.copyCount >= MAX_PENDING_COPIES) return 0;
+        PendingCopy& c = slot.copies[slot.copyCount++];
+        c.layer = layer;
+        c.region.srcOffset = srcOffset;
+        c.region.dstOffset = dstOffset;
+        c.region.size = size;
+    }
+
+    core::memcopy(reinterpret_cast<u8*>(g_ringMemory.mapped) + srcOffset, blocks, size);
+    slot.cursor += size;
+    return count;
+}
+
+void vulkanBlocksRecordUploads(VkCommandBuffer cmd, u32 frameSlot) {
+    FrameSlot& slot = g_slots[frameSlot];
+    if (slot.copyCount == 0) return;
+
+    // Earlier frames may still fetch instances from the layer buffers. Instance data is never read after being
+    // overwritten in the same frame, so an execution dependency is enough for the write-after-read.
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy regions[MAX_PENDING_COPIES];
+    for (u32 layer = 0; layer < MAX_BLOCK_LAYERS; layer++) {
+        u32 regionCount = 0;
+        for (u32 i = 0; i < slot.copyCount; i++) {
+            if (slot.copies[i].layer == layer) regions[regionCount++] = slot.copies[i].region;
+        }
+        if (regionCount == 0 || g_layers[layer].buffer == VK_NULL_HANDLE) continue;
+        vkCmdCopyBuffer(cmd, g_ringBuffer, g_layers[layer].buffer, regionCount, regions);
+    }
+
+    VkMemoryBarrier toVertex{};
+    toVertex.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toVertex.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toVertex.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                         1, &toVertex, 0, nullptr, 0, nullptr);
+
+    // The ring region stays reserved until the slot is reset after its fence. Only the copy list is consumed.
+    slot.copyCount = 0;
+}
+
+void vulkanBlocksRecordDraw(VkCommandBuffer cmd, u32 frameSlot, VkExtent2D extent) {
+    VkViewport viewport{};
+    viewport.width = f32(extent.width);
+    viewport.height = f32(extent.height);
+    viewport.maxDepth = 1.0f;
+    VkRect2D scissor{};
+    scissor.extent = extent;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipelines[u32(g_view.layout)]);
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    auto* indirect = reinterpret_cast<VkDrawIndirectCommand*>(
+        reinterpret_cast<u8*>(g_indirectMemory.mapped) + indirectSlotOffset(frameSlot, 0));
+
+    for (u32 layer = 0; layer < MAX_BLOCK_LAYERS; layer++) {
+        const BlockLayer& l = g_layers[layer];
+        if (l.buffer == VK_NULL_HANDLE || l.count == 0) continue;
+
+        // The view is in bytes, the instances in layer granules.
+        u64 viewStartBytes = g_view.baseAddress > l.desc.baseAddress ? g_view.baseAddress - l.desc.baseAddress : 0;
+        u64 viewStart = viewStartBytes >> l.desc.granuleShift;
+        u64 granulesPerRow = g_view.bytesPerRow >> l.desc.granuleShift;
+        if (viewStart > UINT32_MAX) continue; // the whole layer is before the view
+        if (granulesPerRow == 0) granulesPerRow = 1;
+        if (granulesPerRow > UINT32_MAX) granulesPerRow = UINT32_MAX;
+
+        BlockPushConstants pc = {};
+        pc.viewStart = u32(viewStart);
+        pc.granulesPerRow = u32(granulesPerRow);
+        pc.rowCount = g_view.rowCount;
+        pc.layer = layer;
+        pc.minWidthNdc = extent.width > 0 ? 2.0f / f32(extent.width) : 0.0f;
+        vkCmdPushConstants(cmd, g_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pc), &pc);
+
+        // Written by the CPU today. The indirect form lets a GPU culling pass take over the counts later without
+        // touching the draw recording.
+        VkDrawIndirectCommand& draw = indirect[layer];
+        draw.vertexCount = VERTICES_PER_BLOCK;
+        draw.instanceCount = l.count;
+        draw.firstVertex = 0;
+        draw.firstInstance = 0;
+
+        VkDeviceSize vbOffset = 0;
+        vkCmdBindVertexBuffers(cmd, 0, 1, &l.buffer, &vbOffset);
+        vkCmdDrawIndirect(cmd, g_indirectBuffer, indirectSlotOffset(frameSlot, layer),
+                          1, sizeof(VkDrawIndirectCommand));
+    }
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
@@ -0,0 +1,884 @@
+#include "systems/renderer/vulkan_device_memory.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+
+#include <stdio.h>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = VkDeviceSize(64) * 1024 * 1024;
+// Blocks are halved down to this size when the heap budget can not fit a full block.
+constexpr VkDeviceSize MIN_BLOCK_SIZE = VkDeviceSize(4) * 1024 * 1024;
+constexpr VkDeviceSize DEFAULT_TRANSIENT_BYTES_PER_FRAME = VkDeviceSize(8) * 1024 * 1024;
+// Smallest buddy node. Smaller requests waste the difference, which is fine for buffers and images.
+constexpr VkDeviceSize BUDDY_MIN_NODE_SIZE = 256;
+
+constexpr u32 MAX_MEMORY_BLOCKS = 512;
+constexpr u32 MAX_BUDDY_LEVELS = 40;
+constexpr u32 MAX_TRANSIENT_FRAMES = 4;
+constexpr u32 INITIAL_RECORD_CAP = 256;
+constexpr u32 INVALID_INDEX = UINT32_MAX;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN DEVICE MEMORY STATE ------------------------------------------------
+
+enum struct BlockKind : u8 {
+    NONE,
+    BUDDY,
+    DEDICATED,
+    TRANSIENT,
+};
+
+// Free nodes of every level are kept in one bitmap. Level 0 is the whole block, level L has 2^L nodes of
+// blockSize >> L bytes, and node i of level L is bit (2^L - 1 + i). A node is either free (bit set), split, or in use.
+struct BuddyState {
+    u32 levelCount;
+    u64* freeBits;
+    addr_size freeBitsWordCount;
+    u32 freeCount[MAX_BUDDY_LEVELS];
+};
+
+struct MemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    u8* mapped;
+    u32 memoryTypeIndex;
+    BlockKind kind;
+    VkDeviceSize usedBytes;
+    u32 liveAllocs;
+    BuddyState buddy;
+    VkDeviceSize frameCursor[MAX_TRANSIENT_FRAMES]; // TRANSIENT only, relative to the start of the frame's region.
+};
+
+struct AllocRecord {
+    u32 blockIndex;
+    u32 nodeIndex;
+    u32 level;
+    VkDeviceSize size;      // Requested size.
+    DeviceMemoryUsage usage;
+    bool live;
+    bool moving;
+    u32 moveBlockIndex;     // Destination reserved by deviceMemoryDefragBegin.
+    u32 moveNodeIndex;
+    u32 moveLevel;
+    u32 nextFree;
+};
+
+VkPhysicalDevice g_gpu = VK_NULL_HANDLE;
+VkDevice g_device = VK_NULL_HANDLE;
+const VkAllocationCallbacks* g_allocCallbacks = nullptr;
+bool g_memoryBudgetSupported = false;
+
+VkPhysicalDeviceMemoryProperties g_memProps = {};
+VkDeviceSize g_bufferImageGranularity = 1;
+VkDeviceSize g_blockSize = DEFAULT_BLOCK_SIZE;
+VkDeviceSize g_transientBytesPerFrame = DEFAULT_TRANSIENT_BYTES_PER_FRAME;
+u32 g_framesInFlight = 0;
+u32 g_currentFrame = 0;
+
+MemoryBlock g_blocks[MAX_MEMORY_BLOCKS] = {};
+u32 g_blockCount = 0; // High-water mark of used slots, destroyed blocks leave holes.
+u32 g_transientBlock[VK_MAX_MEMORY_TYPES] = {};
+
+AllocRecord* g_records = nullptr;
+u32 g_recordCap = 0;
+u32 g_recordFreeHead = INVALID_INDEX;
+
+VkDeviceSize g_heapBudget[VK_MAX_MEMORY_HEAPS] = {};
+VkDeviceSize g_heapUsage[VK_MAX_MEMORY_HEAPS] = {};
+VkDeviceSize g_heapBlockBytes[VK_MAX_MEMORY_HEAPS] = {};
+VkDeviceSize g_heapUsedBytes[VK_MAX_MEMORY_HEAPS] = {};
+
+u64 g_failedAllocs = 0;
+u64 g_blocksCreated = 0;
+u64 g_dedicatedAllocs = 0;
+u64 g_bytesMoved = 0;
+
+bool g_initialized = false;
+
+// ------------------------------------------ END DEVICE MEMORY STATE --------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+constexpr VkDeviceSize nextPow2(VkDeviceSize v) {
+    VkDeviceSize p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+constexpr u32 log2Pow2(VkDeviceSize v) {
+    u32 ret = 0;
+    while (v > 1) { v >>= 1; ret++; }
+    return ret;
+}
+
+constexpr VkDeviceSize alignUp(VkDeviceSize v, VkDeviceSize alignment) {
+    return (v + alignment - 1) & ~(alignment - 1);
+}
+
+inline u32 heapOf(u32 memoryTypeIndex) {
+    return g_memProps.memoryTypes[memoryTypeIndex].heapIndex;
+}
+
+inline bool isHostVisible(u32 memoryTypeIndex) {
+    return (g_memProps.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+// ------------------------------------------ BEGIN BUDDY ALLOCATOR ----------------------------------------------------
+
+inline addr_size buddyBit(u32 level, u32 node) {
+    return (addr_size(1) << level) - 1 + node;
+}
+
+inline bool buddyIsFree(const BuddyState& b, u32 level, u32 node) {
+    addr_size bit = buddyBit(level, node);
+    return (b.freeBits[bit / 64] >> (bit % 64)) & 1;
+}
+
+inline void buddySetFree(BuddyState& b, u32 level, u32 node) {
+    addr_size bit = buddyBit(level, node);
+    b.freeBits[bit / 64] |= u64(1) << (bit % 64);
+    b.freeCount[level]++;
+}
+
+inline void buddyClearFree(BuddyState& b, u32 level, u32 node) {
+    addr_size bit = buddyBit(level, node);
+    b.freeBits[bit / 64] &= ~(u64(1) << (bit % 64));
+    b.freeCount[level]--;
+}
+
+// Index of the first free node on a level. The caller checked freeCount, so there is one.
+u32 buddyFindFree(const BuddyState& b, u32 level) {
+    addr_size first = buddyBit(level, 0);
+    addr_size last = first + (addr_size(1) << level); // exclusive
+
+    for (addr_size w = first / 64; w * 64 < last; w++) {
+        u64 word = b.freeBits[w];
+        if (w == first / 64) word &= ~u64(0) << (first % 64);
+        if (word == 0) continue;
+
+        addr_size bit = w * 64 + addr_size(__builtin_ctzll(word));
+        if (bit >= last) break;
+        return u32(bit - first);
+    }
+
+    Panic(false, "Buddy free count and bitmap are out of sync");
+    return INVALID_INDEX;
+}
+
+bool buddyInit(BuddyState& b, VkDeviceSize blockSize) {
+    b = {};
+    b.levelCount = log2Pow2(blockSize / BUDDY_MIN_NODE_SIZE) + 1;
+    Assert(b.levelCount <= MAX_BUDDY_LEVELS, "Block size is too large for the buddy allocator");
+
+    addr_size bitCount = addr_size(1) << b.levelCount;
+    b.freeBitsWordCount = (bitCount + 63) / 64;
+    b.freeBits = metaAlloc<u64>(b.freeBitsWordCount);
+    if (!b.freeBits) return false;
+
+    for (addr_size i = 0; i < b.freeBitsWordCount; i++) b.freeBits[i] = 0;
+    buddySetFree(b, 0, 0);
+    return true;
+}
+
+void buddyDestroy(BuddyState& b) {
+    metaFree(b.freeBits, b.freeBitsWordCount);
+    b = {};
+}
+
+bool buddyAlloc(BuddyState& b, u32 level, u32& outNode) {
+    // Smallest free node that is at least as large as the request.
+    i32 from = i32(level);
+    while (from >= 0 && b.freeCount[from] == 0) from--;
+    if (from < 0) return false;
+
+    u32 node = buddyFindFree(b, u32(from));
+    buddyClearFree(b, u32(from), node);
+
+    // Split down, keeping the left half and freeing the right one.
+    for (u32 l = u32(from); l < level; l++) {
+        node = node * 2;
+        buddySetFree(b, l + 1, node + 1);
+    }
+
+    outNode = node;
+    return true;
+}
+
+void buddyFree(BuddyState& b, u32 level, u32 node) {
+    while (level > 0) {
+        u32 buddy = node ^ 1;
+        if (!buddyIsFree(b, level, buddy)) break;
+        buddyClearFree(b, level, buddy);
+        node >>= 1;
+        level--;
+    }
+    buddySetFree(b, level, node);
+}
+
+VkDeviceSize buddyLargestFree(const BuddyState& b, VkDeviceSize blockSize) {
+    for (u32 l = 0; l < b.levelCount; l++) {
+        if (b.freeCount[l] > 0) return blockSize >> l;
+    }
+    return 0;
+}
+
+// ------------------------------------------ END BUDDY ALLOCATOR ------------------------------------------------------
+
+void refreshBudget() {
+    if (g_memoryBudgetSupported) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps{};
+        budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 props2{};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        props2.pNext = &budgetProps;
+        vkGetPhysicalDeviceMemoryProperties2(g_gpu, &props2);
+
+        for (u32 i = 0; i < g_memProps.memoryHeapCount; i++) {
+            g_heapBudget[i] = budgetProps.heapBudget[i];
+            g_heapUsage[i] = budgetProps.heapUsage[i];
+        }
+        return;
+    }
+
+    // Without the extension nothing is known about other processes. Leave headroom for the driver and the swapchain.
+    for (u32 i = 0; i < g_memProps.memoryHeapCount; i++) {
+        g_heapBudget[i] = g_memProps.memoryHeaps[i].size / 10 * 8;
+        g_heapUsage[i] = g_heapBlockBytes[i];
+    }
+}
+
+u32 createBlock(u32 memoryTypeIndex, VkDeviceSize size, BlockKind kind) {
+    u32 slot = INVALID_INDEX;
+    for (u32 i = 0; i < g_blockCount; i++) {
+        if (g_blocks[i].kind == BlockKind::NONE) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == INVALID_INDEX) {
+        if (g_blockCount >= MAX_MEMORY_BLOCKS) {
+            logErrTagged(RENDERER_TAG, "Out of device memory block slots ({})", MAX_MEMORY_BLOCKS);
+            return INVALID_INDEX;
+        }
+        slot = g_blockCount++;
+    }
+
+    u32 heap = heapOf(memoryTypeIndex);
+    refreshBudget();
+    if (g_heapUsage[heap] + size > g_heapBudget[heap]) {
+        logWarnTagged(RENDERER_TAG, "Device memory heap {} over budget: usage={}KiB, budget={}KiB, request={}KiB",
+                      heap, g_heapUsage[heap] / 1024, g_heapBudget[heap] / 1024, size / 1024);
+        return INVALID_INDEX;
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    MemoryBlock block = {};
+    VkResult vres = vkAllocateMemory(g_device, &allocInfo, g_allocCallbacks, &block.memory);
+    if (vres != VK_SUCCESS) {
+        logWarnTagged(RENDERER_TAG, "vkAllocateMemory of {}KiB from memory type {} failed with {}",
+                      size / 1024, memoryTypeIndex, i32(vres));
+        return INVALID_INDEX;
+    }
+
+    if (isHostVisible(memoryTypeIndex)) {
+        void* mapped = nullptr;
+        VK_MUST(vkMapMemory(g_device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped), "Failed to map device memory block");
+        block.mapped = reinterpret_cast<u8*>(mapped);
+    }
+
+    if (kind == BlockKind::BUDDY && !buddyInit(block.buddy, size)) {
+        vkFreeMemory(g_device, block.memory, g_allocCallbacks);
+        return INVALID_INDEX;
+    }
+
+    block.size = size;
+    block.memoryTypeIndex = memoryTypeIndex;
+    block.kind = kind;
+    g_blocks[slot] = block;
+
+    g_heapBlockBytes[heap] += size;
+    g_blocksCreated++;
+    return slot;
+}
+
+void destroyBlock(u32 blockIndex) {
+    MemoryBlock& block = g_blocks[blockIndex];
+    Assert(block.kind != BlockKind::NONE);
+
+    if (block.kind == BlockKind::BUDDY) buddyDestroy(block.buddy);
+    // Freeing implicitly unmaps.
+    vkFreeMemory(g_device, block.memory, g_allocCallbacks);
+
+    g_heapBlockBytes[heapOf(block.memoryTypeIndex)] -= block.size;
+    block = {};
+
+    while (g_blockCount > 0 && g_blocks[g_blockCount - 1].kind == BlockKind::NONE) g_blockCount--;
+}
+
+// Keeps at most one empty buddy block per memory type, so alloc/free patterns around a block boundary do not thrash
+// vkAllocateMemory.
+void releaseEmptyBlocks(u32 memoryTypeIndex) {
+    bool keptOne = false;
+    for (u32 i = 0; i < g_blockCount; i++) {
+        MemoryBlock& block = g_blocks[i];
+        if (block.kind != BlockKind::BUDDY || block.memoryTypeIndex != memoryTypeIndex || block.liveAllocs > 0) {
+            continue;
+        }
+        if (!keptOne) {
+            keptOne = true;
+            continue;
+        }
+        destroyBlock(i);
+    }
+}
+
+u32 newRecord() {
+    if (g_recordFreeHead == INVALID_INDEX) {
+        u32 newCap = g_recordCap == 0 ? INITIAL_RECORD_CAP : g_recordCap * 2;
+        AllocRecord* records = metaAlloc<AllocRecord>(newCap);
+        if (!records) return INVALID_INDEX;
+
+        if (g_records) {
+            core::memcopy(records, g_records, addr_size(g_recordCap) * sizeof(AllocRecord));
+            metaFree(g_records, g_recordCap);
+        }
+        for (u32 i = g_recordCap; i < newCap; i++) {
+            records[i] = {};
+            records[i].nextFree = i + 1 < newCap ? i + 1 : INVALID_INDEX;
+        }
+
+        g_recordFreeHead = g_recordCap;
+        g_records = records;
+        g_recordCap = newCap;
+    }
+
+    u32 idx = g_recordFreeHead;
+    g_recordFreeHead = g_records[idx].nextFree;
+    g_records[idx] = {};
+    g_records[idx].nextFree = INVALID_INDEX;
+    return idx;
+}
+
+void releaseRecord(u32 idx) {
+    g_records[idx] = {};
+    g_records[idx].nextFree = g_recordFreeHead;
+    g_recordFreeHead = idx;
+}
+
+VkDeviceSize recordOffset(const AllocRecord& r) {
+    const MemoryBlock& block = g_blocks[r.blockIndex];
+    if (block.kind == BlockKind::DEDICATED) return 0;
+    return VkDeviceSize(r.nodeIndex) * (block.size >> r.level);
+}
+
+void fillAllocation(DeviceAllocation& out, u32 blockIndex, VkDeviceSize offset, VkDeviceSize size, u32 id) {
+    const MemoryBlock& block = g_blocks[blockIndex];
+    out.memory = block.memory;
+    out.offset = offset;
+    out.size = size;
+    out.mapped = block.mapped ? block.mapped + offset : nullptr;
+    out.memoryTypeIndex = block.memoryTypeIndex;
+    out.id = id;
+}
+
+// Level of a node of nodeSize bytes in a block, or INVALID_INDEX when the node does not fit.
+u32 levelFor(const MemoryBlock& block, VkDeviceSize nodeSize) {
+    if (nodeSize > block.size) return INVALID_INDEX;
+    u32 level = log2Pow2(block.size / nodeSize);
+    return level < block.buddy.levelCount ? level : INVALID_INDEX;
+}
+
+bool allocTransient(u32 memoryTypeIndex, const VkMemoryRequirements& reqs, DeviceAllocation& out) {
+    u32 blockIndex = g_transientBlock[memoryTypeIndex];
+    if (blockIndex == INVALID_INDEX) {
+        blockIndex = createBlock(memoryTypeIndex, g_transientBytesPerFrame * g_framesInFlight, BlockKind::TRANSIENT);
+        if (blockIndex == INVALID_INDEX) return false;
+        g_transientBlock[memoryTypeIndex] = blockIndex;
+    }
+
+    MemoryBlock& block = g_blocks[blockIndex];
+    VkDeviceSize alignment = reqs.alignment > g_bufferImageGranularity ? reqs.alignment : g_bufferImageGranularity;
+    VkDeviceSize regionStart = g_transientBytesPerFrame * g_currentFrame;
+    VkDeviceSize offset = alignUp(regionStart + block.frameCursor[g_currentFrame], alignment);
+    if (offset + reqs.size > regionStart + g_transientBytesPerFrame) {
+        logWarnTagged(RENDERER_TAG, "Transient device memory for frame {} exhausted ({}KiB per frame)",
+                      g_currentFrame, g_transientBytesPerFrame / 1024);
+        return false;
+    }
+
+    block.frameCursor[g_currentFrame] = offset + reqs.size - regionStart;
+    fillAllocation(out, blockIndex, offset, reqs.size, 0);
+    return true;
+}
+
+bool allocDedicated(u32 memoryTypeIndex, const VkMemoryRequirements& reqs, DeviceMemoryUsage usage,
+                    DeviceAllocation& out) {
+    u32 blockIndex = createBlock(memoryTypeIndex, reqs.size, BlockKind::DEDICATED);
+    if (blockIndex == INVALID_INDEX) return false;
+
+    u32 rec = newRecord();
+    if (rec == INVALID_INDEX) {
+        destroyBlock(blockIndex);
+        return false;
+    }
+
+    AllocRecord& r = g_records[rec];
+    r.blockIndex = blockIndex;
+    r.size = reqs.size;
+    r.usage = usage;
+    r.live = true;
+
+    MemoryBlock& block = g_blocks[blockIndex];
+    block.usedBytes = reqs.size;
+    block.liveAllocs = 1;
+    g_heapUsedBytes[heapOf(memoryTypeIndex)] += reqs.size;
+    g_dedicatedAllocs++;
+
+    fillAllocation(out, blockIndex, 0, reqs.size, rec + 1);
+    return true;
+}
+
+bool allocFromBlocks(u32 memoryTypeIndex, const VkMemoryRequirements& reqs, DeviceMemoryUsage usage,
+                     DeviceAllocation& out) {
+    // Buddy nodes are aligned to their own size relative to the block, and blocks are aligned for any resource.
+    // Rounding up to bufferImageGranularity keeps linear and optimal resources from sharing a granularity page.
+    VkDeviceSize nodeSize = reqs.size;
+    if (nodeSize < reqs.alignment) nodeSize = reqs.alignment;
+    if (nodeSize < g_bufferImageGranularity) nodeSize = g_bufferImageGranularity;
+    if (nodeSize < BUDDY_MIN_NODE_SIZE) nodeSize = BUDDY_MIN_NODE_SIZE;
+    nodeSize = nextPow2(nodeSize);
+
+    if (nodeSize > g_blockSize) {
+        return allocDedicated(memoryTypeIndex, reqs, usage, out);
+    }
+
+    u32 blockIndex = INVALID_INDEX;
+    u32 level = 0;
+    u32 node = 0;
+    for (u32 i = 0; i < g_blockCount; i++) {
+        MemoryBlock& block = g_blocks[i];
+        if (block.kind != BlockKind::BUDDY || block.memoryTypeIndex != memoryTypeIndex) continue;
+
+        level = levelFor(block, nodeSize);
+        if (level == INVALID_INDEX) continue;
+        if (buddyAlloc(block.buddy, level, node)) {
+            blockIndex = i;
+            break;
+        }
+    }
+
+    if (blockIndex == INVALID_INDEX) {
+        // Under a tight budget fall back to smaller blocks rather than failing outright.
+        VkDeviceSize minSize = nodeSize > MIN_BLOCK_SIZE ? nodeSize : MIN_BLOCK_SIZE;
+        for (VkDeviceSize size = g_blockSize; size >= minSize && blockIndex == INVALID_INDEX; size /= 2) {
+            blockIndex = createBlock(memoryTypeIndex, size, BlockKind::BUDDY);
+        }
+        if (blockIndex == INVALID_INDEX) return false;
+
+        level = levelFor(g_blocks[blockIndex], nodeSize);
+        bool ok = buddyAlloc(g_blocks[blockIndex].buddy, level, node);
+        Assert(ok, "A fresh block must fit the allocation");
+    }
+
+    u32 rec = newRecord();
+    if (rec == INVALID_INDEX) {
+        buddyFree(g_blocks[blockIndex].buddy, level, node);
+        return false;
+    }
+
+    AllocRecord& r = g_records[rec];
+    r.blockIndex = blockIndex;
+    r.nodeIndex = node;
+    r.level = level;
+    r.size = reqs.size;
+    r.usage = usage;
+    r.live = true;
+
+    MemoryBlock& block = g_blocks[blockIndex];
+    block.usedBytes += nodeSize;
+    block.liveAllocs++;
+    g_heapUsedBytes[heapOf(memoryTypeIndex)] += nodeSize;
+
+    fillAllocation(out, blockIndex, recordOffset(r), reqs.size, rec + 1);
+    return true;
+}
+
+// Returns the node to its block and updates the accounting. Does not touch the record.
+void releaseNode(u32 blockIndex, u32 level, u32 node) {
+    MemoryBlock& block = g_blocks[blockIndex];
+    VkDeviceSize nodeSize = block.size >> level;
+    buddyFree(block.buddy, level, node);
+    block.usedBytes -= nodeSize;
+    block.liveAllocs--;
+    g_heapUsedBytes[heapOf(block.memoryTypeIndex)] -= nodeSize;
+}
+
+const char* kindToCStr(DeviceMemoryMapEntryKind kind) {
+    switch (kind) {
+        case DeviceMemoryMapEntryKind::BLOCK:            return "block";
+        case DeviceMemoryMapEntryKind::ALLOCATION:       return "allocation";
+        case DeviceMemoryMapEntryKind::TRANSIENT_REGION: return "transient";
+        default:                                         return "unknown";
+    }
+}
+
+} // namespace
+
+bool deviceMemoryInit(const DeviceMemoryCreateInfo& info) {
+    Assert(!g_initialized, "Device memory manager initialized twice");
+    Assert(info.framesInFlight > 0 && info.framesInFlight <= MAX_TRANSIENT_FRAMES);
+
+    g_gpu = info.gpu;
+    g_device = info.device;
+    g_allocCallbacks = info.allocCallbacks;
+    g_memoryBudgetSupported = info.memoryBudgetSupported;
+    g_framesInFlight = info.framesInFlight;
+    g_currentFrame = 0;
+
+    g_blockSize = info.blockSize != 0 ? nextPow2(info.blockSize) : DEFAULT_BLOCK_SIZE;
+    if (g_blockSize < MIN_BLOCK_SIZE) g_blockSize = MIN_BLOCK_SIZE;
+    g_transientBytesPerFrame = info.transientBytesPerFrame != 0 ? info.transientBytesPerFrame
+                                                                : DEFAULT_TRANSIENT_BYTES_PER_FRAME;
+
+    vkGetPhysicalDeviceMemoryProperties(g_gpu, &g_memProps);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(g_gpu, &props);
+    // Kept as reported even when it is large. It is the minimum buddy node size and the transient alignment, which
+    // wastes more of small nodes on such devices, but is what keeps linear and optimal resources out of each other's
+    // granularity pages.
+    g_bufferImageGranularity = props.limits.bufferImageGranularity;
+
+    for (u32 i = 0; i < VK_MAX_MEMORY_TYPES; i++) g_transientBlock[i] = INVALID_INDEX;
+
+    refreshBudget();
+
+    logInfoTagged(RENDERER_TAG, "Device memory: block size {}KiB, transient {}KiB x {} frames, budget ext: {}",
+                  g_blockSize / 1024, g_transientBytesPerFrame / 1024, g_framesInFlight,
+                  g_memoryBudgetSupported ? "yes" : "no");
+
+    g_initialized = true;
+    return true;
+}
+
+void deviceMemoryShutdown() {
+    if (!g_initialized) return;
+
+    deviceMemoryLogStats();
+
+    u32 leaked = 0;
+    for (u32 i = 0; i < g_recordCap; i++) {
+        if (g_records[i].live) leaked++;
+    }
+    if (leaked > 0) {
+        logWarnTagged(RENDERER_TAG, "{} device memory allocations still live at shutdown", leaked);
+    }
+
+    for (u32 i = 0; i < g_blockCount; i++) {
+        if (g_blocks[i].kind != BlockKind::NONE) destroyBlock(i);
+    }
+
+    metaFree(g_records, g_recordCap);
+    g_records = nullptr;
+    g_recordCap = 0;
+    g_recordFreeHead = INVALID_INDEX;
+
+    for (u32 i = 0; i < VK_MAX_MEMORY_HEAPS; i++) {
+        g_heapBlockBytes[i] = 0;
+        g_heapUsedBytes[i] = 0;
+    }
+
+    g_initialized = false;
+}
+
+u32 deviceMemoryFindType(u32 typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    u32 best = INVALID_INDEX;
+    i32 bestScore = -1;
+
+    for (u32 i = 0; i < g_memProps.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) == 0) continue;
+
+        VkMemoryPropertyFlags flags = g_memProps.memoryTypes[i].propertyFlags;
+        if ((flags & required) != required) continue;
+
+        i32 score = __builtin_popcount(flags & preferred);
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+bool deviceMemoryAlloc(const VkMemoryRequirements& reqs,
+                       VkMemoryPropertyFlags required,
+                       VkMemoryPropertyFlags preferred,
+                       DeviceMemoryUsage usage,
+                       DeviceAllocation& out) {
+    Assert(g_initialized, "Device memory manager is not initialized");
+    out = {};
+
+    u32 memoryTypeIndex = deviceMemoryFindType(reqs.memoryTypeBits, required, preferred);
+    if (memoryTypeIndex == INVALID_INDEX) {
+        logErrTagged(RENDERER_TAG, "No memory type in type bits {} with the required property flags {}",
+                     reqs.memoryTypeBits, u32(required));
+        g_failedAllocs++;
+        return false;
+    }
+
+    bool ok = usage == DeviceMemoryUsage::TRANSIENT ? allocTransient(memoryTypeIndex, reqs, out)
+                                                    : allocFromBlocks(memoryTypeIndex, reqs, usage, out);
+    if (!ok) g_failedAllocs++;
+    return ok;
+}
+
+void deviceMemoryFree(DeviceAllocation& alloc) {
+    if (alloc.id == 0) {
+        // Transient allocations go away with their frame.
+        alloc = {};
+        return;
+    }
+
+    u32 rec = alloc.id - 1;
+    Assert(rec < g_recordCap && g_records[rec].live, "Freeing an unknown device allocation");
+    AllocRecord& r = g_records[rec];
+    Assert(!r.moving, "Device allocation freed while it is being defragmented");
+
+    MemoryBlock& block = g_blocks[r.blockIndex];
+    u32 memoryTypeIndex = block.memoryTypeIndex;
+
+    if (block.kind == BlockKind::DEDICATED) {
+        g_heapUsedBytes[heapOf(memoryTypeIndex)] -= block.usedBytes;
+        destroyBlock(r.blockIndex);
+    }
+    else {
+        releaseNode(r.blockIndex, r.level, r.nodeIndex);
+        if (block.liveAllocs == 0) releaseEmptyBlocks(memoryTypeIndex);
+    }
+
+    releaseRecord(rec);
+    alloc = {};
+}
+
+void deviceMemoryBeginFrame(u32 frameIndex) {
+    Assert(frameIndex < g_framesInFlight);
+    g_currentFrame = frameIndex;
+
+    for (u32 i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        if (g_transientBlock[i] != INVALID_INDEX) {
+            g_blocks[g_transientBlock[i]].frameCursor[frameIndex] = 0;
+        }
+    }
+}
+
+u32 deviceMemoryDefragBegin(DeviceMemoryMove* outMoves, u32 maxMoves, VkDeviceSize maxBytes) {
+    // Drain the emptiest buddy blocks into fuller ones of the same memory type. Moving only from a less used block to
+    // a more used one makes sure repeated passes converge instead of shuffling data back and forth.
+    u32 order[MAX_MEMORY_BLOCKS];
+    u32 orderCount = 0;
+    for (u32 i = 0; i < g_blockCount; i++) {
+        if (g_blocks[i].kind == BlockKind::BUDDY && g_blocks[i].liveAllocs > 0) order[orderCount++] = i;
+    }
+    for (u32 i = 1; i < orderCount; i++) {
+        u32 v = order[i];
+        u32 j = i;
+        while (j > 0 && g_blocks[order[j - 1]].usedBytes > g_blocks[v].usedBytes) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = v;
+    }
+
+    u32 moveCount = 0;
+    VkDeviceSize movedBytes = 0;
+
+    for (u32 si = 0; si < orderCount && moveCount < maxMoves; si++) {
+        u32 srcIndex = order[si];
+        const MemoryBlock& src = g_blocks[srcIndex];
+
+        for (u32 rec = 0; rec < g_recordCap && moveCount < maxMoves; rec++) {
+            AllocRecord& r = g_records[rec];
+            if (!r.live || r.moving || r.blockIndex != srcIndex) continue;
+            if (r.usage != DeviceMemoryUsage::LONG_LIVED_MOVABLE) continue;
+
+            VkDeviceSize nodeSize = src.size >> r.level;
+            if (movedBytes + nodeSize > maxBytes) continue;
+
+            for (u32 di = orderCount; di-- > si + 1;) {
+                u32 dstIndex = order[di];
+                MemoryBlock& dst = g_blocks[dstIndex];
+                if (dst.memoryTypeIndex != src.memoryTypeIndex || dst.usedBytes <= src.usedBytes) continue;
+
+                u32 level = levelFor(dst, nodeSize);
+                u32 node = 0;
+                if (level == INVALID_INDEX || !buddyAlloc(dst.buddy, level, node)) continue;
+
+                dst.usedBytes += nodeSize;
+                dst.liveAllocs++;
+                g_heapUsedBytes[heapOf(dst.memoryTypeIndex)] += nodeSize;
+
+                r.moving = true;
+                r.moveBlockIndex = dstIndex;
+                r.moveNodeIndex = node;
+                r.moveLevel = level;
+
+                DeviceMemoryMove& move = outMoves[moveCount++];
+                move.id = rec + 1;
+                fillAllocation(move.src, srcIndex, recordOffset(r), r.size, rec + 1);
+                fillAllocation(move.dst, dstIndex, VkDeviceSize(node) * (dst.size >> level), r.size, rec + 1);
+
+                movedBytes += nodeSize;
+                break;
+            }
+        }
+    }
+
+    if (moveCount > 0) {
+        logInfoTagged(RENDERER_TAG, "Device memory defragmentation planned {} moves ({}KiB)",
+                      moveCount, movedBytes / 1024);
+    }
+    return moveCount;
+}
+
+void deviceMemoryDefragEnd(const DeviceMemoryMove* moves, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        u32 rec = moves[i].id - 1;
+        Assert(rec < g_recordCap && g_records[rec].moving, "Device memory move was not started by DefragBegin");
+        AllocRecord& r = g_records[rec];
+
+        u32 memoryTypeIndex = g_blocks[r.blockIndex].memoryTypeIndex;
+        releaseNode(r.blockIndex, r.level, r.nodeIndex);
+        g_bytesMoved += r.size;
+
+        r.blockIndex = r.moveBlockIndex;
+        r.nodeIndex = r.moveNodeIndex;
+        r.level = r.moveLevel;
+        r.moving = false;
+
+        releaseEmptyBlocks(memoryTypeIndex);
+    }
+}
+
+u32 deviceMemoryQueryBudget(DeviceHeapBudget* out, u32 maxHeaps) {
+    refreshBudget();
+
+    u32 n = g_memProps.memoryHeapCount < maxHeaps ? g_memProps.memoryHeapCount : maxHeaps;
+    for (u32 i = 0; i < n; i++) {
+        out[i].heapSize = g_memProps.memoryHeaps[i].size;
+        out[i].budget = g_heapBudget[i];
+        out[i].usage = g_heapUsage[i];
+        out[i].blockBytes = g_heapBlockBytes[i];
+        out[i].usedBytes = g_heapUsedBytes[i];
+    }
+
+    return g_memProps.memoryHeapCount;
+}
+
+u32 deviceMemoryExportMap(DeviceMemoryMapEntry* out, u32 maxEntries) {
+    u32 total = 0;
+    auto emit = [&](const DeviceMemoryMapEntry& e) {
+        if (total < maxEntries) out[total] = e;
+        total++;
+    };
+
+    for (u32 b = 0; b < g_blockCount; b++) {
+        const MemoryBlock& block = g_blocks[b];
+        if (block.kind == BlockKind::NONE) continue;
+
+        emit({ b, block.memoryTypeIndex, 0, block.size, 0, DeviceMemoryMapEntryKind::BLOCK });
+
+        if (block.kind == BlockKind::TRANSIENT) {
+            for (u32 f = 0; f < g_framesInFlight; f++) {
+                if (block.frameCursor[f] == 0) continue;
+                emit({ b, block.memoryTypeIndex, g_transientBytesPerFrame * f, block.frameCursor[f], 0,
+                       DeviceMemoryMapEntryKind::TRANSIENT_REGION });
+            }
+            continue;
+        }
+
+        for (u32 rec = 0; rec < g_recordCap; rec++) {
+            const AllocRecord& r = g_records[rec];
+            if (!r.live || r.blockIndex != b) continue;
+            emit({ b, block.memoryTypeIndex, recordOffset(r), r.size, rec + 1, DeviceMemoryMapEntryKind::ALLOCATION });
+        }
+    }
+
+    return total;
+}
+
+bool deviceMemoryDumpMap(const char* path) {
+    u32 count = deviceMemoryExportMap(nullptr, 0);
+    DeviceMemoryMapEntry* entries = metaAlloc<DeviceMemoryMapEntry>(count > 0 ? count : 1);
+    if (!entries) return false;
+    defer { metaFree(entries, count > 0 ? count : 1); };
+    count = deviceMemoryExportMap(entries, count);
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        logErrTagged(RENDERER_TAG, "Failed to open '{}' for the device memory map", path);
+        return false;
+    }
+    defer { fclose(f); };
+
+    fprintf(f, "kind,block,memory_type,heap,offset,size,id\n");
+    for (u32 i = 0; i < count; i++) {
+        const DeviceMemoryMapEntry& e = entries[i];
+        fprintf(f, "%s,%u,%u,%u,%llu,%llu,%u\n", kindToCStr(e.kind), e.blockIndex, e.memoryTypeIndex,
+                heapOf(e.memoryTypeIndex), (unsigned long long)e.offset, (unsigned long long)e.size, e.id);
+    }
+
+    logInfoTagged(RENDERER_TAG, "Wrote device memory map with {} entries to '{}'", count, path);
+    return true;
+}
+
+void deviceMemoryLogStats() {
+    refreshBudget();
+
+    logInfoTagged(RENDERER_TAG, "Device memory: {} blocks created, {} dedicated, {} failed allocations, {}KiB moved",
+                  g_blocksCreated, g_dedicatedAllocs, g_failedAllocs, g_bytesMoved / 1024);
+
+    for (u32 h = 0; h < g_memProps.memoryHeapCount; h++) {
+        if (g_heapBlockBytes[h] == 0) continue;
+        logInfoTagged(RENDERER_TAG, "\theap {}: used={}KiB, blocks={}KiB, usage={}KiB, budget={}KiB", h,
+                      g_heapUsedBytes[h] / 1024, g_heapBlockBytes[h] / 1024,
+                      g_heapUsage[h] / 1024, g_heapBudget[h] / 1024);
+    }
+
+    for (u32 b = 0; b < g_blockCount; b++) {
+        const MemoryBlock& block = g_blocks[b];
+        if (block.kind != BlockKind::BUDDY) continue;
+        logInfoTagged(RENDERER_TAG, "\tblock {} (type {}): {} allocs, used={}KiB of {}KiB, largest free={}KiB",
+                      b, block.memoryTypeIndex, block.liveAllocs, block.usedBytes / 1024, block.size / 1024,
+                      buddyLargestFree(block.buddy, block.size) / 1024);
+    }
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
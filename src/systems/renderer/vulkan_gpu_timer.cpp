@@ -0,0 +1,157 @@
+#include "systems/renderer/vulkan_gpu_timer.h"
+
+#include "basic.h"
+#include "systems/logger.h"
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 MAX_FRAME_SLOTS = 4;
+// A begin and an end query for every pass. Indexing by FramePass wastes the CPU passes' queries, but keeps the
+// bookkeeping trivial.
+constexpr u32 QUERIES_PER_SLOT = u32(FramePass::SENTINEL) * 2;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// ------------------------------------------ BEGIN GPU TIMER STATE ----------------------------------------------------
+
+struct TimerSlot {
+    u32 writtenPasses; // Bit per FramePass with both timestamps recorded.
+    bool pending;      // Queries were reset and written by a submitted command buffer.
+};
+
+VkDevice g_device = VK_NULL_HANDLE;
+const VkAllocationCallbacks* g_allocCallbacks = nullptr;
+VkQueryPool g_queryPool = VK_NULL_HANDLE;
+u32 g_framesInFlight = 0;
+f64 g_nsPerTick = 1.0;
+u64 g_timestampMask = ~u64(0);
+TimerSlot g_slots[MAX_FRAME_SLOTS] = {};
+
+// ------------------------------------------ END GPU TIMER STATE ------------------------------------------------------
+
+inline u32 queryIndex(u32 frameSlot, FramePass pass, bool end) {
+    return frameSlot * QUERIES_PER_SLOT + u32(pass) * 2 + (end ? 1 : 0);
+}
+
+void publishSlot(u32 frameSlot) {
+    TimerSlot& slot = g_slots[frameSlot];
+    if (!slot.pending || slot.writtenPasses == 0) return;
+
+    // Value and availability for every query. Never waits: the slot's fence already signaled, and queries that are
+    // still unavailable for any reason are skipped.
+    u64 results[QUERIES_PER_SLOT][2] = {};
+    VkResult vres = vkGetQueryPoolResults(g_device, g_queryPool, frameSlot * QUERIES_PER_SLOT, QUERIES_PER_SLOT,
+                                          sizeof(results), results, sizeof(results[0]),
+                                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (vres != VK_SUCCESS && vres != VK_NOT_READY) {
+        logWarnTagged(RENDERER_TAG, "vkGetQueryPoolResults failed with {}", i32(vres));
+        return;
+    }
+
+    u64 firstTick = UINT64_MAX;
+    u64 lastTick = 0;
+    for (u32 p = 0; p < u32(FramePass::SENTINEL); p++) {
+        if ((slot.writtenPasses & (1u << p)) == 0) continue;
+
+        const u64* begin = results[p * 2];
+        const u64* end = results[p * 2 + 1];
+        if (begin[1] == 0 || end[1] == 0) continue;
+
+        u64 b = begin[0] & g_timestampMask;
+        u64 e = end[0] & g_timestampMask;
+        u64 ticks = (e - b) & g_timestampMask; // the counter may wrap when it has less than 64 valid bits
+        frameTimingRecord(FramePass(p), u64(f64(ticks) * g_nsPerTick));
+
+        if (b < firstTick) firstTick = b;
+        if (e > lastTick) lastTick = e;
+    }
+
+    if (firstTick < lastTick) {
+        frameTimingRecord(FramePass::GPU_FRAME, u64(f64(lastTick - firstTick) * g_nsPerTick));
+    }
+}
+
+} // namespace
+
+bool vulkanGpuTimerInit(const VulkanGpuTimerCreateInfo& info) {
+    Assert(info.framesInFlight <= MAX_FRAME_SLOTS);
+
+    g_device = info.device;
+    g_allocCallbacks = info.allocCallbacks;
+    g_framesInFlight = info.framesInFlight;
+    for (u32 i = 0; i < MAX_FRAME_SLOTS; i++) g_slots[i] = {};
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(info.gpu, &props);
+
+    u32 familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(info.gpu, &familyCount, nullptr);
+    core::ArrStatic<VkQueueFamilyProperties, 64> families (familyCount < 64 ? familyCount : 64,
+                                                           VkQueueFamilyProperties{});
+    vkGetPhysicalDeviceQueueFamilyProperties(info.gpu, &familyCount, families.data());
+
+    u32 validBits = info.queueFamily < familyCount ? families[info.queueFamily].timestampValidBits : 0;
+    if (validBits == 0 || props.limits.timestampPeriod <= 0.0f) {
+        logWarnTagged(RENDERER_TAG, "The graphics queue does not support timestamps, GPU pass timings are disabled");
+        return false;
+    }
+
+    g_nsPerTick = f64(props.limits.timestampPeriod);
+    g_timestampMask = validBits >= 64 ? ~u64(0) : (u64(1) << validBits) - 1;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = QUERIES_PER_SLOT * g_framesInFlight;
+    if (vkCreateQueryPool(g_device, &poolInfo, g_allocCallbacks, &g_queryPool) != VK_SUCCESS) {
+        logWarnTagged(RENDERER_TAG, "Failed to create the timestamp query pool, GPU pass timings are disabled");
+        g_queryPool = VK_NULL_HANDLE;
+        return false;
+    }
+
+    logInfoTagged(RENDERER_TAG, "GPU timestamps: {} valid bits, {:f.3}ns per tick", validBits, g_nsPerTick);
+    return true;
+}
+
+void vulkanGpuTimerShutdown() {
+    if (g_queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(g_device, g_queryPool, g_allocCallbacks);
+        g_queryPool = VK_NULL_HANDLE;
+    }
+    g_device = VK_NULL_HANDLE;
+}
+
+void vulkanGpuTimerBeginFrame(VkCommandBuffer cmd, u32 frameSlot) {
+    if (g_queryPool == VK_NULL_HANDLE) return;
+
+    publishSlot(frameSlot);
+
+    vkCmdResetQueryPool(cmd, g_queryPool, frameSlot * QUERIES_PER_SLOT, QUERIES_PER_SLOT);
+    g_slots[frameSlot].writtenPasses = 0;
+    g_slots[frameSlot].pending = true;
+}
+
+void vulkanGpuTimerBegin(VkCommandBuffer cmd, u32 frameSlot, FramePass pass) {
+    if (g_queryPool == VK_NULL_HANDLE) return;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_queryPool, queryIndex(frameSlot, pass, false));
+}
+
+void vulkanGpuTimerEnd(VkCommandBuffer cmd, u32 frameSlot, FramePass pass) {
+    if (g_queryPool == VK_NULL_HANDLE) return;
+    // Written once everything recorded before it finished executing.
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_queryPool, queryIndex(frameSlot, pass, true));
+    g_slots[frameSlot].writtenPasses |= 1u << u32(pass);
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
@@ -0,0 +1,224 @@
+#include "systems/renderer/vulkan_host_allocator.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+
+#include <atomic>
+
+PRAGMA_WARNING_PUSH
+
+// For this file I do not care about old style casting:
+DISABLE_GCC_AND_CLANG_WARNING(-Wold-style-cast)
+
+namespace memviz {
+
+namespace {
+
+// Stored right before every pointer handed to Vulkan. Vulkan does not pass the size or alignment back on free and
+// realloc, and the core allocators need both to release the block.
+struct alignas(16) AllocHeader {
+    u64 size;      // Requested size.
+    u64 totalSize; // Size of the raw block, as passed to the core allocator.
+    u32 rawOffset; // Distance from the start of the raw block to the aligned pointer.
+    u32 scope;
+};
+
+struct AtomicScopeStats {
+    std::atomic<u64> liveBytes;
+    std::atomic<u64> peakBytes;
+    std::atomic<u64> allocCount;
+    std::atomic<u64> freeCount;
+    std::atomic<u64> internalLiveBytes;
+};
+
+struct HostAllocatorState {
+    u32 allocatorId;
+    u64 capBytes;
+    AtomicScopeStats scopes[VULKAN_ALLOCATION_SCOPE_COUNT];
+    std::atomic<u64> totalLiveBytes;
+    std::atomic<u64> totalPeakBytes;
+    std::atomic<u64> failedAllocs;
+    VkAllocationCallbacks callbacks;
+    bool initialized;
+};
+
+HostAllocatorState g_state = {};
+
+inline void updatePeak(std::atomic<u64>& peak, u64 value) {
+    u64 cur = peak.load(std::memory_order_relaxed);
+    while (value > cur && !peak.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {}
+}
+
+inline u32 scopeIndex(VkSystemAllocationScope scope) {
+    u32 i = u32(scope);
+    return i < VULKAN_ALLOCATION_SCOPE_COUNT ? i : VULKAN_ALLOCATION_SCOPE_COUNT - 1;
+}
+
+// Command scope allocations are small and come and go with every recorded command buffer, the pools serve them
+// without touching the heap. Picked by the raw size, which the header keeps for the free.
+inline core::AllocatorId backingAllocator(u64 totalSize) {
+    if (totalSize <= 32) return core::AllocatorId(POOL_32_ALLOCATOR_ID);
+    if (totalSize <= 64) return core::AllocatorId(POOL_64_ALLOCATOR_ID);
+    if (totalSize <= 128) return core::AllocatorId(POOL_128_ALLOCATOR_ID);
+    return core::AllocatorId(g_state.allocatorId);
+}
+
+inline AllocHeader* headerOf(void* p) {
+    return reinterpret_cast<AllocHeader*>(p) - 1;
+}
+
+void trackAlloc(u32 scope, u64 size) {
+    AtomicScopeStats& s = g_state.scopes[scope];
+    u64 live = s.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    updatePeak(s.peakBytes, live);
+    s.allocCount.fetch_add(1, std::memory_order_relaxed);
+
+    u64 total = g_state.totalLiveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    updatePeak(g_state.totalPeakBytes, total);
+}
+
+void trackFree(u32 scope, u64 size) {
+    AtomicScopeStats& s = g_state.scopes[scope];
+    s.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    s.freeCount.fetch_add(1, std::memory_order_relaxed);
+    g_state.totalLiveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void* VKAPI_PTR hostAlloc(void*, size_t size, size_t alignment, VkSystemAllocationScope vkScope) {
+    if (size == 0) return nullptr;
+
+    // The cap is checked against the live total without reserving first. Concurrent allocations can overshoot it by
+    // at most one allocation per thread, which is fine for a diagnostics cap.
+    if (g_state.capBytes != 0 &&
+        g_state.totalLiveBytes.load(std::memory_order_relaxed) + size > g_state.capBytes) {
+        g_state.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    if (alignment < alignof(AllocHeader)) alignment = alignof(AllocHeader);
+    u64 totalSize = u64(size) + u64(alignment) + sizeof(AllocHeader);
+
+    auto& allocator = core::getAllocator(backingAllocator(totalSize));
+    u8* raw = reinterpret_cast<u8*>(allocator.alloc(totalSize, sizeof(u8)));
+    if (!raw) {
+        g_state.failedAllocs.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    addr_size alignedAddr = (addr_size(raw) + sizeof(AllocHeader) + alignment - 1) & ~(addr_size(alignment) - 1);
+    u8* aligned = reinterpret_cast<u8*>(alignedAddr);
+
+    AllocHeader* h = headerOf(aligned);
+    h->size = size;
+    h->totalSize = totalSize;
+    h->rawOffset = u32(aligned - raw);
+    h->scope = scopeIndex(vkScope);
+
+    trackAlloc(h->scope, size);
+    return aligned;
+}
+
+void VKAPI_PTR hostFree(void*, void* memory) {
+    if (!memory) return;
+
+    AllocHeader* h = headerOf(memory);
+    trackFree(h->scope, h->size);
+
+    u8* raw = reinterpret_cast<u8*>(memory) - h->rawOffset;
+    core::getAllocator(backingAllocator(h->totalSize)).free(raw, h->totalSize, sizeof(u8));
+}
+
+void* VKAPI_PTR hostRealloc(void* userData, void* original, size_t size, size_t alignment,
+                            VkSystemAllocationScope vkScope) {
+    // Semantics from the spec: null original behaves like alloc, zero size behaves like free.
+    if (!original) return hostAlloc(userData, size, alignment, vkScope);
+    if (size == 0) {
+        hostFree(userData, original);
+        return nullptr;
+    }
+
+    AllocHeader* oldHeader = headerOf(original);
+    void* p = hostAlloc(userData, size, alignment, vkScope);
+    if (!p) return nullptr; // the original block stays valid on failure
+
+    u64 copySize = oldHeader->size < size ? oldHeader->size : u64(size);
+    core::memcopy(p, original, copySize);
+    hostFree(userData, original);
+    return p;
+}
+
+void VKAPI_PTR hostInternalAlloc(void*, size_t size, VkInternalAllocationType, VkSystemAllocationScope vkScope) {
+    g_state.scopes[scopeIndex(vkScope)].internalLiveBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void VKAPI_PTR hostInternalFree(void*, size_t size, VkInternalAllocationType, VkSystemAllocationScope vkScope) {
+    g_state.scopes[scopeIndex(vkScope)].internalLiveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+constexpr const char* scopeToCStr(u32 scope) {
+    switch (scope) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:  return "command";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:   return "object";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:    return "cache";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:   return "device";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+        default:                                  return "unknown";
+    }
+}
+
+} // namespace
+
+void vulkanHostAllocatorInit(u32 allocatorId, u64 capBytes) {
+    Assert(!g_state.initialized, "Vulkan host allocator initialized twice");
+
+    g_state.allocatorId = allocatorId;
+    g_state.capBytes = capBytes;
+
+    g_state.callbacks = {};
+    g_state.callbacks.pUserData = nullptr;
+    g_state.callbacks.pfnAllocation = hostAlloc;
+    g_state.callbacks.pfnReallocation = hostRealloc;
+    g_state.callbacks.pfnFree = hostFree;
+    g_state.callbacks.pfnInternalAllocation = hostInternalAlloc;
+    g_state.callbacks.pfnInternalFree = hostInternalFree;
+
+    g_state.initialized = true;
+}
+
+const VkAllocationCallbacks* vulkanHostAllocator() {
+    return g_state.initialized ? &g_state.callbacks : nullptr;
+}
+
+VulkanHostMemoryStats vulkanHostAllocatorStats() {
+    VulkanHostMemoryStats ret = {};
+    for (u32 i = 0; i < VULKAN_ALLOCATION_SCOPE_COUNT; i++) {
+        const AtomicScopeStats& s = g_state.scopes[i];
+        ret.scopes[i].liveBytes = s.liveBytes.load(std::memory_order_relaxed);
+        ret.scopes[i].peakBytes = s.peakBytes.load(std::memory_order_relaxed);
+        ret.scopes[i].allocCount = s.allocCount.load(std::memory_order_relaxed);
+        ret.scopes[i].freeCount = s.freeCount.load(std::memory_order_relaxed);
+        ret.scopes[i].internalLiveBytes = s.internalLiveBytes.load(std::memory_order_relaxed);
+    }
+    ret.totalLiveBytes = g_state.totalLiveBytes.load(std::memory_order_relaxed);
+    ret.totalPeakBytes = g_state.totalPeakBytes.load(std::memory_order_relaxed);
+    ret.capBytes = g_state.capBytes;
+    ret.failedAllocs = g_state.failedAllocs.load(std::memory_order_relaxed);
+    return ret;
+}
+
+void vulkanHostAllocatorLogStats() {
+    VulkanHostMemoryStats stats = vulkanHostAllocatorStats();
+
+    logInfoTagged(RENDERER_TAG, "Vulkan host memory: live={} peak={} cap={} failed={}",
+                  stats.totalLiveBytes, stats.totalPeakBytes, stats.capBytes, stats.failedAllocs);
+    for (u32 i = 0; i < VULKAN_ALLOCATION_SCOPE_COUNT; i++) {
+        const VulkanHostScopeStats& s = stats.scopes[i];
+        logInfoTagged(RENDERER_TAG, "\t{}: live={} peak={} allocs={} frees={} internal={}",
+                      scopeToCStr(i), s.liveBytes, s.peakBytes, s.allocCount, s.freeCount, s.internalLiveBytes);
+    }
+}
+
+} // namespace memviz
+
+PRAGMA_WARNING_POP
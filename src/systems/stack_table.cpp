@@ -0,0 +1,105 @@
+#include "systems/stack_table.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/profiler.h"
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 ENTRIES_MIN_CAPACITY = 1024;
+constexpr u32 FRAMES_MIN_CAPACITY = 16 * 1024;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+bool reserveEntries(StackTable& t, u32 needed) {
+    if (needed <= t.entryCapacity) return true;
+    u32 capacity = t.entryCapacity > 0 ? t.entryCapacity : ENTRIES_MIN_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    StackEntry* entries = metaAlloc<StackEntry>(capacity);
+    if (!entries) return false;
+    if (t.entryCapacity > 0) core::memcopy(entries, t.entries, addr_size(t.entryCapacity) * sizeof(StackEntry));
+    core::memset(entries + t.entryCapacity, 0, addr_size(capacity - t.entryCapacity) * sizeof(StackEntry));
+    metaFree(t.entries, t.entryCapacity);
+    t.entries = entries;
+    t.entryCapacity = capacity;
+    return true;
+}
+
+bool reserveFrames(StackTable& t, u32 needed) {
+    if (needed <= t.frameCapacity) return true;
+    u32 capacity = t.frameCapacity > 0 ? t.frameCapacity : FRAMES_MIN_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    u64* frames = metaAlloc<u64>(capacity);
+    if (!frames) return false;
+    if (t.frameCount > 0) core::memcopy(frames, t.frames, addr_size(t.frameCount) * sizeof(u64));
+    metaFree(t.frames, t.frameCapacity);
+    t.frames = frames;
+    t.frameCapacity = capacity;
+    return true;
+}
+
+} // namespace
+
+bool stackTableApply(StackTable& t, const HookEvent* events, u64 count) {
+    MEMVIZ_ZONE("stackTableApply");
+
+    for (u64 i = 0; i < count; i++) {
+        const HookEvent& e = events[i];
+        if (e.op != HookOp::STACK_FRAME) continue;
+
+        u32 id = e.callsite;
+        u32 frame = u32(e.size & 0xFF);
+        u32 depth = u32(e.size >> 8);
+        if (id == 0 || id >= HOOK_STACK_MAX_STACKS || depth == 0 || depth > HOOK_STACK_MAX_DEPTH || frame >= depth) {
+            continue;
+        }
+        if (!reserveEntries(t, id + 1)) return false;
+
+        StackEntry& entry = t.entries[id];
+        if (entry.depth == 0) {
+            if (!reserveFrames(t, t.frameCount + depth)) return false;
+            entry.offset = t.frameCount;
+            entry.depth = u8(depth);
+            t.frameCount += depth;
+        }
+        // A batch lost in between leaves the stack incomplete for good.
+        if (entry.depth != depth || frame != entry.filled) continue;
+
+        t.frames[entry.offset + frame] = e.address;
+        entry.filled++;
+        if (entry.filled == entry.depth) t.count++;
+    }
+    return true;
+}
+
+u32 stackTableGet(const StackTable& t, u32 id, const u64*& frames) {
+    if (id >= t.entryCapacity) return 0;
+    const StackEntry& entry = t.entries[id];
+    if (entry.depth == 0 || entry.filled != entry.depth) return 0;
+    frames = t.frames + entry.offset;
+    return entry.depth;
+}
+
+void stackTableClear(StackTable& t) {
+    metaFree(t.entries, t.entryCapacity);
+    metaFree(t.frames, t.frameCapacity);
+    t = {};
+}
+
+} // namespace memviz
@@ -0,0 +1,52 @@
+#include "systems/startup_timing.h"
+
+#include "basic.h"
+#include "platform.h"
+
+namespace memviz {
+
+namespace {
+
+struct StageTiming {
+    u64 beginNs;
+    u64 endNs;
+    const char* note;
+};
+
+StageTiming g_stages[i32(StartupStage::SENTINEL)] = {};
+u64 g_firstBeginNs = 0;
+
+} // namespace
+
+void startupTimingBegin(StartupStage stage) {
+    u64 now = Platform::getMonotonicTimeNs();
+    g_stages[i32(stage)].beginNs = now;
+    if (g_firstBeginNs == 0) g_firstBeginNs = now;
+}
+
+void startupTimingEnd(StartupStage stage) {
+    g_stages[i32(stage)].endNs = Platform::getMonotonicTimeNs();
+}
+
+void startupTimingSetNote(StartupStage stage, const char* note) {
+    g_stages[i32(stage)].note = note;
+}
+
+void startupTimingReport() {
+    constexpr f64 NS_PER_MS = 1'000'000.0;
+
+    u64 now = Platform::getMonotonicTimeNs();
+    logInfo("Startup timing:");
+    for (i32 i = 0; i < i32(StartupStage::SENTINEL); i++) {
+        const StageTiming& t = g_stages[i];
+        if (t.endNs == 0) continue;
+
+        f64 ms = f64(t.endNs - t.beginNs) / NS_PER_MS;
+        logInfo("\t{}: {:f.3} ms {}", startupStageToCStr(StartupStage(i)), ms, t.note ? t.note : "");
+    }
+    if (g_firstBeginNs != 0) {
+        logInfo("\ttotal: {:f.3} ms", f64(now - g_firstBeginNs) / NS_PER_MS);
+    }
+}
+
+} // namespace memviz
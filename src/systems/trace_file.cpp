@@ -0,0 +1,549 @@
+#include "systems/trace_file.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/profiler.h"
+#include "varint.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u64 TRACE_FILE_MAGIC = 0x45434152545a564d;   // "MVZTRACE"
+constexpr u64 TRACE_FOOTER_MAGIC = 0x31584449545a564d; // "MVZTIDX1"
+constexpr u32 TRACE_CHUNK_MAGIC = 0x435a564d;          // "MVZC"
+// 2: callsites are stack ids, stacks come as STACK_FRAME events.
+// 3: every record has the pid of its process, the index is 8 byte aligned.
+constexpr u32 TRACE_FILE_VERSION = 3;
+
+// op plus six varints.
+constexpr addr_size MAX_RECORD_BYTES = 1 + 6 * VARINT_MAX_BYTES;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+struct TraceFileHeader {
+    u64 magic;
+    u32 version;
+    u32 reserved;
+};
+
+struct TraceChunkHeader {
+    u32 magic;
+    u32 eventCount;
+    u32 payloadBytes;
+    u32 reserved;
+    u64 minTicks;
+    u64 maxTicks;
+};
+
+struct TraceFooter {
+    u64 indexOffset;
+    u64 eventCount;
+    u32 chunkCount;
+    u32 version;
+    u64 magic;
+};
+
+// ------------------------------------------ BEGIN WRITER STATE -------------------------------------------------------
+
+struct ChunkBuffer {
+    HookEvent* events;
+    u32 count;
+};
+
+struct Writer {
+    FILE* file;
+    u64 offset;
+    u64 eventCount;
+
+    TraceChunkEntry* index;
+    u32 indexCount;
+    u32 indexCapacity;
+
+    u8* scratch; // Encoded payload of the chunk being written.
+
+    ChunkBuffer buffers[TRACE_WRITER_QUEUED_CHUNKS];
+    ChunkBuffer* filling; // Owned by the appending thread.
+
+    // Buffers move free -> filling -> queued -> free. Both lists are guarded by mutex.
+    std::mutex mutex;
+    std::condition_variable queuedChanged;
+    ChunkBuffer* freeBuffers[TRACE_WRITER_QUEUED_CHUNKS];
+    u32 freeCount;
+    ChunkBuffer* queued[TRACE_WRITER_QUEUED_CHUNKS];
+    u32 queuedCount;
+    bool stopping;
+
+    std::thread thread;
+};
+
+Writer* g_writer = nullptr;
+
+// ------------------------------------------ END WRITER STATE ---------------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+inline i64 delta(u64 v, u64 prev) { return i64(v - prev); }
+
+// ------------------------------------------ BEGIN ENCODING -----------------------------------------------------------
+
+addr_size encodeChunk(const HookEvent* events, u32 count, u8* out, u64& minTicks, u64& maxTicks) {
+    HookEvent prev = {};
+    addr_size len = 0;
+    minTicks = ~u64(0);
+    maxTicks = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        const HookEvent& e = events[i];
+        out[len++] = u8(e.op);
+        len += varintEncode(zigzagEncode(delta(e.ticks, prev.ticks)), out + len);
+        len += varintEncode(zigzagEncode(delta(e.address, prev.address)), out + len);
+        len += varintEncode(e.size, out + len);
+        len += varintEncode(zigzagEncode(i64(e.callsite) - i64(prev.callsite)), out + len);
+        len += varintEncode(zigzagEncode(i64(e.tid) - i64(prev.tid)), out + len);
+        len += varintEncode(zigzagEncode(i64(e.pid) - i64(prev.pid)), out + len);
+        prev = e;
+
+        if (e.ticks < minTicks) minTicks = e.ticks;
+        if (e.ticks > maxTicks) maxTicks = e.ticks;
+    }
+
+    return len;
+}
+
+u32 decodeChunk(const u8* in, const u8* end, u32 count, HookEvent* out) {
+    HookEvent prev = {};
+
+    for (u32 i = 0; i < count; i++) {
+        if (in >= end || *in == 0 || *in >= u8(HookOp::SENTINEL)) return 0;
+
+        HookEvent e = {};
+        e.op = HookOp(*in++);
+
+        u64 v[6];
+        for (u64& field : v) {
+            addr_size n = varintDecode(in, end, field);
+            if (n == 0) return 0;
+            in += n;
+        }
+
+        e.ticks = prev.ticks + u64(zigzagDecode(v[0]));
+        e.address = prev.address + u64(zigzagDecode(v[1]));
+        e.size = v[2];
+        e.callsite = u32(i64(prev.callsite) + zigzagDecode(v[3]));
+        e.tid = u32(i64(prev.tid) + zigzagDecode(v[4]));
+        e.pid = u32(i64(prev.pid) + zigzagDecode(v[5]));
+
+        out[i] = e;
+        prev = e;
+    }
+
+    return count;
+}
+
+// ------------------------------------------ END ENCODING -------------------------------------------------------------
+
+// ------------------------------------------ BEGIN WRITER -------------------------------------------------------------
+
+void writeChunk(Writer& w, const ChunkBuffer& chunk) {
+    MEMVIZ_ZONE("trace writeChunk");
+
+    TraceChunkHeader header = {};
+    header.magic = TRACE_CHUNK_MAGIC;
+    header.eventCount = chunk.count;
+    header.payloadBytes = u32(encodeChunk(chunk.events, chunk.count, w.scratch, header.minTicks, header.maxTicks));
+
+    fwrite(&header, sizeof(header), 1, w.file);
+    fwrite(w.scratch, 1, header.payloadBytes, w.file);
+
+    if (w.indexCount == w.indexCapacity) {
+        u32 capacity = w.indexCapacity ? w.indexCapacity * 2 : 1024;
+        TraceChunkEntry* index = metaAlloc<TraceChunkEntry>(capacity);
+        Assert(index, "Failed to grow the trace index");
+        if (w.index) core::memcopy(index, w.index, w.indexCount * sizeof(TraceChunkEntry));
+        metaFree(w.index, w.indexCapacity);
+        w.index = index;
+        w.indexCapacity = capacity;
+    }
+
+    TraceChunkEntry& entry = w.index[w.indexCount++];
+    entry.offset = w.offset;
+    entry.minTicks = header.minTicks;
+    entry.maxTicks = header.maxTicks;
+    entry.eventCount = header.eventCount;
+    entry.payloadBytes = header.payloadBytes;
+
+    w.offset += sizeof(header) + header.payloadBytes;
+    w.eventCount += chunk.count;
+}
+
+void writerMain(Writer* w) {
+    for (;;) {
+        ChunkBuffer* chunk = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(w->mutex);
+            w->queuedChanged.wait(lock, [w] { return w->queuedCount > 0 || w->stopping; });
+            if (w->queuedCount == 0) return; // stopping with nothing left
+            chunk = w->queued[0];
+            w->queuedCount--;
+            for (u32 i = 0; i < w->queuedCount; i++) w->queued[i] = w->queued[i + 1];
+        }
+
+        writeChunk(*w, *chunk);
+        chunk->count = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->freeBuffers[w->freeCount++] = chunk;
+        }
+        w->queuedChanged.notify_all();
+    }
+}
+
+// Hands the filling buffer to the writer thread and takes a free one, waiting for the writer when there is none.
+void submitFilling(Writer& w) {
+    std::unique_lock<std::mutex> lock(w.mutex);
+    w.queued[w.queuedCount++] = w.filling;
+    w.queuedChanged.notify_all();
+
+    w.queuedChanged.wait(lock, [&w] { return w.freeCount > 0; });
+    w.filling = w.freeBuffers[--w.freeCount];
+}
+
+// ------------------------------------------ END WRITER ---------------------------------------------------------------
+
+} // namespace
+
+bool traceWriterStart(const char* path) {
+    Assert(!g_writer, "traceWriterStart called twice");
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        logErr("Failed to open '{}' for writing the trace", path);
+        return false;
+    }
+
+    Writer* w = new Writer();
+    w->file = file;
+    w->scratch = metaAlloc<u8>(TRACE_CHUNK_EVENTS * MAX_RECORD_BYTES);
+    Assert(w->scratch, "Failed to allocate the trace encode buffer");
+    for (u32 i = 0; i < TRACE_WRITER_QUEUED_CHUNKS; i++) {
+        w->buffers[i].events = metaAlloc<HookEvent>(TRACE_CHUNK_EVENTS);
+        Assert(w->buffers[i].events, "Failed to allocate a trace chunk buffer");
+        if (i > 0) w->freeBuffers[w->freeCount++] = &w->buffers[i];
+    }
+    w->filling = &w->buffers[0];
+
+    TraceFileHeader header = {};
+    header.magic = TRACE_FILE_MAGIC;
+    header.version = TRACE_FILE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+    w->offset = sizeof(header);
+
+    w->thread = std::thread(writerMain, w);
+    g_writer = w;
+
+    logInfo("Saving the trace to '{}'", path);
+    return true;
+}
+
+void traceWriterAppend(u32 pid, const HookEvent* events, u32 count) {
+    Writer& w = *g_writer;
+    while (count > 0) {
+        u32 room = TRACE_CHUNK_EVENTS - w.filling->count;
+        u32 n = count < room ? count : room;
+        HookEvent* dst = w.filling->events + w.filling->count;
+        core::memcopy(dst, events, n * sizeof(HookEvent));
+        for (u32 i = 0; i < n; i++) dst[i].pid = pid;
+        w.filling->count += n;
+        events += n;
+        count -= n;
+
+        if (w.filling->count == TRACE_CHUNK_EVENTS) submitFilling(w);
+    }
+}
+
+void traceWriterStop() {
+    if (!g_writer) return;
+    Writer& w = *g_writer;
+
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.filling->count > 0) w.queued[w.queuedCount++] = w.filling;
+        w.stopping = true;
+    }
+    w.queuedChanged.notify_all();
+    w.thread.join();
+
+    // The reader uses the index in place, it has to be aligned for TraceChunkEntry.
+    static_assert(alignof(TraceChunkEntry) <= 8);
+    constexpr u8 padding[8] = {};
+    addr_size padBytes = addr_size(-w.offset & 7);
+    fwrite(padding, 1, padBytes, w.file);
+
+    TraceFooter footer = {};
+    footer.indexOffset = w.offset + padBytes;
+    footer.eventCount = w.eventCount;
+    footer.chunkCount = w.indexCount;
+    footer.version = TRACE_FILE_VERSION;
+    footer.magic = TRACE_FOOTER_MAGIC;
+    fwrite(w.index, sizeof(TraceChunkEntry), w.indexCount, w.file);
+    fwrite(&footer, sizeof(footer), 1, w.file);
+
+    bool ok = ferror(w.file) == 0;
+    ok &= fclose(w.file) == 0;
+    if (ok) logInfo("Saved {} events in {} chunks ({} bytes)", w.eventCount, w.indexCount, footer.indexOffset);
+    else    logErr("Failed writing the trace, it is incomplete");
+
+    for (ChunkBuffer& b : w.buffers) metaFree(b.events, TRACE_CHUNK_EVENTS);
+    metaFree(w.scratch, TRACE_CHUNK_EVENTS * MAX_RECORD_BYTES);
+    metaFree(w.index, w.indexCapacity);
+    delete g_writer;
+    g_writer = nullptr;
+}
+
+bool traceWriterIsActive() {
+    return g_writer != nullptr;
+}
+
+// ------------------------------------------ BEGIN READER -------------------------------------------------------------
+
+namespace {
+
+// Walks the chunk headers of a file whose footer is missing. Stops at the first chunk that is cut off.
+TraceChunkEntry* rebuildIndex(const u8* data, addr_size size, u32& chunkCount, u32& capacity, u64& eventCount) {
+    capacity = 0;
+    TraceChunkEntry* index = nullptr;
+    chunkCount = 0;
+    eventCount = 0;
+
+    addr_size offset = sizeof(TraceFileHeader);
+    while (offset + sizeof(TraceChunkHeader) <= size) {
+        TraceChunkHeader header;
+        core::memcopy(&header, data + offset, sizeof(header));
+        if (header.magic != TRACE_CHUNK_MAGIC || header.eventCount > TRACE_CHUNK_EVENTS ||
+            offset + sizeof(header) + header.payloadBytes > size) {
+            break;
+        }
+
+        if (chunkCount == capacity) {
+            u32 newCapacity = capacity ? capacity * 2 : 1024;
+            TraceChunkEntry* grown = metaAlloc<TraceChunkEntry>(newCapacity);
+            Assert(grown, "Failed to grow the rebuilt trace index");
+            if (index) core::memcopy(grown, index, chunkCount * sizeof(TraceChunkEntry));
+            metaFree(index, capacity);
+            index = grown;
+            capacity = newCapacity;
+        }
+
+        TraceChunkEntry& e = index[chunkCount++];
+        e.offset = offset;
+        e.minTicks = header.minTicks;
+        e.maxTicks = header.maxTicks;
+        e.eventCount = header.eventCount;
+        e.payloadBytes = header.payloadBytes;
+        eventCount += header.eventCount;
+
+        offset += sizeof(header) + header.payloadBytes;
+    }
+
+    return index;
+}
+
+// The footer only says where the index is. Every entry still has to hold a whole chunk that ends before the index,
+// and the counts have to add up, the readers size their output from them.
+bool indexIsValid(const TraceChunkEntry* chunks, u32 chunkCount, u64 indexOffset, u64 eventCount) {
+    u64 total = 0;
+    for (u32 i = 0; i < chunkCount; i++) {
+        const TraceChunkEntry& e = chunks[i];
+        if (e.eventCount > TRACE_CHUNK_EVENTS || e.offset < sizeof(TraceFileHeader) || e.offset > indexOffset ||
+            indexOffset - e.offset < sizeof(TraceChunkHeader) + u64(e.payloadBytes)) {
+            return false;
+        }
+        total += e.eventCount;
+    }
+    return total == eventCount;
+}
+
+void decodeWorker(const TraceFile* f, u32 first, u32 count, const u64* outOffsets, HookEvent* out,
+                  std::atomic<u32>* next, std::atomic<u64>* decoded) {
+    u64 local = 0;
+    for (u32 i = next->fetch_add(1, std::memory_order_relaxed); i < count;
+         i = next->fetch_add(1, std::memory_order_relaxed)) {
+        u32 n = traceFileDecodeChunk(*f, first + i, out + outOffsets[i]);
+        if (n == 0) core::memset(out + outOffsets[i], 0, f->chunks[first + i].eventCount * sizeof(HookEvent));
+        local += n;
+    }
+    decoded->fetch_add(local, std::memory_order_relaxed);
+}
+
+} // namespace
+
+bool traceFileOpen(const char* path, TraceFile& out) {
+    MEMVIZ_ZONE("traceFileOpen");
+
+    out = {};
+
+    i32 fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        logErr("Failed to open trace '{}'", path);
+        return false;
+    }
+    defer { close(fd); };
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || addr_size(st.st_size) < sizeof(TraceFileHeader)) {
+        logErr("'{}' is too small to be a trace", path);
+        return false;
+    }
+
+    addr_size size = addr_size(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        logErr("Failed to map trace '{}'", path);
+        return false;
+    }
+    // Chunks are decoded on demand, reading ahead would pull in the whole file.
+    madvise(mapping, size, MADV_RANDOM);
+
+    const u8* data = reinterpret_cast<const u8*>(mapping);
+    TraceFileHeader header;
+    core::memcopy(&header, data, sizeof(header));
+    if (header.magic != TRACE_FILE_MAGIC || header.version != TRACE_FILE_VERSION) {
+        logErr("'{}' is not a version {} trace", path, TRACE_FILE_VERSION);
+        munmap(mapping, size);
+        return false;
+    }
+
+    out.data = data;
+    out.size = size;
+
+    TraceFooter footer = {};
+    if (size >= sizeof(TraceFileHeader) + sizeof(TraceFooter)) {
+        core::memcopy(&footer, data + size - sizeof(footer), sizeof(footer));
+    }
+    // The mapping is page aligned, so an aligned offset is an aligned pointer.
+    bool footerValid = footer.magic == TRACE_FOOTER_MAGIC && footer.version == TRACE_FILE_VERSION &&
+                       footer.indexOffset % alignof(TraceChunkEntry) == 0 && footer.indexOffset <= size &&
+                       size - footer.indexOffset == u64(footer.chunkCount) * sizeof(TraceChunkEntry) + sizeof(footer);
+
+    const TraceChunkEntry* index = nullptr;
+    if (footerValid) {
+        index = reinterpret_cast<const TraceChunkEntry*>(data + footer.indexOffset);
+        footerValid = indexIsValid(index, footer.chunkCount, footer.indexOffset, footer.eventCount);
+        if (!footerValid) logWarn("Trace '{}' has an index that does not match its chunks", path);
+    }
+
+    if (footerValid) {
+        out.chunks = index;
+        out.chunkCount = footer.chunkCount;
+        out.eventCount = footer.eventCount;
+    }
+    else {
+        logWarn("Trace '{}' has no usable index, rebuilding it from the chunks", path);
+        out.rebuiltChunks = rebuildIndex(data, size, out.chunkCount, out.rebuiltCapacity, out.eventCount);
+        out.chunks = out.rebuiltChunks;
+        out.recovered = true;
+    }
+
+    out.maxTicksUpTo = metaAlloc<u64>(out.chunkCount);
+    Assert(out.chunkCount == 0 || out.maxTicksUpTo, "Failed to allocate the trace seek table");
+    u64 maxTicks = 0;
+    for (u32 i = 0; i < out.chunkCount; i++) {
+        if (out.chunks[i].maxTicks > maxTicks) maxTicks = out.chunks[i].maxTicks;
+        out.maxTicksUpTo[i] = maxTicks;
+    }
+
+    return true;
+}
+
+void traceFileClose(TraceFile& f) {
+    if (f.data) munmap(const_cast<u8*>(f.data), f.size);
+    metaFree(f.maxTicksUpTo, f.chunkCount);
+    metaFree(f.rebuiltChunks, f.rebuiltCapacity);
+    f = {};
+}
+
+u32 traceFileSeek(const TraceFile& f, u64 ticks) {
+    u32 lo = 0;
+    u32 hi = f.chunkCount;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (f.maxTicksUpTo[mid] < ticks) lo = mid + 1;
+        else                              hi = mid;
+    }
+    return lo;
+}
+
+u32 traceFileDecodeChunk(const TraceFile& f, u32 chunk, HookEvent* out) {
+    Assert(chunk < f.chunkCount, "Trace chunk out of range");
+
+    const TraceChunkEntry& entry = f.chunks[chunk];
+    if (entry.offset + sizeof(TraceChunkHeader) + entry.payloadBytes > f.size) return 0;
+
+    const u8* payload = f.data + entry.offset + sizeof(TraceChunkHeader);
+    return decodeChunk(payload, payload + entry.payloadBytes, entry.eventCount, out);
+}
+
+u64 traceFileDecodeChunks(const TraceFile& f, u32 first, u32 count, HookEvent* out, u32 threadCount) {
+    MEMVIZ_ZONE("traceFileDecodeChunks");
+
+    Assert(first + count <= f.chunkCount, "Trace chunk range out of range");
+    if (count == 0) return 0;
+
+    u64* outOffsets = metaAlloc<u64>(count);
+    Assert(outOffsets, "Failed to allocate the decode offsets");
+    defer { metaFree(outOffsets, count); };
+
+    u64 total = 0;
+    for (u32 i = 0; i < count; i++) {
+        outOffsets[i] = total;
+        total += f.chunks[first + i].eventCount;
+    }
+
+    // The first touch of every chunk is a page fault, hint the kernel about the whole range at once.
+    const TraceChunkEntry& last = f.chunks[first + count - 1];
+    addr_size begin = f.chunks[first].offset & ~addr_size(getpagesize() - 1);
+    addr_size end = last.offset + sizeof(TraceChunkHeader) + last.payloadBytes;
+    madvise(const_cast<u8*>(f.data) + begin, end - begin, MADV_WILLNEED);
+
+    if (threadCount > TRACE_DECODE_MAX_THREADS) threadCount = TRACE_DECODE_MAX_THREADS;
+    if (threadCount > count) threadCount = count;
+    if (threadCount == 0) threadCount = 1;
+
+    std::atomic<u32> next = 0;
+    std::atomic<u64> decoded = 0;
+    std::thread threads[TRACE_DECODE_MAX_THREADS];
+    for (u32 i = 1; i < threadCount; i++) {
+        threads[i] = std::thread(decodeWorker, &f, first, count, outOffsets, out, &next, &decoded);
+    }
+    decodeWorker(&f, first, count, outOffsets, out, &next, &decoded);
+    for (u32 i = 1; i < threadCount; i++) threads[i].join();
+
+    return decoded.load(std::memory_order_relaxed);
+}
+
+// ------------------------------------------ END READER ---------------------------------------------------------------
+
+} // namespace memviz
@@ -0,0 +1,169 @@
+#include "systems/vma_regions.h"
+
+#include "basic.h"
+#include "systems/allocators.h"
+#include "systems/profiler.h"
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 RECORDS_MIN_CAPACITY = 1024;
+constexpr u32 NAMES_MIN_CAPACITY = 64 * 1024;
+constexpr u32 COMPACT_MIN_DEAD_BYTES = 64 * 1024;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+u32 nameBytes(const VmaRecord& record) {
+    return record.nameLength > 0 ? u32(record.nameLength) + 1 : 0;
+}
+
+bool reserveRecords(VmaRegions& r, u32 needed) {
+    if (needed <= r.capacity) return true;
+    u32 capacity = r.capacity > 0 ? r.capacity : RECORDS_MIN_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    VmaRecord* records = metaAlloc<VmaRecord>(capacity);
+    VmaRecord* scratch = metaAlloc<VmaRecord>(capacity);
+    if (!records || !scratch) {
+        metaFree(records, capacity);
+        metaFree(scratch, capacity);
+        return false;
+    }
+    if (r.count > 0) core::memcopy(records, r.records, addr_size(r.count) * sizeof(VmaRecord));
+    metaFree(r.records, r.capacity);
+    metaFree(r.scratch, r.capacity);
+    r.records = records;
+    r.scratch = scratch;
+    r.capacity = capacity;
+    return true;
+}
+
+bool reserveNames(VmaRegions& r, u32 needed) {
+    if (needed <= r.namesCapacity) return true;
+    u32 capacity = r.namesCapacity > 0 ? r.namesCapacity : NAMES_MIN_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    char* names = metaAlloc<char>(capacity);
+    if (!names) return false;
+    if (r.namesLength > 0) core::memcopy(names, r.names, r.namesLength);
+    metaFree(r.names, r.namesCapacity);
+    r.names = names;
+    r.namesCapacity = capacity;
+    return true;
+}
+
+// Copies the live names into a fresh pool, dropping those of removed records.
+bool compactNames(VmaRegions& r) {
+    MEMVIZ_ZONE("vmaRegions compactNames");
+
+    u32 length = r.namesLength - r.deadNameBytes;
+    u32 capacity = length > NAMES_MIN_CAPACITY ? length : NAMES_MIN_CAPACITY;
+    char* names = metaAlloc<char>(capacity);
+    if (!names) return false;
+
+    u32 at = 0;
+    for (u32 i = 0; i < r.count; i++) {
+        VmaRecord& record = r.records[i];
+        u32 n = nameBytes(record);
+        if (n == 0) continue;
+        core::memcopy(names + at, r.names + record.nameOffset, n);
+        record.nameOffset = at;
+        at += n;
+    }
+
+    metaFree(r.names, r.namesCapacity);
+    r.names = names;
+    r.namesLength = at;
+    r.namesCapacity = capacity;
+    r.deadNameBytes = 0;
+    return true;
+}
+
+} // namespace
+
+bool vmaRegionsApply(VmaRegions& r, const VmaDelta& delta) {
+    MEMVIZ_ZONE("vmaRegionsApply");
+    r.rollup = delta.rollup;
+    if (delta.removedCount == 0 && delta.addedCount == 0) return true;
+
+    u32 addedNameBytes = 0;
+    for (u32 i = 0; i < delta.addedCount; i++) addedNameBytes += nameBytes(delta.added[i]);
+    if (!reserveRecords(r, r.count + delta.addedCount)) return false;
+    if (!reserveNames(r, r.namesLength + addedNameBytes)) return false;
+
+    // Three sorted lists: the current records, the removed and the added ones. A record is dropped when the next
+    // removed one has its start, an added one goes in before the first record starting after it.
+    u32 count = 0;
+    u32 i = 0, removed = 0, added = 0;
+    while (i < r.count || added < delta.addedCount) {
+        if (i < r.count) {
+            const VmaRecord& record = r.records[i];
+            while (removed < delta.removedCount && delta.removed[removed].start < record.start) removed++;
+            if (removed < delta.removedCount && delta.removed[removed].start == record.start) {
+                r.deadNameBytes += nameBytes(record);
+                removed++;
+                i++;
+                continue;
+            }
+            if (added == delta.addedCount || record.start <= delta.added[added].start) {
+                r.scratch[count++] = record;
+                i++;
+                continue;
+            }
+        }
+
+        VmaRecord record = delta.added[added++];
+        u32 n = nameBytes(record);
+        if (n > 0) core::memcopy(r.names + r.namesLength, delta.names + record.nameOffset, n);
+        record.nameOffset = r.namesLength;
+        r.namesLength += n;
+        r.scratch[count++] = record;
+    }
+
+    VmaRecord* records = r.records;
+    r.records = r.scratch;
+    r.scratch = records;
+    r.count = count;
+
+    if (r.deadNameBytes > COMPACT_MIN_DEAD_BYTES && r.deadNameBytes * 2 > r.namesLength) return compactNames(r);
+    return true;
+}
+
+bool vmaRegionsFind(const VmaRegions& r, u64 address, VmaRecord& out) {
+    // The last record starting at or before address.
+    u32 lo = 0, hi = r.count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (r.records[mid].start <= address) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0 || address >= r.records[lo - 1].end) return false;
+    out = r.records[lo - 1];
+    return true;
+}
+
+const char* vmaRegionName(const VmaRegions& r, const VmaRecord& record) {
+    return record.nameLength > 0 ? r.names + record.nameOffset : "";
+}
+
+void vmaRegionsClear(VmaRegions& r) {
+    metaFree(r.records, r.capacity);
+    metaFree(r.scratch, r.capacity);
+    metaFree(r.names, r.namesCapacity);
+    r = {};
+}
+
+} // namespace memviz
@@ -0,0 +1,525 @@
+#include "systems/vma_sampler.h"
+
+#include "basic.h"
+#include "platform.h"
+#include "systems/allocators.h"
+#include "systems/logger.h"
+#include "systems/profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace memviz {
+
+namespace {
+
+// ------------------------------------------ BEGIN CONSTNATS ----------------------------------------------------------
+
+constexpr u32 TEXT_MIN_CAPACITY = 64 * 1024;
+constexpr u32 LINES_MIN_CAPACITY = 1024;
+constexpr u32 RECORDS_MIN_CAPACITY = 256;
+constexpr u32 ROLLUP_CAPACITY = 4096; // smaps_rollup is about 25 short lines.
+constexpr u32 WARNINGS_PER_SECOND = 1;
+
+// ------------------------------------------ END CONSTNATS ------------------------------------------------------------
+
+// A line of the maps text, with just enough parsed to match it against the previous sample.
+struct MapsLine {
+    u64 start;
+    u32 offset;
+    u32 length;
+};
+
+struct Sample {
+    char* text;
+    u32 textLength;
+    u32 textCapacity;
+    MapsLine* lines;
+    u32 lineCount;
+    u32 lineCapacity;
+};
+
+struct DeltaBuffers {
+    VmaRecord* removed;
+    u32 removedCount;
+    u32 removedCapacity;
+    VmaRecord* added;
+    u32 addedCount;
+    u32 addedCapacity;
+    char* names;
+    u32 namesLength;
+    u32 namesCapacity;
+    VmaRollup rollup;
+    u32 vmaCount;
+    u64 sampleNs;
+    u64 sampleCostNs;
+};
+
+struct Sampler {
+    u32 pid;
+    u64 periodNs;
+    VmaSampleHook onSample;
+    i32 mapsFd;
+    i32 rollupFd; // -1 on kernels before 4.14, which have no smaps_rollup.
+
+    // samples[current] is read next, the other one is what the main thread has.
+    Sample samples[2];
+    u32 current;
+    bool hasPrevious;
+    u32 sampleCount;
+    VmaRollup rollup;
+    char rollupText[ROLLUP_CAPACITY];
+
+    // Written by the sampler while pending is false, read by the main thread while it is true.
+    DeltaBuffers delta;
+    std::atomic<bool> pending;
+    std::atomic<bool> exited;
+
+    std::mutex mutex;
+    std::condition_variable stopRequested;
+    bool stopping;
+
+    std::thread thread;
+};
+
+Sampler* g_sampler = nullptr;
+
+template <typename T>
+T* metaAlloc(addr_size count) {
+    return reinterpret_cast<T*>(core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).alloc(count, sizeof(T)));
+}
+
+template <typename T>
+void metaFree(T* p, addr_size count) {
+    if (p) core::getAllocator(core::AllocatorId(DEFAULT_ALLOCATOR_ID)).free(p, count, sizeof(T));
+}
+
+// Grows data to hold at least needed elements, keeping the first count. Buffers only ever grow, a process with a steady
+// number of VMAs stops allocating after its first samples.
+template <typename T>
+bool reserve(T*& data, u32& capacity, u32 count, u32 needed, u32 minCapacity) {
+    if (needed <= capacity) return true;
+    u32 newCapacity = capacity > 0 ? capacity : minCapacity;
+    while (newCapacity < needed) newCapacity *= 2;
+
+    T* grown = metaAlloc<T>(newCapacity);
+    if (!grown) return false;
+    if (count > 0) core::memcopy(grown, data, addr_size(count) * sizeof(T));
+    metaFree(data, capacity);
+    data = grown;
+    capacity = newCapacity;
+    return true;
+}
+
+// ------------------------------------------ BEGIN PARSING ------------------------------------------------------------
+
+inline bool parseHex(const char*& p, const char* end, u64& out) {
+    const char* begin = p;
+    u64 v = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        u32 digit;
+        if (c >= '0' && c <= '9') digit = u32(c - '0');
+        else if (c >= 'a' && c <= 'f') digit = u32(c - 'a' + 10);
+        else break;
+        v = (v << 4) | digit;
+    }
+    out = v;
+    return p > begin;
+}
+
+inline bool parseDec(const char*& p, const char* end, u64& out) {
+    const char* begin = p;
+    u64 v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) v = v * 10 + u64(*p - '0');
+    out = v;
+    return p > begin;
+}
+
+inline bool expect(const char*& p, const char* end, char c) {
+    if (p >= end || *p != c) return false;
+    p++;
+    return true;
+}
+
+inline void skipSpaces(const char*& p, const char* end) {
+    while (p < end && *p == ' ') p++;
+}
+
+inline bool startsWith(const char* s, u32 length, const char* prefix) {
+    u32 n = u32(core::cstrLen(prefix));
+    return length >= n && core::memcmp(s, prefix, n) == 0;
+}
+
+VmaKind classify(const char* name, u32 length, u8 perms) {
+    if (length == 0 || startsWith(name, length, "[anon:")) {
+        return (perms & VMA_EXEC) ? VmaKind::JIT : VmaKind::ANON;
+    }
+    if (name[0] != '[') return VmaKind::FILE;
+    if (startsWith(name, length, "[heap]")) return VmaKind::HEAP;
+    if (startsWith(name, length, "[stack")) return VmaKind::STACK; // [stack:tid] before 4.5
+    return VmaKind::SPECIAL;
+}
+
+struct RollupField {
+    const char* key;
+    u64 VmaRollup::* field;
+};
+
+constexpr RollupField ROLLUP_FIELDS[] = {
+    { "Rss:", &VmaRollup::rss },
+    { "Pss:", &VmaRollup::pss },
+    { "Pss_Anon:", &VmaRollup::pssAnon },
+    { "Pss_File:", &VmaRollup::pssFile },
+    { "Shared_Clean:", &VmaRollup::sharedClean },
+    { "Shared_Dirty:", &VmaRollup::sharedDirty },
+    { "Private_Clean:", &VmaRollup::privateClean },
+    { "Private_Dirty:", &VmaRollup::privateDirty },
+    { "AnonHugePages:", &VmaRollup::anonHugePages },
+    { "Swap:", &VmaRollup::swap },
+};
+
+// ------------------------------------------ END PARSING --------------------------------------------------------------
+
+// ------------------------------------------ BEGIN SAMPLING -----------------------------------------------------------
+
+// Reads the whole file from the start. /proc files are generated on read and report no size, the buffer grows until a
+// read comes back short of filling it.
+bool readAll(i32 fd, char*& text, u32& length, u32& capacity) {
+    length = 0;
+    for (;;) {
+        if (!reserve(text, capacity, length, length + 1, TEXT_MIN_CAPACITY)) return false;
+        ssize_t n = pread(fd, text + length, capacity - length, off_t(length));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return true;
+        length += u32(n);
+    }
+}
+
+bool scanLines(Sample& s) {
+    s.lineCount = 0;
+    const char* text = s.text;
+    const char* end = text + s.textLength;
+
+    for (const char* p = text; p < end;) {
+        const char* nl = reinterpret_cast<const char*>(memchr(p, '\n', addr_size(end - p)));
+        const char* lineEnd = nl ? nl : end;
+
+        if (s.lineCount == s.lineCapacity &&
+            !reserve(s.lines, s.lineCapacity, s.lineCount, s.lineCount + 1, LINES_MIN_CAPACITY)) {
+            return false;
+        }
+        MapsLine& line = s.lines[s.lineCount++];
+        const char* cursor = p;
+        parseHex(cursor, lineEnd, line.start);
+        line.offset = u32(p - text);
+        line.length = u32(lineEnd - p);
+
+        p = lineEnd + 1;
+    }
+    return true;
+}
+
+bool emitRecord(DeltaBuffers& d, bool added, const char* line, u32 length) {
+    VmaRecord r;
+    if (!vmaParseLine(line, length, r)) {
+        logWarnTaggedLimited(WARNINGS_PER_SECOND, INGEST_TAG, "Skipping a maps line that does not parse");
+        return true;
+    }
+
+    // Names are copied out and terminated, the sample text gets reused while the main thread reads the delta.
+    u32 nameBytes = r.nameLength > 0 ? u32(r.nameLength) + 1 : 0;
+    if (!reserve(d.names, d.namesCapacity, d.namesLength, d.namesLength + nameBytes, TEXT_MIN_CAPACITY)) return false;
+    if (nameBytes > 0) {
+        core::memcopy(d.names + d.namesLength, line + r.nameOffset, r.nameLength);
+        d.names[d.namesLength + r.nameLength] = '\0';
+    }
+    r.nameOffset = d.namesLength;
+    d.namesLength += nameBytes;
+
+    VmaRecord*& records = added ? d.added : d.removed;
+    u32& count = added ? d.addedCount : d.removedCount;
+    u32& capacity = added ? d.addedCapacity : d.removedCapacity;
+    if (!reserve(records, capacity, count, count + 1, RECORDS_MIN_CAPACITY)) return false;
+    records[count++] = r;
+    return true;
+}
+
+// Both samples are sorted by start, the kernel lists VMAs in address order.
+bool diffSamples(const Sample& prev, const Sample& cur, DeltaBuffers& d) {
+    u32 i = 0, j = 0;
+    while (i < prev.lineCount || j < cur.lineCount) {
+        const MapsLine* p = i < prev.lineCount ? &prev.lines[i] : nullptr;
+        const MapsLine* c = j < cur.lineCount ? &cur.lines[j] : nullptr;
+
+        if (p && (!c || p->start < c->start)) {
+            if (!emitRecord(d, false, prev.text + p->offset, p->length)) return false;
+            i++;
+        }
+        else if (c && (!p || c->start < p->start)) {
+            if (!emitRecord(d, true, cur.text + c->offset, c->length)) return false;
+            j++;
+        }
+        else {
+            bool same = p->length == c->length &&
+                        core::memcmp(prev.text + p->offset, cur.text + c->offset, p->length) == 0;
+            if (!same) {
+                if (!emitRecord(d, false, prev.text + p->offset, p->length)) return false;
+                if (!emitRecord(d, true, cur.text + c->offset, c->length)) return false;
+            }
+            i++;
+            j++;
+        }
+    }
+    return true;
+}
+
+VmaDelta deltaView(const DeltaBuffers& d) {
+    VmaDelta delta = {};
+    delta.removed = d.removed;
+    delta.removedCount = d.removedCount;
+    delta.added = d.added;
+    delta.addedCount = d.addedCount;
+    delta.names = d.names;
+    delta.rollup = d.rollup;
+    delta.vmaCount = d.vmaCount;
+    delta.sampleNs = d.sampleNs;
+    delta.sampleCostNs = d.sampleCostNs;
+    return delta;
+}
+
+// Returns false once the process is gone.
+bool takeSample(Sampler& s, u64 nowNs) {
+    MEMVIZ_ZONE("vma sample");
+
+    Sample& cur = s.samples[s.current];
+    Sample& prev = s.samples[s.current ^ 1];
+    // An exited process has an empty maps file, or reading it fails with ESRCH.
+    if (!readAll(s.mapsFd, cur.text, cur.textLength, cur.textCapacity) || cur.textLength == 0) return false;
+
+    DeltaBuffers& d = s.delta;
+    d.removedCount = 0;
+    d.addedCount = 0;
+    d.namesLength = 0;
+    d.sampleNs = nowNs;
+
+    if (s.rollupFd >= 0 && s.sampleCount % VMA_SAMPLER_ROLLUP_EVERY == 0) {
+        ssize_t n = pread(s.rollupFd, s.rollupText, ROLLUP_CAPACITY, 0);
+        if (n > 0) vmaParseRollup(s.rollupText, u32(n), s.rollup);
+    }
+    d.rollup = s.rollup;
+    s.sampleCount++;
+
+    // Most samples of a settled process are identical, one compare of the whole text and done.
+    bool unchanged = s.hasPrevious && cur.textLength == prev.textLength &&
+                     core::memcmp(cur.text, prev.text, cur.textLength) == 0;
+    if (unchanged) {
+        d.vmaCount = prev.lineCount;
+    }
+    else {
+        if (!scanLines(cur)) return false;
+        if (!s.hasPrevious) prev.lineCount = 0;
+        if (!diffSamples(prev, cur, d)) {
+            logErrTagged(INGEST_TAG, "Out of memory diffing the maps of {}", s.pid);
+            return false;
+        }
+        d.vmaCount = cur.lineCount;
+        s.current ^= 1;
+        s.hasPrevious = true;
+    }
+
+    d.sampleCostNs = Platform::getMonotonicTimeNs() - nowNs;
+    return true;
+}
+
+void samplerMain(Sampler* s) {
+    u64 nextNs = Platform::getMonotonicTimeNs();
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            u64 nowNs = Platform::getMonotonicTimeNs();
+            if (nextNs > nowNs) {
+                s->stopRequested.wait_for(lock, std::chrono::nanoseconds(nextNs - nowNs), [s] { return s->stopping; });
+            }
+            if (s->stopping) return;
+        }
+
+        u64 startNs = Platform::getMonotonicTimeNs();
+        u64 periodNs = s->periodNs;
+
+        // The main thread has not taken the last delta yet. Diffing against what it has keeps the next delta complete.
+        if (!s->pending.load(std::memory_order_acquire)) {
+            if (!takeSample(*s, startNs)) {
+                s->exited.store(true, std::memory_order_release);
+                Platform::wakeUp();
+                return;
+            }
+            if (s->onSample) s->onSample(deltaView(s->delta));
+            s->pending.store(true, std::memory_order_release);
+            Platform::wakeUp();
+
+            u64 costNs = Platform::getMonotonicTimeNs() - startNs;
+            u64 budgetNs = costNs * 100 / VMA_SAMPLER_MAX_DUTY_PERCENT;
+            if (budgetNs > periodNs) {
+                logWarnTaggedLimited(WARNINGS_PER_SECOND, INGEST_TAG,
+                                     "Sampling {} VMAs took {}us, sampling less often", s->delta.vmaCount,
+                                     costNs / 1000);
+                periodNs = budgetNs;
+            }
+        }
+
+        nextNs = startNs + periodNs;
+    }
+}
+
+// ------------------------------------------ END SAMPLING -------------------------------------------------------------
+
+void freeSampler(Sampler* s) {
+    if (s->mapsFd >= 0) close(s->mapsFd);
+    if (s->rollupFd >= 0) close(s->rollupFd);
+    for (Sample& sample : s->samples) {
+        metaFree(sample.text, sample.textCapacity);
+        metaFree(sample.lines, sample.lineCapacity);
+    }
+    metaFree(s->delta.removed, s->delta.removedCapacity);
+    metaFree(s->delta.added, s->delta.addedCapacity);
+    metaFree(s->delta.names, s->delta.namesCapacity);
+    delete s;
+}
+
+} // namespace
+
+bool vmaParseLine(const char* line, u32 length, VmaRecord& out) {
+    // start-end perms offset major:minor inode [name]
+    const char* p = line;
+    const char* end = line + length;
+    out = {};
+
+    u64 major, minor;
+    if (!parseHex(p, end, out.start) || !expect(p, end, '-') || !parseHex(p, end, out.end)) return false;
+    if (!expect(p, end, ' ') || end - p < 5) return false;
+    if (p[0] == 'r') out.perms |= VMA_READ;
+    if (p[1] == 'w') out.perms |= VMA_WRITE;
+    if (p[2] == 'x') out.perms |= VMA_EXEC;
+    if (p[3] == 's') out.perms |= VMA_SHARED;
+    p += 4;
+    if (!expect(p, end, ' ') || !parseHex(p, end, out.offset)) return false;
+    if (!expect(p, end, ' ') || !parseHex(p, end, major) || !expect(p, end, ':') || !parseHex(p, end, minor)) {
+        return false;
+    }
+    if (!expect(p, end, ' ') || !parseDec(p, end, out.inode)) return false;
+    out.dev = u32(major << 20 | minor);
+
+    skipSpaces(p, end);
+    u32 nameLength = u32(end - p);
+    out.nameOffset = u32(p - line);
+    out.nameLength = nameLength > UINT16_MAX ? u16(UINT16_MAX) : u16(nameLength);
+    out.kind = classify(p, nameLength, out.perms);
+    return true;
+}
+
+bool vmaParseRollup(const char* text, u32 length, VmaRollup& out) {
+    out = {};
+    const char* end = text + length;
+    bool any = false;
+
+    // The first line is the address range the rollup covers, it matches no key.
+    for (const char* p = text; p < end;) {
+        const char* nl = reinterpret_cast<const char*>(memchr(p, '\n', addr_size(end - p)));
+        const char* lineEnd = nl ? nl : end;
+
+        for (const RollupField& f : ROLLUP_FIELDS) {
+            if (!startsWith(p, u32(lineEnd - p), f.key)) continue;
+            const char* v = p + core::cstrLen(f.key);
+            skipSpaces(v, lineEnd);
+            u64 kib;
+            if (parseDec(v, lineEnd, kib)) {
+                out.*f.field = kib * 1024;
+                any = true;
+            }
+            break;
+        }
+
+        p = lineEnd + 1;
+    }
+    return any;
+}
+
+bool vmaSamplerStart(u32 pid, u32 hz, VmaSampleHook onSample) {
+    Assert(!g_sampler, "vmaSamplerStart called twice");
+    if (hz == 0) return false;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+    i32 mapsFd = open(path, O_RDONLY | O_CLOEXEC);
+    if (mapsFd < 0) {
+        logErrTagged(INGEST_TAG, "Failed to open {}, errno={}", path, errno);
+        return false;
+    }
+    snprintf(path, sizeof(path), "/proc/%u/smaps_rollup", pid);
+    i32 rollupFd = open(path, O_RDONLY | O_CLOEXEC);
+    if (rollupFd < 0) logWarnTagged(INGEST_TAG, "No {}, sampling VMAs without totals", path);
+
+    Sampler* s = new Sampler();
+    s->pid = pid;
+    s->periodNs = 1'000'000'000ull / hz;
+    s->onSample = onSample;
+    s->mapsFd = mapsFd;
+    s->rollupFd = rollupFd;
+    s->thread = std::thread(samplerMain, s);
+    g_sampler = s;
+
+    logInfoTagged(INGEST_TAG, "Sampling the VMAs of {} {} times per second", pid, hz);
+    return true;
+}
+
+void vmaSamplerStop() {
+    if (!g_sampler) return;
+    Sampler* s = g_sampler;
+
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->stopping = true;
+    }
+    s->stopRequested.notify_all();
+    s->thread.join();
+
+    freeSampler(s);
+    g_sampler = nullptr;
+}
+
+bool vmaSamplerIsActive() {
+    return g_sampler != nullptr;
+}
+
+bool vmaSamplerUpdate(VmaDeltaSink sink) {
+    if (!g_sampler) return false;
+    Sampler& s = *g_sampler;
+
+    if (s.pending.load(std::memory_order_acquire)) {
+        sink(s.pid, deltaView(s.delta));
+        s.pending.store(false, std::memory_order_release);
+    }
+
+    if (s.exited.load(std::memory_order_acquire)) {
+        logInfoTagged(INGEST_TAG, "Process {} exited, stopped sampling its VMAs", s.pid);
+        vmaSamplerStop();
+        return false;
+    }
+    return true;
+}
+
+} // namespace memviz
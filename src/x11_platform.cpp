@@ -4,12 +4,22 @@
 #include "error.h"
 
 #include "systems/logger.h"
+#include "systems/profiler.h"
+#include "linux_event_waiter.h"
+#include "platform_events.h"
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <error.h>
 
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdlib.h>
+#endif
+
 #if defined(MEMVIZ_USE_VULKAN)
 #include "systems/renderer/vulkan_backend.h"
 #endif
@@ -23,16 +33,34 @@ Window g_window = 0;
 Atom g_wmDeleteWindow;
 [[maybe_unused]] bool g_initialized = false; // Probably won't use this in release builds.
 
-WindowCloseCallback windowCloseCallbackX11 = nullptr;
-WindowResizeCallback windowResizeCallbackX11 = nullptr;
-WindowFocusCallback windowFocusCallbackX11 = nullptr;
+// X server time of the last event that carried one. Window and focus events have no timestamp and reuse this.
+u32 g_lastServerTimeMs = 0;
+
+// Requests that fail report asynchronously; comparing this before and after an XSync tells whether they succeeded.
+u32 g_xErrorCount = 0;
+
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+
+constexpr u32 MAX_SOFTWARE_FRAMEBUFFERS = 4;
 
-KeyCallback keyCallbackX11 = nullptr;
+struct SoftwareImage {
+    XImage* image;
+    XShmSegmentInfo shm;
+    bool inUse;
+    bool useShm;         // Otherwise the pixels are in client memory and every present copies them over the socket.
+    bool presentPending; // An XShmPutImage was sent and its completion event not yet seen.
+};
 
-MouseClickCallback mouseClickCallbackX11 = nullptr;
-MouseMoveCallback mouseMoveCallbackX11 = nullptr;
-MouseScrollCallback mouseScrollCallbackX11 = nullptr;
-MouseEnterOrLeaveCallback mouseEnterOrLeaveCallbackX11 = nullptr;
+SoftwareImage g_softwareImages[MAX_SOFTWARE_FRAMEBUFFERS] = {};
+GC g_softwareGC = nullptr;
+bool g_shmChecked = false;
+bool g_shmAvailable = false;
+i32 g_shmCompletionEventType = -1;
+
+bool handleShmCompletion(XEvent& xevent);
+void destroySoftwareImage(SoftwareImage& img);
+
+#endif
 
 i32 handleXError(Display* display, XErrorEvent* errorEvent);
 
@@ -108,6 +136,10 @@ Error Platform::init(const char *windowTitle, i32 windowWidth, i32 windowHeight)
     // Informs the window manager that the application wants to handle the WM_DELETE_WINDOW message.
     XSetWMProtocols(g_display, g_window, &g_wmDeleteWindow, 1);
 
+    if (Error err = linuxEventWaiterInit(XConnectionNumber(g_display)); err != Error::OK) {
+        return err;
+    }
+
     // Maps the window on the screen, making it visible.
     XMapWindow(g_display, g_window);
     // Flushes all pending requests to the X server.
@@ -123,6 +155,23 @@ Error Platform::init(const char *windowTitle, i32 windowWidth, i32 windowHeight)
 void Platform::shutdown() {
     g_initialized = false; // Mark the platform as uninitialized
 
+    PlatformEventStats stats = Platform::getEventStats();
+    logInfoTagged(
+        LogTag::PLATFORM_TAG,
+        "Event stats: received={}, dispatched={}, coalesced={}, dropped={}, batches={}, max batch={}",
+        stats.received, stats.dispatched, stats.coalesced, stats.dropped, stats.batches, stats.maxBatchSize
+    );
+
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+    for (u32 i = 0; i < MAX_SOFTWARE_FRAMEBUFFERS; i++) {
+        if (g_softwareImages[i].inUse) destroySoftwareImage(g_softwareImages[i]);
+    }
+    if (g_softwareGC) {
+        XFreeGC(g_display, g_softwareGC);
+        g_softwareGC = nullptr;
+    }
+#endif
+
     if (g_window) {
         XDestroyWindow(g_display, g_window);
         g_window = 0;
@@ -135,6 +184,8 @@ void Platform::shutdown() {
         XCloseDisplay(g_display);
         g_display = nullptr;
     }
+
+    linuxEventWaiterShutdown();
 }
 
 namespace {
@@ -150,160 +201,186 @@ constexpr inline KeyboardModifiers getModifiers (u32 m) {
     return ret;
 }
 
-inline void handleMouseClickEvent(XEvent& ev, bool isPress) {
-    KeyboardModifiers mods = getModifiers(ev.xbutton.state);
-    i32 x = i32(ev.xbutton.x);
-    i32 y = i32(ev.xbutton.y);
-
-    if (mouseScrollCallbackX11) {
-        if (ev.xbutton.button == Button4) {
-            mouseScrollCallbackX11(MouseScrollDirection::UP, x, y);
-            return;
-        }
-        else if (ev.xbutton.button == Button5) {
-            mouseScrollCallbackX11(MouseScrollDirection::DOWN, x, y);
-            return;
-        }
+inline void translateMouseButtonEvent(XEvent& xevent, bool isPress, PlatformEvent& out) {
+    KeyboardModifiers mods = getModifiers(xevent.xbutton.state);
+    i32 x = i32(xevent.xbutton.x);
+    i32 y = i32(xevent.xbutton.y);
+
+    // X11 reports the scroll wheel as buttons 4 and 5.
+    if (xevent.xbutton.button == Button4 || xevent.xbutton.button == Button5) {
+        out.type = PlatformEventType::MOUSE_SCROLL;
+        out.scroll.direction = xevent.xbutton.button == Button4 ? MouseScrollDirection::UP : MouseScrollDirection::DOWN;
+        out.scroll.x = x;
+        out.scroll.y = y;
+        return;
     }
 
-    if (mouseClickCallbackX11) {
-        if (ev.xbutton.button == Button1) {
-            mouseClickCallbackX11(MouseButton::LEFT, isPress, x, y, mods);
-            return;
-        }
-        else if (ev.xbutton.button == Button2) {
-            mouseClickCallbackX11(MouseButton::MIDDLE, isPress, x, y, mods);
-            return;
-        }
-        else if (ev.xbutton.button == Button3) {
-            mouseClickCallbackX11(MouseButton::RIGHT, isPress, x, y, mods);
-            return;
-        }
-        else {
-            mouseClickCallbackX11(MouseButton::NONE, isPress, x, y, mods);
-            logDebugTagged(PLATFORM_TAG, "Unknown Mouse Button");
-            return;
-        }
-    }
-}
+    out.type = PlatformEventType::MOUSE_CLICK;
+    out.click.isPress = isPress;
+    out.click.x = x;
+    out.click.y = y;
+    out.click.mods = mods;
 
-inline void handleKeyEvent(XEvent& ev, bool isPress) {
-    if (keyCallbackX11) {
-        u32 vkcode = u32(XLookupKeysym(&ev.xkey, 0));
-        u32 scancode = ev.xkey.keycode;
-        KeyboardModifiers mods = getModifiers(ev.xkey.state);
-        keyCallbackX11(vkcode, scancode, isPress, mods);
+    switch (xevent.xbutton.button) {
+        case Button1: out.click.button = MouseButton::LEFT; break;
+        case Button2: out.click.button = MouseButton::MIDDLE; break;
+        case Button3: out.click.button = MouseButton::RIGHT; break;
+        default:
+            out.click.button = MouseButton::NONE;
+            logTagged(Debug, PLATFORM_TAG, "Unknown Mouse Button");
+            break;
     }
 }
 
-} // namespace
+inline void translateKeyEvent(XEvent& xevent, bool isPress, PlatformEvent& out) {
+    out.type = PlatformEventType::KEY;
+    out.key.vkcode = u32(XLookupKeysym(&xevent.xkey, 0));
+    out.key.scancode = xevent.xkey.keycode;
+    out.key.isPress = isPress;
+    out.key.mods = getModifiers(xevent.xkey.state);
+}
 
-Error Platform::pollEvents(bool block) {
-    Assert(g_initialized, "Platform layer not initialized");
+// Returns false for events the platform layer does not forward.
+bool translateEvent(XEvent& xevent, PlatformEvent& out) {
+    out = {};
 
-    if (!block && !XPending(g_display)) {
-        return Error::OK;
+    switch (xevent.type) {
+        case KeyPress: [[fallthrough]];
+        case KeyRelease:    g_lastServerTimeMs = u32(xevent.xkey.time); break;
+        case ButtonPress: [[fallthrough]];
+        case ButtonRelease: g_lastServerTimeMs = u32(xevent.xbutton.time); break;
+        case MotionNotify:  g_lastServerTimeMs = u32(xevent.xmotion.time); break;
+        case EnterNotify: [[fallthrough]];
+        case LeaveNotify:   g_lastServerTimeMs = u32(xevent.xcrossing.time); break;
+        default: break;
     }
-
-    XEvent xevent;
-    XNextEvent(g_display, &xevent);
+    out.timeMs = g_lastServerTimeMs;
 
     switch (xevent.type) {
         case DestroyNotify: {
             XDestroyWindowEvent* e = reinterpret_cast<XDestroyWindowEvent*>(&xevent);
-            if(e->window == g_window) {
-                XSync(g_display, true);
-                if (windowCloseCallbackX11) windowCloseCallbackX11();
-                return Error::OK;
-            }
-
-            break;
+            if (e->window != g_window) return false;
+            out.type = PlatformEventType::WINDOW_CLOSE;
+            return true;
         }
         case ClientMessage: {
-            if (Atom(xevent.xclient.data.l[0]) == g_wmDeleteWindow) {
-                XSync(g_display, true);
-                if (windowCloseCallbackX11) windowCloseCallbackX11();
-                return Error::OK;
-            }
-            break;
+            if (Atom(xevent.xclient.data.l[0]) != g_wmDeleteWindow) return false;
+            out.type = PlatformEventType::WINDOW_CLOSE;
+            return true;
         }
 
         case ConfigureNotify:
-            if (windowResizeCallbackX11) {
-                i32 w = i32(xevent.xconfigure.width);
-                i32 h = i32(xevent.xconfigure.height);
-                windowResizeCallbackX11(w, h);
-            }
-            return Error::OK;
+            out.type = PlatformEventType::WINDOW_RESIZE;
+            out.resize.w = i32(xevent.xconfigure.width);
+            out.resize.h = i32(xevent.xconfigure.height);
+            return true;
 
         case ButtonPress:
-            handleMouseClickEvent(xevent, true);
-            return Error::OK;
+            translateMouseButtonEvent(xevent, true, out);
+            return true;
 
         case ButtonRelease:
-            handleMouseClickEvent(xevent, false);
-            return Error::OK;
+            translateMouseButtonEvent(xevent, false, out);
+            return true;
 
         case KeyPress:
-            handleKeyEvent(xevent, true);
-            return Error::OK;
+            translateKeyEvent(xevent, true, out);
+            return true;
 
         case KeyRelease:
-            handleKeyEvent(xevent, false);
-            return Error::OK;
-
-        case MotionNotify: {
-            if (mouseMoveCallbackX11) {
-                i32 x = i32(xevent.xmotion.x);
-                i32 y = i32(xevent.xmotion.y);
-                mouseMoveCallbackX11(x, y);
-            }
-            return Error::OK;
-        }
+            translateKeyEvent(xevent, false, out);
+            return true;
 
-        case EnterNotify: {
-            if (mouseEnterOrLeaveCallbackX11) {
-                // i32 x = xevent.xcrossing.x;
-                // i32 y = xevent.xcrossing.y;
-                mouseEnterOrLeaveCallbackX11(true);
-            }
-            return Error::OK;
-        }
+        case MotionNotify:
+            out.type = PlatformEventType::MOUSE_MOVE;
+            out.move.x = i32(xevent.xmotion.x);
+            out.move.y = i32(xevent.xmotion.y);
+            return true;
 
-        case LeaveNotify: {
-            if (mouseEnterOrLeaveCallbackX11) {
-                // i32 x = xevent.xcrossing.x;
-                // i32 y = xevent.xcrossing.y;
-                mouseEnterOrLeaveCallbackX11(false);
-            }
-            return Error::OK;
-        }
+        case EnterNotify:
+            out.type = PlatformEventType::MOUSE_ENTER_OR_LEAVE;
+            out.crossing.enter = true;
+            return true;
+
+        case LeaveNotify:
+            out.type = PlatformEventType::MOUSE_ENTER_OR_LEAVE;
+            out.crossing.enter = false;
+            return true;
 
         case FocusIn:
-            if (windowFocusCallbackX11) windowFocusCallbackX11(true);
-            return Error::OK;
+            out.type = PlatformEventType::WINDOW_FOCUS;
+            out.focus.gain = true;
+            return true;
 
         case FocusOut:
-            if (windowFocusCallbackX11) windowFocusCallbackX11(false);
-            return Error::OK;
+            out.type = PlatformEventType::WINDOW_FOCUS;
+            out.focus.gain = false;
+            return true;
 
         default:
-            break;
+            return false;
+    }
+}
+
+} // namespace
+
+Error Platform::pollEvents(bool block) {
+    Assert(g_initialized, "Platform layer not initialized");
+    MEMVIZ_ZONE("Platform::pollEvents");
+
+    // XPending flushes the output buffer and reads whatever the server has sent so far.
+    i32 pending = XPending(g_display);
+    if (pending == 0 && block && platformEventRingEmpty()) {
+        pending = 1; // XNextEvent will block until the first event arrives.
     }
 
+    u32 batchSize = 0;
+    while (pending > 0) {
+        for (i32 i = 0; i < pending; i++) {
+            XEvent xevent;
+            XNextEvent(g_display, &xevent);
+
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+            if (handleShmCompletion(xevent)) continue;
+#endif
+
+            PlatformEvent ev;
+            if (translateEvent(xevent, ev)) platformEventRingPush(ev);
+            else                            platformEventDropped();
+        }
+        batchSize += u32(pending);
+
+        // Pick up events that were read from the connection while draining, without another round trip.
+        pending = XEventsQueued(g_display, QueuedAlready);
+    }
+
+    platformEventRingFlush(batchSize);
+
     return Error::OK;
 }
 
-void Platform::registerWindowCloseCallback(WindowCloseCallback cb) { windowCloseCallbackX11 = cb; }
-void Platform::registerWindowResizeCallback(WindowResizeCallback cb) { windowResizeCallbackX11 = cb; }
-void Platform::registerWindowFocusCallback(WindowFocusCallback cb) { windowFocusCallbackX11 = cb; }
+void Platform::pushEvent(const PlatformEvent& ev) {
+    platformEventRingPush(ev);
+}
+
+Error Platform::waitEvents(u64 deadlineNs) {
+    Assert(g_initialized, "Platform layer not initialized");
 
-void Platform::registerKeyCallback(KeyCallback cb) { keyCallbackX11 = cb; }
+    // Requests must reach the server before sleeping, otherwise the replies we are waiting for never come.
+    XFlush(g_display);
 
-void Platform::registerMouseClickCallback(MouseClickCallback cb) { mouseClickCallbackX11 = cb; }
-void Platform::registerMouseMoveCallback(MouseMoveCallback cb) { mouseMoveCallbackX11 = cb; }
-void Platform::registerMouseScrollCallback(MouseScrollCallback cb) { mouseScrollCallbackX11 = cb; }
-void Platform::registerMouseEnterOrLeaveCallback(MouseEnterOrLeaveCallback cb) { mouseEnterOrLeaveCallbackX11 = cb; }
+    // Events already read into Xlib's queue will not make the socket readable again.
+    if (XEventsQueued(g_display, QueuedAlready) > 0 || !platformEventRingEmpty()) {
+        return Error::OK;
+    }
+
+    return linuxEventWaiterWait(deadlineNs);
+}
+
+void Platform::wakeUp() { linuxEventWaiterWakeUp(); }
+bool Platform::watchFd(i32 fd) { return linuxEventWaiterWatchFd(fd); }
+void Platform::unwatchFd(i32 fd) { linuxEventWaiterUnwatchFd(fd); }
+u64 Platform::getMonotonicTimeNs() { return linuxMonotonicNowNs(); }
 
 void Platform::requiredVulkanExtsCount(i32& count) {
     count = 1;
@@ -315,7 +392,8 @@ void Platform::requiredVulkanExts([[maybe_unused]] const char** extensions) {
 #endif
 }
 
-Error Platform::createVulkanSurface(VkInstance instance, VkSurfaceKHR& outSurface) {
+Error Platform::createVulkanSurface(VkInstance instance, const VkAllocationCallbacks* allocator,
+                                     VkSurfaceKHR& outSurface) {
 #if defined(MEMVIZ_USE_VULKAN)
     Assert(g_initialized, "Platform Layer needs to be initialized");
 
@@ -324,7 +402,7 @@ Error Platform::createVulkanSurface(VkInstance instance, VkSurfaceKHR& outSurfac
     createInfo.dpy = g_display;
     createInfo.window = g_window;
 
-    VkResult vres = vkCreateXlibSurfaceKHR(instance, &createInfo, nullptr, &outSurface);
+    VkResult vres = vkCreateXlibSurfaceKHR(instance, &createInfo, allocator, &outSurface);
     if (vres != VK_SUCCESS) {
         // This could technically be a render error as well.
         return Error::FAILED_TO_CREATE_X11_KHR_XLIB_SURFACE;
@@ -356,8 +434,182 @@ bool Platform::getFrameBufferSize(u32& width, u32& height) {
     return true;
 }
 
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+
+bool Platform::createSoftwareFramebuffer(u32 width, u32 height, SoftwareFramebuffer& out) {
+    Assert(g_initialized, "Platform Layer needs to be initialized");
+
+    out = {};
+
+    SoftwareImage* img = nullptr;
+    for (u32 i = 0; i < MAX_SOFTWARE_FRAMEBUFFERS; i++) {
+        if (!g_softwareImages[i].inUse) {
+            img = &g_softwareImages[i];
+            break;
+        }
+    }
+    if (!img || width == 0 || height == 0) return false;
+
+    i32 screen = DefaultScreen(g_display);
+    Visual* visual = DefaultVisual(g_display, screen);
+    i32 depth = DefaultDepth(g_display, screen);
+    if ((depth != 24 && depth != 32) ||
+        visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff) {
+        logErrTagged(PLATFORM_TAG, "Software framebuffers need a 24 bit RGB visual, the default visual has depth {}",
+                     depth);
+        return false;
+    }
+
+    if (!g_softwareGC) {
+        g_softwareGC = XCreateGC(g_display, g_window, 0, nullptr);
+    }
+
+    if (!g_shmChecked) {
+        g_shmChecked = true;
+        g_shmAvailable = XShmQueryExtension(g_display);
+        if (g_shmAvailable) g_shmCompletionEventType = XShmGetEventBase(g_display) + ShmCompletion;
+        else                logWarnTagged(PLATFORM_TAG, "MIT-SHM is not available, presenting will copy every frame");
+    }
+
+    *img = {};
+
+    if (g_shmAvailable) {
+        img->image = XShmCreateImage(g_display, visual, u32(depth), ZPixmap, nullptr, &img->shm, width, height);
+        if (img->image) {
+            addr_size size = addr_size(img->image->bytes_per_line) * addr_size(height);
+            img->shm.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+            img->shm.shmaddr = img->shm.shmid >= 0 ? reinterpret_cast<char*>(shmat(img->shm.shmid, nullptr, 0))
+                                                   : reinterpret_cast<char*>(-1);
+            img->shm.readOnly = False;
+
+            // Attaching fails with BadAccess when the server runs on another machine. That only shows up as an
+            // error after the round trip.
+            u32 errorsBefore = g_xErrorCount;
+            bool attached = img->shm.shmaddr != reinterpret_cast<char*>(-1) && XShmAttach(g_display, &img->shm);
+            if (attached) XSync(g_display, False);
+
+            // Removed right away so the segment can not leak if the process dies. It lives until both sides detach.
+            if (img->shm.shmid >= 0) shmctl(img->shm.shmid, IPC_RMID, nullptr);
+
+            if (attached && g_xErrorCount == errorsBefore) {
+                img->image->data = img->shm.shmaddr;
+                img->useShm = true;
+            }
+            else {
+                logWarnTagged(PLATFORM_TAG, "Failed to attach a MIT-SHM segment, presenting will copy every frame");
+                if (img->shm.shmaddr != reinterpret_cast<char*>(-1)) shmdt(img->shm.shmaddr);
+                XDestroyImage(img->image);
+                img->image = nullptr;
+                g_shmAvailable = false;
+            }
+        }
+    }
+
+    if (!img->useShm) {
+        char* data = reinterpret_cast<char*>(malloc(addr_size(width) * addr_size(height) * sizeof(u32)));
+        if (!data) return false;
+        // XDestroyImage frees data.
+        img->image = XCreateImage(g_display, visual, u32(depth), ZPixmap, 0, data, width, height, 32, 0);
+        if (!img->image) {
+            free(data);
+            return false;
+        }
+    }
+
+    img->inUse = true;
+
+    out.pixels = reinterpret_cast<u32*>(img->image->data);
+    out.width = width;
+    out.height = height;
+    out.stride = u32(img->image->bytes_per_line) / sizeof(u32);
+    out.native = img;
+    return true;
+}
+
+void Platform::destroySoftwareFramebuffer(SoftwareFramebuffer& fb) {
+    if (fb.native) {
+        SoftwareImage& img = *reinterpret_cast<SoftwareImage*>(fb.native);
+        Platform::waitSoftwareFramebuffer(fb);
+        destroySoftwareImage(img);
+    }
+    fb = {};
+}
+
+void Platform::presentSoftwareFramebuffer(SoftwareFramebuffer& fb) {
+    Assert(g_initialized, "Platform Layer needs to be initialized");
+
+    SoftwareImage& img = *reinterpret_cast<SoftwareImage*>(fb.native);
+    if (img.useShm) {
+        // send_event = True: the server reports an ShmCompletion event once it is done reading the segment.
+        XShmPutImage(g_display, g_window, g_softwareGC, img.image, 0, 0, 0, 0, fb.width, fb.height, True);
+        img.presentPending = true;
+    }
+    else {
+        XPutImage(g_display, g_window, g_softwareGC, img.image, 0, 0, 0, 0, fb.width, fb.height);
+    }
+    XFlush(g_display);
+}
+
+void Platform::waitSoftwareFramebuffer(SoftwareFramebuffer& fb) {
+    SoftwareImage& img = *reinterpret_cast<SoftwareImage*>(fb.native);
+    if (!img.presentPending) return;
+
+    // Only takes the matching completion event out of the queue, everything else stays for pollEvents.
+    auto isCompletion = [](Display*, XEvent* ev, XPointer arg) -> Bool {
+        auto* target = reinterpret_cast<SoftwareImage*>(arg);
+        return ev->type == g_shmCompletionEventType &&
+               reinterpret_cast<XShmCompletionEvent*>(ev)->shmseg == target->shm.shmseg;
+    };
+
+    XEvent xevent;
+    XIfEvent(g_display, &xevent, isCompletion, reinterpret_cast<XPointer>(&img));
+    img.presentPending = false;
+}
+
+#else
+
+bool Platform::createSoftwareFramebuffer(u32, u32, SoftwareFramebuffer& out) {
+    out = {};
+    return false;
+}
+
+void Platform::destroySoftwareFramebuffer(SoftwareFramebuffer& fb) { fb = {}; }
+void Platform::presentSoftwareFramebuffer(SoftwareFramebuffer&) {}
+void Platform::waitSoftwareFramebuffer(SoftwareFramebuffer&) {}
+
+#endif
+
 namespace {
 
+#if defined(MEMVIZ_USE_SOFTWARE_RENDERER)
+
+// Completion of a present nobody waited for yet. Consumed here, it is not an input event.
+bool handleShmCompletion(XEvent& xevent) {
+    if (xevent.type != g_shmCompletionEventType) return false;
+
+    auto* e = reinterpret_cast<XShmCompletionEvent*>(&xevent);
+    for (u32 i = 0; i < MAX_SOFTWARE_FRAMEBUFFERS; i++) {
+        SoftwareImage& img = g_softwareImages[i];
+        if (img.inUse && img.useShm && img.shm.shmseg == e->shmseg) img.presentPending = false;
+    }
+    return true;
+}
+
+void destroySoftwareImage(SoftwareImage& img) {
+    if (img.useShm) {
+        XShmDetach(g_display, &img.shm);
+        XSync(g_display, False);
+        XDestroyImage(img.image); // does not touch the segment
+        shmdt(img.shm.shmaddr);
+    }
+    else if (img.image) {
+        XDestroyImage(img.image);
+    }
+    img = {};
+}
+
+#endif
+
 i32 handleXError(Display* display, XErrorEvent* errorEvent) {
     constexpr i32 ERROR_TEXT_MAX_SIZE = 512;
     char errorText[ERROR_TEXT_MAX_SIZE] = {};
@@ -368,6 +620,8 @@ i32 handleXError(Display* display, XErrorEvent* errorEvent) {
     if (errorEvent->error_code == Success)
         return 0;
 
+    g_xErrorCount++;
+
     logErrTagged(
         LogTag::PLATFORM_TAG,
         "Xlib Error: \n\tRequest Code: {}\n\tMinor Code: {}\n\tResource ID: {}, Error Text: {}",